@@ -22,6 +22,7 @@
 """Tests for ExtendedTemporalMemory."""
 
 import os
+import pickle
 import shutil
 import tempfile
 import unittest
@@ -58,3 +59,151 @@ class ApicalTiebreakTemporalMemoryTest(unittest.TestCase):
     finally:
       shutil.rmtree(tempdir)
     self.assertEqual(tm.numberOfColumns(), tmNew.numberOfColumns())
+
+
+  @unittest.skipUnless(
+    ApicalTiebreakPairMemory.statsAvailable(),
+    "Built without NTA_ATTM_STATS, skipping stats test.")
+  def testStats(self):
+    tm = ApicalTiebreakPairMemory(columnCount=32,
+                                  basalInputSize=100,
+                                  apicalInputSize=100,
+                                  cellsPerColumn=4,
+                                  activationThreshold=3,
+                                  minThreshold=2)
+    tm.setCollectStats(True)
+    tm.compute([0, 1, 2], basalInput=[10, 20, 30])
+
+    stats = tm.getStats()
+    self.assertEqual(3, stats["phases"]["burstColumn"]["calls"])
+    self.assertEqual(3, stats["segmentsCreated"])
+    self.assertEqual(9, stats["synapsesGrown"])
+
+
+  def testMemoryUsage(self):
+    tm = ApicalTiebreakPairMemory(columnCount=32,
+                                  basalInputSize=100,
+                                  apicalInputSize=100,
+                                  cellsPerColumn=4,
+                                  activationThreshold=3,
+                                  minThreshold=2)
+    tm.compute([0, 1, 2], basalInput=[10, 20, 30])
+
+    usage = tm.memoryUsage()
+    self.assertEqual(3, usage["basal"]["liveSegments"])
+    self.assertEqual(9, usage["basal"]["liveSynapses"])
+    self.assertGreater(usage["total"], usage["basal"]["total"])
+
+    estimate = ApicalTiebreakPairMemory.estimateMemoryUsage(
+      2048, 32, 4096, 0, 100000, 0, 20)
+    self.assertEqual(2000000, estimate["basal"]["liveSynapses"])
+    self.assertGreater(estimate["total"], 2000000 * 4)
+
+
+  def testLifecycleStats(self):
+    tm = ApicalTiebreakPairMemory(columnCount=32,
+                                  basalInputSize=100,
+                                  apicalInputSize=100,
+                                  cellsPerColumn=4,
+                                  activationThreshold=3,
+                                  minThreshold=2,
+                                  maxSegmentsPerCell=1)
+    tm.compute([0, 1, 2], basalInput=[10, 20, 30])
+
+    basal = tm.getLifecycleStats()["basal"]
+    self.assertEqual([32 * 4 - 3, 3], basal["segmentsPerCell"])
+    self.assertEqual(3, basal["synapsesPerSegment"][3])
+    self.assertEqual(0, basal["segmentsEvicted"])
+
+    # Once each cell in the columns has a segment, new ones are evicted.
+    for i in range(1, 5):
+      tm.reset()
+      tm.compute([0, 1, 2], basalInput=[10 + i, 20 + i, 30 + i])
+
+    basal = tm.getLifecycleStats()["basal"]
+    self.assertGreater(basal["segmentsEvicted"], 0)
+    self.assertEqual(basal["segmentsEvicted"], sum(basal["evictionAges"]))
+
+    tm.resetLifecycleStats()
+    basal = tm.getLifecycleStats()["basal"]
+    self.assertEqual(0, basal["segmentsEvicted"])
+    self.assertEqual(32 * 4, sum(basal["segmentsPerCell"]))
+
+
+  def testDeltaCheckpoints(self):
+    params = dict(columnCount=32,
+                  basalInputSize=100,
+                  apicalInputSize=100,
+                  cellsPerColumn=4,
+                  activationThreshold=3,
+                  minThreshold=2)
+    tm = ApicalTiebreakPairMemory(**params)
+    tm.compute([0, 1, 2], basalInput=[10, 20, 30])
+
+    tempdir = tempfile.mkdtemp()
+    try:
+      basePath = os.path.join(tempdir, "base.bin")
+      deltaPath = os.path.join(tempdir, "delta.bin")
+      compactedPath = os.path.join(tempdir, "compacted.bin")
+
+      tm.writeBaseCheckpoint(basePath)
+      self.assertEqual(0, tm.getNumDirtyCells())
+      tm.reset()
+      tm.compute([3, 4, 5], basalInput=[40, 50, 60])
+      self.assertEqual(3, tm.getNumDirtyCells())
+      tm.writeDeltaCheckpoint(deltaPath)
+
+      tmNew = ApicalTiebreakPairMemory(**params)
+      tmNew.loadCheckpoints(basePath, [deltaPath])
+      self.assertEqual(tm.getCheckpointId(), tmNew.getCheckpointId())
+      self.assertEqual(6, tmNew.basalConnections.numSegments())
+
+      ApicalTiebreakPairMemory.compactCheckpoints(basePath, [deltaPath],
+                                                  compactedPath)
+      tmNew = ApicalTiebreakPairMemory(**params)
+      tmNew.loadCheckpoints(compactedPath, [])
+      self.assertEqual(6, tmNew.basalConnections.numSegments())
+    finally:
+      shutil.rmtree(tempdir)
+
+
+  def testSnapshots(self):
+    params = dict(columnCount=32,
+                  basalInputSize=100,
+                  apicalInputSize=100,
+                  cellsPerColumn=4,
+                  activationThreshold=3,
+                  minThreshold=2)
+    tm = ApicalTiebreakPairMemory(**params)
+    for _ in range(5):
+      tm.reset()
+      tm.compute([0, 1, 2], basalInput=[10, 20, 30])
+      tm.compute([3, 4, 5], basalInput=[40, 50, 60])
+
+    tempdir = tempfile.mkdtemp()
+    try:
+      path = os.path.join(tempdir, "model.snapshot")
+      tm.writeSnapshot(path)
+
+      tmNew = ApicalTiebreakPairMemory(**params)
+      tmNew.loadSnapshot(path)
+      self.assertTrue(tmNew.isFrozen())
+
+      for model in (tm, tmNew):
+        model.reset()
+        model.compute([0, 1, 2], basalInput=[10, 20, 30], learn=False)
+      self.assertEqual(list(tm.getPredictedCells()),
+                       list(tmNew.getPredictedCells()))
+
+      # A frozen model pickles without thawing.
+      tmCopy = pickle.loads(pickle.dumps(tmNew))
+      self.assertTrue(tmNew.isFrozen())
+      self.assertEqual(tm.basalConnections.numSegments(),
+                       tmCopy.basalConnections.numSegments())
+
+      tmNew.thaw()
+      self.assertFalse(tmNew.isFrozen())
+      self.assertEqual(tm.basalConnections.numSegments(),
+                       tmNew.basalConnections.numSegments())
+    finally:
+      shutil.rmtree(tempdir)
@@ -0,0 +1,310 @@
+#!/usr/bin/env python
+# ----------------------------------------------------------------------
+# Numenta Platform for Intelligent Computing (NuPIC)
+# Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+# with Numenta, Inc., for a separate license for this software code, the
+# following terms and conditions apply:
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero Public License version 3 as
+# published by the Free Software Foundation.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+# See the GNU Affero Public License for more details.
+#
+# You should have received a copy of the GNU Affero Public License
+# along with this program.  If not, see http://www.gnu.org/licenses.
+#
+# http://numenta.org/licenses/
+# ----------------------------------------------------------------------
+
+"""
+Runs the benchmarks executable and compares it against a baseline, exiting
+with status 1 if any benchmark got significantly slower.
+
+Each benchmark is run several times. A benchmark regressed if its median time
+grew by more than --tolerance, and a one-sided Mann-Whitney U test says that
+the new times are slower with at least --confidence. Using both keeps noisy
+benchmarks from failing the check, and keeps tiny but consistent slowdowns
+from failing it too.
+
+The baseline only holds the benchmarks that are checked: by default the ATTM
+compute and the grid uniqueness searches. It depends on the machine, so it
+isn't checked in. Record it on the machine that runs the check:
+
+  check-benchmark-regressions.py --benchmarks build/benchmarks --update-baseline
+
+and then check:
+
+  check-benchmark-regressions.py --benchmarks build/benchmarks
+
+The baseline records the CPU model and count, and the check refuses to
+compare against a baseline from another machine.
+"""
+
+from __future__ import print_function
+
+import argparse
+import json
+import math
+import os
+import platform
+import subprocess
+import sys
+import tempfile
+
+
+DEFAULT_BASELINE = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                os.pardir, "src", "test", "benchmark",
+                                "baseline.json")
+
+DEFAULT_FILTER = ("BM_(SequenceMemoryCompute|PairMemoryCompute|"
+                  "FindGridCodeZero|ComputeBinSidelength)")
+
+NANOSECONDS_PER_UNIT = {
+  "ns": 1.0,
+  "us": 1e3,
+  "ms": 1e6,
+  "s": 1e9,
+}
+
+
+
+def runBenchmarks(executable, benchmarkFilter, repetitions, minTime):
+  """
+  Runs the benchmarks and returns their JSON output.
+  """
+  fd, outPath = tempfile.mkstemp(suffix=".json")
+  os.close(fd)
+  try:
+    subprocess.check_call([
+      executable,
+      "--benchmark_filter=%s" % benchmarkFilter,
+      "--benchmark_repetitions=%d" % repetitions,
+      "--benchmark_min_time=%s" % minTime,
+      "--benchmark_out=%s" % outPath,
+      "--benchmark_out_format=json",
+    ])
+    with open(outPath) as f:
+      return json.load(f)
+  finally:
+    os.remove(outPath)
+
+
+
+def cpuModel():
+  """
+  Returns the CPU's model name, or the best description the platform has.
+  """
+  try:
+    with open("/proc/cpuinfo") as f:
+      for line in f:
+        if line.startswith("model name"):
+          return line.split(":", 1)[1].strip()
+  except IOError:
+    pass
+
+  if platform.system() == "Darwin":
+    try:
+      return subprocess.check_output(
+        ["sysctl", "-n", "machdep.cpu.brand_string"]).decode().strip()
+    except (OSError, subprocess.CalledProcessError):
+      pass
+
+  return platform.processor() or platform.machine()
+
+
+
+def describeMachine(results):
+  """
+  The parts of the machine that the timings depend on. The clock speed is
+  left out since it's reported inconsistently under frequency scaling.
+  """
+  return {
+    "cpu": cpuModel(),
+    "num_cpus": results["context"].get("num_cpus"),
+  }
+
+
+
+def timesByBenchmark(results):
+  """
+  Returns {name: [nanoseconds per iteration, ...]}, one time per repetition.
+  The aggregates are skipped since we compute our own.
+  """
+  times = {}
+  for run in results["benchmarks"]:
+    if run.get("run_type", "iteration") != "iteration":
+      continue
+    if "error_occurred" in run and run["error_occurred"]:
+      continue
+
+    name = run.get("run_name", run["name"])
+    nanoseconds = (run["real_time"] *
+                   NANOSECONDS_PER_UNIT[run.get("time_unit", "ns")])
+    times.setdefault(name, []).append(nanoseconds)
+
+  return times
+
+
+
+def median(values):
+  values = sorted(values)
+  middle = len(values) // 2
+  if len(values) % 2 == 1:
+    return values[middle]
+  return (values[middle - 1] + values[middle]) / 2.0
+
+
+
+def probabilitySlower(baselineTimes, times):
+  """
+  The confidence that 'times' comes from a slower distribution than
+  'baselineTimes', from a one-sided Mann-Whitney U test with the normal
+  approximation and a tie correction.
+  """
+  n1 = len(baselineTimes)
+  n2 = len(times)
+
+  # Rank the pooled samples, averaging the ranks of ties.
+  pooled = sorted([(t, 0) for t in baselineTimes] + [(t, 1) for t in times])
+  ranks = [0.0] * len(pooled)
+  tieCorrection = 0.0
+  i = 0
+  while i < len(pooled):
+    j = i
+    while j + 1 < len(pooled) and pooled[j + 1][0] == pooled[i][0]:
+      j += 1
+    for k in range(i, j + 1):
+      ranks[k] = (i + j) / 2.0 + 1
+    numTied = j - i + 1
+    tieCorrection += numTied**3 - numTied
+    i = j + 1
+
+  rankSum = sum(rank for rank, (_, group) in zip(ranks, pooled) if group == 1)
+  u = rankSum - n2 * (n2 + 1) / 2.0
+
+  mean = n1 * n2 / 2.0
+  n = n1 + n2
+  variance = (n1 * n2 / 12.0) * ((n + 1) - tieCorrection / (n * (n - 1)))
+  if variance <= 0:
+    return 0.5
+
+  # Continuity correction
+  z = (u - mean - 0.5) / math.sqrt(variance)
+  return 0.5 * (1 + math.erf(z / math.sqrt(2)))
+
+
+
+def compare(baseline, times, tolerance, confidence):
+  """
+  Prints a comparison of each baseline benchmark and returns the names of the
+  ones that regressed.
+  """
+  regressions = []
+
+  print("%-60s %12s %12s %8s %8s" % ("Benchmark", "Baseline", "Current",
+                                      "Change", "P(slower)"))
+  for name in sorted(baseline):
+    if name not in times:
+      print("%-60s missing from the current results" % name)
+      regressions.append(name)
+      continue
+
+    baselineMedian = median(baseline[name])
+    currentMedian = median(times[name])
+    change = currentMedian / baselineMedian - 1
+    pSlower = probabilitySlower(baseline[name], times[name])
+
+    regressed = change > tolerance and pSlower >= confidence
+    if regressed:
+      regressions.append(name)
+
+    print("%-60s %10.0fns %10.0fns %+7.1f%% %8.3f%s" % (
+      name, baselineMedian, currentMedian, change * 100, pSlower,
+      "  REGRESSED" if regressed else ""))
+
+  return regressions
+
+
+
+def main():
+  parser = argparse.ArgumentParser(
+    description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+  parser.add_argument("--benchmarks", default="benchmarks",
+                      help="Path to the benchmarks executable")
+  parser.add_argument("--results",
+                      help="Compare this benchmark JSON instead of running "
+                      "the benchmarks. It needs several repetitions, and "
+                      "it must be from this machine.")
+  parser.add_argument("--baseline", default=DEFAULT_BASELINE)
+  parser.add_argument("--update-baseline", action="store_true",
+                      help="Write the results as the new baseline")
+  parser.add_argument("--filter", default=DEFAULT_FILTER,
+                      help="Regex of the benchmarks to run")
+  parser.add_argument("--repetitions", type=int, default=10)
+  parser.add_argument("--min-time", default="0.1",
+                      help="Minimum seconds per repetition")
+  parser.add_argument("--tolerance", type=float, default=0.05,
+                      help="Allowed growth of the median time, as a fraction")
+  parser.add_argument("--confidence", type=float, default=0.99,
+                      help="Required confidence that a benchmark is slower")
+  args = parser.parse_args()
+
+  if args.results:
+    with open(args.results) as f:
+      results = json.load(f)
+  else:
+    results = runBenchmarks(args.benchmarks, args.filter, args.repetitions,
+                            args.min_time)
+  times = timesByBenchmark(results)
+
+  machine = describeMachine(results)
+
+  if args.update_baseline:
+    # Keep the machine description, not the local paths.
+    context = dict(results["context"])
+    context.pop("executable", None)
+    context["machine"] = machine
+    with open(args.baseline, "w") as f:
+      json.dump({"context": context,
+                 "benchmarks": times},
+                f, indent=2, sort_keys=True)
+      f.write("\n")
+    print("Wrote %d benchmarks to %s" % (len(times), args.baseline))
+    return 0
+
+  if not os.path.exists(args.baseline):
+    print("There's no baseline at %s. Record one on this machine with "
+          "--update-baseline." % args.baseline)
+    return 2
+
+  with open(args.baseline) as f:
+    baselineResults = json.load(f)
+
+  baselineMachine = baselineResults["context"].get("machine")
+  if baselineMachine != machine:
+    print("The baseline was recorded on another machine, so its timings "
+          "can't be compared.")
+    print("  Baseline: %s" % json.dumps(baselineMachine, sort_keys=True))
+    print("  Current:  %s" % json.dumps(machine, sort_keys=True))
+    print("Record a new baseline with --update-baseline.")
+    return 2
+
+  baseline = baselineResults["benchmarks"]
+
+  regressions = compare(baseline, times, args.tolerance, args.confidence)
+  if regressions:
+    print("\n%d of %d benchmarks regressed" % (len(regressions),
+                                                len(baseline)))
+    return 1
+
+  print("\nNo regressions in %d benchmarks" % len(baseline))
+  return 0
+
+
+
+if __name__ == "__main__":
+  sys.exit(main())
@@ -0,0 +1,71 @@
+# -----------------------------------------------------------------------------
+# Numenta Platform for Intelligent Computing (NuPIC)
+# Copyright (C) 2017, Numenta, Inc.  Unless you have purchased from
+# Numenta, Inc. a separate commercial license for this software code, the
+# following terms and conditions apply:
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero Public License version 3 as
+# published by the Free Software Foundation.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+# See the GNU Affero Public License for more details.
+#
+# You should have received a copy of the GNU Affero Public License
+# along with this program.  If not, see http://www.gnu.org/licenses.
+#
+# http://numenta.org/licenses/
+# -----------------------------------------------------------------------------
+
+# Configure Google Benchmark, used by the benchmarks target
+#
+# INPUT VARIABLES: Passed via -DVAR=VALUE
+#    LOCAL_BENCHMARK_INSTALL_DIR: Use a local Google Benchmark installed at
+#                                 this location instead of building
+#
+# OUTPUT VARIABLES: Available to the parent scope
+#
+#   BENCHMARK_INCLUDE_DIR: Google Benchmark include directory
+#   BENCHMARK_STATIC_LIB_TARGET: Google Benchmark static library
+#
+# EXPORTED TARGETS:
+#
+#   google_benchmark: depend on this before using the library
+#
+
+set(BENCHMARK_VERSION "1.4.1")
+
+if(LOCAL_BENCHMARK_INSTALL_DIR)
+    add_custom_target(google_benchmark)
+    if(NOT EXISTS "${LOCAL_BENCHMARK_INSTALL_DIR}/include/benchmark")
+        message(FATAL_ERROR "Invalid Google Benchmark installation. \
+        Make sure LOCAL_BENCHMARK_INSTALL_DIR points to a valid Google \
+        Benchmark installation")
+    endif()
+    set(BENCHMARK_INSTALL_DIR "${LOCAL_BENCHMARK_INSTALL_DIR}")
+else(LOCAL_BENCHMARK_INSTALL_DIR)
+    set(BENCHMARK_INSTALL_DIR "${EP_BASE}/Install/google_benchmark")
+
+    set_directory_properties(PROPERTIES EP_BASE "${EP_BASE}")
+    ExternalProject_Add(
+        google_benchmark
+        URL "https://github.com/google/benchmark/archive/v${BENCHMARK_VERSION}.tar.gz"
+        UPDATE_COMMAND ""
+        PATCH_COMMAND ""
+        CMAKE_GENERATOR ${CMAKE_GENERATOR}
+        CMAKE_ARGS
+            -DBENCHMARK_ENABLE_TESTING=OFF
+            -DBENCHMARK_ENABLE_GTEST_TESTS=OFF
+            -DCMAKE_BUILD_TYPE=Release
+            -DCMAKE_INSTALL_PREFIX=${BENCHMARK_INSTALL_DIR}
+            -DCMAKE_INSTALL_LIBDIR=lib
+    )
+endif(LOCAL_BENCHMARK_INSTALL_DIR)
+
+set(BENCHMARK_INCLUDE_DIR "${BENCHMARK_INSTALL_DIR}/include")
+
+# Expose Google Benchmark directories and targets
+set(BENCHMARK_INCLUDE_DIR "${BENCHMARK_INCLUDE_DIR}" PARENT_SCOPE)
+set(BENCHMARK_STATIC_LIB_TARGET "${BENCHMARK_INSTALL_DIR}/lib/${CMAKE_STATIC_LIBRARY_PREFIX}benchmark${CMAKE_STATIC_LIBRARY_SUFFIX}" PARENT_SCOPE)
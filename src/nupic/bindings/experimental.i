@@ -89,6 +89,97 @@ _EXPERIMENTAL = _experimental
 using namespace nupic::experimental::apical_tiebreak_temporal_memory;
 using namespace nupic;
 
+static PyObject* connectionsMemoryUsageToDict(
+  const ConnectionsMemoryUsage& usage)
+{
+  return Py_BuildValue(
+    "{s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K}",
+    "segments", (unsigned long long)usage.segments,
+    "synapses", (unsigned long long)usage.synapses,
+    "presynapticMaps", (unsigned long long)usage.presynapticMaps,
+    "indexes", (unsigned long long)usage.indexes,
+    "total", (unsigned long long)usage.total(),
+    "liveSegments", (unsigned long long)usage.liveSegments,
+    "deadSegments", (unsigned long long)usage.deadSegments,
+    "liveSynapses", (unsigned long long)usage.liveSynapses,
+    "deadSynapses", (unsigned long long)usage.deadSynapses);
+}
+
+static PyObject* memoryUsageToDict(
+  const ApicalTiebreakTemporalMemoryMemoryUsage& usage)
+{
+  return Py_BuildValue(
+    "{s:N,s:N,s:K,s:K,s:K,s:K}",
+    "basal", connectionsMemoryUsageToDict(usage.basal),
+    "apical", connectionsMemoryUsageToDict(usage.apical),
+    "overlaps", (unsigned long long)usage.overlaps,
+    "lastUsedIterations", (unsigned long long)usage.lastUsedIterations,
+    "state", (unsigned long long)usage.state,
+    "total", (unsigned long long)usage.total());
+}
+
+static PyObject* histogramToList(const std::vector<nupic::UInt64>& histogram)
+{
+  PyObject* list = PyList_New(histogram.size());
+  for (size_t i = 0; i < histogram.size(); i++)
+  {
+    PyList_SET_ITEM(list, i,
+                    PyLong_FromUnsignedLongLong(histogram[i]));
+  }
+  return list;
+}
+
+static PyObject* lifecycleStatsToDict(
+  const ConnectionsLifecycleStats& lifecycleStats)
+{
+  return Py_BuildValue(
+    "{s:N,s:N,s:K,s:K,s:N,s:K,s:K,s:K}",
+    "segmentsPerCell", histogramToList(lifecycleStats.segmentsPerCell),
+    "synapsesPerSegment", histogramToList(lifecycleStats.synapsesPerSegment),
+    "segmentsEvicted", (unsigned long long)lifecycleStats.segmentsEvicted,
+    "segmentsEvictedBySynapseBudget",
+    (unsigned long long)lifecycleStats.segmentsEvictedBySynapseBudget,
+    "evictionAges", histogramToList(lifecycleStats.evictionAges),
+    "synapsesDestroyedByAdaptSegment",
+    (unsigned long long)lifecycleStats.synapsesDestroyedByAdaptSegment,
+    "segmentsDestroyedByAdaptSegment",
+    (unsigned long long)lifecycleStats.segmentsDestroyedByAdaptSegment,
+    "synapsesDestroyedByMinPermanence",
+    (unsigned long long)lifecycleStats.synapsesDestroyedByMinPermanence);
+}
+
+static std::vector<std::string> pathsFromList(PyObject* paths)
+{
+  std::vector<std::string> result;
+
+  PyObject* iterator = PyObject_GetIter(paths);
+  NTA_CHECK(iterator != nullptr) << "The paths must be a list of strings";
+
+  PyObject* path;
+  while ((path = PyIter_Next(iterator)) != nullptr)
+  {
+    PyObject* bytes = PyUnicode_Check(path)
+      ? PyUnicode_AsUTF8String(path)
+      : (Py_INCREF(path), path);
+    const char* str = bytes != nullptr ? PyBytes_AsString(bytes) : nullptr;
+    if (str != nullptr)
+    {
+      result.push_back(str);
+    }
+    Py_XDECREF(bytes);
+    Py_DECREF(path);
+    if (str == nullptr)
+    {
+      Py_DECREF(iterator);
+      PyErr_Clear();
+      NTA_THROW << "The paths must be a list of strings";
+    }
+  }
+  Py_DECREF(iterator);
+
+  return result;
+}
+
 %}
 
 %{
@@ -115,6 +206,27 @@ using namespace nupic;
   }
 }
 
+%{
+#include <nupic/experimental/Tracing.hpp>
+%}
+
+%inline {
+  void startTracing(size_t eventsPerThread, bool hardwareCounters=false)
+  {
+    nupic::experimental::tracing::start(eventsPerThread, hardwareCounters);
+  }
+
+  void stopTracing()
+  {
+    nupic::experimental::tracing::stop();
+  }
+
+  void writeChromeTrace(const std::string& path)
+  {
+    nupic::experimental::tracing::writeChromeTrace(path);
+  }
+}
+
 //
 // Numpy API
 //
@@ -375,6 +487,112 @@ using namespace nupic;
       cellIdxs.size(), cellIdxs.data()
     ).forPython();
   }
+
+  /**
+   * Returns the stats as a dict, with a {"calls", "nanoseconds"} dict for
+   * each phase under "phases".
+   */
+  inline PyObject* getStats()
+  {
+    typedef nupic::experimental::apical_tiebreak_temporal_memory::
+      ApicalTiebreakTemporalMemoryStats Stats;
+    const Stats& stats = self->getStats();
+
+    PyObject* phases = PyDict_New();
+    for (int phase = 0; phase < Stats::NUM_PHASES; phase++)
+    {
+      PyObject* phaseStats = Py_BuildValue(
+        "{s:K,s:K}",
+        "calls", (unsigned long long)stats.calls[phase],
+        "nanoseconds", (unsigned long long)stats.nanoseconds[phase]);
+      PyDict_SetItemString(phases, Stats::phaseName((Stats::Phase)phase),
+                           phaseStats);
+      Py_DECREF(phaseStats);
+    }
+
+    return Py_BuildValue(
+      "{s:N,s:K,s:K,s:K,s:K}",
+      "phases", phases,
+      "segmentsCreated", (unsigned long long)stats.segmentsCreated,
+      "segmentsEvicted", (unsigned long long)stats.segmentsEvicted,
+      "synapsesGrown", (unsigned long long)stats.synapsesGrown,
+      "synapsesDestroyed", (unsigned long long)stats.synapsesDestroyed);
+  }
+
+  /**
+   * Returns the lifecycle stats as a dict with a dict for each of "basal" and
+   * "apical". The histograms are lists indexed by count, or by log2 bucket
+   * for the eviction ages.
+   */
+  inline PyObject* getLifecycleStats()
+  {
+    return Py_BuildValue(
+      "{s:N,s:N}",
+      "basal", lifecycleStatsToDict(self->getLifecycleStats().basal),
+      "apical", lifecycleStatsToDict(self->getLifecycleStats().apical));
+  }
+
+  /**
+   * Returns the memory usage as a dict of bytes, with a dict for each of
+   * "basal" and "apical" that also has their slot counts.
+   */
+  inline PyObject* memoryUsage()
+  {
+    return memoryUsageToDict(self->memoryUsage());
+  }
+
+  static PyObject* estimateMemoryUsage(UInt columnCount,
+                                       UInt cellsPerColumn,
+                                       UInt basalInputSize,
+                                       UInt apicalInputSize,
+                                       UInt numBasalSegments,
+                                       UInt numApicalSegments,
+                                       UInt synapsesPerSegment)
+  {
+    return memoryUsageToDict(
+      nupic::experimental::apical_tiebreak_temporal_memory::
+      ApicalTiebreakTemporalMemory::estimateMemoryUsage(
+        columnCount, cellsPerColumn, basalInputSize, apicalInputSize,
+        numBasalSegments, numApicalSegments, synapsesPerSegment));
+  }
+
+  void writeBaseCheckpoint(const std::string& path)
+  {
+    std::ofstream out(path.c_str(), std::ios::binary);
+    NTA_CHECK(out) << "Can't open " << path;
+    self->writeBaseCheckpoint(out);
+  }
+
+  void writeDeltaCheckpoint(const std::string& path)
+  {
+    std::ofstream out(path.c_str(), std::ios::binary);
+    NTA_CHECK(out) << "Can't open " << path;
+    self->writeDeltaCheckpoint(out);
+  }
+
+  void readDeltaCheckpoint(const std::string& path)
+  {
+    std::ifstream in(path.c_str(), std::ios::binary);
+    NTA_CHECK(in) << "Can't open " << path;
+    self->readDeltaCheckpoint(in);
+  }
+
+  /**
+   * Reads a base checkpoint and replays a list of delta checkpoint paths.
+   */
+  void loadCheckpoints(const std::string& basePath, PyObject* deltaPaths)
+  {
+    self->loadCheckpoints(basePath, pathsFromList(deltaPaths));
+  }
+
+  static void compactCheckpoints(const std::string& basePath,
+                                 PyObject* deltaPaths,
+                                 const std::string& outPath)
+  {
+    nupic::experimental::apical_tiebreak_temporal_memory::
+      ApicalTiebreakTemporalMemory::compactCheckpoints(
+        basePath, pathsFromList(deltaPaths), outPath);
+  }
 }
 
 %extend nupic::experimental::apical_tiebreak_temporal_memory::ApicalTiebreakPairMemory
@@ -872,6 +1090,22 @@ using namespace nupic;
 %ignore nupic::experimental::apical_tiebreak_temporal_memory::ApicalTiebreakTemporalMemory::getPredictedCells;
 %ignore nupic::experimental::apical_tiebreak_temporal_memory::ApicalTiebreakTemporalMemory::getWinnerCells;
 %ignore nupic::experimental::apical_tiebreak_temporal_memory::ApicalTiebreakTemporalMemory::cellsForColumn;
+%ignore nupic::experimental::apical_tiebreak_temporal_memory::ApicalTiebreakTemporalMemory::getStats;
+%ignore nupic::experimental::apical_tiebreak_temporal_memory::ApicalTiebreakTemporalMemory::memoryUsage;
+%ignore nupic::experimental::apical_tiebreak_temporal_memory::ApicalTiebreakTemporalMemory::estimateMemoryUsage;
+%ignore nupic::experimental::apical_tiebreak_temporal_memory::ConnectionsMemoryUsage;
+%ignore nupic::experimental::apical_tiebreak_temporal_memory::ApicalTiebreakTemporalMemoryMemoryUsage;
+%ignore nupic::experimental::apical_tiebreak_temporal_memory::ApicalTiebreakTemporalMemory::getLifecycleStats;
+%ignore nupic::experimental::apical_tiebreak_temporal_memory::ConnectionsLifecycleStats;
+%ignore nupic::experimental::apical_tiebreak_temporal_memory::ApicalTiebreakTemporalMemoryLifecycleStats;
+%ignore nupic::experimental::apical_tiebreak_temporal_memory::ApicalTiebreakTemporalMemory::writeBaseCheckpoint(ApicalTiebreakTemporalMemoryProto::Builder&);
+%ignore nupic::experimental::apical_tiebreak_temporal_memory::ApicalTiebreakTemporalMemory::writeBaseCheckpoint(std::ostream&);
+%ignore nupic::experimental::apical_tiebreak_temporal_memory::ApicalTiebreakTemporalMemory::writeDeltaCheckpoint(ApicalTiebreakTemporalMemoryDeltaProto::Builder&);
+%ignore nupic::experimental::apical_tiebreak_temporal_memory::ApicalTiebreakTemporalMemory::writeDeltaCheckpoint(std::ostream&);
+%ignore nupic::experimental::apical_tiebreak_temporal_memory::ApicalTiebreakTemporalMemory::readDeltaCheckpoint(ApicalTiebreakTemporalMemoryDeltaProto::Reader&);
+%ignore nupic::experimental::apical_tiebreak_temporal_memory::ApicalTiebreakTemporalMemory::readDeltaCheckpoint(std::istream&);
+%ignore nupic::experimental::apical_tiebreak_temporal_memory::ApicalTiebreakTemporalMemory::loadCheckpoints(const std::string&, const std::vector<std::string>&);
+%ignore nupic::experimental::apical_tiebreak_temporal_memory::ApicalTiebreakTemporalMemory::compactCheckpoints(const std::string&, const std::vector<std::string>&, const std::string&);
 
 %ignore nupic::experimental::apical_tiebreak_temporal_memory::ApicalTiebreakSequenceMemory::getPredictedCells;
 %ignore nupic::experimental::apical_tiebreak_temporal_memory::ApicalTiebreakSequenceMemory::getNextPredictedCells;
@@ -33,9 +33,17 @@
  * 4. Model parameters (including "learn")
  */
 
+#include <algorithm>
+#include <chrono>
 #include <cstring>
 #include <climits>
+#include <deque>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <sstream>
 #include <string>
 #include <iterator>
 #include <vector>
@@ -46,20 +54,294 @@
 
 #include <nupic/algorithms/Connections.hpp>
 #include <nupic/experimental/ApicalTiebreakTemporalMemory.hpp>
+#include <nupic/experimental/DirtyCellTracker.hpp>
+#include <nupic/experimental/FrozenConnections.hpp>
+#include <nupic/experimental/IncrementalOverlaps.hpp>
+#include <nupic/experimental/IndexUtils.hpp>
+#include <nupic/experimental/MappedFile.hpp>
+#include <nupic/experimental/PermanenceAdaptation.hpp>
+#include <nupic/experimental/PhaseTimer.hpp>
+#include <nupic/experimental/PresynapticCellIndex.hpp>
+#include <nupic/experimental/SegmentRecency.hpp>
+#include <nupic/experimental/SynapseArrays.hpp>
+#include <nupic/experimental/Tracing.hpp>
 #include <nupic/utils/GroupBy.hpp>
 
 using namespace std;
 using namespace nupic;
 using namespace nupic::algorithms::connections;
 using namespace nupic::experimental::apical_tiebreak_temporal_memory;
+using namespace nupic::experimental::permanence_adaptation;
 
 static const Permanence EPSILON = 0.000001;
 static const UInt TM_VERSION = 1;
 static const UInt32 MIN_PREDICTIVE_THRESHOLD = 2;
 
+// calculatePredictedCells switches to per-cell score arrays when there are at
+// least this many active segments per column with an active basal segment.
+// Benchmarked at 2048 columns x 32 cells, the two were even at about 4.
+static const UInt DENSE_PREDICTED_CELLS_ACTIVE_SEGMENTS_PER_COLUMN = 4;
+
+#ifdef NTA_ATTM_STATS
+thread_local ApicalTiebreakTemporalMemoryStats*
+nupic::experimental::apical_tiebreak_temporal_memory::currentStats = nullptr;
+#endif // NTA_ATTM_STATS
+
+ApicalTiebreakTemporalMemoryStats::ApicalTiebreakTemporalMemoryStats()
+  : calls(),
+    nanoseconds(),
+    segmentsCreated(0),
+    segmentsEvicted(0),
+    synapsesGrown(0),
+    synapsesDestroyed(0)
+{
+}
+
+const char* ApicalTiebreakTemporalMemoryStats::phaseName(Phase phase)
+{
+  switch (phase)
+  {
+  case BASAL_OVERLAPS:
+    return "basalOverlaps";
+  case APICAL_OVERLAPS:
+    return "apicalOverlaps";
+  case SORT_SEGMENTS:
+    return "sortSegments";
+  case PREDICTED_CELLS:
+    return "predictedCells";
+  case ACTIVATE_PREDICTED_COLUMN:
+    return "activatePredictedColumn";
+  case BURST_COLUMN:
+    return "burstColumn";
+  case PUNISH_PREDICTED_COLUMN:
+    return "punishPredictedColumn";
+  case CREATE_SEGMENT:
+    return "createSegment";
+  case EVICT_SEGMENTS:
+    return "evictSegments";
+  case GROW_SYNAPSES:
+    return "growSynapses";
+  case DESTROY_SYNAPSES:
+    return "destroySynapses";
+  default:
+    NTA_THROW << "Invalid phase " << (int)phase;
+  }
+}
+
+ConnectionsMemoryUsage::ConnectionsMemoryUsage()
+  : segments(0),
+    synapses(0),
+    presynapticMaps(0),
+    indexes(0),
+    liveSegments(0),
+    deadSegments(0),
+    liveSynapses(0),
+    deadSynapses(0)
+{
+}
+
+size_t ConnectionsMemoryUsage::total() const
+{
+  return segments + synapses + presynapticMaps + indexes;
+}
+
+ApicalTiebreakTemporalMemoryMemoryUsage::
+ApicalTiebreakTemporalMemoryMemoryUsage()
+  : overlaps(0),
+    lastUsedIterations(0),
+    state(0)
+{
+}
+
+size_t ApicalTiebreakTemporalMemoryMemoryUsage::total() const
+{
+  return basal.total() + apical.total() + overlaps + lastUsedIterations +
+    state;
+}
+
+ConnectionsLifecycleStats::ConnectionsLifecycleStats()
+  : segmentsEvicted(0),
+    segmentsEvictedBySynapseBudget(0),
+    synapsesDestroyedByAdaptSegment(0),
+    segmentsDestroyedByAdaptSegment(0),
+    synapsesDestroyedByMinPermanence(0)
+{
+}
+
+size_t ConnectionsLifecycleStats::ageBucket(UInt64 age)
+{
+  size_t bucket = 0;
+  while (age != 0)
+  {
+    bucket++;
+    age >>= 1;
+  }
+  return bucket;
+}
+
+static void recordEviction(ConnectionsLifecycleStats& lifecycleStats,
+                           UInt64 age)
+{
+  const size_t bucket = ConnectionsLifecycleStats::ageBucket(age);
+  if (bucket >= lifecycleStats.evictionAges.size())
+  {
+    lifecycleStats.evictionAges.resize(bucket + 1, 0);
+  }
+  lifecycleStats.evictionAges[bucket]++;
+}
 
 
+
+namespace nupic {
+  namespace experimental {
+    namespace apical_tiebreak_temporal_memory {
+
+      /**
+       * Limits the number of segments that learning creates per compute.
+       * Segments over the limit are queued with their growth candidates,
+       * and they're created on later computes that have room, oldest first.
+       * Learning on existing segments is never deferred.
+       */
+      class LearningBudget
+      {
+      public:
+        struct DeferredSegment
+        {
+          CellIdx cell;
+          bool apical;
+          vector<CellIdx> growthCandidates;
+        };
+
+        LearningBudget()
+          : maxNewSegmentsPerStep_(0),
+            maxDeferredSegments_(0),
+            numNewSegments_(0)
+        {}
+
+        UInt getMaxNewSegmentsPerStep() const
+        {
+          return maxNewSegmentsPerStep_;
+        }
+
+        /**
+         * The oldest deferred segments are dropped when the queue would grow
+         * past maxDeferredSegments.
+         */
+        void setLimits(UInt maxNewSegmentsPerStep, size_t maxDeferredSegments)
+        {
+          maxNewSegmentsPerStep_ = maxNewSegmentsPerStep;
+          maxDeferredSegments_ = maxDeferredSegments;
+        }
+
+        void startStep()
+        {
+          numNewSegments_ = 0;
+        }
+
+        /**
+         * Whether another segment can be created this step, counting it if
+         * so.
+         */
+        bool tryCreateSegment()
+        {
+          if (maxNewSegmentsPerStep_ > 0 &&
+              numNewSegments_ >= maxNewSegmentsPerStep_)
+          {
+            return false;
+          }
+
+          numNewSegments_++;
+          return true;
+        }
+
+        /**
+         * A cell has at most one deferred segment of each kind. Deferring
+         * another one, e.g. when its column keeps bursting, replaces its
+         * growth candidates with the newer ones.
+         */
+        void deferSegment(CellIdx cell, bool apical,
+                          const CellIdx* growthCandidatesBegin,
+                          const CellIdx* growthCandidatesEnd)
+        {
+          for (DeferredSegment& deferred : deferred_)
+          {
+            if (deferred.cell == cell && deferred.apical == apical)
+            {
+              deferred.growthCandidates.assign(growthCandidatesBegin,
+                                               growthCandidatesEnd);
+              return;
+            }
+          }
+
+          while (!deferred_.empty() &&
+                 deferred_.size() >= maxDeferredSegments_)
+          {
+            deferred_.pop_front();
+          }
+
+          deferred_.push_back({cell, apical,
+                               vector<CellIdx>(growthCandidatesBegin,
+                                               growthCandidatesEnd)});
+        }
+
+        deque<DeferredSegment>& deferredSegments()
+        {
+          return deferred_;
+        }
+
+        size_t numDeferredSegments() const
+        {
+          return deferred_.size();
+        }
+
+        size_t memoryUsage() const
+        {
+          size_t bytes = 0;
+          for (const DeferredSegment& deferred : deferred_)
+          {
+            bytes += sizeof(DeferredSegment) +
+              deferred.growthCandidates.capacity() * sizeof(CellIdx);
+          }
+          return bytes;
+        }
+
+      private:
+        UInt maxNewSegmentsPerStep_;
+        size_t maxDeferredSegments_;
+        UInt numNewSegments_;
+        deque<DeferredSegment> deferred_;
+      };
+
+    } // end namespace apical_tiebreak_temporal_memory
+  } // end namespace experimental
+} // end namespace nupic
+
 ApicalTiebreakTemporalMemory::ApicalTiebreakTemporalMemory()
+  : basalSynapseArrays_(nullptr),
+    apicalSynapseArrays_(nullptr),
+    lazyPermanences_(false),
+    basalCellIndex_(nullptr),
+    apicalCellIndex_(nullptr),
+    basalIncrementalOverlaps_(nullptr),
+    apicalIncrementalOverlaps_(nullptr),
+    compactionThreshold_(0.0),
+    coldSegmentAge_(0),
+    coolingCursor_(0),
+    maxSynapses_(0),
+    basalSegmentRecency_(nullptr),
+    apicalSegmentRecency_(nullptr),
+    learningBudget_(new LearningBudget()),
+    basalDirtyCells_(new DirtyCells()),
+    apicalDirtyCells_(new DirtyCells()),
+    trackingDirtyCells_(false),
+    checkpointId_(0),
+    checkpointIteration_(0),
+    snapshot_(nullptr),
+    collectStats_(false),
+    expectedSegments_(0),
+    expectedSynapsesPerSegment_(0),
+    numReallocations_(0),
+    segmentArrayCapacities_()
 {
 }
 
@@ -82,6 +364,31 @@ ApicalTiebreakTemporalMemory::ApicalTiebreakTemporalMemory(
   UInt maxSegmentsPerCell,
   UInt maxSynapsesPerSegment,
   bool checkInputs)
+  : basalSynapseArrays_(nullptr),
+    apicalSynapseArrays_(nullptr),
+    lazyPermanences_(false),
+    basalCellIndex_(nullptr),
+    apicalCellIndex_(nullptr),
+    basalIncrementalOverlaps_(nullptr),
+    apicalIncrementalOverlaps_(nullptr),
+    compactionThreshold_(0.0),
+    coldSegmentAge_(0),
+    coolingCursor_(0),
+    maxSynapses_(0),
+    basalSegmentRecency_(nullptr),
+    apicalSegmentRecency_(nullptr),
+    learningBudget_(new LearningBudget()),
+    basalDirtyCells_(new DirtyCells()),
+    apicalDirtyCells_(new DirtyCells()),
+    trackingDirtyCells_(false),
+    checkpointId_(0),
+    checkpointIteration_(0),
+    snapshot_(nullptr),
+    collectStats_(false),
+    expectedSegments_(0),
+    expectedSynapsesPerSegment_(0),
+    numReallocations_(0),
+    segmentArrayCapacities_()
 {
   NTA_CHECK(columnCount > 0);
   NTA_CHECK(cellsPerColumn > 0);
@@ -90,6 +397,9 @@ ApicalTiebreakTemporalMemory::ApicalTiebreakTemporalMemory(
   NTA_CHECK(permanenceIncrement >= 0.0 && permanenceIncrement <= 1.0);
   NTA_CHECK(permanenceDecrement >= 0.0 && permanenceDecrement <= 1.0);
   NTA_CHECK(minThreshold <= activationThreshold);
+  NTA_CHECK((UInt64)columnCount * cellsPerColumn <=
+            std::numeric_limits<CellIdx>::max())
+    << "The number of cells doesn't fit in a CellIdx";
 
   columnCount_ = columnCount;
   basalInputSize_ = basalInputSize;
@@ -112,6 +422,7 @@ ApicalTiebreakTemporalMemory::ApicalTiebreakTemporalMemory(
 
   basalConnections = Connections(numberOfCells());
   apicalConnections = Connections(numberOfCells());
+  subscribeIndexes_();
 
   this->seed((UInt64)(seed < 0 ? rand() : seed));
 }
@@ -120,6 +431,13 @@ ApicalTiebreakTemporalMemory::ApicalTiebreakTemporalMemory(
 
 ApicalTiebreakTemporalMemory::~ApicalTiebreakTemporalMemory()
 {
+  setIncrementalOverlaps(false);
+  unsubscribeSegmentRecency_();
+  unsubscribeIndexes_();
+  releaseSnapshot_();
+  delete learningBudget_;
+  delete basalDirtyCells_;
+  delete apicalDirtyCells_;
 }
 
 static UInt32 predictiveScore(
@@ -165,10 +483,11 @@ segmentsForCell(vector<Segment>::const_iterator segmentsStart,
   return std::make_tuple(cellBegin, cellEnd);
 }
 
+template <typename ConnectionsT>
 static CellIdx getLeastUsedCell(
   Random& rng,
   UInt column,
-  const Connections& connections,
+  const ConnectionsT& connections,
   UInt cellsPerColumn)
 {
   const CellIdx start = column * cellsPerColumn;
@@ -213,67 +532,83 @@ static CellIdx getLeastUsedCell(
 
 static void adaptSegment(
   Connections& connections,
+  SynapseArrays& synapseArrays,
   Segment segment,
-  const vector<bool>& activeInputDense,
+  const vector<unsigned char>& activeInputDense,
   Permanence permanenceIncrement,
   Permanence permanenceDecrement)
 {
-  const vector<Synapse>& synapses = connections.synapsesForSegment(segment);
-
-  for (SynapseIdx i = 0; i < synapses.size();)
+  const SynapseArrays::SegmentSynapses& segmentSynapses =
+    synapseArrays.forSegment(segment);
+  const size_t numSynapses = segmentSynapses.synapses.size();
+  SynapseArrays::AdaptBuffers& buffers =
+    synapseArrays.adaptBuffers(numSynapses);
+
+  const UInt32 numDestroy = adaptPermanences(
+    buffers.permanences.data(), buffers.destroy.data(),
+    segmentSynapses.presynapticCells.data(),
+    segmentSynapses.permanences.data(), numSynapses,
+    activeInputDense.data(),
+    permanenceIncrement, permanenceDecrement, EPSILON);
+
+  // Apply the updates first. They modify the arrays in-place but don't move
+  // any synapses, so the indices stay valid.
+  buffers.synapsesToDestroy.clear();
+  for (size_t i = 0; i < numSynapses; i++)
   {
-    const SynapseData& synapseData = connections.dataForSynapse(synapses[i]);
-
-    Permanence permanence = synapseData.permanence;
-    if (activeInputDense[synapseData.presynapticCell])
-    {
-      permanence += permanenceIncrement;
-    }
-    else
-    {
-      permanence -= permanenceDecrement;
-    }
-
-    permanence = min(permanence, (Permanence)1.0);
-    permanence = max(permanence, (Permanence)0.0);
-
-    if (permanence < EPSILON)
+    if (buffers.destroy[i])
     {
-      connections.destroySynapse(synapses[i]);
-      // Synapses vector is modified in-place, so don't update `i`.
+      buffers.synapsesToDestroy.push_back(segmentSynapses.synapses[i]);
     }
-    else
+    else if (buffers.permanences[i] != segmentSynapses.permanences[i])
     {
-      connections.updateSynapsePermanence(synapses[i], permanence);
-      i++;
+      synapseArrays.updatePermanence(segment, i, buffers.permanences[i]);
     }
   }
 
-  if (synapses.size() == 0)
+  NTA_ATTM_COUNT(synapsesDestroyed, numDestroy);
+  ConnectionsLifecycleStats& lifecycleStats = synapseArrays.lifecycleStats();
+  lifecycleStats.synapsesDestroyedByAdaptSegment += numDestroy;
+  if (numDestroy == numSynapses)
   {
+    lifecycleStats.segmentsDestroyedByAdaptSegment++;
     connections.destroySegment(segment);
   }
+  else if (numDestroy > 0)
+  {
+    NTA_ATTM_TIME_PHASE(DESTROY_SYNAPSES);
+    for (Synapse synapse : buffers.synapsesToDestroy)
+    {
+      connections.destroySynapse(synapse);
+    }
+  }
 }
 
 static void destroyMinPermanenceSynapses(
   Connections& connections,
+  SynapseArrays& synapseArrays,
   Random& rng,
   Segment segment,
   Int nDestroy,
   const CellIdx* excludeCellsBegin,
   const CellIdx* excludeCellsEnd)
 {
-  // Don't destroy any cells that are in excludeCells.
+  NTA_ATTM_TIME_PHASE(DESTROY_SYNAPSES);
+
+  const SynapseArrays::SegmentSynapses& segmentSynapses =
+    synapseArrays.forSegment(segment);
+
+  // Don't destroy any cells that are in excludeCells. Take the permanences
+  // from the synapse arrays, which are current in lazy mode.
   vector<Synapse> destroyCandidates;
-  for (Synapse synapse : connections.synapsesForSegment(segment))
+  vector<Permanence> destroyCandidatePermanences;
+  for (size_t i = 0; i < segmentSynapses.synapses.size(); i++)
   {
-    const CellIdx presynapticCell =
-      connections.dataForSynapse(synapse).presynapticCell;
-
     if (!std::binary_search(excludeCellsBegin, excludeCellsEnd,
-                            presynapticCell))
+                            segmentSynapses.presynapticCells[i]))
     {
-      destroyCandidates.push_back(synapse);
+      destroyCandidates.push_back(segmentSynapses.synapses[i]);
+      destroyCandidatePermanences.push_back(segmentSynapses.permanences[i]);
     }
   }
 
@@ -282,31 +617,34 @@ static void destroyMinPermanenceSynapses(
   for (Int32 i = 0; i < nDestroy && !destroyCandidates.empty(); i++)
   {
     Permanence minPermanence = std::numeric_limits<Permanence>::max();
-    vector<Synapse>::iterator minSynapse = destroyCandidates.end();
+    size_t minCandidate = destroyCandidates.size();
 
-    for (auto synapse = destroyCandidates.begin();
-         synapse != destroyCandidates.end();
-         synapse++)
+    for (size_t candidate = 0; candidate < destroyCandidates.size();
+         candidate++)
     {
-      const Permanence permanence =
-        connections.dataForSynapse(*synapse).permanence;
+      const Permanence permanence = destroyCandidatePermanences[candidate];
 
       // Use special EPSILON logic to compensate for floating point
       // differences between C++ and other environments.
       if (permanence < minPermanence - EPSILON)
       {
-        minSynapse = synapse;
+        minCandidate = candidate;
         minPermanence = permanence;
       }
     }
 
-    connections.destroySynapse(*minSynapse);
-    destroyCandidates.erase(minSynapse);
+    connections.destroySynapse(destroyCandidates[minCandidate]);
+    NTA_ATTM_COUNT(synapsesDestroyed, 1);
+    synapseArrays.lifecycleStats().synapsesDestroyedByMinPermanence++;
+    destroyCandidates.erase(destroyCandidates.begin() + minCandidate);
+    destroyCandidatePermanences.erase(
+      destroyCandidatePermanences.begin() + minCandidate);
   }
 }
 
 static void growSynapses(
   Connections& connections,
+  SynapseArrays& synapseArrays,
   Random& rng,
   Segment segment,
   UInt32 nDesiredNewSynapses,
@@ -315,6 +653,8 @@ static void growSynapses(
   Permanence initialPermanence,
   UInt maxSynapsesPerSegment)
 {
+  NTA_ATTM_TIME_PHASE(GROW_SYNAPSES);
+
   // It's possible to optimize this, swapping candidates to the end as
   // they're used. But this is awkward to mimic in other
   // implementations, especially because it requires iterating over
@@ -325,10 +665,9 @@ static void growSynapses(
   NTA_ASSERT(std::is_sorted(candidates.begin(), candidates.end()));
 
   // Remove cells that are already synapsed on by this segment
-  for (Synapse synapse : connections.synapsesForSegment(segment))
+  for (CellIdx presynapticCell :
+         synapseArrays.forSegment(segment).presynapticCells)
   {
-    CellIdx presynapticCell =
-      connections.dataForSynapse(synapse).presynapticCell;
     auto ineligible = std::lower_bound(candidates.begin(), candidates.end(),
                                        presynapticCell);
     if (ineligible != candidates.end() && *ineligible == presynapticCell)
@@ -345,7 +684,8 @@ static void growSynapses(
                          nActual - maxSynapsesPerSegment);
   if (overrun > 0)
   {
-    destroyMinPermanenceSynapses(connections, rng, segment, overrun,
+    destroyMinPermanenceSynapses(connections, synapseArrays, rng,
+                                 segment, overrun,
                                  growthCandidatesBegin, growthCandidatesEnd);
   }
 
@@ -361,17 +701,24 @@ static void growSynapses(
     connections.createSynapse(segment, candidates[i], initialPermanence);
     candidates.erase(candidates.begin() + i);
   }
+  NTA_ATTM_COUNT(synapsesGrown, nActualWithMax);
 }
 
 static Segment createSegment(
   Connections& connections,
+  SynapseArrays& synapseArrays,
   vector<UInt64>& lastUsedIterationForSegment,
   CellIdx cell,
   UInt64 iteration,
   UInt maxSegmentsPerCell)
 {
+  NTA_ATTM_TIME_PHASE(CREATE_SEGMENT);
+
   while (connections.numSegments(cell) >= maxSegmentsPerCell)
   {
+    NTA_ATTM_TIME_PHASE(EVICT_SEGMENTS);
+    NTA_ATTM_COUNT(segmentsEvicted, 1);
+
     const vector<Segment>& destroyCandidates =
       connections.segmentsForCell(cell);
 
@@ -383,10 +730,18 @@ static Segment createSegment(
                 lastUsedIterationForSegment[b]);
       });
 
+    ConnectionsLifecycleStats& lifecycleStats = synapseArrays.lifecycleStats();
+    lifecycleStats.segmentsEvicted++;
+    recordEviction(lifecycleStats,
+                   iteration -
+                   lastUsedIterationForSegment[*leastRecentlyUsedSegment]);
+
     connections.destroySegment(*leastRecentlyUsedSegment);
   }
 
   const Segment segment = connections.createSegment(cell);
+  NTA_CHECK(segment != NOT_INDEXED) << "Too many segments";
+  NTA_ATTM_COUNT(segmentsCreated, 1);
   lastUsedIterationForSegment.resize(connections.segmentFlatListLength());
   lastUsedIterationForSegment[segment] = iteration;
 
@@ -395,14 +750,17 @@ static Segment createSegment(
 
 static void learnOnCell(
   Connections& connections,
+  SynapseArrays& synapseArrays,
   Random& rng,
   vector<UInt64>& lastUsedIterationForSegment,
+  LearningBudget& learningBudget,
   CellIdx cell,
+  bool apical,
   vector<Segment>::const_iterator cellActiveSegmentsBegin,
   vector<Segment>::const_iterator cellActiveSegmentsEnd,
   vector<Segment>::const_iterator cellMatchingSegmentsBegin,
   vector<Segment>::const_iterator cellMatchingSegmentsEnd,
-  const vector<bool>& activeInputDense,
+  const vector<unsigned char>& activeInputDense,
   const CellIdx* growthCandidatesBegin,
   const CellIdx* growthCandidatesEnd,
   const vector<UInt32>& potentialOverlaps,
@@ -421,7 +779,7 @@ static void learnOnCell(
     auto activeSegment = cellActiveSegmentsBegin;
     do
     {
-      adaptSegment(connections,
+      adaptSegment(connections, synapseArrays,
                    *activeSegment,
                    activeInputDense,
                    permanenceIncrement, permanenceDecrement);
@@ -430,7 +788,7 @@ static void learnOnCell(
         potentialOverlaps[*activeSegment];
       if (nGrowDesired > 0)
       {
-        growSynapses(connections, rng,
+        growSynapses(connections, synapseArrays, rng,
                      *activeSegment, nGrowDesired,
                      growthCandidatesBegin, growthCandidatesEnd,
                      initialPermanence, maxSynapsesPerSegment);
@@ -450,7 +808,7 @@ static void learnOnCell(
                 potentialOverlaps[b]);
       });
 
-    adaptSegment(connections,
+    adaptSegment(connections, synapseArrays,
                  bestMatchingSegment,
                  activeInputDense,
                  permanenceIncrement, permanenceDecrement);
@@ -459,7 +817,7 @@ static void learnOnCell(
       potentialOverlaps[bestMatchingSegment];
     if (nGrowDesired > 0)
     {
-      growSynapses(connections, rng,
+      growSynapses(connections, synapseArrays, rng,
                    bestMatchingSegment, nGrowDesired,
                    growthCandidatesBegin, growthCandidatesEnd,
                    initialPermanence, maxSynapsesPerSegment);
@@ -475,12 +833,17 @@ static void learnOnCell(
                                        (UInt32)std::distance(
                                          growthCandidatesBegin,
                                          growthCandidatesEnd));
-    if (nGrowExact > 0)
+    if (nGrowExact > 0 && !learningBudget.tryCreateSegment())
+    {
+      learningBudget.deferSegment(cell, apical,
+                                  growthCandidatesBegin, growthCandidatesEnd);
+    }
+    else if (nGrowExact > 0)
     {
-      const Segment segment = createSegment(connections,
+      const Segment segment = createSegment(connections, synapseArrays,
                                             lastUsedIterationForSegment, cell,
                                             iteration, maxSegmentsPerCell);
-      growSynapses(connections, rng,
+      growSynapses(connections, synapseArrays, rng,
                    segment, nGrowExact,
                    growthCandidatesBegin, growthCandidatesEnd,
                    initialPermanence, maxSynapsesPerSegment);
@@ -495,9 +858,12 @@ static void activatePredictedColumn(
   vector<CellIdx>& predictedActiveCells,
   Connections& basalConnections,
   Connections& apicalConnections,
+  SynapseArrays& basalSynapseArrays,
+  SynapseArrays& apicalSynapseArrays,
   Random& rng,
   vector<UInt64>& lastUsedIterationForBasalSegment,
   vector<UInt64>& lastUsedIterationForApicalSegment,
+  LearningBudget& learningBudget,
   vector<CellIdx>::const_iterator columnPredictedCellsBegin,
   vector<CellIdx>::const_iterator columnPredictedCellsEnd,
   vector<Segment>::const_iterator columnActiveBasalBegin,
@@ -508,8 +874,8 @@ static void activatePredictedColumn(
   vector<Segment>::const_iterator columnActiveApicalEnd,
   vector<Segment>::const_iterator columnMatchingApicalBegin,
   vector<Segment>::const_iterator columnMatchingApicalEnd,
-  const vector<bool>& basalInputDense,
-  const vector<bool>& apicalInputDense,
+  const vector<unsigned char>& basalInputDense,
+  const vector<unsigned char>& apicalInputDense,
   const CellIdx* basalGrowthCandidatesBegin,
   const CellIdx* basalGrowthCandidatesEnd,
   const CellIdx* apicalGrowthCandidatesBegin,
@@ -523,8 +889,11 @@ static void activatePredictedColumn(
   Permanence permanenceDecrement,
   UInt maxSegmentsPerCell,
   UInt maxSynapsesPerSegment,
+  bool hasApical,
   bool learn)
 {
+  NTA_ATTM_TIME_PHASE(ACTIVATE_PREDICTED_COLUMN);
+
   const auto cellForBasalSegment = [&](Segment segment)
     { return basalConnections.cellForSegment(segment); };
   const auto cellForApicalSegment = [&](Segment segment)
@@ -563,8 +932,9 @@ static void activatePredictedColumn(
 
       if (learn)
       {
-        learnOnCell(basalConnections, rng, lastUsedIterationForBasalSegment,
-                    cell,
+        learnOnCell(basalConnections, basalSynapseArrays, rng,
+                    lastUsedIterationForBasalSegment, learningBudget,
+                    cell, false,
                     cellActiveBasalBegin, cellActiveBasalEnd,
                     cellMatchingBasalBegin, cellMatchingBasalEnd,
                     basalInputDense,
@@ -574,29 +944,88 @@ static void activatePredictedColumn(
                     permanenceIncrement, permanenceDecrement,
                     maxSegmentsPerCell, maxSynapsesPerSegment);
 
-        learnOnCell(apicalConnections, rng, lastUsedIterationForApicalSegment,
-                    cell,
-                    cellActiveApicalBegin, cellActiveApicalEnd,
-                    cellMatchingApicalBegin, cellMatchingApicalEnd,
-                    apicalInputDense,
-                    apicalGrowthCandidatesBegin, apicalGrowthCandidatesEnd,
-                    apicalPotentialOverlaps, iteration,
-                    sampleSize, initialPermanence,
-                    permanenceIncrement, permanenceDecrement,
-                    maxSegmentsPerCell, maxSynapsesPerSegment);
+        if (hasApical)
+        {
+          learnOnCell(apicalConnections, apicalSynapseArrays, rng,
+                      lastUsedIterationForApicalSegment, learningBudget,
+                      cell, true,
+                      cellActiveApicalBegin, cellActiveApicalEnd,
+                      cellMatchingApicalBegin, cellMatchingApicalEnd,
+                      apicalInputDense,
+                      apicalGrowthCandidatesBegin, apicalGrowthCandidatesEnd,
+                      apicalPotentialOverlaps, iteration,
+                      sampleSize, initialPermanence,
+                      permanenceIncrement, permanenceDecrement,
+                      maxSegmentsPerCell, maxSynapsesPerSegment);
+        }
       }
     }
   }
 }
 
+/**
+ * Chooses a bursting column's winner cell: the cell with the best matching
+ * basal segment, or else a least used cell. If it chooses a segment, it
+ * narrows the candidate segments to it.
+ */
+template <typename ConnectionsT>
+static CellIdx chooseWinnerCell(
+  vector<Segment>::const_iterator& basalCandidatesBegin,
+  vector<Segment>::const_iterator& basalCandidatesEnd,
+  Random& rng,
+  map<UInt, CellIdx>& chosenCellForColumn,
+  UInt column,
+  const vector<UInt32>& basalPotentialOverlaps,
+  const ConnectionsT& basalConnections,
+  UInt cellsPerColumn,
+  bool learnOnOneCell)
+{
+  if (learnOnOneCell && chosenCellForColumn.count(column))
+  {
+    return chosenCellForColumn.at(column);
+  }
+
+  CellIdx winnerCell;
+  if (basalCandidatesBegin != basalCandidatesEnd)
+  {
+    auto bestBasalSegment = std::max_element(
+      basalCandidatesBegin, basalCandidatesEnd,
+      [&](Segment a, Segment b)
+      {
+        return (basalPotentialOverlaps[a] <
+                basalPotentialOverlaps[b]);
+      });
+
+    basalCandidatesBegin = bestBasalSegment;
+    basalCandidatesEnd = bestBasalSegment + 1;
+
+    winnerCell = basalConnections.cellForSegment(*bestBasalSegment);
+  }
+  else
+  {
+    winnerCell = getLeastUsedCell(rng, column, basalConnections,
+                                  cellsPerColumn);
+  }
+
+  if (learnOnOneCell)
+  {
+    chosenCellForColumn[column] = winnerCell;
+  }
+
+  return winnerCell;
+}
+
 static void burstColumn(
   vector<CellIdx>& activeCells,
   vector<CellIdx>& winnerCells,
   Connections& basalConnections,
   Connections& apicalConnections,
+  SynapseArrays& basalSynapseArrays,
+  SynapseArrays& apicalSynapseArrays,
   Random& rng,
   vector<UInt64>& lastUsedIterationForBasalSegment,
   vector<UInt64>& lastUsedIterationForApicalSegment,
+  LearningBudget& learningBudget,
   map<UInt, CellIdx>& chosenCellForColumn,
   UInt column,
   vector<Segment>::const_iterator columnActiveBasalBegin,
@@ -607,8 +1036,8 @@ static void burstColumn(
   vector<Segment>::const_iterator columnActiveApicalEnd,
   vector<Segment>::const_iterator columnMatchingApicalBegin,
   vector<Segment>::const_iterator columnMatchingApicalEnd,
-  const vector<bool>& basalInputDense,
-  const vector<bool>& apicalInputDense,
+  const vector<unsigned char>& basalInputDense,
+  const vector<unsigned char>& apicalInputDense,
   const CellIdx* basalGrowthCandidatesBegin,
   const CellIdx* basalGrowthCandidatesEnd,
   const CellIdx* apicalGrowthCandidatesBegin,
@@ -624,8 +1053,11 @@ static void burstColumn(
   UInt maxSegmentsPerCell,
   UInt maxSynapsesPerSegment,
   bool learnOnOneCell,
+  bool hasApical,
   bool learn)
 {
+  NTA_ATTM_TIME_PHASE(BURST_COLUMN);
+
   // Calculate the active cells.
   const CellIdx start = column * cellsPerColumn;
   const CellIdx end = start + cellsPerColumn;
@@ -638,40 +1070,10 @@ static void burstColumn(
   auto basalCandidatesBegin = columnMatchingBasalBegin;
   auto basalCandidatesEnd = columnMatchingBasalEnd;
 
-  // Calculate the winner cell.
-  CellIdx winnerCell;
-  if (learnOnOneCell && chosenCellForColumn.count(column))
-  {
-    winnerCell = chosenCellForColumn.at(column);
-  }
-  else
-  {
-    if (columnMatchingBasalBegin != columnMatchingBasalEnd)
-    {
-      auto bestBasalSegment = std::max_element(
-        columnMatchingBasalBegin, columnMatchingBasalEnd,
-        [&](Segment a, Segment b)
-        {
-          return (basalPotentialOverlaps[a] <
-                  basalPotentialOverlaps[b]);
-        });
-
-      basalCandidatesBegin = bestBasalSegment;
-      basalCandidatesEnd = bestBasalSegment + 1;
-
-      winnerCell = basalConnections.cellForSegment(*bestBasalSegment);
-    }
-    else
-    {
-      winnerCell = getLeastUsedCell(rng, column, basalConnections,
-                                    cellsPerColumn);
-    }
-
-    if (learnOnOneCell)
-    {
-      chosenCellForColumn[column] = winnerCell;
-    }
-  }
+  const CellIdx winnerCell = chooseWinnerCell(
+    basalCandidatesBegin, basalCandidatesEnd, rng, chosenCellForColumn,
+    column, basalPotentialOverlaps, basalConnections, cellsPerColumn,
+    learnOnOneCell);
   winnerCells.push_back(winnerCell);
 
   // Learn.
@@ -692,19 +1094,10 @@ static void burstColumn(
                                                 basalCandidatesEnd,
                                                 winnerCell,
                                                 basalConnections);
-    tie(cellActiveApicalBegin,
-        cellActiveApicalEnd) = segmentsForCell(columnActiveApicalBegin,
-                                               columnActiveApicalEnd,
-                                               winnerCell,
-                                               apicalConnections);
-    tie(cellMatchingApicalBegin,
-        cellMatchingApicalEnd) = segmentsForCell(columnMatchingApicalBegin,
-                                                 columnMatchingApicalEnd,
-                                                 winnerCell,
-                                                 apicalConnections);
 
-    learnOnCell(basalConnections, rng, lastUsedIterationForBasalSegment,
-                winnerCell,
+    learnOnCell(basalConnections, basalSynapseArrays, rng,
+                lastUsedIterationForBasalSegment, learningBudget,
+                winnerCell, false,
                 cellActiveBasalBegin, cellActiveBasalEnd,
                 cellMatchingBasalBegin, cellMatchingBasalEnd,
                 basalInputDense,
@@ -714,32 +1107,50 @@ static void burstColumn(
                 permanenceIncrement, permanenceDecrement,
                 maxSegmentsPerCell, maxSynapsesPerSegment);
 
-    learnOnCell(apicalConnections, rng, lastUsedIterationForApicalSegment,
-                winnerCell,
-                cellActiveApicalBegin, cellActiveApicalEnd,
-                cellMatchingApicalBegin, cellMatchingApicalEnd,
-                apicalInputDense,
-                apicalGrowthCandidatesBegin, apicalGrowthCandidatesEnd,
-                apicalPotentialOverlaps, iteration,
-                sampleSize, initialPermanence,
-                permanenceIncrement, permanenceDecrement,
-                maxSegmentsPerCell, maxSynapsesPerSegment);
+    if (hasApical)
+    {
+      tie(cellActiveApicalBegin,
+          cellActiveApicalEnd) = segmentsForCell(columnActiveApicalBegin,
+                                                 columnActiveApicalEnd,
+                                                 winnerCell,
+                                                 apicalConnections);
+      tie(cellMatchingApicalBegin,
+          cellMatchingApicalEnd) = segmentsForCell(columnMatchingApicalBegin,
+                                                   columnMatchingApicalEnd,
+                                                   winnerCell,
+                                                   apicalConnections);
+
+      learnOnCell(apicalConnections, apicalSynapseArrays, rng,
+                  lastUsedIterationForApicalSegment, learningBudget,
+                  winnerCell, true,
+                  cellActiveApicalBegin, cellActiveApicalEnd,
+                  cellMatchingApicalBegin, cellMatchingApicalEnd,
+                  apicalInputDense,
+                  apicalGrowthCandidatesBegin, apicalGrowthCandidatesEnd,
+                  apicalPotentialOverlaps, iteration,
+                  sampleSize, initialPermanence,
+                  permanenceIncrement, permanenceDecrement,
+                  maxSegmentsPerCell, maxSynapsesPerSegment);
+    }
   }
 }
 
 static void punishPredictedColumn(
   Connections& connections,
+  SynapseArrays& synapseArrays,
   vector<Segment>::const_iterator matchingSegmentsBegin,
   vector<Segment>::const_iterator matchingSegmentsEnd,
-  const vector<bool>& activeInputDense,
+  const vector<unsigned char>& activeInputDense,
   Permanence predictedSegmentDecrement)
 {
+  NTA_ATTM_TIME_PHASE(PUNISH_PREDICTED_COLUMN);
+
   if (predictedSegmentDecrement > 0.0)
   {
     for (auto matchingSegment = matchingSegmentsBegin;
          matchingSegment != matchingSegmentsEnd; matchingSegment++)
     {
-      adaptSegment(connections, *matchingSegment,
+      adaptSegment(connections, synapseArrays, *matchingSegment,
                    activeInputDense,
                    -predictedSegmentDecrement, 0.0);
     }
@@ -759,23 +1170,68 @@ void ApicalTiebreakTemporalMemory::activateCells(
   const CellIdx* apicalGrowthCandidatesEnd,
   bool learn)
 {
+  NTA_ATTM_STATS_SCOPE(collectStats_ ? &stats_ : nullptr);
+  NTA_ATTM_TRACE("activateCells");
+
   activeCells_.clear();
   winnerCells_.clear();
   predictedActiveCells_.clear();
 
+  if (learn)
+  {
+    thaw();
+  }
+
+  if (snapshot_ != nullptr)
+  {
+    activateCellsFrozen_(activeColumnsBegin, activeColumnsEnd);
+    return;
+  }
+
+  if (!basalSynapseArrays_->inSync() || !apicalSynapseArrays_->inSync())
+  {
+    NTA_WARN << "ApicalTiebreakTemporalMemory: rebuilding synapse arrays";
+    basalSynapseArrays_->rebuild();
+    apicalSynapseArrays_->rebuild();
+  }
+
+  // With no apical input, no apical segment is ever active or matching, so
+  // skip all apical learning.
+  const bool hasApical = (apicalInputSize_ > 0);
+
   // Perf: Densify these inputs so adaptSegment can quickly check
-  // whether a synapse is active.
-  vector<bool> basalReinforceCandidatesDense(basalInputSize_, false);
-  for (auto it = basalReinforceCandidatesBegin;
-       it != basalReinforceCandidatesEnd; it++)
+  // whether a synapse is active. Use a byte per cell, with padding, so that
+  // the vectorized kernel can gather them. They're only used for learning.
+  vector<unsigned char> basalReinforceCandidatesDense;
+  vector<unsigned char> apicalReinforceCandidatesDense;
+  if (learn)
+  {
+    basalReinforceCandidatesDense.resize(
+      basalInputSize_ + ACTIVE_INPUT_PADDING, 0);
+    for (auto it = basalReinforceCandidatesBegin;
+         it != basalReinforceCandidatesEnd; it++)
+    {
+      basalReinforceCandidatesDense[*it] = 1;
+    }
+  }
+  if (learn && hasApical)
   {
-    basalReinforceCandidatesDense[*it] = true;
+    apicalReinforceCandidatesDense.resize(
+      apicalInputSize_ + ACTIVE_INPUT_PADDING, 0);
+    for (auto it = apicalReinforceCandidatesBegin;
+         it != apicalReinforceCandidatesEnd; it++)
+    {
+      apicalReinforceCandidatesDense[*it] = 1;
+    }
   }
-  vector<bool> apicalReinforceCandidatesDense(apicalInputSize_, false);
-  for (auto it = apicalReinforceCandidatesBegin;
-       it != apicalReinforceCandidatesEnd; it++)
+
+  learningBudget_->startStep();
+
+  if (learn && coldSegmentAge_ > 0)
   {
-    apicalReinforceCandidatesDense[*it] = true;
+    promoteColdSegments_(activeColumnsBegin, activeColumnsEnd,
+                         basalReinforceCandidatesDense,
+                         apicalReinforceCandidatesDense);
   }
 
   const auto columnForCellFn = [&](CellIdx cell)
@@ -826,8 +1282,10 @@ void ApicalTiebreakTemporalMemory::activateCells(
       {
         activatePredictedColumn(
           activeCells_, winnerCells_, predictedActiveCells_,
-          basalConnections, apicalConnections, rng_,
+          basalConnections, apicalConnections,
+          *basalSynapseArrays_, *apicalSynapseArrays_, rng_,
           lastUsedIterationForBasalSegment_, lastUsedIterationForApicalSegment_,
+          *learningBudget_,
           columnPredictedCellsBegin, columnPredictedCellsEnd,
           columnActiveBasalBegin, columnActiveBasalEnd,
           columnMatchingBasalBegin, columnMatchingBasalEnd,
@@ -841,14 +1299,16 @@ void ApicalTiebreakTemporalMemory::activateCells(
           sampleSize_,
           initialPermanence_, permanenceIncrement_, permanenceDecrement_,
           maxSegmentsPerCell_, maxSynapsesPerSegment_,
-          learn);
+          hasApical, learn);
       }
       else
       {
         burstColumn(
           activeCells_, winnerCells_,
-          basalConnections, apicalConnections, rng_,
+          basalConnections, apicalConnections,
+          *basalSynapseArrays_, *apicalSynapseArrays_, rng_,
           lastUsedIterationForBasalSegment_, lastUsedIterationForApicalSegment_,
+          *learningBudget_,
           chosenCellForColumn_,
           column,
           columnActiveBasalBegin, columnActiveBasalEnd,
@@ -863,7 +1323,7 @@ void ApicalTiebreakTemporalMemory::activateCells(
           cellsPerColumn_, sampleSize_,
           initialPermanence_, permanenceIncrement_, permanenceDecrement_,
           maxSegmentsPerCell_, maxSynapsesPerSegment_,
-          learnOnOneCell_, learn);
+          learnOnOneCell_, hasApical, learn);
       }
     }
     else
@@ -871,84 +1331,118 @@ void ApicalTiebreakTemporalMemory::activateCells(
       if (learn)
       {
         punishPredictedColumn(
-          basalConnections,
+          basalConnections, *basalSynapseArrays_,
           columnMatchingBasalBegin, columnMatchingBasalEnd,
           basalReinforceCandidatesDense,
           basalPredictedSegmentDecrement_);
 
-        punishPredictedColumn(
-          apicalConnections,
-          columnMatchingApicalBegin, columnMatchingApicalEnd,
-          apicalReinforceCandidatesDense,
-          apicalPredictedSegmentDecrement_);
+        if (hasApical)
+        {
+          punishPredictedColumn(
+            apicalConnections, *apicalSynapseArrays_,
+            columnMatchingApicalBegin, columnMatchingApicalEnd,
+            apicalReinforceCandidatesDense,
+            apicalPredictedSegmentDecrement_);
+        }
       }
     }
   }
+
+  if (learn)
+  {
+    createDeferredSegments_();
+
+    if (maxSynapses_ > 0)
+    {
+      enforceSynapseBudget_();
+    }
+
+    compactIfFragmented_();
+  }
+
+  updateSegmentArrayCapacities_(true);
 }
 
-static void calculateOverlaps(
-  vector<UInt32>& overlaps,
-  vector<Segment>& activeSegments,
-  vector<UInt32>& potentialOverlaps,
-  vector<Segment>& matchingSegments,
-  const CellIdx* activeInputBegin,
-  const CellIdx* activeInputEnd,
-  const Connections& connections,
-  Permanence connectedPermanence,
-  UInt activationThreshold,
-  UInt minThreshold)
+/**
+ * activateCells without learning, for a frozen model. Nothing is learned, so
+ * only the predicted cells and the basal segments that choose the winner
+ * cells are needed.
+ */
+void ApicalTiebreakTemporalMemory::activateCellsFrozen_(
+  const UInt* activeColumnsBegin,
+  const UInt* activeColumnsEnd)
 {
-  const UInt32 length = connections.segmentFlatListLength();
-  overlaps.assign(length, 0);
-  potentialOverlaps.assign(length, 0);
+  const FrozenConnections& basal = snapshot_->basal;
 
-  for (auto cell = activeInputBegin; cell != activeInputEnd; cell++)
-  {
-    connections.computeActivity(overlaps, potentialOverlaps,
-                                *cell, connectedPermanence);
-  }
+  const auto columnForCellFn = [&](CellIdx cell)
+    { return this->columnForCell(cell); };
+  const auto columnForBasalSegment = [&](Segment segment)
+    { return basal.cellForSegment(segment) / cellsPerColumn_; };
 
-  // Active segments, connected synapses.
-  activeSegments.clear();
-  for (Segment segment = 0;
-       segment < overlaps.size();
-       segment++)
+  for (auto& columnData : iterGroupBy(
+         activeColumnsBegin, activeColumnsEnd, identity<UInt>,
+         predictedCells_.begin(), predictedCells_.end(), columnForCellFn,
+         matchingBasalSegments_.begin(),
+         matchingBasalSegments_.end(), columnForBasalSegment))
   {
-    if (overlaps[segment] >= activationThreshold)
+    UInt column;
+    const UInt
+      *columnActiveColumnsBegin, *columnActiveColumnsEnd;
+    vector<CellIdx>::const_iterator
+      columnPredictedCellsBegin, columnPredictedCellsEnd;
+    vector<Segment>::const_iterator
+      columnMatchingBasalBegin, columnMatchingBasalEnd;
+    tie(column,
+        columnActiveColumnsBegin, columnActiveColumnsEnd,
+        columnPredictedCellsBegin, columnPredictedCellsEnd,
+        columnMatchingBasalBegin, columnMatchingBasalEnd) = columnData;
+
+    if (columnActiveColumnsBegin == columnActiveColumnsEnd)
     {
-      activeSegments.push_back(segment);
+      continue;
     }
-  }
-  std::sort(activeSegments.begin(), activeSegments.end(),
-            [&](Segment a, Segment b)
-            {
-              return connections.compareSegments(a, b);
-            });
 
-  // Matching segments, potential synapses.
-  matchingSegments.clear();
-  for (Segment segment = 0;
-       segment < potentialOverlaps.size();
-       segment++)
-  {
-    if (potentialOverlaps[segment] >= minThreshold)
+    if (columnPredictedCellsBegin != columnPredictedCellsEnd)
+    {
+      NTA_ATTM_TIME_PHASE(ACTIVATE_PREDICTED_COLUMN);
+
+      for (auto cell = columnPredictedCellsBegin;
+           cell != columnPredictedCellsEnd;
+           cell++)
+      {
+        activeCells_.push_back(*cell);
+        winnerCells_.push_back(*cell);
+        predictedActiveCells_.push_back(*cell);
+      }
+    }
+    else
     {
-      matchingSegments.push_back(segment);
+      NTA_ATTM_TIME_PHASE(BURST_COLUMN);
+
+      const CellIdx start = column * cellsPerColumn_;
+      for (CellIdx cell = start; cell < start + cellsPerColumn_; cell++)
+      {
+        activeCells_.push_back(cell);
+      }
+
+      winnerCells_.push_back(
+        chooseWinnerCell(columnMatchingBasalBegin, columnMatchingBasalEnd,
+                         rng_, chosenCellForColumn_, column,
+                         basalPotentialOverlaps_, basal, cellsPerColumn_,
+                         learnOnOneCell_));
     }
   }
-  std::sort(matchingSegments.begin(), matchingSegments.end(),
-            [&](Segment a, Segment b)
-            {
-              return connections.compareSegments(a, b);
-            });
+
+  updateSegmentArrayCapacities_(true);
 }
 
-static void calculatePredictedCells(
+template <typename ConnectionsT>
+static void calculatePredictedCellsGrouped(
   vector<CellIdx>& predictedCells,
   const vector<Segment>& activeBasalSegments,
-  const Connections& basalConnections,
+  const ConnectionsT& basalConnections,
   const vector<Segment>& activeApicalSegments,
-  const Connections& apicalConnections,
+  const ConnectionsT& apicalConnections,
   UInt cellsPerColumn)
 {
   const auto columnForBasalSegment = [&](Segment segment)
@@ -1016,44 +1510,437 @@ static void calculatePredictedCells(
   }
 }
 
-void ApicalTiebreakTemporalMemory::depolarizeCells(
-  const CellIdx* basalInputBegin,
-  const CellIdx* basalInputEnd,
-  const CellIdx* apicalInputBegin,
-  const CellIdx* apicalInputEnd,
-  bool learn)
+/**
+ * Equivalent to calculatePredictedCellsGrouped, but scatters each segment's
+ * contribution into a per-cell score array and then takes the max over each
+ * column's cells. This avoids regrouping the segments by cell, which is
+ * cheaper when the columns have many active segments.
+ *
+ * Only columns with an active basal segment can contain predicted cells, so
+ * only those columns are scanned. The score array is all zeros on entry and
+ * is left that way on exit.
+ */
+template <typename ConnectionsT>
+static void calculatePredictedCellsDense(
+  vector<CellIdx>& predictedCells,
+  vector<unsigned char>& cellScores,
+  const vector<Segment>& activeBasalSegments,
+  const ConnectionsT& basalConnections,
+  const vector<Segment>& activeApicalSegments,
+  const ConnectionsT& apicalConnections,
+  UInt cellsPerColumn)
 {
-  calculateOverlaps(
-    basalOverlaps_, activeBasalSegments_,
-    basalPotentialOverlaps_, matchingBasalSegments_,
-    basalInputBegin, basalInputEnd, basalConnections,
-    connectedPermanence_, activationThreshold_, minThreshold_);
-
-  calculateOverlaps(
-    apicalOverlaps_, activeApicalSegments_,
-    apicalPotentialOverlaps_, matchingApicalSegments_,
-    apicalInputBegin, apicalInputEnd, apicalConnections,
-    connectedPermanence_, activationThreshold_, minThreshold_);
-
-  predictedCells_.clear();
-  calculatePredictedCells(predictedCells_,
-                          activeBasalSegments_, basalConnections,
-                          activeApicalSegments_, apicalConnections,
-                          cellsPerColumn_);
+  // Use the predictiveScore weights.
+  for (Segment segment : activeApicalSegments)
+  {
+    cellScores[apicalConnections.cellForSegment(segment)] = 1;
+  }
 
-  if (learn)
+  const auto emitColumn = [&](UInt column)
   {
-    for (Segment segment : activeBasalSegments_)
+    unsigned char* const columnScores = &cellScores[column * cellsPerColumn];
+
+    unsigned char maxDepolarization = 0;
+    for (UInt i = 0; i < cellsPerColumn; i++)
     {
-      lastUsedIterationForBasalSegment_[segment] = iteration_;
+      maxDepolarization = std::max(maxDepolarization, columnScores[i]);
     }
-    for (Segment segment : activeApicalSegments_)
+
+    for (UInt i = 0; i < cellsPerColumn; i++)
+    {
+      if (columnScores[i] == maxDepolarization)
+      {
+        predictedCells.push_back(column * cellsPerColumn + i);
+      }
+    }
+
+    std::fill(columnScores, columnScores + cellsPerColumn, 0);
+  };
+
+  // activeBasalSegments is sorted by cell, so each column's basal segments
+  // are contiguous, and a column is complete once the next one starts.
+  UInt column = 0;
+  bool haveColumn = false;
+  for (Segment segment : activeBasalSegments)
+  {
+    const CellIdx cell = basalConnections.cellForSegment(segment);
+    const UInt cellColumn = cell / cellsPerColumn;
+    if (haveColumn && cellColumn != column)
+    {
+      emitColumn(column);
+    }
+    column = cellColumn;
+    haveColumn = true;
+
+    cellScores[cell] |= 2;
+  }
+
+  if (haveColumn)
+  {
+    emitColumn(column);
+  }
+
+  for (Segment segment : activeApicalSegments)
+  {
+    cellScores[apicalConnections.cellForSegment(segment)] = 0;
+  }
+}
+
+/**
+ * Choose between the grouped and dense strategies. The dense strategy scans
+ * every cell of each column that has an active basal segment, so it only
+ * pays off once there are several active segments per scanned column.
+ */
+template <typename ConnectionsT>
+static void calculatePredictedCells(
+  vector<CellIdx>& predictedCells,
+  vector<unsigned char>& cellScores,
+  const vector<Segment>& activeBasalSegments,
+  const ConnectionsT& basalConnections,
+  const vector<Segment>& activeApicalSegments,
+  const ConnectionsT& apicalConnections,
+  UInt columnCount,
+  UInt cellsPerColumn)
+{
+  NTA_ATTM_TIME_PHASE(PREDICTED_CELLS);
+
+  if (activeApicalSegments.empty())
+  {
+    // Perf: Without apical support every cell with an active basal segment
+    // has the same score, so they're all predicted.
+    for (Segment segment : activeBasalSegments)
+    {
+      const CellIdx cell = basalConnections.cellForSegment(segment);
+      if (predictedCells.empty() || predictedCells.back() != cell)
+      {
+        predictedCells.push_back(cell);
+      }
+    }
+    return;
+  }
+
+  // The basal segments are sorted by cell, so their columns are too.
+  size_t numBasalColumns = 0;
+  UInt previousColumn = (UInt)-1;
+  for (Segment segment : activeBasalSegments)
+  {
+    const UInt column = basalConnections.cellForSegment(segment) /
+      cellsPerColumn;
+    if (column != previousColumn)
+    {
+      numBasalColumns++;
+      previousColumn = column;
+    }
+  }
+
+  const size_t numActiveSegments =
+    activeBasalSegments.size() + activeApicalSegments.size();
+
+  if (numActiveSegments >=
+      DENSE_PREDICTED_CELLS_ACTIVE_SEGMENTS_PER_COLUMN * numBasalColumns)
+  {
+    cellScores.resize(columnCount * cellsPerColumn, 0);
+    calculatePredictedCellsDense(predictedCells, cellScores,
+                                 activeBasalSegments, basalConnections,
+                                 activeApicalSegments, apicalConnections,
+                                 cellsPerColumn);
+  }
+  else
+  {
+    calculatePredictedCellsGrouped(predictedCells,
+                                   activeBasalSegments, basalConnections,
+                                   activeApicalSegments, apicalConnections,
+                                   cellsPerColumn);
+  }
+}
+
+static void removeColdSegments(vector<Segment>& segments,
+                               const PresynapticCellIndex& cellIndex)
+{
+  segments.erase(std::remove_if(segments.begin(), segments.end(),
+                                [&](Segment segment)
+                                {
+                                  return cellIndex.isCold(segment);
+                                }),
+                 segments.end());
+}
+
+static void coolSegments(
+  PresynapticCellIndex& cellIndex,
+  const Connections& connections,
+  const vector<UInt64>& lastUsedIterationForSegment,
+  UInt64 iteration,
+  UInt64 coldSegmentAge,
+  CellIdx cellsBegin,
+  CellIdx cellsEnd)
+{
+  for (CellIdx cell = cellsBegin; cell < cellsEnd; cell++)
+  {
+    for (Segment segment : connections.segmentsForCell(cell))
+    {
+      if (iteration - lastUsedIterationForSegment[segment] > coldSegmentAge)
+      {
+        cellIndex.setCold(segment, true);
+      }
+    }
+  }
+}
+
+/**
+ * Makes the cold segments on the cells of the given columns hot if they
+ * would match the reinforce candidates, and adds them to the matching
+ * segments.
+ */
+static void promoteColdSegments(
+  PresynapticCellIndex& cellIndex,
+  vector<UInt64>& lastUsedIterationForSegment,
+  vector<Segment>& matchingSegments,
+  vector<UInt32>& potentialOverlaps,
+  const vector<UInt>& columns,
+  const vector<unsigned char>& reinforceCandidatesDense,
+  const Connections& connections,
+  UInt cellsPerColumn,
+  UInt minThreshold,
+  UInt64 iteration)
+{
+  const size_t numMatchingSegments = matchingSegments.size();
+
+  for (UInt column : columns)
+  {
+    const CellIdx cellsBegin = column * cellsPerColumn;
+    for (CellIdx cell = cellsBegin; cell < cellsBegin + cellsPerColumn; cell++)
+    {
+      for (Segment segment : connections.segmentsForCell(cell))
+      {
+        if (!cellIndex.isCold(segment))
+        {
+          continue;
+        }
+
+        UInt32 potentialOverlap = 0;
+        for (Synapse synapse : connections.synapsesForSegment(segment))
+        {
+          potentialOverlap += reinforceCandidatesDense[
+            connections.dataForSynapse(synapse).presynapticCell];
+        }
+
+        if (potentialOverlap >= minThreshold)
+        {
+          cellIndex.setCold(segment, false);
+          lastUsedIterationForSegment[segment] = iteration;
+          if (segment >= potentialOverlaps.size())
+          {
+            potentialOverlaps.resize(connections.segmentFlatListLength(), 0);
+          }
+          potentialOverlaps[segment] = potentialOverlap;
+          matchingSegments.push_back(segment);
+        }
+      }
+    }
+  }
+
+  if (matchingSegments.size() > numMatchingSegments)
+  {
+    std::sort(matchingSegments.begin(), matchingSegments.end(),
+              [&](Segment a, Segment b)
+              {
+                return connections.compareSegments(a, b);
+              });
+  }
+}
+
+void ApicalTiebreakTemporalMemory::promoteColdSegments_(
+  const UInt* activeColumnsBegin,
+  const UInt* activeColumnsEnd,
+  const vector<unsigned char>& basalReinforceCandidatesDense,
+  const vector<unsigned char>& apicalReinforceCandidatesDense)
+{
+  // The bursting columns without any matching basal segments. In these
+  // columns learning would otherwise grow new segments.
+  vector<unsigned char> isCovered(columnCount_, 0);
+  for (CellIdx cell : predictedCells_)
+  {
+    isCovered[cell / cellsPerColumn_] = 1;
+  }
+  for (Segment segment : matchingBasalSegments_)
+  {
+    isCovered[basalConnections.cellForSegment(segment) / cellsPerColumn_] = 1;
+  }
+
+  vector<UInt> columns;
+  for (auto column = activeColumnsBegin; column != activeColumnsEnd; column++)
+  {
+    if (!isCovered[*column])
+    {
+      columns.push_back(*column);
+    }
+  }
+
+  if (columns.empty())
+  {
+    return;
+  }
+
+  promoteColdSegments(*basalCellIndex_, lastUsedIterationForBasalSegment_,
+                      matchingBasalSegments_, basalPotentialOverlaps_,
+                      columns, basalReinforceCandidatesDense,
+                      basalConnections, cellsPerColumn_, minThreshold_,
+                      iteration_);
+
+  if (!apicalReinforceCandidatesDense.empty())
+  {
+    promoteColdSegments(*apicalCellIndex_, lastUsedIterationForApicalSegment_,
+                        matchingApicalSegments_, apicalPotentialOverlaps_,
+                        columns, apicalReinforceCandidatesDense,
+                        apicalConnections, cellsPerColumn_, minThreshold_,
+                        iteration_);
+  }
+}
+
+void ApicalTiebreakTemporalMemory::depolarizeCells(
+  const CellIdx* basalInputBegin,
+  const CellIdx* basalInputEnd,
+  const CellIdx* apicalInputBegin,
+  const CellIdx* apicalInputEnd,
+  bool learn)
+{
+  NTA_ATTM_STATS_SCOPE(collectStats_ ? &stats_ : nullptr);
+  NTA_ATTM_TRACE("depolarizeCells");
+
+  if (learn)
+  {
+    thaw();
+  }
+
+  if (!basalCellIndex_->inSync() || !apicalCellIndex_->inSync())
+  {
+    NTA_WARN << "ApicalTiebreakTemporalMemory: rebuilding cell indexes";
+    basalCellIndex_->rebuild();
+    apicalCellIndex_->rebuild();
+  }
+
+  {
+    NTA_ATTM_TIME_PHASE(BASAL_OVERLAPS);
+
+    if (snapshot_ != nullptr)
+    {
+      calculateOverlaps(
+        basalOverlaps_, activeBasalSegments_,
+        basalPotentialOverlaps_, matchingBasalSegments_,
+        basalInputBegin, basalInputEnd,
+        snapshot_->basal, nullptr,
+        connectedPermanence_, activationThreshold_, minThreshold_);
+    }
+    else if (basalIncrementalOverlaps_ != nullptr)
+    {
+      basalIncrementalOverlaps_->compute(
+        basalOverlaps_, activeBasalSegments_,
+        basalPotentialOverlaps_, matchingBasalSegments_,
+        basalInputBegin, basalInputEnd,
+        connectedPermanence_, activationThreshold_, minThreshold_);
+
+      if (coldSegmentAge_ > 0)
+      {
+        removeColdSegments(activeBasalSegments_, *basalCellIndex_);
+        removeColdSegments(matchingBasalSegments_, *basalCellIndex_);
+      }
+    }
+    else
+    {
+      calculateOverlaps(
+        basalOverlaps_, activeBasalSegments_,
+        basalPotentialOverlaps_, matchingBasalSegments_,
+        basalInputBegin, basalInputEnd,
+        basalConnections, basalCellIndex_,
+        connectedPermanence_, activationThreshold_, minThreshold_);
+
+      if (basalIncrementalOverlaps_ != nullptr)
+      {
+        basalIncrementalOverlaps_->invalidate();
+      }
+    }
+  }
+
+  {
+    NTA_ATTM_TIME_PHASE(APICAL_OVERLAPS);
+
+    if (apicalInputSize_ > 0 && snapshot_ != nullptr)
+    {
+      calculateOverlaps(
+        apicalOverlaps_, activeApicalSegments_,
+        apicalPotentialOverlaps_, matchingApicalSegments_,
+        apicalInputBegin, apicalInputEnd,
+        snapshot_->apical, nullptr,
+        connectedPermanence_, activationThreshold_, minThreshold_);
+    }
+    else if (apicalInputSize_ > 0 && apicalIncrementalOverlaps_ != nullptr)
+    {
+      apicalIncrementalOverlaps_->compute(
+        apicalOverlaps_, activeApicalSegments_,
+        apicalPotentialOverlaps_, matchingApicalSegments_,
+        apicalInputBegin, apicalInputEnd,
+        connectedPermanence_, activationThreshold_, minThreshold_);
+
+      if (coldSegmentAge_ > 0)
+      {
+        removeColdSegments(activeApicalSegments_, *apicalCellIndex_);
+        removeColdSegments(matchingApicalSegments_, *apicalCellIndex_);
+      }
+    }
+    else if (apicalInputSize_ > 0)
+    {
+      calculateOverlaps(
+        apicalOverlaps_, activeApicalSegments_,
+        apicalPotentialOverlaps_, matchingApicalSegments_,
+        apicalInputBegin, apicalInputEnd,
+        apicalConnections, apicalCellIndex_,
+        connectedPermanence_, activationThreshold_, minThreshold_);
+    }
+    else
+    {
+      // Perf: There's no apical input, so no apical segment is active or
+      // matching.
+      activeApicalSegments_.clear();
+      matchingApicalSegments_.clear();
+    }
+  }
+
+  predictedCells_.clear();
+  if (snapshot_ != nullptr)
+  {
+    calculatePredictedCells(predictedCells_, cellPredictiveScores_,
+                            activeBasalSegments_, snapshot_->basal,
+                            activeApicalSegments_, snapshot_->apical,
+                            columnCount_, cellsPerColumn_);
+  }
+  else
+  {
+    calculatePredictedCells(predictedCells_, cellPredictiveScores_,
+                            activeBasalSegments_, basalConnections,
+                            activeApicalSegments_, apicalConnections,
+                            columnCount_, cellsPerColumn_);
+  }
+
+  if (learn)
+  {
+    for (Segment segment : activeBasalSegments_)
+    {
+      lastUsedIterationForBasalSegment_[segment] = iteration_;
+    }
+    for (Segment segment : activeApicalSegments_)
     {
       lastUsedIterationForApicalSegment_[segment] = iteration_;
     }
 
     iteration_++;
+
+    if (coldSegmentAge_ > 0)
+    {
+      coolNextCells_();
+    }
   }
+
+  updateSegmentArrayCapacities_(true);
 }
 
 void ApicalTiebreakTemporalMemory::reset(void)
@@ -1075,13 +1962,17 @@ void ApicalTiebreakTemporalMemory::reset(void)
 
 Segment ApicalTiebreakTemporalMemory::createBasalSegment(CellIdx cell)
 {
-  return ::createSegment(basalConnections, lastUsedIterationForBasalSegment_,
+  thaw();
+  return ::createSegment(basalConnections, *basalSynapseArrays_,
+                         lastUsedIterationForBasalSegment_,
                          cell, iteration_, maxSegmentsPerCell_);
 }
 
 Segment ApicalTiebreakTemporalMemory::createApicalSegment(CellIdx cell)
 {
-  return ::createSegment(apicalConnections, lastUsedIterationForApicalSegment_,
+  thaw();
+  return ::createSegment(apicalConnections, *apicalSynapseArrays_,
+                         lastUsedIterationForApicalSegment_,
                          cell, iteration_, maxSegmentsPerCell_);
 }
 
@@ -1190,6 +2081,7 @@ UInt ApicalTiebreakTemporalMemory::getActivationThreshold() const
 void ApicalTiebreakTemporalMemory::setActivationThreshold(UInt activationThreshold)
 {
   activationThreshold_ = activationThreshold;
+  updateCellIndexThresholds_();
 }
 
 Permanence ApicalTiebreakTemporalMemory::getInitialPermanence() const
@@ -1211,6 +2103,12 @@ void ApicalTiebreakTemporalMemory::setConnectedPermanence(
   Permanence connectedPermanence)
 {
   connectedPermanence_ = connectedPermanence;
+  updateCellIndexThresholds_();
+
+  if (getLazyPermanences())
+  {
+    setLazyPermanences(true);
+  }
 }
 
 UInt ApicalTiebreakTemporalMemory::getMinThreshold() const
@@ -1221,6 +2119,7 @@ UInt ApicalTiebreakTemporalMemory::getMinThreshold() const
 void ApicalTiebreakTemporalMemory::setMinThreshold(UInt minThreshold)
 {
   minThreshold_ = minThreshold;
+  updateCellIndexThresholds_();
 }
 
 UInt ApicalTiebreakTemporalMemory::getSampleSize() const
@@ -1307,324 +2206,2379 @@ void ApicalTiebreakTemporalMemory::setCheckInputs(bool checkInputs)
   checkInputs_ = checkInputs;
 }
 
+void ApicalTiebreakTemporalMemory::subscribeIndexes_()
+{
+  NTA_ASSERT(basalSynapseArrays_ == nullptr);
+  NTA_ASSERT(apicalSynapseArrays_ == nullptr);
+
+  basalSynapseArrays_ = new SynapseArrays(basalConnections,
+                                          numReallocations_,
+                                          lifecycleStats_.basal);
+  basalSynapseArraysToken_ = basalConnections.subscribe(basalSynapseArrays_);
+  apicalSynapseArrays_ = new SynapseArrays(apicalConnections,
+                                           numReallocations_,
+                                           lifecycleStats_.apical);
+  apicalSynapseArraysToken_ = apicalConnections.subscribe(apicalSynapseArrays_);
+  basalSynapseArrays_->setLazy(lazyPermanences_, connectedPermanence_);
+  apicalSynapseArrays_->setLazy(lazyPermanences_, connectedPermanence_);
+
+  basalCellIndex_ = new PresynapticCellIndex(
+    basalConnections, connectedPermanence_, activationThreshold_,
+    minThreshold_, numReallocations_);
+  basalCellIndexToken_ = basalConnections.subscribe(basalCellIndex_);
+  apicalCellIndex_ = new PresynapticCellIndex(
+    apicalConnections, connectedPermanence_, activationThreshold_,
+    minThreshold_, numReallocations_);
+  apicalCellIndexToken_ = apicalConnections.subscribe(apicalCellIndex_);
+
+  updateDirtyCellTracking_();
+
+  reserve_();
+}
+
+void ApicalTiebreakTemporalMemory::unsubscribeIndexes_()
+{
+  if (basalSynapseArrays_ != nullptr)
+  {
+    // Connections deletes the handlers.
+    basalConnections.unsubscribe(basalSynapseArraysToken_);
+    basalSynapseArrays_ = nullptr;
+    apicalConnections.unsubscribe(apicalSynapseArraysToken_);
+    apicalSynapseArrays_ = nullptr;
+
+    basalConnections.unsubscribe(basalCellIndexToken_);
+    basalCellIndex_ = nullptr;
+    apicalConnections.unsubscribe(apicalCellIndexToken_);
+    apicalCellIndex_ = nullptr;
+
+    updateDirtyCellTracking_();
+  }
+}
+
 /**
-* Create a RNG with given seed
-*/
-void ApicalTiebreakTemporalMemory::seed(UInt64 seed)
+ * Cells are only tracked in a chain of checkpoints, i.e. while there's a
+ * checkpoint for the next delta to be relative to, and only while the
+ * indexes are subscribed, since the Connections are replaced while they're
+ * suspended. The dirty cells are kept across a suspension.
+ */
+void ApicalTiebreakTemporalMemory::updateDirtyCellTracking_()
 {
-  rng_ = Random(seed);
+  const bool track = (checkpointId_ != 0 && basalSynapseArrays_ != nullptr);
+  if (track && !trackingDirtyCells_)
+  {
+    basalDirtyCellTrackerToken_ = basalConnections.subscribe(
+      new DirtyCellTracker(basalConnections, *basalDirtyCells_));
+    apicalDirtyCellTrackerToken_ = apicalConnections.subscribe(
+      new DirtyCellTracker(apicalConnections, *apicalDirtyCells_));
+  }
+  else if (!track && trackingDirtyCells_)
+  {
+    basalConnections.unsubscribe(basalDirtyCellTrackerToken_);
+    apicalConnections.unsubscribe(apicalDirtyCellTrackerToken_);
+  }
+  trackingDirtyCells_ = track;
+
+  if (checkpointId_ == 0)
+  {
+    clearDirtyCells_();
+  }
 }
 
-void ApicalTiebreakTemporalMemory::write(ApicalTiebreakTemporalMemoryProto::Builder& proto) const
+void ApicalTiebreakTemporalMemory::suspendIndexes_(bool& incrementalOverlaps,
+                                                   bool& lazyPermanences)
 {
-  proto.setColumnCount(columnCount_);
-  proto.setBasalInputSize(basalInputSize_);
-  proto.setApicalInputSize(apicalInputSize_);
-  proto.setCellsPerColumn(cellsPerColumn_);
-  proto.setActivationThreshold(activationThreshold_);
-  proto.setInitialPermanence(initialPermanence_);
-  proto.setConnectedPermanence(connectedPermanence_);
-  proto.setMinThreshold(minThreshold_);
-  proto.setSampleSize(sampleSize_);
-  proto.setPermanenceIncrement(permanenceIncrement_);
-  proto.setPermanenceDecrement(permanenceDecrement_);
-  proto.setBasalPredictedSegmentDecrement(basalPredictedSegmentDecrement_);
-  proto.setApicalPredictedSegmentDecrement(apicalPredictedSegmentDecrement_);
+  incrementalOverlaps = getIncrementalOverlaps();
+  lazyPermanences = getLazyPermanences();
+  setIncrementalOverlaps(false);
+  unsubscribeSegmentRecency_();
+  unsubscribeIndexes_();
+}
 
-  proto.setMaxSegmentsPerCell(maxSegmentsPerCell_);
-  proto.setMaxSynapsesPerSegment(maxSynapsesPerSegment_);
+void ApicalTiebreakTemporalMemory::resumeIndexes_(bool incrementalOverlaps,
+                                                  bool lazyPermanences)
+{
+  subscribeIndexes_();
+  setIncrementalOverlaps(incrementalOverlaps);
+  setLazyPermanences(lazyPermanences);
+  if (coldSegmentAge_ > 0)
+  {
+    coolSegments_();
+  }
+
+  // The recency order depends on the last used iterations.
+  if (maxSynapses_ > 0)
+  {
+    subscribeSegmentRecency_();
+  }
+}
+
+void ApicalTiebreakTemporalMemory::updateCellIndexThresholds_()
+{
+  if (basalCellIndex_ != nullptr)
+  {
+    basalCellIndex_->setThresholds(connectedPermanence_,
+                                   activationThreshold_, minThreshold_);
+    apicalCellIndex_->setThresholds(connectedPermanence_,
+                                    activationThreshold_, minThreshold_);
+  }
+}
+
+bool ApicalTiebreakTemporalMemory::getIncrementalOverlaps() const
+{
+  return basalIncrementalOverlaps_ != nullptr;
+}
+
+void ApicalTiebreakTemporalMemory::setIncrementalOverlaps(
+  bool incrementalOverlaps)
+{
+  if (incrementalOverlaps && basalIncrementalOverlaps_ == nullptr)
+  {
+    basalIncrementalOverlaps_ = new IncrementalOverlaps(basalConnections,
+                                                        numReallocations_);
+    basalIncrementalOverlapsToken_ =
+      basalConnections.subscribe(basalIncrementalOverlaps_);
+    apicalIncrementalOverlaps_ = new IncrementalOverlaps(apicalConnections,
+                                                         numReallocations_);
+    apicalIncrementalOverlapsToken_ =
+      apicalConnections.subscribe(apicalIncrementalOverlaps_);
+    reserve_();
+  }
+  else if (!incrementalOverlaps && basalIncrementalOverlaps_ != nullptr)
+  {
+    // Connections deletes the handlers.
+    basalConnections.unsubscribe(basalIncrementalOverlapsToken_);
+    basalIncrementalOverlaps_ = nullptr;
+    apicalConnections.unsubscribe(apicalIncrementalOverlapsToken_);
+    apicalIncrementalOverlaps_ = nullptr;
+  }
+}
+
+bool ApicalTiebreakTemporalMemory::getLazyPermanences() const
+{
+  return lazyPermanences_;
+}
+
+void ApicalTiebreakTemporalMemory::setLazyPermanences(bool lazyPermanences)
+{
+  lazyPermanences_ = lazyPermanences;
+
+  // A default-constructed model subscribes its indexes when it's read.
+  if (basalSynapseArrays_ != nullptr)
+  {
+    basalSynapseArrays_->setLazy(lazyPermanences, connectedPermanence_);
+    apicalSynapseArrays_->setLazy(lazyPermanences, connectedPermanence_);
+  }
+}
+
+void ApicalTiebreakTemporalMemory::materializePermanences()
+{
+  if (basalSynapseArrays_ != nullptr)
+  {
+    basalSynapseArrays_->materialize();
+    apicalSynapseArrays_->materialize();
+  }
+}
+
+// The per-segment storage of a Connections and of this class's side arrays.
+static const size_t BYTES_PER_SEGMENT_SLOT =
+  sizeof(SegmentData) + // Connections segment data
+  sizeof(UInt64) + // Connections segment ordinal
+  sizeof(Segment) + // Connections list of destroyed segments
+  2 * sizeof(UInt32) + // overlaps and potential overlaps
+  sizeof(UInt64); // last used iteration
+
+// Learning can destroy active and matching segments, so they're dropped here.
+static void remapSegments(const vector<Segment>& newSegmentForSegment,
+                          vector<Segment>& segments)
+{
+  size_t numRemapped = 0;
+  for (Segment segment : segments)
+  {
+    if (newSegmentForSegment[segment] != NOT_INDEXED)
+    {
+      segments[numRemapped++] = newSegmentForSegment[segment];
+    }
+  }
+  segments.resize(numRemapped);
+}
+
+static UInt32 compactSegments(
+  Connections& connections,
+  vector<UInt32>& overlaps,
+  vector<UInt32>& potentialOverlaps,
+  vector<UInt64>& lastUsedIterationForSegment,
+  vector<Segment>& activeSegments,
+  vector<Segment>& matchingSegments)
+{
+  const UInt32 oldLength = connections.segmentFlatListLength();
+
+  // Recreate the segments cell by cell. Each cell's segments keep their
+  // order, so the segment comparisons don't change.
+  Connections compacted(connections.numCells());
+  vector<Segment> newSegmentForSegment(oldLength, NOT_INDEXED);
+  for (CellIdx cell = 0; cell < connections.numCells(); cell++)
+  {
+    for (Segment segment : connections.segmentsForCell(cell))
+    {
+      const Segment newSegment = compacted.createSegment(cell);
+      newSegmentForSegment[segment] = newSegment;
+
+      for (Synapse synapse : connections.synapsesForSegment(segment))
+      {
+        const SynapseData& synapseData = connections.dataForSynapse(synapse);
+        compacted.createSynapse(newSegment, synapseData.presynapticCell,
+                                synapseData.permanence);
+      }
+    }
+  }
+
+  const UInt32 newLength = compacted.segmentFlatListLength();
+  vector<UInt32> newOverlaps(newLength, 0);
+  vector<UInt32> newPotentialOverlaps(newLength, 0);
+  vector<UInt64> newLastUsedIterationForSegment(newLength, 0);
+  for (Segment segment = 0; segment < oldLength; segment++)
+  {
+    const Segment newSegment = newSegmentForSegment[segment];
+    if (newSegment != NOT_INDEXED)
+    {
+      if (segment < overlaps.size())
+      {
+        newOverlaps[newSegment] = overlaps[segment];
+        newPotentialOverlaps[newSegment] = potentialOverlaps[segment];
+      }
+      if (segment < lastUsedIterationForSegment.size())
+      {
+        newLastUsedIterationForSegment[newSegment] =
+          lastUsedIterationForSegment[segment];
+      }
+    }
+  }
+
+  remapSegments(newSegmentForSegment, activeSegments);
+  remapSegments(newSegmentForSegment, matchingSegments);
+
+  connections = compacted;
+  overlaps.swap(newOverlaps);
+  potentialOverlaps.swap(newPotentialOverlaps);
+  lastUsedIterationForSegment.swap(newLastUsedIterationForSegment);
+
+  return oldLength - newLength;
+}
+
+size_t ApicalTiebreakTemporalMemory::compact()
+{
+  if (snapshot_ != nullptr)
+  {
+    // A snapshot has no destroyed segments.
+    return 0;
+  }
+
+  // The indexes are rebuilt for the new segment numbers, like after a read.
+  materializePermanences();
+  bool incrementalOverlaps, lazyPermanences;
+  suspendIndexes_(incrementalOverlaps, lazyPermanences);
+
+  UInt32 numSlotsReclaimed = 0;
+  numSlotsReclaimed += compactSegments(
+    basalConnections, basalOverlaps_, basalPotentialOverlaps_,
+    lastUsedIterationForBasalSegment_,
+    activeBasalSegments_, matchingBasalSegments_);
+  numSlotsReclaimed += compactSegments(
+    apicalConnections, apicalOverlaps_, apicalPotentialOverlaps_,
+    lastUsedIterationForApicalSegment_,
+    activeApicalSegments_, matchingApicalSegments_);
+
+  resumeIndexes_(incrementalOverlaps, lazyPermanences);
+
+  return numSlotsReclaimed * BYTES_PER_SEGMENT_SLOT;
+}
+
+static void warmSegments(PresynapticCellIndex& cellIndex,
+                         const Connections& connections)
+{
+  for (CellIdx cell = 0; cell < connections.numCells(); cell++)
+  {
+    for (Segment segment : connections.segmentsForCell(cell))
+    {
+      cellIndex.setCold(segment, false);
+    }
+  }
+}
+
+static Real32 destroyedSegmentFraction(const Connections& connections)
+{
+  const UInt32 length = connections.segmentFlatListLength();
+  return (length > 0)
+    ? (Real32)(length - connections.numSegments()) / length
+    : 0.0;
+}
+
+void ApicalTiebreakTemporalMemory::compactIfFragmented_()
+{
+  if (compactionThreshold_ > 0.0 &&
+      (destroyedSegmentFraction(basalConnections) >= compactionThreshold_ ||
+       destroyedSegmentFraction(apicalConnections) >= compactionThreshold_))
+  {
+    compact();
+  }
+}
+
+Real32 ApicalTiebreakTemporalMemory::getCompactionThreshold() const
+{
+  return compactionThreshold_;
+}
+
+void ApicalTiebreakTemporalMemory::setCompactionThreshold(
+  Real32 compactionThreshold)
+{
+  NTA_CHECK(compactionThreshold >= 0.0 && compactionThreshold <= 1.0);
+  compactionThreshold_ = compactionThreshold;
+}
+
+UInt64 ApicalTiebreakTemporalMemory::getColdSegmentAge() const
+{
+  return coldSegmentAge_;
+}
+
+void ApicalTiebreakTemporalMemory::setColdSegmentAge(UInt64 coldSegmentAge)
+{
+  coldSegmentAge_ = coldSegmentAge;
+
+  // A default-constructed model subscribes its indexes when it's read, and
+  // resumeIndexes_ cools them then.
+  if (basalCellIndex_ == nullptr)
+  {
+    return;
+  }
+
+  if (coldSegmentAge_ > 0)
+  {
+    coolSegments_();
+  }
+  else
+  {
+    warmSegments(*basalCellIndex_, basalConnections);
+    warmSegments(*apicalCellIndex_, apicalConnections);
+  }
+}
+
+UInt64 ApicalTiebreakTemporalMemory::getMaxSynapses() const
+{
+  return maxSynapses_;
+}
+
+void ApicalTiebreakTemporalMemory::setMaxSynapses(UInt64 maxSynapses)
+{
+  maxSynapses_ = maxSynapses;
+
+  if (maxSynapses_ > 0 && basalSegmentRecency_ == nullptr)
+  {
+    subscribeSegmentRecency_();
+  }
+  else if (maxSynapses_ == 0)
+  {
+    unsubscribeSegmentRecency_();
+  }
+}
+
+void ApicalTiebreakTemporalMemory::reserve(UInt expectedSegments,
+                                           UInt expectedSynapsesPerSegment)
+{
+  expectedSegments_ = expectedSegments;
+  expectedSynapsesPerSegment_ = expectedSynapsesPerSegment;
+  reserve_();
+
+  // Growing the arrays here isn't a reallocation during learning.
+  updateSegmentArrayCapacities_(false);
+}
+
+UInt64 ApicalTiebreakTemporalMemory::getNumReallocations() const
+{
+  return numReallocations_;
+}
+
+UInt ApicalTiebreakTemporalMemory::getMaxNewSegmentsPerStep() const
+{
+  return learningBudget_->getMaxNewSegmentsPerStep();
+}
+
+void ApicalTiebreakTemporalMemory::setMaxNewSegmentsPerStep(
+  UInt maxNewSegmentsPerStep)
+{
+  // Each cell can have a basal and an apical segment waiting.
+  learningBudget_->setLimits(maxNewSegmentsPerStep, 2 * numberOfCells());
+}
+
+size_t ApicalTiebreakTemporalMemory::getNumDeferredSegments() const
+{
+  return learningBudget_->numDeferredSegments();
+}
+
+bool ApicalTiebreakTemporalMemory::statsAvailable()
+{
+#ifdef NTA_ATTM_STATS
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool ApicalTiebreakTemporalMemory::getCollectStats() const
+{
+  return collectStats_;
+}
+
+void ApicalTiebreakTemporalMemory::setCollectStats(bool collectStats)
+{
+  NTA_CHECK(!collectStats || statsAvailable())
+    << "Stats aren't available in this build. Build with NTA_ATTM_STATS.";
+  collectStats_ = collectStats;
+}
+
+const ApicalTiebreakTemporalMemoryStats&
+ApicalTiebreakTemporalMemory::getStats() const
+{
+  return stats_;
+}
+
+void ApicalTiebreakTemporalMemory::resetStats()
+{
+  stats_ = ApicalTiebreakTemporalMemoryStats();
+}
+
+const ApicalTiebreakTemporalMemoryLifecycleStats&
+ApicalTiebreakTemporalMemory::getLifecycleStats() const
+{
+  return lifecycleStats_;
+}
+
+void ApicalTiebreakTemporalMemory::resetLifecycleStats()
+{
+  for (ConnectionsLifecycleStats* lifecycleStats : {&lifecycleStats_.basal,
+                                                    &lifecycleStats_.apical})
+  {
+    ConnectionsLifecycleStats reset;
+    reset.segmentsPerCell.swap(lifecycleStats->segmentsPerCell);
+    reset.synapsesPerSegment.swap(lifecycleStats->synapsesPerSegment);
+    *lifecycleStats = std::move(reset);
+  }
+}
+
+/**
+ * The bytes of a std::map node: the value, the color and three pointers.
+ */
+template <typename Value>
+static size_t mapNodeBytes()
+{
+  return sizeof(Value) + 4 * sizeof(void*);
+}
+
+/**
+ * Computes the bytes of a Connections with the usage's slot counts, following
+ * nupic.core's layout: flat lists of segment and synapse data with an ordinal
+ * for each, each cell's and segment's list of children, the destroyed slots
+ * waiting for reuse, and a map from presynaptic cell to synapses.
+ */
+static void computeConnectionsBytes(ConnectionsMemoryUsage& usage,
+                                    size_t numCells,
+                                    size_t numPresynapticCells)
+{
+  const UInt64 segmentSlots = usage.liveSegments + usage.deadSegments;
+  const UInt64 synapseSlots = usage.liveSynapses + usage.deadSynapses;
+
+  usage.segments = numCells * sizeof(CellData) +
+    segmentSlots * (sizeof(SegmentData) + sizeof(UInt64) + sizeof(Segment));
+  usage.synapses =
+    synapseSlots * (sizeof(SynapseData) + sizeof(UInt64) + sizeof(Synapse));
+  usage.presynapticMaps =
+    numPresynapticCells * mapNodeBytes<pair<const CellIdx, vector<Synapse>>>() +
+    usage.liveSynapses * sizeof(Synapse);
+}
+
+static ConnectionsMemoryUsage measureConnections(
+  const Connections& connections,
+  UInt inputSize,
+  const SynapseArrays* synapseArrays)
+{
+  size_t synapseFlatListLength = (synapseArrays != nullptr)
+    ? synapseArrays->synapseFlatListLength()
+    : 0;
+
+  vector<bool> isPresynapticCell(inputSize, false);
+  size_t numPresynapticCells = 0;
+  for (CellIdx cell = 0; cell < connections.numCells(); cell++)
+  {
+    for (Segment segment : connections.segmentsForCell(cell))
+    {
+      for (Synapse synapse : connections.synapsesForSegment(segment))
+      {
+        synapseFlatListLength = std::max(synapseFlatListLength,
+                                         (size_t)synapse + 1);
+
+        const CellIdx presynapticCell =
+          connections.dataForSynapse(synapse).presynapticCell;
+        if (presynapticCell >= isPresynapticCell.size())
+        {
+          isPresynapticCell.resize(presynapticCell + 1, false);
+        }
+        if (!isPresynapticCell[presynapticCell])
+        {
+          isPresynapticCell[presynapticCell] = true;
+          numPresynapticCells++;
+        }
+      }
+    }
+  }
+
+  ConnectionsMemoryUsage usage;
+  usage.liveSegments = connections.numSegments();
+  usage.deadSegments =
+    connections.segmentFlatListLength() - usage.liveSegments;
+  usage.liveSynapses = connections.numSynapses();
+  usage.deadSynapses = synapseFlatListLength - usage.liveSynapses;
+  computeConnectionsBytes(usage, connections.numCells(), numPresynapticCells);
+
+  return usage;
+}
+
+ApicalTiebreakTemporalMemoryMemoryUsage
+ApicalTiebreakTemporalMemory::memoryUsage() const
+{
+  ApicalTiebreakTemporalMemoryMemoryUsage usage;
+
+  if (snapshot_ != nullptr)
+  {
+    usage.basal = snapshot_->basal.memoryUsage();
+    usage.apical = snapshot_->apical.memoryUsage();
+  }
+  else
+  {
+    usage.basal = measureConnections(basalConnections, basalInputSize_,
+                                     basalSynapseArrays_);
+    usage.apical = measureConnections(apicalConnections, apicalInputSize_,
+                                      apicalSynapseArrays_);
+  }
+
+  if (basalSynapseArrays_ != nullptr)
+  {
+    usage.basal.indexes += basalSynapseArrays_->memoryUsage() +
+      basalCellIndex_->memoryUsage();
+    usage.apical.indexes += apicalSynapseArrays_->memoryUsage() +
+      apicalCellIndex_->memoryUsage();
+  }
+  if (basalIncrementalOverlaps_ != nullptr)
+  {
+    usage.basal.indexes += basalIncrementalOverlaps_->memoryUsage();
+    usage.apical.indexes += apicalIncrementalOverlaps_->memoryUsage();
+  }
+  if (basalSegmentRecency_ != nullptr)
+  {
+    usage.basal.indexes += basalSegmentRecency_->memoryUsage();
+    usage.apical.indexes += apicalSegmentRecency_->memoryUsage();
+  }
+
+  usage.overlaps =
+    vectorBytes(activeBasalSegments_) + vectorBytes(matchingBasalSegments_) +
+    vectorBytes(basalOverlaps_) + vectorBytes(basalPotentialOverlaps_) +
+    vectorBytes(activeApicalSegments_) + vectorBytes(matchingApicalSegments_) +
+    vectorBytes(apicalOverlaps_) + vectorBytes(apicalPotentialOverlaps_);
+
+  usage.lastUsedIterations =
+    vectorBytes(lastUsedIterationForBasalSegment_) +
+    vectorBytes(lastUsedIterationForApicalSegment_);
+  if (snapshot_ != nullptr)
+  {
+    usage.lastUsedIterations += snapshot_->basal.lastUsedIterationBytes() +
+      snapshot_->apical.lastUsedIterationBytes();
+  }
+
+  usage.state =
+    vectorBytes(activeCells_) + vectorBytes(predictedCells_) +
+    vectorBytes(predictedActiveCells_) + vectorBytes(winnerCells_) +
+    vectorBytes(cellPredictiveScores_) +
+    chosenCellForColumn_.size() * mapNodeBytes<pair<const UInt, CellIdx>>() +
+    learningBudget_->memoryUsage() +
+    basalDirtyCells_->memoryUsage() + apicalDirtyCells_->memoryUsage();
+
+  return usage;
+}
+
+static ConnectionsMemoryUsage estimateConnections(size_t numCells,
+                                                  size_t inputSize,
+                                                  size_t numSegments,
+                                                  size_t synapsesPerSegment)
+{
+  ConnectionsMemoryUsage usage;
+  usage.liveSegments = numSegments;
+  usage.liveSynapses = numSegments * synapsesPerSegment;
+
+  const size_t numPresynapticCells =
+    std::min(inputSize, (size_t)usage.liveSynapses);
+  computeConnectionsBytes(usage, numCells, numPresynapticCells);
+
+  usage.indexes =
+    SynapseArrays::estimateMemoryUsage(numSegments, usage.liveSynapses) +
+    PresynapticCellIndex::estimateMemoryUsage(numSegments, usage.liveSynapses,
+                                              numPresynapticCells);
+
+  return usage;
+}
+
+ApicalTiebreakTemporalMemoryMemoryUsage
+ApicalTiebreakTemporalMemory::estimateMemoryUsage(
+  UInt columnCount,
+  UInt cellsPerColumn,
+  UInt basalInputSize,
+  UInt apicalInputSize,
+  UInt numBasalSegments,
+  UInt numApicalSegments,
+  UInt synapsesPerSegment)
+{
+  const size_t numCells = (size_t)columnCount * cellsPerColumn;
+  const size_t numSegments = (size_t)numBasalSegments + numApicalSegments;
+
+  ApicalTiebreakTemporalMemoryMemoryUsage usage;
+  usage.basal = estimateConnections(numCells, basalInputSize,
+                                    numBasalSegments, synapsesPerSegment);
+  usage.apical = estimateConnections(numCells, apicalInputSize,
+                                     numApicalSegments, synapsesPerSegment);
+
+  // The overlaps and potential overlaps. The active and matching segments
+  // are usually much fewer.
+  usage.overlaps = numSegments * 2 * sizeof(UInt32);
+  usage.lastUsedIterations = numSegments * sizeof(UInt64);
+
+  // The predictive scores. The per-step lists of cells are much smaller.
+  usage.state = numCells * sizeof(unsigned char) +
+    2 * numCells * sizeof(unsigned char); // dirty cells
+
+  return usage;
+}
+
+/**
+ * Whether one of the cell's segments has at least minThreshold synapses to
+ * the growth candidates, i.e. it would have been learned on instead.
+ */
+static bool hasMatchingSegment(const Connections& connections, CellIdx cell,
+                               vector<CellIdx> growthCandidates,
+                               UInt minThreshold)
+{
+  std::sort(growthCandidates.begin(), growthCandidates.end());
+  for (Segment segment : connections.segmentsForCell(cell))
+  {
+    UInt overlap = 0;
+    for (Synapse synapse : connections.synapsesForSegment(segment))
+    {
+      if (std::binary_search(growthCandidates.begin(), growthCandidates.end(),
+                             connections.dataForSynapse(synapse)
+                             .presynapticCell))
+      {
+        overlap++;
+      }
+    }
+    if (overlap >= minThreshold)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+void ApicalTiebreakTemporalMemory::createDeferredSegments_()
+{
+  deque<LearningBudget::DeferredSegment>& deferredSegments =
+    learningBudget_->deferredSegments();
+
+  while (!deferredSegments.empty())
+  {
+    const LearningBudget::DeferredSegment& deferred =
+      deferredSegments.front();
+    Connections& connections =
+      deferred.apical ? apicalConnections : basalConnections;
+
+    // The cell may have grown a segment for this input since it was
+    // deferred, when its column burst with room in the budget.
+    if (hasMatchingSegment(connections, deferred.cell,
+                           deferred.growthCandidates, minThreshold_))
+    {
+      deferredSegments.pop_front();
+      continue;
+    }
+
+    if (!learningBudget_->tryCreateSegment())
+    {
+      break;
+    }
+
+    SynapseArrays& synapseArrays =
+      deferred.apical ? *apicalSynapseArrays_ : *basalSynapseArrays_;
+    vector<UInt64>& lastUsedIterationForSegment = deferred.apical
+      ? lastUsedIterationForApicalSegment_
+      : lastUsedIterationForBasalSegment_;
+
+    const CellIdx* growthCandidatesBegin = deferred.growthCandidates.data();
+    const CellIdx* growthCandidatesEnd =
+      growthCandidatesBegin + deferred.growthCandidates.size();
+    const UInt32 nGrowExact = std::min(
+      sampleSize_, (UInt32)deferred.growthCandidates.size());
+
+    const Segment segment = ::createSegment(
+      connections, synapseArrays, lastUsedIterationForSegment, deferred.cell,
+      iteration_, maxSegmentsPerCell_);
+    growSynapses(connections, synapseArrays, rng_,
+                 segment, nGrowExact,
+                 growthCandidatesBegin, growthCandidatesEnd,
+                 initialPermanence_, maxSynapsesPerSegment_);
+
+    deferredSegments.pop_front();
+  }
+}
+
+void ApicalTiebreakTemporalMemory::reserve_()
+{
+  if (expectedSegments_ == 0)
+  {
+    return;
+  }
+
+  // There are only apical segments if there's an apical input.
+  const UInt basalSegments = expectedSegments_;
+  const UInt apicalSegments = (apicalInputSize_ > 0) ? expectedSegments_ : 0;
+  const size_t basalSynapses =
+    (size_t)basalSegments * expectedSynapsesPerSegment_;
+  const size_t apicalSynapses =
+    (size_t)apicalSegments * expectedSynapsesPerSegment_;
+
+  basalOverlaps_.reserve(basalSegments);
+  basalPotentialOverlaps_.reserve(basalSegments);
+  lastUsedIterationForBasalSegment_.reserve(basalSegments);
+  apicalOverlaps_.reserve(apicalSegments);
+  apicalPotentialOverlaps_.reserve(apicalSegments);
+  lastUsedIterationForApicalSegment_.reserve(apicalSegments);
+
+  if (basalSynapseArrays_ != nullptr)
+  {
+    basalSynapseArrays_->reserve(basalSegments, expectedSynapsesPerSegment_);
+    apicalSynapseArrays_->reserve(apicalSegments,
+                                  expectedSynapsesPerSegment_);
+    basalCellIndex_->reserve(basalSegments, basalSynapses, basalInputSize_);
+    apicalCellIndex_->reserve(apicalSegments, apicalSynapses,
+                              apicalInputSize_);
+  }
+
+  if (basalIncrementalOverlaps_ != nullptr)
+  {
+    basalIncrementalOverlaps_->reserve(basalSegments);
+    apicalIncrementalOverlaps_->reserve(apicalSegments);
+  }
+
+  if (basalSegmentRecency_ != nullptr)
+  {
+    basalSegmentRecency_->reserve(basalSegments);
+    apicalSegmentRecency_->reserve(apicalSegments);
+  }
+}
+
+void ApicalTiebreakTemporalMemory::updateSegmentArrayCapacities_(
+  bool countReallocations)
+{
+  const size_t capacities[NUM_SEGMENT_ARRAYS] = {
+    basalOverlaps_.capacity(),
+    basalPotentialOverlaps_.capacity(),
+    lastUsedIterationForBasalSegment_.capacity(),
+    apicalOverlaps_.capacity(),
+    apicalPotentialOverlaps_.capacity(),
+    lastUsedIterationForApicalSegment_.capacity()};
+
+  for (size_t i = 0; i < NUM_SEGMENT_ARRAYS; i++)
+  {
+    if (countReallocations && capacities[i] != segmentArrayCapacities_[i])
+    {
+      numReallocations_++;
+    }
+    segmentArrayCapacities_[i] = capacities[i];
+  }
+}
+
+void ApicalTiebreakTemporalMemory::subscribeSegmentRecency_()
+{
+  NTA_ASSERT(basalSegmentRecency_ == nullptr);
+
+  basalSegmentRecency_ = new SegmentRecency(
+    basalConnections, lastUsedIterationForBasalSegment_, numReallocations_);
+  basalSegmentRecencyToken_ = basalConnections.subscribe(basalSegmentRecency_);
+  apicalSegmentRecency_ = new SegmentRecency(
+    apicalConnections, lastUsedIterationForApicalSegment_,
+    numReallocations_);
+  apicalSegmentRecencyToken_ =
+    apicalConnections.subscribe(apicalSegmentRecency_);
+  reserve_();
+}
+
+void ApicalTiebreakTemporalMemory::unsubscribeSegmentRecency_()
+{
+  if (basalSegmentRecency_ != nullptr)
+  {
+    // Connections deletes the handlers.
+    basalConnections.unsubscribe(basalSegmentRecencyToken_);
+    basalSegmentRecency_ = nullptr;
+    apicalConnections.unsubscribe(apicalSegmentRecencyToken_);
+    apicalSegmentRecency_ = nullptr;
+  }
+}
+
+void ApicalTiebreakTemporalMemory::enforceSynapseBudget_()
+{
+  // Each step only evicts as many segments as it takes to get back under
+  // the budget, which is about as many as learning just grew.
+  while ((UInt64)basalConnections.numSynapses() +
+         apicalConnections.numSynapses() > maxSynapses_)
+  {
+    NTA_ATTM_TIME_PHASE(EVICT_SEGMENTS);
+
+    UInt64 basalLastUsed = 0;
+    UInt64 apicalLastUsed = 0;
+    const Segment basalSegment =
+      basalSegmentRecency_->leastRecentlyUsed(basalLastUsed);
+    const Segment apicalSegment =
+      apicalSegmentRecency_->leastRecentlyUsed(apicalLastUsed);
+
+    if (basalSegment != NOT_INDEXED &&
+        (apicalSegment == NOT_INDEXED || basalLastUsed <= apicalLastUsed))
+    {
+      lifecycleStats_.basal.segmentsEvictedBySynapseBudget++;
+      recordEviction(lifecycleStats_.basal, iteration_ - basalLastUsed);
+      basalConnections.destroySegment(basalSegment);
+      NTA_ATTM_COUNT(segmentsEvicted, 1);
+    }
+    else if (apicalSegment != NOT_INDEXED)
+    {
+      lifecycleStats_.apical.segmentsEvictedBySynapseBudget++;
+      recordEviction(lifecycleStats_.apical, iteration_ - apicalLastUsed);
+      apicalConnections.destroySegment(apicalSegment);
+      NTA_ATTM_COUNT(segmentsEvicted, 1);
+    }
+    else
+    {
+      break;
+    }
+  }
+}
+
+void ApicalTiebreakTemporalMemory::coolSegments_()
+{
+  coolSegments(*basalCellIndex_, basalConnections,
+               lastUsedIterationForBasalSegment_, iteration_,
+               coldSegmentAge_, 0, basalConnections.numCells());
+  coolSegments(*apicalCellIndex_, apicalConnections,
+               lastUsedIterationForApicalSegment_, iteration_,
+               coldSegmentAge_, 0, apicalConnections.numCells());
+}
+
+/**
+ * Checks the next numCells / coldSegmentAge cells, so the cells are covered
+ * once every coldSegmentAge calls. A segment becomes cold at most
+ * coldSegmentAge iterations late, as with a full scan every coldSegmentAge
+ * iterations, but the work is spread over the steps.
+ */
+void ApicalTiebreakTemporalMemory::coolNextCells_()
+{
+  const CellIdx numCells = numberOfCells();
+  const CellIdx numToCheck =
+    (CellIdx)((numCells + coldSegmentAge_ - 1) / coldSegmentAge_);
+
+  if (coolingCursor_ >= numCells)
+  {
+    coolingCursor_ = 0;
+  }
+  const CellIdx cellsEnd = (CellIdx)std::min<UInt64>(
+    numCells, (UInt64)coolingCursor_ + numToCheck);
+
+  coolSegments(*basalCellIndex_, basalConnections,
+               lastUsedIterationForBasalSegment_, iteration_,
+               coldSegmentAge_, coolingCursor_, cellsEnd);
+  coolSegments(*apicalCellIndex_, apicalConnections,
+               lastUsedIterationForApicalSegment_, iteration_,
+               coldSegmentAge_, coolingCursor_, cellsEnd);
+
+  coolingCursor_ = cellsEnd;
+}
+
+/**
+* Create a RNG with given seed
+*/
+void ApicalTiebreakTemporalMemory::seed(UInt64 seed)
+{
+  rng_ = Random(seed);
+}
+
+// A Cap'n Proto list holds at most 2^29 - 1 elements.
+static const size_t MAX_LIST_LENGTH = (1 << 29) - 1;
+
+// Longer lists are split into chunks. Tests lower this.
+static size_t maxListLength = MAX_LIST_LENGTH;
+
+size_t ApicalTiebreakTemporalMemory::getMaxListLength()
+{
+  return maxListLength;
+}
+
+void ApicalTiebreakTemporalMemory::setMaxListLength(size_t length)
+{
+  NTA_CHECK(length > 0 && length <= MAX_LIST_LENGTH)
+    << "The list length must be between 1 and " << MAX_LIST_LENGTH;
+  maxListLength = length;
+}
+
+template <typename SegmentNumberPair, typename Number>
+static void setSegmentNumber(SegmentNumberPair pair, CellIdx cell,
+                             UInt32 idxOnCell, Number number)
+{
+  pair.setCell(cell);
+  pair.setIdxOnCell(idxOnCell);
+  pair.setNumber(number);
+}
+
+/**
+ * Writes a number for each of the numSegments live segments that 'include'
+ * accepts, in a single list if they fit in maxLength and otherwise in
+ * chunks.
+ */
+template <typename InitList, typename InitChunks, typename Number,
+          typename Include>
+static void writeSegmentNumbers(
+  InitList initList,
+  InitChunks initChunks,
+  const Connections& connections,
+  const vector<Number>& numberForSegment,
+  size_t numSegments,
+  Include include,
+  size_t maxLength)
+{
+  const auto number = [&](Segment segment)
+    {
+      return (segment < numberForSegment.size())
+        ? numberForSegment[segment]
+        : 0;
+    };
+
+  if (numSegments <= maxLength)
+  {
+    auto pairs = initList(numSegments);
+    size_t i = 0;
+    for (CellIdx cell = 0; cell < connections.numCells(); cell++)
+    {
+      const vector<Segment>& segments = connections.segmentsForCell(cell);
+      for (UInt32 idxOnCell = 0; idxOnCell < segments.size(); idxOnCell++)
+      {
+        if (include(cell, segments[idxOnCell]))
+        {
+          setSegmentNumber(pairs[i++], cell, idxOnCell,
+                           number(segments[idxOnCell]));
+        }
+      }
+    }
+  }
+  else
+  {
+    const size_t numChunks = (numSegments + maxLength - 1) / maxLength;
+    auto chunks = initChunks(numChunks);
+    for (size_t chunk = 0; chunk < numChunks; chunk++)
+    {
+      chunks[chunk].initPairs(
+        std::min(maxLength, numSegments - chunk * maxLength));
+    }
+
+    size_t i = 0;
+    for (CellIdx cell = 0; cell < connections.numCells(); cell++)
+    {
+      const vector<Segment>& segments = connections.segmentsForCell(cell);
+      for (UInt32 idxOnCell = 0; idxOnCell < segments.size(); idxOnCell++)
+      {
+        if (include(cell, segments[idxOnCell]))
+        {
+          setSegmentNumber(
+            chunks[i / maxLength].getPairs()[i % maxLength],
+            cell, idxOnCell, number(segments[idxOnCell]));
+          i++;
+        }
+      }
+    }
+  }
+}
+
+template <typename SegmentNumberPairs, typename Number>
+static void readSegmentNumbers(
+  vector<Number>& numberForSegment,
+  SegmentNumberPairs pairs,
+  const Connections& connections)
+{
+  for (auto pair : pairs)
+  {
+    const Segment segment = connections.getSegment(pair.getCell(),
+                                                   pair.getIdxOnCell());
+    numberForSegment[segment] = pair.getNumber();
+  }
+}
+
+// The format of the per-segment numbers that write() uses.
+static const UInt16 SERIALIZATION_VERSION = 1;
+
+static size_t varintLength(UInt64 value)
+{
+  size_t length = 1;
+  while (value >= 0x80)
+  {
+    value >>= 7;
+    length++;
+  }
+  return length;
+}
+
+/**
+ * Writes iteration - lastUsedIteration for each live segment as a varint,
+ * so the segments that were used recently take a byte or two. A chunk holds
+ * at most maxLength bytes, unless a single varint is longer.
+ */
+template <typename InitChunks>
+static void writeSegmentAges(
+  InitChunks initChunks,
+  const Connections& connections,
+  const vector<UInt64>& lastUsedIterationForSegment,
+  UInt64 iteration,
+  size_t maxLength)
+{
+  const auto age = [&](Segment segment)
+    {
+      return iteration - ((segment < lastUsedIterationForSegment.size())
+                          ? lastUsedIterationForSegment[segment]
+                          : 0);
+    };
+
+  // Size the chunks first so that the bytes go straight into the message.
+  vector<size_t> chunkLengths = {0};
+  for (CellIdx cell = 0; cell < connections.numCells(); cell++)
+  {
+    for (Segment segment : connections.segmentsForCell(cell))
+    {
+      const size_t length = varintLength(age(segment));
+      if (chunkLengths.back() > 0 &&
+          chunkLengths.back() + length > maxLength)
+      {
+        chunkLengths.push_back(0);
+      }
+      chunkLengths.back() += length;
+    }
+  }
+
+  auto chunks = initChunks(chunkLengths.size());
+  size_t chunk = 0;
+  auto bytes = chunks[chunk].initBytes(chunkLengths[chunk]);
+  size_t i = 0;
+  for (CellIdx cell = 0; cell < connections.numCells(); cell++)
+  {
+    for (Segment segment : connections.segmentsForCell(cell))
+    {
+      UInt64 value = age(segment);
+      if (i + varintLength(value) > chunkLengths[chunk])
+      {
+        chunk++;
+        bytes = chunks[chunk].initBytes(chunkLengths[chunk]);
+        i = 0;
+      }
+
+      while (value >= 0x80)
+      {
+        bytes[i++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+      }
+      bytes[i++] = value;
+    }
+  }
+}
+
+template <typename Chunks>
+static void readSegmentAges(
+  vector<UInt64>& lastUsedIterationForSegment,
+  Chunks chunks,
+  const Connections& connections,
+  UInt64 iteration)
+{
+  lastUsedIterationForSegment.assign(connections.segmentFlatListLength(), 0);
+
+  size_t nextChunk = 0;
+  const kj::byte* byte = nullptr;
+  const kj::byte* end = nullptr;
+  const auto readVarint = [&]()
+    {
+      UInt64 value = 0;
+      for (UInt shift = 0; ; shift += 7)
+      {
+        while (byte == end)
+        {
+          NTA_CHECK(nextChunk < chunks.size())
+            << "There are fewer segment ages than segments";
+          auto bytes = chunks[nextChunk++].getBytes();
+          byte = bytes.begin();
+          end = bytes.end();
+        }
+
+        NTA_CHECK(shift < 64) << "Invalid segment age";
+        value |= (UInt64)(*byte & 0x7F) << shift;
+        if ((*byte++ & 0x80) == 0)
+        {
+          return value;
+        }
+      }
+    };
+
+  for (CellIdx cell = 0; cell < connections.numCells(); cell++)
+  {
+    for (Segment segment : connections.segmentsForCell(cell))
+    {
+      lastUsedIterationForSegment[segment] = iteration - readVarint();
+    }
+  }
+
+  while (byte == end && nextChunk < chunks.size())
+  {
+    auto bytes = chunks[nextChunk++].getBytes();
+    byte = bytes.begin();
+    end = bytes.end();
+  }
+  NTA_CHECK(byte == end) << "There are more segment ages than segments";
+}
+
+/**
+ * Writes the potential overlaps of the matching segments. They're the only
+ * ones that the next compute uses.
+ */
+template <typename UInt32List>
+static void writeMatchingOverlaps(UInt32List overlaps,
+                                  const vector<Segment>& matchingSegments,
+                                  const vector<UInt32>& potentialOverlaps)
+{
+  for (size_t i = 0; i < matchingSegments.size(); i++)
+  {
+    overlaps.set(i, potentialOverlaps[matchingSegments[i]]);
+  }
+}
+
+template <typename UInt32List>
+static void readMatchingOverlaps(vector<UInt32>& potentialOverlaps,
+                                 UInt32List overlaps,
+                                 const vector<Segment>& matchingSegments)
+{
+  NTA_CHECK(overlaps.size() == matchingSegments.size())
+    << "There are " << overlaps.size() << " potential overlaps for "
+    << matchingSegments.size() << " matching segments";
+  for (size_t i = 0; i < matchingSegments.size(); i++)
+  {
+    potentialOverlaps[matchingSegments[i]] = overlaps[i];
+  }
+}
+
+/**
+ * The connections with the deferred permanence changes applied. If there are
+ * any, they're copied into scratch, since const code can't materialize them.
+ */
+static const Connections& withDeferredPermanences(
+  const Connections& connections, const SynapseArrays* synapseArrays,
+  Connections& scratch)
+{
+  if (synapseArrays == nullptr || !synapseArrays->hasDeferredChanges())
+  {
+    return connections;
+  }
+
+  synapseArrays->copyTo(scratch);
+  return scratch;
+}
+
+/**
+ * Writes the segments and their ages. A frozen model's segments are copied
+ * out of its snapshot, which numbers them the way a thawed model would, so
+ * the other per-segment lists still line up. A copy with the deferred
+ * permanences numbers them differently, but it has the same segments in the
+ * same order, so the ages are written from the original.
+ */
+template <typename InitConnections, typename InitAges>
+static void writeConnections(
+  InitConnections initConnections,
+  InitAges initAges,
+  const Connections& connections,
+  const vector<UInt64>& lastUsedIterationForSegment,
+  const SynapseArrays* synapseArrays,
+  const FrozenConnections* frozen,
+  UInt64 iteration,
+  size_t maxListLength)
+{
+  Connections scratch;
+  const Connections* toWrite =
+    &withDeferredPermanences(connections, synapseArrays, scratch);
+
+  vector<UInt64> frozenLastUsedIterationForSegment;
+  const Connections* segments = &connections;
+  const vector<UInt64>* lastUsed = &lastUsedIterationForSegment;
+  if (frozen != nullptr)
+  {
+    frozen->materialize(scratch, frozenLastUsedIterationForSegment);
+    toWrite = &scratch;
+    segments = &scratch;
+    lastUsed = &frozenLastUsedIterationForSegment;
+  }
+
+  auto connectionsProto = initConnections();
+  toWrite->write(connectionsProto);
+
+  writeSegmentAges(initAges, *segments, *lastUsed, iteration, maxListLength);
+}
+
+void ApicalTiebreakTemporalMemory::write(ApicalTiebreakTemporalMemoryProto::Builder& proto) const
+{
+  writeState_(proto);
+
+  // Deferred permanence changes are part of the model. The basal segments
+  // are written before the apical ones are copied, if they need to be.
+  writeConnections(
+    [&]() { return proto.initBasalConnections(); },
+    [&](size_t n)
+    { return proto.initLastUsedIterationAgeForBasalSegment(n); },
+    basalConnections, lastUsedIterationForBasalSegment_, basalSynapseArrays_,
+    (snapshot_ != nullptr) ? &snapshot_->basal : nullptr,
+    iteration_, maxListLength);
+  writeConnections(
+    [&]() { return proto.initApicalConnections(); },
+    [&](size_t n)
+    { return proto.initLastUsedIterationAgeForApicalSegment(n); },
+    apicalConnections, lastUsedIterationForApicalSegment_,
+    apicalSynapseArrays_,
+    (snapshot_ != nullptr) ? &snapshot_->apical : nullptr,
+    iteration_, maxListLength);
+
+  // The segments are implied by their order, so there's one number per live
+  // segment rather than a (cell, idxOnCell, number) struct.
+  proto.setSerializationVersion(SERIALIZATION_VERSION);
+  writeMatchingOverlaps(
+    proto.initNumActivePotentialSynapsesForMatchingBasalSegment(
+      matchingBasalSegments_.size()),
+    matchingBasalSegments_, basalPotentialOverlaps_);
+  writeMatchingOverlaps(
+    proto.initNumActivePotentialSynapsesForMatchingApicalSegment(
+      matchingApicalSegments_.size()),
+    matchingApicalSegments_, apicalPotentialOverlaps_);
+}
+
+/**
+ * Writes the active and matching segments as (cell, idxOnCell) pairs.
+ */
+template <typename ConnectionsT>
+void ApicalTiebreakTemporalMemory::writeSegmentsState_(
+  ApicalTiebreakTemporalMemoryProto::Builder& proto,
+  const ConnectionsT& basal, const ConnectionsT& apical) const
+{
+  auto activeBasalSegments = proto.initActiveBasalSegments(
+    activeBasalSegments_.size());
+  for (UInt i = 0; i < activeBasalSegments_.size(); ++i)
+  {
+    activeBasalSegments[i].setCell(
+      basal.cellForSegment(activeBasalSegments_[i]));
+    activeBasalSegments[i].setIdxOnCell(
+      basal.idxOnCellForSegment(activeBasalSegments_[i]));
+  }
+
+  auto matchingBasalSegments = proto.initMatchingBasalSegments(
+    matchingBasalSegments_.size());
+  for (UInt i = 0; i < matchingBasalSegments_.size(); ++i)
+  {
+    matchingBasalSegments[i].setCell(
+      basal.cellForSegment(matchingBasalSegments_[i]));
+    matchingBasalSegments[i].setIdxOnCell(
+      basal.idxOnCellForSegment(matchingBasalSegments_[i]));
+  }
+
+  auto activeApicalSegments = proto.initActiveApicalSegments(
+    activeApicalSegments_.size());
+  for (UInt i = 0; i < activeApicalSegments_.size(); ++i)
+  {
+    activeApicalSegments[i].setCell(
+      apical.cellForSegment(activeApicalSegments_[i]));
+    activeApicalSegments[i].setIdxOnCell(
+      apical.idxOnCellForSegment(activeApicalSegments_[i]));
+  }
+
+  auto matchingApicalSegments = proto.initMatchingApicalSegments(
+    matchingApicalSegments_.size());
+  for (UInt i = 0; i < matchingApicalSegments_.size(); ++i)
+  {
+    matchingApicalSegments[i].setCell(
+      apical.cellForSegment(matchingApicalSegments_[i]));
+    matchingApicalSegments[i].setIdxOnCell(
+      apical.idxOnCellForSegment(matchingApicalSegments_[i]));
+  }
+}
+
+/**
+ * Writes the parameters and the per-step state: everything but the
+ * Connections and the per-segment lists.
+ */
+void ApicalTiebreakTemporalMemory::writeState_(
+  ApicalTiebreakTemporalMemoryProto::Builder& proto) const
+{
+  proto.setColumnCount(columnCount_);
+  proto.setBasalInputSize(basalInputSize_);
+  proto.setApicalInputSize(apicalInputSize_);
+  proto.setCellsPerColumn(cellsPerColumn_);
+  proto.setActivationThreshold(activationThreshold_);
+  proto.setInitialPermanence(initialPermanence_);
+  proto.setConnectedPermanence(connectedPermanence_);
+  proto.setMinThreshold(minThreshold_);
+  proto.setSampleSize(sampleSize_);
+  proto.setPermanenceIncrement(permanenceIncrement_);
+  proto.setPermanenceDecrement(permanenceDecrement_);
+  proto.setBasalPredictedSegmentDecrement(basalPredictedSegmentDecrement_);
+  proto.setApicalPredictedSegmentDecrement(apicalPredictedSegmentDecrement_);
+
+  proto.setMaxSegmentsPerCell(maxSegmentsPerCell_);
+  proto.setMaxSynapsesPerSegment(maxSynapsesPerSegment_);
+
+  auto random = proto.initRandom();
+  rng_.write(random);
+
+  auto activeCells = proto.initActiveCells(activeCells_.size());
+  UInt i = 0;
+  for (CellIdx cell : activeCells_)
+  {
+    activeCells.set(i++, cell);
+  }
+
+  auto predictedCells = proto.initPredictedActiveCells(predictedCells_.size());
+  i = 0;
+  for (CellIdx cell : predictedCells_)
+  {
+    predictedCells.set(i++, cell);
+  }
+
+  auto predictedActiveCells = proto.initPredictedActiveCells(predictedActiveCells_.size());
+  i = 0;
+  for (CellIdx cell : predictedActiveCells_)
+  {
+    predictedActiveCells.set(i++, cell);
+  }
+
+  auto winnerCells = proto.initWinnerCells(winnerCells_.size());
+  i = 0;
+  for (CellIdx cell : winnerCells_)
+  {
+    winnerCells.set(i++, cell);
+  }
+
+  // A frozen model's segments are in its snapshot.
+  if (snapshot_ != nullptr)
+  {
+    writeSegmentsState_(proto, snapshot_->basal, snapshot_->apical);
+  }
+  else
+  {
+    writeSegmentsState_(proto, basalConnections, apicalConnections);
+  }
+
+  proto.setIteration(iteration_);
+
+  proto.setLearnOnOneCell(learnOnOneCell_);
+  auto chosenCellsProto = proto.initChosenCellForColumn(chosenCellForColumn_.size());
+  UInt32 chosenIdx = 0;
+  for (auto pair : chosenCellForColumn_)
+  {
+    chosenCellsProto[chosenIdx].setColumnIdx(pair.first);
+    chosenCellsProto[chosenIdx].setCellIdx(pair.second);
+    ++chosenIdx;
+  }
+
+  writeSubclassState_(proto);
+}
+
+void ApicalTiebreakTemporalMemory::read(
+  ApicalTiebreakTemporalMemoryProto::Reader& proto)
+{
+  const UInt16 version = proto.getSerializationVersion();
+  NTA_CHECK(version <= SERIALIZATION_VERSION)
+    << "Unsupported serialization version " << version;
+
+  readParameters_(proto);
+  releaseSnapshot_();
+
+  // The deferred segments were for the old model.
+  learningBudget_->deferredSegments().clear();
+
+  // The synapse arrays and overlaps are rebuilt from scratch after a read.
+  bool incrementalOverlaps, lazyPermanences;
+  suspendIndexes_(incrementalOverlaps, lazyPermanences);
+  try
+  {
+    auto _basalConnections = proto.getBasalConnections();
+    basalConnections.read(_basalConnections);
+
+    auto _apicalConnections = proto.getApicalConnections();
+    apicalConnections.read(_apicalConnections);
+
+    basalOverlaps_.assign(
+      basalConnections.segmentFlatListLength(), 0);
+    apicalOverlaps_.assign(
+      apicalConnections.segmentFlatListLength(), 0);
+
+    readState_(proto);
+
+    basalPotentialOverlaps_.assign(basalConnections.segmentFlatListLength(), 0);
+    apicalPotentialOverlaps_.assign(apicalConnections.segmentFlatListLength(),
+                                    0);
+
+    if (version == 0)
+    {
+      readSegmentNumbers(basalPotentialOverlaps_,
+                         proto.getNumActivePotentialSynapsesForBasalSegment(),
+                         basalConnections);
+      for (auto chunk :
+             proto.getNumActivePotentialSynapsesForBasalSegmentChunks())
+      {
+        readSegmentNumbers(basalPotentialOverlaps_, chunk.getPairs(),
+                           basalConnections);
+      }
+
+      readSegmentNumbers(apicalPotentialOverlaps_,
+                         proto.getNumActivePotentialSynapsesForApicalSegment(),
+                         apicalConnections);
+      for (auto chunk :
+             proto.getNumActivePotentialSynapsesForApicalSegmentChunks())
+      {
+        readSegmentNumbers(apicalPotentialOverlaps_, chunk.getPairs(),
+                           apicalConnections);
+      }
+
+      lastUsedIterationForBasalSegment_.assign(
+        basalConnections.segmentFlatListLength(), 0);
+      readSegmentNumbers(lastUsedIterationForBasalSegment_,
+                         proto.getLastUsedIterationForBasalSegment(),
+                         basalConnections);
+      for (auto chunk : proto.getLastUsedIterationForBasalSegmentChunks())
+      {
+        readSegmentNumbers(lastUsedIterationForBasalSegment_, chunk.getPairs(),
+                           basalConnections);
+      }
+
+      lastUsedIterationForApicalSegment_.assign(
+        apicalConnections.segmentFlatListLength(), 0);
+      readSegmentNumbers(lastUsedIterationForApicalSegment_,
+                         proto.getLastUsedIterationForApicalSegment(),
+                         apicalConnections);
+      for (auto chunk : proto.getLastUsedIterationForApicalSegmentChunks())
+      {
+        readSegmentNumbers(lastUsedIterationForApicalSegment_, chunk.getPairs(),
+                           apicalConnections);
+      }
+    }
+    else
+    {
+      readMatchingOverlaps(
+        basalPotentialOverlaps_,
+        proto.getNumActivePotentialSynapsesForMatchingBasalSegment(),
+        matchingBasalSegments_);
+      readMatchingOverlaps(
+        apicalPotentialOverlaps_,
+        proto.getNumActivePotentialSynapsesForMatchingApicalSegment(),
+        matchingApicalSegments_);
+
+      readSegmentAges(lastUsedIterationForBasalSegment_,
+                      proto.getLastUsedIterationAgeForBasalSegment(),
+                      basalConnections, iteration_);
+      readSegmentAges(lastUsedIterationForApicalSegment_,
+                      proto.getLastUsedIterationAgeForApicalSegment(),
+                      apicalConnections, iteration_);
+    }
+  }
+  catch (...)
+  {
+    discardPartialRead_();
+    resumeIndexes_(incrementalOverlaps, lazyPermanences);
+    throw;
+  }
+
+  resumeIndexes_(incrementalOverlaps, lazyPermanences);
+
+  // A model read from a base checkpoint continues its chain.
+  clearDirtyCells_();
+  checkpointId_ = proto.getCheckpointId();
+  checkpointIteration_ = iteration_;
+  updateDirtyCellTracking_();
+}
+
+/**
+ * Leaves a model whose read failed partway consistent enough to compute and
+ * to read again: its per-step state is cleared, its per-segment arrays match
+ * its segments, and it no longer continues a checkpoint chain.
+ */
+void ApicalTiebreakTemporalMemory::discardPartialRead_()
+{
+  reset();
+  basalOverlaps_.assign(basalConnections.segmentFlatListLength(), 0);
+  apicalOverlaps_.assign(apicalConnections.segmentFlatListLength(), 0);
+  basalPotentialOverlaps_.assign(basalConnections.segmentFlatListLength(), 0);
+  apicalPotentialOverlaps_.assign(apicalConnections.segmentFlatListLength(),
+                                  0);
+  lastUsedIterationForBasalSegment_.resize(
+    basalConnections.segmentFlatListLength(), iteration_);
+  lastUsedIterationForApicalSegment_.resize(
+    apicalConnections.segmentFlatListLength(), iteration_);
+  checkpointId_ = 0;
+}
+
+void ApicalTiebreakTemporalMemory::readParameters_(
+  ApicalTiebreakTemporalMemoryProto::Reader& proto)
+{
+  columnCount_ = proto.getColumnCount();
+  basalInputSize_ = proto.getBasalInputSize();
+  apicalInputSize_ = proto.getApicalInputSize();
+  cellsPerColumn_ = proto.getCellsPerColumn();
+  activationThreshold_ = proto.getActivationThreshold();
+  initialPermanence_ = proto.getInitialPermanence();
+  connectedPermanence_ = proto.getConnectedPermanence();
+  minThreshold_ = proto.getMinThreshold();
+  sampleSize_ = proto.getSampleSize();
+  permanenceIncrement_ = proto.getPermanenceIncrement();
+  permanenceDecrement_ = proto.getPermanenceDecrement();
+  basalPredictedSegmentDecrement_ = proto.getBasalPredictedSegmentDecrement();
+  apicalPredictedSegmentDecrement_ = proto.getApicalPredictedSegmentDecrement();
+
+  maxSegmentsPerCell_ = proto.getMaxSegmentsPerCell();
+  maxSynapsesPerSegment_ = proto.getMaxSynapsesPerSegment();
+}
+
+/**
+ * Reads the state written by writeState_. The Connections must already be
+ * read, or the snapshot mapped, since the segments are found by cell.
+ */
+void ApicalTiebreakTemporalMemory::readState_(
+  ApicalTiebreakTemporalMemoryProto::Reader& proto)
+{
+  const auto getBasalSegment = [&](CellIdx cell, UInt32 idxOnCell)
+    {
+      return (snapshot_ != nullptr)
+        ? snapshot_->basal.getSegment(cell, idxOnCell)
+        : basalConnections.getSegment(cell, idxOnCell);
+    };
+  const auto getApicalSegment = [&](CellIdx cell, UInt32 idxOnCell)
+    {
+      return (snapshot_ != nullptr)
+        ? snapshot_->apical.getSegment(cell, idxOnCell)
+        : apicalConnections.getSegment(cell, idxOnCell);
+    };
+
+  auto random = proto.getRandom();
+  rng_.read(random);
+
+  activeCells_.clear();
+  for (auto cell : proto.getActiveCells())
+  {
+    activeCells_.push_back(cell);
+  }
+
+  predictedCells_.clear();
+  for (auto cell : proto.getPredictedCells())
+  {
+    predictedCells_.push_back(cell);
+  }
+
+  predictedActiveCells_.clear();
+  for (auto cell : proto.getPredictedActiveCells())
+  {
+    predictedActiveCells_.push_back(cell);
+  }
+
+  winnerCells_.clear();
+  for (auto cell : proto.getWinnerCells())
+  {
+    winnerCells_.push_back(cell);
+  }
+
+  activeBasalSegments_.clear();
+  for (auto value : proto.getActiveBasalSegments())
+  {
+    const Segment segment = getBasalSegment(value.getCell(),
+                                            value.getIdxOnCell());
+    activeBasalSegments_.push_back(segment);
+  }
+
+  matchingBasalSegments_.clear();
+  for (auto value : proto.getMatchingBasalSegments())
+  {
+    const Segment segment = getBasalSegment(value.getCell(),
+                                            value.getIdxOnCell());
+    matchingBasalSegments_.push_back(segment);
+  }
+
+  activeApicalSegments_.clear();
+  for (auto value : proto.getActiveApicalSegments())
+  {
+    const Segment segment = getApicalSegment(value.getCell(),
+                                             value.getIdxOnCell());
+    activeApicalSegments_.push_back(segment);
+  }
+
+  matchingApicalSegments_.clear();
+  for (auto value : proto.getMatchingApicalSegments())
+  {
+    const Segment segment = getApicalSegment(value.getCell(),
+                                             value.getIdxOnCell());
+    matchingApicalSegments_.push_back(segment);
+  }
+
+  iteration_ = proto.getIteration();
+
+  learnOnOneCell_ = proto.getLearnOnOneCell();
+  chosenCellForColumn_.clear();
+  for (auto chosenCellProto : proto.getChosenCellForColumn())
+  {
+    chosenCellForColumn_[chosenCellProto.getColumnIdx()] = chosenCellProto.getCellIdx();
+  }
+
+  readSubclassState_(proto);
+}
+
+void ApicalTiebreakTemporalMemory::writeSubclassState_(
+  ApicalTiebreakTemporalMemoryProto::Builder& proto) const
+{
+}
+
+void ApicalTiebreakTemporalMemory::readSubclassState_(
+  ApicalTiebreakTemporalMemoryProto::Reader& proto)
+{
+}
+
+//----------------------------------------------------------------------
+// Delta checkpoints
+//----------------------------------------------------------------------
+
+static UInt64 newCheckpointId()
+{
+  // Not from the model's rng, so checkpointing doesn't change the model.
+  std::random_device device;
+  UInt64 id = 0;
+  while (id == 0)
+  {
+    id = ((UInt64)device() << 32) | device();
+  }
+  return id;
+}
+
+template <typename Proto, typename Write>
+static void writeMessage(std::ostream& stream, Write write)
+{
+  capnp::MallocMessageBuilder message;
+  typename Proto::Builder proto = message.initRoot<Proto>();
+  write(proto);
+
+  kj::std::StdOutputStream out(stream);
+  capnp::writeMessage(out, message);
+}
+
+template <typename Proto, typename Read>
+static void readMessage(std::istream& stream, Read read)
+{
+  kj::std::StdInputStream in(stream);
+  capnp::ReaderOptions options;
+  options.traversalLimitInWords = kj::maxValue;
+  capnp::InputStreamMessageReader message(in, options);
+  typename Proto::Reader proto = message.getRoot<Proto>();
+  read(proto);
+}
+
+/**
+ * Writes all segments of each dirty cell, with their synapses and last used
+ * iterations.
+ */
+template <typename CellSegmentsList>
+static void writeDirtyCells(CellSegmentsList cellsProto,
+                            const Connections& connections,
+                            const vector<CellIdx>& cells,
+                            const vector<UInt64>& lastUsedIterationForSegment)
+{
+  for (size_t i = 0; i < cells.size(); i++)
+  {
+    const vector<Segment>& segments = connections.segmentsForCell(cells[i]);
+    cellsProto[i].setCell(cells[i]);
+    auto segmentsProto = cellsProto[i].initSegments(segments.size());
+    for (size_t j = 0; j < segments.size(); j++)
+    {
+      const Segment segment = segments[j];
+      segmentsProto[j].setLastUsedIteration(
+        (segment < lastUsedIterationForSegment.size())
+        ? lastUsedIterationForSegment[segment]
+        : 0);
+
+      const vector<Synapse>& synapses = connections.synapsesForSegment(segment);
+      auto synapsesProto = segmentsProto[j].initSynapses(synapses.size());
+      for (size_t k = 0; k < synapses.size(); k++)
+      {
+        const SynapseData& synapseData = connections.dataForSynapse(synapses[k]);
+        synapsesProto[k].setPresynapticCell(synapseData.presynapticCell);
+        synapsesProto[k].setPermanence(synapseData.permanence);
+      }
+    }
+  }
+}
+
+/**
+ * Writes the last used iterations of the segments on the clean cells that
+ * were used since the checkpoint. Learning only sets them to the current
+ * iteration, so these are the ones at or after the checkpoint's iteration.
+ */
+template <typename InitList, typename InitChunks>
+static void writeUsedSegments(
+  InitList initList,
+  InitChunks initChunks,
+  const Connections& connections,
+  const DirtyCells& dirtyCells,
+  const vector<UInt64>& lastUsedIterationForSegment,
+  UInt64 checkpointIteration)
+{
+  const auto used = [&](CellIdx cell, Segment segment)
+    {
+      return (!dirtyCells.isDirty(cell) &&
+              segment < lastUsedIterationForSegment.size() &&
+              lastUsedIterationForSegment[segment] >= checkpointIteration);
+    };
+
+  size_t numUsed = 0;
+  for (CellIdx cell = 0; cell < connections.numCells(); cell++)
+  {
+    for (Segment segment : connections.segmentsForCell(cell))
+    {
+      if (used(cell, segment))
+      {
+        numUsed++;
+      }
+    }
+  }
+
+  writeSegmentNumbers(initList, initChunks, connections,
+                      lastUsedIterationForSegment, numUsed, used,
+                      maxListLength);
+}
+
+/**
+ * Replaces the segments of each cell in the delta.
+ */
+template <typename CellSegmentsList>
+static void replayDirtyCells(Connections& connections,
+                             vector<UInt64>& lastUsedIterationForSegment,
+                             CellSegmentsList cellsProto)
+{
+  for (auto cellProto : cellsProto)
+  {
+    const CellIdx cell = cellProto.getCell();
+    NTA_CHECK(cell < connections.numCells()) << "Invalid cell " << cell;
+
+    // Copy the list, since destroying the segments changes it.
+    const vector<Segment> oldSegments = connections.segmentsForCell(cell);
+    for (Segment segment : oldSegments)
+    {
+      connections.destroySegment(segment);
+    }
+
+    for (auto segmentProto : cellProto.getSegments())
+    {
+      const Segment segment = connections.createSegment(cell);
+      for (auto synapseProto : segmentProto.getSynapses())
+      {
+        connections.createSynapse(segment, synapseProto.getPresynapticCell(),
+                                  synapseProto.getPermanence());
+      }
+
+      if (segment >= lastUsedIterationForSegment.size())
+      {
+        lastUsedIterationForSegment.resize(
+          connections.segmentFlatListLength(), 0);
+      }
+      lastUsedIterationForSegment[segment] =
+        segmentProto.getLastUsedIteration();
+    }
+  }
+}
+
+/**
+ * Checks that a checkpoint reached the stream before it's committed, so a
+ * failed write leaves the next delta relative to the last one written.
+ */
+static void checkWritten(std::ostream& stream)
+{
+  stream.flush();
+  NTA_CHECK(stream.good()) << "Failed to write the checkpoint";
+}
+
+void ApicalTiebreakTemporalMemory::writeBaseCheckpoint(
+  ApicalTiebreakTemporalMemoryProto::Builder& proto)
+{
+  const UInt64 checkpointId = newCheckpointId();
+  writeBaseCheckpoint_(proto, checkpointId);
+  commitCheckpoint_(checkpointId);
+}
+
+void ApicalTiebreakTemporalMemory::writeBaseCheckpoint(std::ostream& stream)
+{
+  const UInt64 checkpointId = newCheckpointId();
+  writeMessage<ApicalTiebreakTemporalMemoryProto>(
+    stream,
+    [&](ApicalTiebreakTemporalMemoryProto::Builder& proto)
+    {
+      writeBaseCheckpoint_(proto, checkpointId);
+    });
+  checkWritten(stream);
+  commitCheckpoint_(checkpointId);
+}
 
-  auto _basalConnections = proto.initBasalConnections();
-  basalConnections.write(_basalConnections);
+void ApicalTiebreakTemporalMemory::writeBaseCheckpoint_(
+  ApicalTiebreakTemporalMemoryProto::Builder& proto, UInt64 checkpointId)
+{
+  thaw();
+  // The next delta starts from the materialized permanences.
+  materializePermanences();
+  write(proto);
+  proto.setCheckpointId(checkpointId);
+}
 
-  auto _apicalConnections = proto.initApicalConnections();
-  apicalConnections.write(_apicalConnections);
+void ApicalTiebreakTemporalMemory::writeDeltaCheckpoint(
+  ApicalTiebreakTemporalMemoryDeltaProto::Builder& proto)
+{
+  const UInt64 checkpointId = newCheckpointId();
+  writeDeltaCheckpoint_(proto, checkpointId);
+  commitCheckpoint_(checkpointId);
+}
 
-  auto random = proto.initRandom();
-  rng_.write(random);
+void ApicalTiebreakTemporalMemory::writeDeltaCheckpoint(std::ostream& stream)
+{
+  const UInt64 checkpointId = newCheckpointId();
+  writeMessage<ApicalTiebreakTemporalMemoryDeltaProto>(
+    stream,
+    [&](ApicalTiebreakTemporalMemoryDeltaProto::Builder& proto)
+    {
+      writeDeltaCheckpoint_(proto, checkpointId);
+    });
+  checkWritten(stream);
+  commitCheckpoint_(checkpointId);
+}
 
-  auto activeCells = proto.initActiveCells(activeCells_.size());
-  UInt i = 0;
-  for (CellIdx cell : activeCells_)
-  {
-    activeCells.set(i++, cell);
-  }
+void ApicalTiebreakTemporalMemory::writeDeltaCheckpoint_(
+  ApicalTiebreakTemporalMemoryDeltaProto::Builder& proto, UInt64 checkpointId)
+{
+  NTA_CHECK(checkpointId_ != 0)
+    << "There's no checkpoint to write a delta of. Write a base checkpoint "
+    << "first.";
+
+  // Writing the deferred permanence changes marks their cells.
+  materializePermanences();
+
+  proto.setPreviousCheckpointId(checkpointId_);
+  proto.setCheckpointId(checkpointId);
+
+  const vector<CellIdx>& basalCells = basalDirtyCells_->cells();
+  writeDirtyCells(proto.initBasalCells(basalCells.size()), basalConnections,
+                  basalCells, lastUsedIterationForBasalSegment_);
+  const vector<CellIdx>& apicalCells = apicalDirtyCells_->cells();
+  writeDirtyCells(proto.initApicalCells(apicalCells.size()),
+                  apicalConnections, apicalCells,
+                  lastUsedIterationForApicalSegment_);
+
+  writeUsedSegments(
+    [&](size_t n)
+    { return proto.initLastUsedIterationForBasalSegment(n); },
+    [&](size_t n)
+    { return proto.initLastUsedIterationForBasalSegmentChunks(n); },
+    basalConnections, *basalDirtyCells_, lastUsedIterationForBasalSegment_,
+    checkpointIteration_);
+  writeUsedSegments(
+    [&](size_t n)
+    { return proto.initLastUsedIterationForApicalSegment(n); },
+    [&](size_t n)
+    { return proto.initLastUsedIterationForApicalSegmentChunks(n); },
+    apicalConnections, *apicalDirtyCells_, lastUsedIterationForApicalSegment_,
+    checkpointIteration_);
+
+  auto state = proto.initState();
+  writeState_(state);
+  state.setSerializationVersion(SERIALIZATION_VERSION);
+  writeMatchingOverlaps(
+    state.initNumActivePotentialSynapsesForMatchingBasalSegment(
+      matchingBasalSegments_.size()),
+    matchingBasalSegments_, basalPotentialOverlaps_);
+  writeMatchingOverlaps(
+    state.initNumActivePotentialSynapsesForMatchingApicalSegment(
+      matchingApicalSegments_.size()),
+    matchingApicalSegments_, apicalPotentialOverlaps_);
+}
 
-  auto predictedCells = proto.initPredictedActiveCells(predictedCells_.size());
-  i = 0;
-  for (CellIdx cell : predictedCells_)
-  {
-    predictedCells.set(i++, cell);
-  }
+/**
+ * Makes a written checkpoint the one that the next delta is relative to.
+ */
+void ApicalTiebreakTemporalMemory::commitCheckpoint_(UInt64 checkpointId)
+{
+  checkpointId_ = checkpointId;
+  checkpointIteration_ = iteration_;
+  clearDirtyCells_();
+  updateDirtyCellTracking_();
+}
 
-  auto predictedActiveCells = proto.initPredictedActiveCells(predictedActiveCells_.size());
-  i = 0;
-  for (CellIdx cell : predictedActiveCells_)
+/**
+ * Applies a delta while the indexes are unsubscribed. The per-segment arrays
+ * are resized, and the indexes are rebuilt when they're resubscribed.
+ */
+void ApicalTiebreakTemporalMemory::applyDeltaCheckpoint_(
+  ApicalTiebreakTemporalMemoryDeltaProto::Reader& proto)
+{
+  NTA_CHECK(checkpointId_ != 0 &&
+            proto.getPreviousCheckpointId() == checkpointId_)
+    << "The delta was written after checkpoint "
+    << proto.getPreviousCheckpointId() << ", but this model is at checkpoint "
+    << checkpointId_;
+
+  auto state = proto.getState();
+  const UInt16 version = state.getSerializationVersion();
+  NTA_CHECK(version <= SERIALIZATION_VERSION)
+    << "Unsupported serialization version " << version;
+
+  readParameters_(state);
+  learningBudget_->deferredSegments().clear();
+
+  replayDirtyCells(basalConnections, lastUsedIterationForBasalSegment_,
+                   proto.getBasalCells());
+  replayDirtyCells(apicalConnections, lastUsedIterationForApicalSegment_,
+                   proto.getApicalCells());
+
+  lastUsedIterationForBasalSegment_.resize(
+    basalConnections.segmentFlatListLength(), 0);
+  readSegmentNumbers(lastUsedIterationForBasalSegment_,
+                     proto.getLastUsedIterationForBasalSegment(),
+                     basalConnections);
+  for (auto chunk : proto.getLastUsedIterationForBasalSegmentChunks())
   {
-    predictedActiveCells.set(i++, cell);
+    readSegmentNumbers(lastUsedIterationForBasalSegment_, chunk.getPairs(),
+                       basalConnections);
   }
 
-  auto winnerCells = proto.initWinnerCells(winnerCells_.size());
-  i = 0;
-  for (CellIdx cell : winnerCells_)
+  lastUsedIterationForApicalSegment_.resize(
+    apicalConnections.segmentFlatListLength(), 0);
+  readSegmentNumbers(lastUsedIterationForApicalSegment_,
+                     proto.getLastUsedIterationForApicalSegment(),
+                     apicalConnections);
+  for (auto chunk : proto.getLastUsedIterationForApicalSegmentChunks())
   {
-    winnerCells.set(i++, cell);
+    readSegmentNumbers(lastUsedIterationForApicalSegment_, chunk.getPairs(),
+                       apicalConnections);
   }
 
+  readState_(state);
 
-  auto activeBasalSegments = proto.initActiveBasalSegments(
-    activeBasalSegments_.size());
-  for (UInt i = 0; i < activeBasalSegments_.size(); ++i)
+  basalOverlaps_.assign(basalConnections.segmentFlatListLength(), 0);
+  basalPotentialOverlaps_.assign(basalConnections.segmentFlatListLength(), 0);
+  apicalOverlaps_.assign(apicalConnections.segmentFlatListLength(), 0);
+  apicalPotentialOverlaps_.assign(apicalConnections.segmentFlatListLength(),
+                                  0);
+  if (version == 0)
   {
-    activeBasalSegments[i].setCell(
-      basalConnections.cellForSegment(activeBasalSegments_[i]));
-    activeBasalSegments[i].setIdxOnCell(
-      basalConnections.idxOnCellForSegment(activeBasalSegments_[i]));
+    readSegmentNumbers(basalPotentialOverlaps_,
+                       state.getNumActivePotentialSynapsesForBasalSegment(),
+                       basalConnections);
+    readSegmentNumbers(apicalPotentialOverlaps_,
+                       state.getNumActivePotentialSynapsesForApicalSegment(),
+                       apicalConnections);
   }
-
-  auto matchingBasalSegments = proto.initMatchingBasalSegments(
-    matchingBasalSegments_.size());
-  for (UInt i = 0; i < matchingBasalSegments_.size(); ++i)
+  else
   {
-    matchingBasalSegments[i].setCell(
-      basalConnections.cellForSegment(matchingBasalSegments_[i]));
-    matchingBasalSegments[i].setIdxOnCell(
-      basalConnections.idxOnCellForSegment(matchingBasalSegments_[i]));
+    readMatchingOverlaps(
+      basalPotentialOverlaps_,
+      state.getNumActivePotentialSynapsesForMatchingBasalSegment(),
+      matchingBasalSegments_);
+    readMatchingOverlaps(
+      apicalPotentialOverlaps_,
+      state.getNumActivePotentialSynapsesForMatchingApicalSegment(),
+      matchingApicalSegments_);
   }
 
-  auto activeApicalSegments = proto.initActiveApicalSegments(
-    activeApicalSegments_.size());
-  for (UInt i = 0; i < activeApicalSegments_.size(); ++i)
-  {
-    activeApicalSegments[i].setCell(
-      apicalConnections.cellForSegment(activeApicalSegments_[i]));
-    activeApicalSegments[i].setIdxOnCell(
-      apicalConnections.idxOnCellForSegment(activeApicalSegments_[i]));
-  }
+  checkpointId_ = proto.getCheckpointId();
+  checkpointIteration_ = iteration_;
+}
 
-  auto matchingApicalSegments = proto.initMatchingApicalSegments(
-    matchingApicalSegments_.size());
-  for (UInt i = 0; i < matchingApicalSegments_.size(); ++i)
-  {
-    matchingApicalSegments[i].setCell(
-      apicalConnections.cellForSegment(matchingApicalSegments_[i]));
-    matchingApicalSegments[i].setIdxOnCell(
-      apicalConnections.idxOnCellForSegment(matchingApicalSegments_[i]));
-  }
+void ApicalTiebreakTemporalMemory::readDeltaCheckpoint(
+  ApicalTiebreakTemporalMemoryDeltaProto::Reader& proto)
+{
+  materializePermanences();
+  NTA_CHECK(getNumDirtyCells() == 0 && iteration_ == checkpointIteration_)
+    << "The model changed since its checkpoint";
 
-  auto basalPotentialOverlaps =
-    proto.initNumActivePotentialSynapsesForBasalSegment(
-      basalPotentialOverlaps_.size());
-  for (Segment segment = 0;
-       segment < basalPotentialOverlaps_.size();
-       segment++)
+  bool incrementalOverlaps, lazyPermanences;
+  suspendIndexes_(incrementalOverlaps, lazyPermanences);
+  try
   {
-    basalPotentialOverlaps[segment].setCell(
-      basalConnections.cellForSegment(segment));
-    basalPotentialOverlaps[segment].setIdxOnCell(
-      basalConnections.idxOnCellForSegment(segment));
-    basalPotentialOverlaps[segment].setNumber(
-      basalPotentialOverlaps_[segment]);
+    applyDeltaCheckpoint_(proto);
   }
-
-  auto apicalPotentialOverlaps =
-    proto.initNumActivePotentialSynapsesForApicalSegment(
-      apicalPotentialOverlaps_.size());
-  for (Segment segment = 0;
-       segment < apicalPotentialOverlaps_.size();
-       segment++)
+  catch (...)
   {
-    apicalPotentialOverlaps[segment].setCell(
-      apicalConnections.cellForSegment(segment));
-    apicalPotentialOverlaps[segment].setIdxOnCell(
-      apicalConnections.idxOnCellForSegment(segment));
-    apicalPotentialOverlaps[segment].setNumber(
-      apicalPotentialOverlaps_[segment]);
+    resumeIndexes_(incrementalOverlaps, lazyPermanences);
+    throw;
   }
+  resumeIndexes_(incrementalOverlaps, lazyPermanences);
+}
 
+void ApicalTiebreakTemporalMemory::readDeltaCheckpoint(std::istream& stream)
+{
+  readMessage<ApicalTiebreakTemporalMemoryDeltaProto>(
+    stream,
+    [&](ApicalTiebreakTemporalMemoryDeltaProto::Reader& proto)
+    {
+      readDeltaCheckpoint(proto);
+    });
+}
 
-  proto.setIteration(iteration_);
+void ApicalTiebreakTemporalMemory::loadCheckpoints(
+  const std::string& basePath,
+  const std::vector<std::string>& deltaPaths)
+{
+  std::ifstream base(basePath, std::ios::binary);
+  NTA_CHECK(base.good()) << "Couldn't open " << basePath;
+  readMessage<ApicalTiebreakTemporalMemoryProto>(
+    base,
+    [&](ApicalTiebreakTemporalMemoryProto::Reader& proto)
+    {
+      read(proto);
+    });
+  NTA_CHECK(checkpointId_ != 0) << basePath << " isn't a base checkpoint";
 
-  auto lastUsedIterationForBasalSegment =
-    proto.initLastUsedIterationForBasalSegment(lastUsedIterationForBasalSegment_.size());
-  for (Segment segment = 0;
-       segment < lastUsedIterationForBasalSegment_.size();
-       ++segment)
+  bool incrementalOverlaps, lazyPermanences;
+  suspendIndexes_(incrementalOverlaps, lazyPermanences);
+  try
   {
-    lastUsedIterationForBasalSegment[segment].setCell(
-      basalConnections.cellForSegment(segment));
-    lastUsedIterationForBasalSegment[segment].setIdxOnCell(
-      basalConnections.idxOnCellForSegment(segment));
-    lastUsedIterationForBasalSegment[segment].setNumber(
-      lastUsedIterationForBasalSegment_[segment]);
+    for (const std::string& deltaPath : deltaPaths)
+    {
+      std::ifstream delta(deltaPath, std::ios::binary);
+      NTA_CHECK(delta.good()) << "Couldn't open " << deltaPath;
+      readMessage<ApicalTiebreakTemporalMemoryDeltaProto>(
+        delta,
+        [&](ApicalTiebreakTemporalMemoryDeltaProto::Reader& proto)
+        {
+          applyDeltaCheckpoint_(proto);
+        });
+    }
   }
-
-  auto lastUsedIterationForApicalSegment =
-    proto.initLastUsedIterationForApicalSegment(lastUsedIterationForApicalSegment_.size());
-  for (Segment segment = 0;
-       segment < lastUsedIterationForApicalSegment_.size();
-       ++segment)
+  catch (...)
   {
-    lastUsedIterationForApicalSegment[segment].setCell(
-      apicalConnections.cellForSegment(segment));
-    lastUsedIterationForApicalSegment[segment].setIdxOnCell(
-      apicalConnections.idxOnCellForSegment(segment));
-    lastUsedIterationForApicalSegment[segment].setNumber(
-      lastUsedIterationForApicalSegment_[segment]);
+    resumeIndexes_(incrementalOverlaps, lazyPermanences);
+    throw;
   }
+  resumeIndexes_(incrementalOverlaps, lazyPermanences);
+}
 
-  proto.setLearnOnOneCell(learnOnOneCell_);
-  auto chosenCellsProto = proto.initChosenCellForColumn(chosenCellForColumn_.size());
-  UInt32 chosenIdx = 0;
-  for (auto pair : chosenCellForColumn_)
-  {
-    chosenCellsProto[chosenIdx].setColumnIdx(pair.first);
-    chosenCellsProto[chosenIdx].setCellIdx(pair.second);
-    ++chosenIdx;
-  }
+void ApicalTiebreakTemporalMemory::compactCheckpoints(
+  const std::string& basePath,
+  const std::vector<std::string>& deltaPaths,
+  const std::string& outPath)
+{
+  ApicalTiebreakTemporalMemory tm;
+  tm.loadCheckpoints(basePath, deltaPaths);
+
+  std::ofstream out(outPath, std::ios::binary);
+  NTA_CHECK(out.good()) << "Couldn't open " << outPath;
+  writeMessage<ApicalTiebreakTemporalMemoryProto>(
+    out,
+    [&](ApicalTiebreakTemporalMemoryProto::Builder& proto)
+    {
+      tm.write(proto);
+      proto.setCheckpointId(tm.checkpointId_);
+    });
 }
 
-void ApicalTiebreakTemporalMemory::read(
-  ApicalTiebreakTemporalMemoryProto::Reader& proto)
+UInt64 ApicalTiebreakTemporalMemory::getCheckpointId() const
 {
-  columnCount_ = proto.getColumnCount();
-  basalInputSize_ = proto.getBasalInputSize();
-  apicalInputSize_ = proto.getApicalInputSize();
-  cellsPerColumn_ = proto.getCellsPerColumn();
-  activationThreshold_ = proto.getActivationThreshold();
-  initialPermanence_ = proto.getInitialPermanence();
-  connectedPermanence_ = proto.getConnectedPermanence();
-  minThreshold_ = proto.getMinThreshold();
-  sampleSize_ = proto.getSampleSize();
-  permanenceIncrement_ = proto.getPermanenceIncrement();
-  permanenceDecrement_ = proto.getPermanenceDecrement();
-  basalPredictedSegmentDecrement_ = proto.getBasalPredictedSegmentDecrement();
-  apicalPredictedSegmentDecrement_ = proto.getApicalPredictedSegmentDecrement();
+  return checkpointId_;
+}
 
-  maxSegmentsPerCell_ = proto.getMaxSegmentsPerCell();
-  maxSynapsesPerSegment_ = proto.getMaxSynapsesPerSegment();
+size_t ApicalTiebreakTemporalMemory::getNumDirtyCells() const
+{
+  return basalDirtyCells_->size() + apicalDirtyCells_->size();
+}
 
-  auto _basalConnections = proto.getBasalConnections();
-  basalConnections.read(_basalConnections);
+void ApicalTiebreakTemporalMemory::clearDirtyCells_()
+{
+  basalDirtyCells_->clear();
+  apicalDirtyCells_->clear();
+}
 
-  auto _apicalConnections = proto.getApicalConnections();
-  apicalConnections.read(_apicalConnections);
+//----------------------------------------------------------------------
+// Snapshots
+//----------------------------------------------------------------------
 
-  basalOverlaps_.assign(
-    basalConnections.segmentFlatListLength(), 0);
-  basalPotentialOverlaps_.assign(
-    basalConnections.segmentFlatListLength(), 0);
+/**
+ * Appends the values as an 8-byte aligned array.
+ */
+template <typename T>
+static void writeSnapshotArray(std::ostream& out, SnapshotArray& array,
+                               const T* values, size_t length)
+{
+  static const char padding[8] = {};
+  const UInt64 offset = (UInt64)out.tellp();
+  out.write(padding, (8 - offset % 8) % 8);
 
-  apicalOverlaps_.assign(
-    apicalConnections.segmentFlatListLength(), 0);
-  apicalPotentialOverlaps_.assign(
-    apicalConnections.segmentFlatListLength(), 0);
+  array.offset = (UInt64)out.tellp();
+  array.length = length;
+  out.write(reinterpret_cast<const char*>(values), length * sizeof(T));
+}
 
-  auto random = proto.getRandom();
-  rng_.read(random);
+template <typename T>
+static void writeSnapshotArray(std::ostream& out, SnapshotArray& array,
+                               const vector<T>& values)
+{
+  writeSnapshotArray(out, array, values.data(), values.size());
+}
 
-  activeCells_.clear();
-  for (auto cell : proto.getActiveCells())
+/**
+ * Writes the live segments in cell order, and an index of their synapses by
+ * presynaptic cell.
+ */
+static void writeSnapshotConnections(
+  std::ostream& out,
+  SnapshotConnections& header,
+  const Connections& connections,
+  UInt inputSize,
+  const vector<UInt32>& potentialOverlaps,
+  const vector<UInt64>& lastUsedIterationForSegment)
+{
+  vector<UInt32> segmentOffsetForCell;
+  vector<CellIdx> cellForSegment;
+  vector<UInt64> lastUsedIterations;
+  vector<UInt32> segmentPotentialOverlaps;
+  vector<UInt64> synapseOffsetForSegment;
+  vector<CellIdx> presynapticCells;
+  vector<Permanence> permanences;
+
+  segmentOffsetForCell.reserve(connections.numCells() + 1);
+  for (CellIdx cell = 0; cell < connections.numCells(); cell++)
   {
-    activeCells_.push_back(cell);
+    segmentOffsetForCell.push_back((UInt32)cellForSegment.size());
+    for (Segment segment : connections.segmentsForCell(cell))
+    {
+      cellForSegment.push_back(cell);
+      lastUsedIterations.push_back(
+        segment < lastUsedIterationForSegment.size()
+        ? lastUsedIterationForSegment[segment]
+        : 0);
+      segmentPotentialOverlaps.push_back(
+        segment < potentialOverlaps.size() ? potentialOverlaps[segment] : 0);
+
+      synapseOffsetForSegment.push_back(presynapticCells.size());
+      for (Synapse synapse : connections.synapsesForSegment(segment))
+      {
+        const SynapseData& synapseData = connections.dataForSynapse(synapse);
+        presynapticCells.push_back(synapseData.presynapticCell);
+        permanences.push_back(synapseData.permanence);
+      }
+    }
   }
+  segmentOffsetForCell.push_back((UInt32)cellForSegment.size());
+  synapseOffsetForSegment.push_back(presynapticCells.size());
 
-  predictedCells_.clear();
-  for (auto cell : proto.getPredictedCells())
+  // Counting sort the synapses by presynaptic cell, keeping segment order.
+  UInt64 numPresynapticCells = inputSize;
+  for (CellIdx presynapticCell : presynapticCells)
   {
-    predictedCells_.push_back(cell);
+    numPresynapticCells = std::max(numPresynapticCells,
+                                   (UInt64)presynapticCell + 1);
   }
-
-  predictedActiveCells_.clear();
-  for (auto cell : proto.getPredictedActiveCells())
+  vector<UInt64> synapseOffsetForPresynapticCell(numPresynapticCells + 1, 0);
+  for (CellIdx presynapticCell : presynapticCells)
   {
-    predictedActiveCells_.push_back(cell);
+    synapseOffsetForPresynapticCell[presynapticCell + 1]++;
   }
-
-  winnerCells_.clear();
-  for (auto cell : proto.getWinnerCells())
+  for (UInt64 cell = 0; cell < numPresynapticCells; cell++)
   {
-    winnerCells_.push_back(cell);
+    synapseOffsetForPresynapticCell[cell + 1] +=
+      synapseOffsetForPresynapticCell[cell];
   }
 
-  activeBasalSegments_.clear();
-  for (auto value : proto.getActiveBasalSegments())
+  vector<Segment> segmentForPresynapticSynapse(presynapticCells.size());
+  vector<Permanence> permanenceForPresynapticSynapse(presynapticCells.size());
+  vector<UInt64> next(synapseOffsetForPresynapticCell.begin(),
+                      synapseOffsetForPresynapticCell.end() - 1);
+  for (Segment segment = 0; segment < cellForSegment.size(); segment++)
   {
-    const Segment segment = basalConnections.getSegment(value.getCell(),
-                                                        value.getIdxOnCell());
-    activeBasalSegments_.push_back(segment);
+    for (UInt64 i = synapseOffsetForSegment[segment];
+         i < synapseOffsetForSegment[segment + 1];
+         i++)
+    {
+      const UInt64 position = next[presynapticCells[i]]++;
+      segmentForPresynapticSynapse[position] = segment;
+      permanenceForPresynapticSynapse[position] = permanences[i];
+    }
   }
 
-  matchingBasalSegments_.clear();
-  for (auto value : proto.getMatchingBasalSegments())
-  {
-    const Segment segment = basalConnections.getSegment(value.getCell(),
-                                                        value.getIdxOnCell());
-    matchingBasalSegments_.push_back(segment);
-  }
+  header.numCells = connections.numCells();
+  header.numSegments = cellForSegment.size();
+  header.numSynapses = presynapticCells.size();
+  header.numPresynapticCells = numPresynapticCells;
+  writeSnapshotArray(out, header.segmentOffsetForCell, segmentOffsetForCell);
+  writeSnapshotArray(out, header.cellForSegment, cellForSegment);
+  writeSnapshotArray(out, header.lastUsedIterationForSegment,
+                     lastUsedIterations);
+  writeSnapshotArray(out, header.potentialOverlapForSegment,
+                     segmentPotentialOverlaps);
+  writeSnapshotArray(out, header.synapseOffsetForSegment,
+                     synapseOffsetForSegment);
+  writeSnapshotArray(out, header.presynapticCells, presynapticCells);
+  writeSnapshotArray(out, header.permanences, permanences);
+  writeSnapshotArray(out, header.synapseOffsetForPresynapticCell,
+                     synapseOffsetForPresynapticCell);
+  writeSnapshotArray(out, header.segmentForPresynapticSynapse,
+                     segmentForPresynapticSynapse);
+  writeSnapshotArray(out, header.permanenceForPresynapticSynapse,
+                     permanenceForPresynapticSynapse);
+}
 
-  activeApicalSegments_.clear();
-  for (auto value : proto.getActiveApicalSegments())
-  {
-    const Segment segment = apicalConnections.getSegment(value.getCell(),
-                                                         value.getIdxOnCell());
-    activeApicalSegments_.push_back(segment);
-  }
+void ApicalTiebreakTemporalMemory::writeSnapshot(const std::string& path)
+{
+  thaw();
+  materializePermanences();
 
-  matchingApicalSegments_.clear();
-  for (auto value : proto.getMatchingApicalSegments())
-  {
-    const Segment segment = apicalConnections.getSegment(value.getCell(),
-                                                         value.getIdxOnCell());
-    matchingApicalSegments_.push_back(segment);
-  }
+  std::ostringstream state;
+  writeMessage<ApicalTiebreakTemporalMemoryProto>(
+    state,
+    [&](ApicalTiebreakTemporalMemoryProto::Builder& proto)
+    {
+      writeState_(proto);
+    });
+  const string stateBytes = state.str();
+
+  std::ofstream out(path, std::ios::binary);
+  NTA_CHECK(out.good()) << "Couldn't open " << path;
+
+  // The header is rewritten once the arrays' offsets are known.
+  SnapshotHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+  header.version = SNAPSHOT_VERSION;
+  header.byteOrder = SNAPSHOT_BYTE_ORDER;
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  writeSnapshotArray(out, header.state, stateBytes.data(), stateBytes.size());
+  writeSnapshotConnections(out, header.basal, basalConnections,
+                           basalInputSize_, basalPotentialOverlaps_,
+                           lastUsedIterationForBasalSegment_);
+  writeSnapshotConnections(out, header.apical, apicalConnections,
+                           apicalInputSize_, apicalPotentialOverlaps_,
+                           lastUsedIterationForApicalSegment_);
+
+  out.seekp(0);
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  NTA_CHECK(out.good()) << "Couldn't write " << path;
+}
+
+void ApicalTiebreakTemporalMemory::loadSnapshot(const std::string& path)
+{
+  std::unique_ptr<MappedSnapshot> snapshot(new MappedSnapshot(path));
+
+  const SnapshotArray& stateArray = snapshot->header.state;
+  const char* stateBytes = snapshotArray<char>(snapshot->file, stateArray,
+                                               stateArray.length);
+  std::istringstream state(string(stateBytes, stateArray.length));
 
-  basalPotentialOverlaps_.clear();
-  basalPotentialOverlaps_.resize(
-    basalConnections.segmentFlatListLength());
-  for (auto segmentNumPair : proto.getNumActivePotentialSynapsesForBasalSegment())
+  bool incrementalOverlaps, lazyPermanences;
+  bool suspended = false;
+  try
   {
-    const Segment segment = basalConnections.getSegment(
-      segmentNumPair.getCell(), segmentNumPair.getIdxOnCell());
-    basalPotentialOverlaps_[segment] = segmentNumPair.getNumber();
+    readMessage<ApicalTiebreakTemporalMemoryProto>(
+      state,
+      [&](ApicalTiebreakTemporalMemoryProto::Reader& proto)
+      {
+        const UInt64 numCells =
+          (UInt64)proto.getColumnCount() * proto.getCellsPerColumn();
+        NTA_CHECK(snapshot->basal.numCells() == numCells &&
+                  snapshot->apical.numCells() == numCells)
+          << "The snapshot is corrupt";
+
+        readParameters_(proto);
+
+        // The deferred segments were for the old model.
+        learningBudget_->deferredSegments().clear();
+
+        // The indexes are left empty until the model is thawed.
+        suspendIndexes_(incrementalOverlaps, lazyPermanences);
+        suspended = true;
+        releaseSnapshot_();
+        basalConnections = Connections(numberOfCells());
+        apicalConnections = Connections(numberOfCells());
+        snapshot_ = snapshot.release();
+
+        readState_(proto);
+      });
   }
-
-  apicalPotentialOverlaps_.clear();
-  apicalPotentialOverlaps_.resize(
-    apicalConnections.segmentFlatListLength());
-  for (auto segmentNumPair : proto.getNumActivePotentialSynapsesForApicalSegment())
+  catch (...)
   {
-    const Segment segment = apicalConnections.getSegment(
-      segmentNumPair.getCell(), segmentNumPair.getIdxOnCell());
-    apicalPotentialOverlaps_[segment] = segmentNumPair.getNumber();
+    if (suspended)
+    {
+      releaseSnapshot_();
+      discardPartialRead_();
+      resumeIndexes_(incrementalOverlaps, lazyPermanences);
+    }
+    throw;
   }
 
-  iteration_ = proto.getIteration();
+  const FrozenConnections& basal = snapshot_->basal;
+  const FrozenConnections& apical = snapshot_->apical;
+  basalOverlaps_.assign(basal.segmentFlatListLength(), 0);
+  apicalOverlaps_.assign(apical.segmentFlatListLength(), 0);
+  basalPotentialOverlaps_.assign(
+    basal.potentialOverlaps(),
+    basal.potentialOverlaps() + basal.segmentFlatListLength());
+  apicalPotentialOverlaps_.assign(
+    apical.potentialOverlaps(),
+    apical.potentialOverlaps() + apical.segmentFlatListLength());
 
+  // Only learning uses these, so they're copied when the model is thawed.
   lastUsedIterationForBasalSegment_.clear();
-  lastUsedIterationForBasalSegment_.resize(basalConnections.segmentFlatListLength());
-  for (auto segmentIterationPair : proto.getLastUsedIterationForBasalSegment())
-  {
-    const Segment segment = basalConnections.getSegment(
-      segmentIterationPair.getCell(), segmentIterationPair.getIdxOnCell());
-    lastUsedIterationForBasalSegment_[segment] = segmentIterationPair.getNumber();
-  }
-
   lastUsedIterationForApicalSegment_.clear();
-  lastUsedIterationForApicalSegment_.resize(apicalConnections.segmentFlatListLength());
-  for (auto segmentIterationPair : proto.getLastUsedIterationForApicalSegment())
-  {
-    const Segment segment = apicalConnections.getSegment(
-      segmentIterationPair.getCell(), segmentIterationPair.getIdxOnCell());
-    lastUsedIterationForApicalSegment_[segment] = segmentIterationPair.getNumber();
-  }
 
-  learnOnOneCell_ = proto.getLearnOnOneCell();
-  chosenCellForColumn_.clear();
-  for (auto chosenCellProto : proto.getChosenCellForColumn())
+  resumeIndexes_(incrementalOverlaps, lazyPermanences);
+
+  // A snapshot isn't part of a chain of checkpoints.
+  checkpointId_ = 0;
+  checkpointIteration_ = iteration_;
+  updateDirtyCellTracking_();
+}
+
+void ApicalTiebreakTemporalMemory::thaw()
+{
+  if (snapshot_ == nullptr)
   {
-    chosenCellForColumn_[chosenCellProto.getColumnIdx()] = chosenCellProto.getCellIdx();
+    return;
   }
+
+  NTA_ATTM_TRACE("thaw");
+
+  bool incrementalOverlaps, lazyPermanences;
+  suspendIndexes_(incrementalOverlaps, lazyPermanences);
+  snapshot_->basal.materialize(basalConnections,
+                               lastUsedIterationForBasalSegment_);
+  snapshot_->apical.materialize(apicalConnections,
+                                lastUsedIterationForApicalSegment_);
+  releaseSnapshot_();
+  resumeIndexes_(incrementalOverlaps, lazyPermanences);
+}
+
+bool ApicalTiebreakTemporalMemory::isFrozen() const
+{
+  return snapshot_ != nullptr;
+}
+
+void ApicalTiebreakTemporalMemory::releaseSnapshot_()
+{
+  delete snapshot_;
+  snapshot_ = nullptr;
 }
 
 static set< pair<CellIdx,SynapseIdx> >
@@ -1664,8 +4618,18 @@ bool ApicalTiebreakTemporalMemory::operator==(const ApicalTiebreakTemporalMemory
     return false;
   }
 
-  if (basalConnections != other.basalConnections ||
-      apicalConnections != other.apicalConnections)
+  NTA_CHECK(snapshot_ == nullptr && other.snapshot_ == nullptr)
+    << "Thaw frozen models before comparing them";
+
+  Connections scratch, otherScratch;
+  if (withDeferredPermanences(basalConnections, basalSynapseArrays_,
+                              scratch) !=
+      withDeferredPermanences(other.basalConnections,
+                              other.basalSynapseArrays_, otherScratch) ||
+      withDeferredPermanences(apicalConnections, apicalSynapseArrays_,
+                              scratch) !=
+      withDeferredPermanences(other.apicalConnections,
+                              other.apicalSynapseArrays_, otherScratch))
   {
     return false;
   }
@@ -1749,16 +4713,22 @@ bool isSortedWithoutDuplicates(Iterator begin, Iterator end)
   return true;
 }
 
+/**
+ * The segments are on the frozenConnections if they're given.
+ */
 static vector<CellIdx>
 getUniqueCellsForSegments(const vector<Segment>& segments,
-                          const Connections& connections)
+                          const Connections& connections,
+                          const FrozenConnections* frozenConnections)
 {
   vector<CellIdx> cells;
   cells.reserve(segments.size());
 
   for (Segment segment : segments)
   {
-    cells.push_back(connections.cellForSegment(segment));
+    cells.push_back(frozenConnections != nullptr
+                    ? frozenConnections->cellForSegment(segment)
+                    : connections.cellForSegment(segment));
   }
 
   std::sort(cells.begin(), cells.end());
@@ -1891,12 +4861,16 @@ void ApicalTiebreakPairMemory::compute(
 
 vector<CellIdx> ApicalTiebreakPairMemory::getBasalPredictedCells() const
 {
-  return getUniqueCellsForSegments(activeBasalSegments_, basalConnections);
+  return getUniqueCellsForSegments(
+    activeBasalSegments_, basalConnections,
+    (snapshot_ != nullptr) ? &snapshot_->basal : nullptr);
 }
 
 vector<CellIdx> ApicalTiebreakPairMemory::getApicalPredictedCells() const
 {
-  return getUniqueCellsForSegments(activeApicalSegments_, apicalConnections);
+  return getUniqueCellsForSegments(
+    activeApicalSegments_, apicalConnections,
+    (snapshot_ != nullptr) ? &snapshot_->apical : nullptr);
 }
 
 void ApicalTiebreakPairMemory::read(
@@ -2047,65 +5021,108 @@ vector<CellIdx> ApicalTiebreakSequenceMemory::getNextPredictedCells() const
 
 vector<CellIdx> ApicalTiebreakSequenceMemory::getNextBasalPredictedCells() const
 {
-  return getUniqueCellsForSegments(activeBasalSegments_, basalConnections);
+  return getUniqueCellsForSegments(
+    activeBasalSegments_, basalConnections,
+    (snapshot_ != nullptr) ? &snapshot_->basal : nullptr);
 }
 
 vector<CellIdx> ApicalTiebreakSequenceMemory::getNextApicalPredictedCells() const
 {
-  return getUniqueCellsForSegments(activeApicalSegments_, apicalConnections);
+  return getUniqueCellsForSegments(
+    activeApicalSegments_, apicalConnections,
+    (snapshot_ != nullptr) ? &snapshot_->apical : nullptr);
 }
 
-void ApicalTiebreakSequenceMemory::read(
-  ApicalTiebreakSequenceMemoryProto::Reader& proto)
+/**
+ * The previous inputs are in both ApicalTiebreakSequenceMemoryProto and, for
+ * checkpoints and snapshots, ApicalTiebreakTemporalMemoryProto.
+ */
+template <typename Reader>
+static void readPrevState(Reader& proto,
+                          vector<CellIdx>& prevApicalInput,
+                          vector<CellIdx>& prevApicalGrowthCandidates,
+                          vector<CellIdx>& prevPredictedCells)
 {
-  auto _tm = proto.getApicalTiebreakTemporalMemory();
-  ApicalTiebreakTemporalMemory::read(_tm);
-
-  prevApicalInput_.clear();
+  prevApicalInput.clear();
   for (auto cell : proto.getPrevApicalInput())
   {
-    prevApicalInput_.push_back(cell);
+    prevApicalInput.push_back(cell);
   }
 
-  prevApicalGrowthCandidates_.clear();
+  prevApicalGrowthCandidates.clear();
   for (auto cell : proto.getPrevApicalGrowthCandidates())
   {
-    prevApicalGrowthCandidates_.push_back(cell);
+    prevApicalGrowthCandidates.push_back(cell);
   }
 
-  prevPredictedCells_.clear();
+  prevPredictedCells.clear();
   for (auto cell : proto.getPrevPredictedCells())
   {
-    prevPredictedCells_.push_back(cell);
+    prevPredictedCells.push_back(cell);
   }
 }
 
-void ApicalTiebreakSequenceMemory::write(
-  ApicalTiebreakSequenceMemoryProto::Builder& proto) const
+template <typename Builder>
+static void writePrevState(Builder& proto,
+                           const vector<CellIdx>& prevApicalInput,
+                           const vector<CellIdx>& prevApicalGrowthCandidates,
+                           const vector<CellIdx>& prevPredictedCells)
 {
-  auto _tm = proto.initApicalTiebreakTemporalMemory();
-  ApicalTiebreakTemporalMemory::write(_tm);
-
-  auto prevApicalInput = proto.initPrevApicalInput(prevApicalInput_.size());
+  auto prevApicalInputProto = proto.initPrevApicalInput(
+    prevApicalInput.size());
   UInt i = 0;
-  for (CellIdx cell : prevApicalInput_)
+  for (CellIdx cell : prevApicalInput)
   {
-    prevApicalInput.set(i++, cell);
+    prevApicalInputProto.set(i++, cell);
   }
 
-  auto prevApicalGrowthCandidates = proto.initPrevApicalGrowthCandidates(
-    prevApicalGrowthCandidates_.size());
+  auto prevApicalGrowthCandidatesProto = proto.initPrevApicalGrowthCandidates(
+    prevApicalGrowthCandidates.size());
   i = 0;
-  for (CellIdx cell : prevApicalGrowthCandidates_)
+  for (CellIdx cell : prevApicalGrowthCandidates)
   {
-    prevApicalGrowthCandidates.set(i++, cell);
+    prevApicalGrowthCandidatesProto.set(i++, cell);
   }
 
-  auto prevPredictedCells = proto.initPrevPredictedCells(
-    prevPredictedCells_.size());
+  auto prevPredictedCellsProto = proto.initPrevPredictedCells(
+    prevPredictedCells.size());
   i = 0;
-  for (CellIdx cell : prevPredictedCells_)
+  for (CellIdx cell : prevPredictedCells)
   {
-    prevPredictedCells.set(i++, cell);
+    prevPredictedCellsProto.set(i++, cell);
   }
 }
+
+void ApicalTiebreakSequenceMemory::read(
+  ApicalTiebreakSequenceMemoryProto::Reader& proto)
+{
+  auto _tm = proto.getApicalTiebreakTemporalMemory();
+  ApicalTiebreakTemporalMemory::read(_tm);
+
+  readPrevState(proto, prevApicalInput_, prevApicalGrowthCandidates_,
+                prevPredictedCells_);
+}
+
+void ApicalTiebreakSequenceMemory::write(
+  ApicalTiebreakSequenceMemoryProto::Builder& proto) const
+{
+  auto _tm = proto.initApicalTiebreakTemporalMemory();
+  ApicalTiebreakTemporalMemory::write(_tm);
+
+  writePrevState(proto, prevApicalInput_, prevApicalGrowthCandidates_,
+                 prevPredictedCells_);
+}
+
+void ApicalTiebreakSequenceMemory::readSubclassState_(
+  ApicalTiebreakTemporalMemoryProto::Reader& proto)
+{
+  readPrevState(proto, prevApicalInput_, prevApicalGrowthCandidates_,
+                prevPredictedCells_);
+}
+
+void ApicalTiebreakSequenceMemory::writeSubclassState_(
+  ApicalTiebreakTemporalMemoryProto::Builder& proto) const
+{
+  writePrevState(proto, prevApicalInput_, prevApicalGrowthCandidates_,
+                 prevPredictedCells_);
+}
@@ -27,6 +27,8 @@
 #ifndef NTA_APICAL_TIEBREAK_TM_HPP
 #define NTA_APICAL_TIEBREAK_TM_HPP
 
+#include <iostream>
+#include <string>
 #include <vector>
 #include <nupic/types/Serializable.hpp>
 #include <nupic/types/Types.hpp>
@@ -40,6 +42,172 @@ namespace nupic {
 
       using namespace algorithms::connections;
 
+      class IncrementalOverlaps;
+      class PresynapticCellIndex;
+      class SegmentRecency;
+      class LearningBudget;
+      class SynapseArrays;
+      class DirtyCells;
+      class MappedSnapshot;
+
+      /**
+       * Counters and timers for the phases of an
+       * ApicalTiebreakTemporalMemory's computes. They're only collected if
+       * the library is built with NTA_ATTM_STATS (the CMake option
+       * NUPIC_ATTM_STATS) and collection is enabled with setCollectStats.
+       *
+       * Phases can nest, e.g. bursting a column includes creating its
+       * segment, and each phase's time includes its nested phases.
+       *
+       * Builds with NTA_ATTM_STATS also record the phases as trace events
+       * while tracing::start() is in effect, regardless of setCollectStats.
+       */
+      struct ApicalTiebreakTemporalMemoryStats
+      {
+        enum Phase
+        {
+          BASAL_OVERLAPS,
+          APICAL_OVERLAPS,
+          SORT_SEGMENTS,
+          PREDICTED_CELLS,
+          ACTIVATE_PREDICTED_COLUMN,
+          BURST_COLUMN,
+          PUNISH_PREDICTED_COLUMN,
+          CREATE_SEGMENT,
+          EVICT_SEGMENTS,
+          GROW_SYNAPSES,
+          DESTROY_SYNAPSES,
+          NUM_PHASES
+        };
+
+        ApicalTiebreakTemporalMemoryStats();
+
+        /**
+         * Returns the phase's name, e.g. "burstColumn".
+         */
+        static const char* phaseName(Phase phase);
+
+        // The number of times each phase ran, and its total time.
+        UInt64 calls[NUM_PHASES];
+        UInt64 nanoseconds[NUM_PHASES];
+
+        UInt64 segmentsCreated;
+        UInt64 segmentsEvicted;
+        UInt64 synapsesGrown;
+        UInt64 synapsesDestroyed;
+      };
+
+      /**
+       * The bytes used by a Connections and by the indexes that the
+       * ApicalTiebreakTemporalMemory keeps for it, and its numbers of live and
+       * dead (destroyed, awaiting reuse) slots in the flat segment and synapse
+       * lists.
+       *
+       * The Connections' containers are private, so their bytes are computed
+       * from the counts and the sizes of nupic.core's data structures,
+       * without the containers' slack. The indexes are measured, including
+       * slack.
+       */
+      struct ConnectionsMemoryUsage
+      {
+        ConnectionsMemoryUsage();
+
+        size_t total() const;
+
+        // The segment data, including the cells' lists of segments.
+        size_t segments;
+
+        // The synapse data, including the segments' lists of synapses.
+        size_t synapses;
+
+        // The lists of synapses for each presynaptic cell.
+        size_t presynapticMaps;
+
+        // The ApicalTiebreakTemporalMemory's mirrors and indexes.
+        size_t indexes;
+
+        UInt64 liveSegments;
+        UInt64 deadSegments;
+        UInt64 liveSynapses;
+        UInt64 deadSynapses;
+      };
+
+      /**
+       * The bytes used by an ApicalTiebreakTemporalMemory. See
+       * ApicalTiebreakTemporalMemory::memoryUsage().
+       */
+      struct ApicalTiebreakTemporalMemoryMemoryUsage
+      {
+        ApicalTiebreakTemporalMemoryMemoryUsage();
+
+        size_t total() const;
+
+        ConnectionsMemoryUsage basal;
+        ConnectionsMemoryUsage apical;
+
+        // The active and matching segments, and their overlaps.
+        size_t overlaps;
+
+        // The last used iteration of each segment.
+        size_t lastUsedIterations;
+
+        // The active, predicted and winner cells, and other per-step state.
+        size_t state;
+      };
+
+      /**
+       * Segment and synapse lifecycle statistics for a Connections, for tuning
+       * maxSegmentsPerCell, maxSynapsesPerSegment and maxSynapses. Unlike
+       * ApicalTiebreakTemporalMemoryStats, these are always maintained. The
+       * histograms describe the current Connections, while the counters
+       * accumulate from construction or resetLifecycleStats().
+       *
+       * The age of an evicted segment is the number of iterations since it
+       * was last used. evictionAges is a log2 histogram: bucket 0 counts age
+       * 0, and bucket i counts ages in [2^(i-1), 2^i).
+       */
+      struct ConnectionsLifecycleStats
+      {
+        ConnectionsLifecycleStats();
+
+        /**
+         * Returns the evictionAges bucket of an age.
+         */
+        static size_t ageBucket(UInt64 age);
+
+        // The number of cells with each number of segments, indexed by the
+        // number of segments.
+        std::vector<UInt64> segmentsPerCell;
+
+        // The number of segments with each number of synapses, indexed by
+        // the number of synapses.
+        std::vector<UInt64> synapsesPerSegment;
+
+        // Segments destroyed by createSegment to stay within
+        // maxSegmentsPerCell, and by the maxSynapses budget.
+        UInt64 segmentsEvicted;
+        UInt64 segmentsEvictedBySynapseBudget;
+        std::vector<UInt64> evictionAges;
+
+        // Synapses destroyed by adaptSegment when their permanence reaches
+        // zero, including the segments destroyed with their last synapse.
+        UInt64 synapsesDestroyedByAdaptSegment;
+        UInt64 segmentsDestroyedByAdaptSegment;
+
+        // Synapses destroyed to make room for new ones under
+        // maxSynapsesPerSegment.
+        UInt64 synapsesDestroyedByMinPermanence;
+      };
+
+      /**
+       * See ApicalTiebreakTemporalMemory::getLifecycleStats().
+       */
+      struct ApicalTiebreakTemporalMemoryLifecycleStats
+      {
+        ConnectionsLifecycleStats basal;
+        ConnectionsLifecycleStats apical;
+      };
+
       /**
        * A fast generalized Temporal Memory implementation with apical dendrites
        * that add a "tiebreak".
@@ -156,6 +324,14 @@ namespace nupic {
 
         virtual ~ApicalTiebreakTemporalMemory();
 
+        // Event handlers such as the incremental overlap trackers are
+        // subscribed to this object's Connections, so they can't be shared
+        // with a copy.
+        ApicalTiebreakTemporalMemory(
+          const ApicalTiebreakTemporalMemory&) = delete;
+        ApicalTiebreakTemporalMemory& operator=(
+          const ApicalTiebreakTemporalMemory&) = delete;
+
         //----------------------------------------------------------------------
         //  Main functions
         //----------------------------------------------------------------------
@@ -372,6 +548,211 @@ namespace nupic {
         bool getCheckInputs() const;
         void setCheckInputs(bool checkInputs);
 
+        /**
+         * Returns whether segment overlaps are computed incrementally. In this
+         * mode the TM keeps the previous input and overlaps, and each step only
+         * applies the cells that were added to or removed from the input, along
+         * with the synapse changes from learning. This is faster when
+         * consecutive inputs share most of their cells. The results are the
+         * same either way.
+         *
+         * @returns the incrementalOverlaps parameter
+         */
+        bool getIncrementalOverlaps() const;
+        void setIncrementalOverlaps(bool incrementalOverlaps);
+
+        /**
+         * Returns whether permanence changes are deferred. In this mode
+         * learning keeps its own copy of the permanences and only writes a
+         * permanence to basalConnections / apicalConnections when the synapse
+         * becomes connected or disconnected. Segment activity only depends on
+         * which synapses are connected, so the results are the same either
+         * way, but learning makes fewer Connections updates.
+         *
+         * The other changes are written by materializePermanences(), which
+         * the checkpoint and snapshot writers call. write() and operator==
+         * see them without writing them. Call it before reading permanences
+         * from basalConnections or apicalConnections directly.
+         *
+         * @returns the lazyPermanences parameter
+         */
+        bool getLazyPermanences() const;
+        void setLazyPermanences(bool lazyPermanences);
+
+        /**
+         * Writes the deferred permanence changes to the Connections. This
+         * doesn't change the model, only where its permanences are stored,
+         * but the changed cells are dirty for the next delta checkpoint.
+         */
+        void materializePermanences();
+
+        /**
+         * Renumbers the segments of basalConnections and apicalConnections
+         * densely, dropping the slots of destroyed segments, and remaps the
+         * per-segment state. Segments from before the call are invalid
+         * afterward. The model doesn't change.
+         *
+         * @returns
+         * An estimate of the bytes reclaimed in the Connections and this
+         * class's per-segment arrays.
+         */
+        size_t compact();
+
+        /**
+         * Returns the fraction of destroyed segment slots in basalConnections
+         * or apicalConnections at which learning calls compact(), or 0.0 if
+         * it never does.
+         *
+         * @returns the compactionThreshold parameter
+         */
+        Real32 getCompactionThreshold() const;
+        void setCompactionThreshold(Real32 compactionThreshold);
+
+        /**
+         * Returns the number of learning iterations after which a segment
+         * that hasn't been active becomes cold, or 0 if segments never do.
+         *
+         * Cold segments are left out of the overlap computation, so they
+         * never become active or matching, which makes this an approximation
+         * of the normal TM. A cold segment becomes hot again when learning
+         * would otherwise grow a new segment in its column: if a column
+         * bursts and has no matching basal segments, the cold segments on
+         * its cells that match the reinforce candidates are made hot and
+         * treated as matching. Each learning step checks a slice of the
+         * cells, so every segment is checked once per coldSegmentAge
+         * iterations without a step that scans them all.
+         *
+         * @returns the coldSegmentAge parameter
+         */
+        UInt64 getColdSegmentAge() const;
+        void setColdSegmentAge(UInt64 coldSegmentAge);
+
+        /**
+         * Returns the maximum total number of basal and apical synapses, or 0
+         * if there's no maximum. When learning ends with more synapses than
+         * this, it destroys the least recently active segments, basal or
+         * apical, until the total is within the budget. This is in addition
+         * to maxSegmentsPerCell and maxSynapsesPerSegment.
+         *
+         * @returns the maxSynapses parameter
+         */
+        UInt64 getMaxSynapses() const;
+        void setMaxSynapses(UInt64 maxSynapses);
+
+        /**
+         * Reserves this class's per-segment and per-synapse storage, including
+         * its indexes, so that learning doesn't reallocate it until the model
+         * outgrows the reservation. The reservation is kept when the indexes
+         * are rebuilt, e.g. by compact() or read(). The Connections' own
+         * storage can't be reserved.
+         *
+         * @param expectedSegments
+         * The number of segments to reserve in basalConnections, and in
+         * apicalConnections if there's an apical input
+         *
+         * @param expectedSynapsesPerSegment
+         * The number of synapses to reserve on each segment
+         */
+        void reserve(UInt expectedSegments, UInt expectedSynapsesPerSegment);
+
+        /**
+         * Returns the number of times this class's per-segment or per-synapse
+         * storage has been reallocated to grow. Once the model reaches a
+         * steady state within its reservation, this stops changing.
+         *
+         * @returns the number of reallocations
+         */
+        UInt64 getNumReallocations() const;
+
+        /**
+         * Returns the maximum number of segments that learning creates per
+         * compute, or 0 if there's no maximum. This bounds the learning work
+         * of a compute, e.g. when many columns burst at once. Segments over
+         * the maximum are deferred: they're queued with their growth
+         * candidates and created on later computes that create fewer
+         * segments, oldest first. A cell has at most one deferred basal and
+         * one deferred apical segment, with the latest growth candidates,
+         * and it isn't created if the cell has since grown a segment that
+         * matches them. Learning on existing segments is never deferred. If
+         * the queue reaches twice the number of cells, the oldest deferred
+         * segments are dropped.
+         *
+         * @returns the maxNewSegmentsPerStep parameter
+         */
+        UInt getMaxNewSegmentsPerStep() const;
+        void setMaxNewSegmentsPerStep(UInt maxNewSegmentsPerStep);
+
+        /**
+         * Returns the number of deferred segments waiting to be created. See
+         * getMaxNewSegmentsPerStep().
+         *
+         * @returns the size of the learning backlog
+         */
+        size_t getNumDeferredSegments() const;
+
+        /**
+         * Returns whether this build can collect stats, i.e. whether it was
+         * built with NTA_ATTM_STATS.
+         */
+        static bool statsAvailable();
+
+        /**
+         * Returns whether computes collect stats into getStats(). This can
+         * only be enabled if statsAvailable().
+         *
+         * @returns the collectStats parameter
+         */
+        bool getCollectStats() const;
+        void setCollectStats(bool collectStats);
+
+        /**
+         * Returns the stats collected since construction or resetStats().
+         */
+        const ApicalTiebreakTemporalMemoryStats& getStats() const;
+        void resetStats();
+
+        /**
+         * Returns the segment and synapse lifecycle statistics. They're
+         * maintained incrementally as the Connections change, in every build.
+         * resetLifecycleStats() resets the counters and the eviction ages,
+         * but not the histograms, which describe the current Connections.
+         */
+        const ApicalTiebreakTemporalMemoryLifecycleStats&
+        getLifecycleStats() const;
+        void resetLifecycleStats();
+
+        /**
+         * Returns a breakdown of the memory used by this model, with the
+         * number of live and dead segment and synapse slots. This walks the
+         * segments, so it isn't meant to be called every compute.
+         *
+         * While the model is frozen, the segments and synapses are the
+         * snapshot's arrays in the mapping, which aren't all resident.
+         */
+        ApicalTiebreakTemporalMemoryMemoryUsage memoryUsage() const;
+
+        /**
+         * Estimates the memoryUsage() of a trained model from its size, for
+         * capacity planning. It assumes that every segment slot is live, that
+         * the synapses are spread over the whole input, and the default
+         * indexes, i.e. no incremental overlaps or synapse budget.
+         *
+         * @param numBasalSegments
+         * @param numApicalSegments
+         * The expected total number of segments
+         *
+         * @param synapsesPerSegment
+         * The expected average number of synapses on a segment
+         */
+        static ApicalTiebreakTemporalMemoryMemoryUsage estimateMemoryUsage(
+          UInt columnCount,
+          UInt cellsPerColumn,
+          UInt basalInputSize,
+          UInt apicalInputSize,
+          UInt numBasalSegments,
+          UInt numApicalSegments,
+          UInt synapsesPerSegment);
+
         /**
          * Raises an error if cell index is invalid.
          *
@@ -382,6 +763,111 @@ namespace nupic {
         void write(ApicalTiebreakTemporalMemoryProto::Builder& proto) const;
         void read(ApicalTiebreakTemporalMemoryProto::Reader& proto);
 
+        /**
+         * Returns the longest per-segment list that write() and
+         * writeDeltaCheckpoint() put in a message before splitting it into
+         * chunks. The default is the longest list Cap'n Proto allows. Tests
+         * lower it to cover the chunks.
+         *
+         * @returns the maxListLength parameter
+         */
+        static size_t getMaxListLength();
+        static void setMaxListLength(size_t maxListLength);
+
+        /**
+         * Writes the full model like write(), as the base of a chain of
+         * delta checkpoints, and starts tracking the changes for the next
+         * delta.
+         *
+         * Changes are tracked by cell: a cell is dirty once any of its
+         * segments or their synapses are created, destroyed or updated.
+         */
+        void writeBaseCheckpoint(
+          ApicalTiebreakTemporalMemoryProto::Builder& proto);
+        void writeBaseCheckpoint(std::ostream& stream);
+
+        /**
+         * Writes the changes since the last base or delta checkpoint: all
+         * segments of the dirty cells, the last used iterations of the other
+         * segments that were used since, and the parameters and per-step
+         * state, which are small.
+         */
+        void writeDeltaCheckpoint(
+          ApicalTiebreakTemporalMemoryDeltaProto::Builder& proto);
+        void writeDeltaCheckpoint(std::ostream& stream);
+
+        /**
+         * Applies a delta to this model, which must have been read from the
+         * checkpoint that the delta was written after. This rebuilds the
+         * indexes, so to replay a chain of deltas use loadCheckpoints().
+         */
+        void readDeltaCheckpoint(
+          ApicalTiebreakTemporalMemoryDeltaProto::Reader& proto);
+        void readDeltaCheckpoint(std::istream& stream);
+
+        /**
+         * Reads a base checkpoint and replays a chain of deltas onto it, in
+         * order. The indexes are only rebuilt once.
+         */
+        void loadCheckpoints(const std::string& basePath,
+                             const std::vector<std::string>& deltaPaths);
+
+        /**
+         * Folds a chain of deltas into a new base checkpoint. The new base
+         * keeps the last delta's id, so deltas that the model writes later
+         * apply to it.
+         */
+        static void compactCheckpoints(
+          const std::string& basePath,
+          const std::vector<std::string>& deltaPaths,
+          const std::string& outPath);
+
+        /**
+         * Returns the id of the last base or delta checkpoint that this model
+         * wrote or read, or 0 if it isn't in a chain of checkpoints.
+         */
+        UInt64 getCheckpointId() const;
+
+        /**
+         * Returns the number of cells whose segments changed since the last
+         * checkpoint. Cells are only tracked while the model is in a chain of
+         * checkpoints, so this is 0 otherwise.
+         */
+        size_t getNumDirtyCells() const;
+
+        /**
+         * Writes the model as a snapshot that loadSnapshot() maps into memory
+         * rather than reading. The segments are stored as flat arrays in
+         * cell order, along with an index of their synapses by presynaptic
+         * cell, so a loaded model can compute straight from the mapping.
+         *
+         * Snapshots are in native byte order.
+         */
+        void writeSnapshot(const std::string& path);
+
+        /**
+         * Maps a snapshot and replaces this model with it, leaving the model
+         * frozen. Computes without learning read the segments from the
+         * mapping, so the segments aren't read or copied when loading, and
+         * their pages are only loaded as they're used.
+         *
+         * Anything that changes the segments, e.g. a compute with learning,
+         * thaws the model first. While the model is frozen basalConnections
+         * and apicalConnections are empty and operator== throws. write()
+         * copies the segments out of the snapshot, leaving it frozen.
+         * The file must not change until the model is thawed.
+         */
+        void loadSnapshot(const std::string& path);
+
+        /**
+         * Copies a frozen model's segments into basalConnections and
+         * apicalConnections and unmaps its snapshot. Does nothing if the model
+         * isn't frozen.
+         */
+        void thaw();
+
+        bool isFrozen() const;
+
         bool operator==(const ApicalTiebreakTemporalMemory& other);
         bool operator!=(const ApicalTiebreakTemporalMemory& other);
 
@@ -503,6 +989,9 @@ namespace nupic {
         std::vector<UInt32> apicalOverlaps_;
         std::vector<UInt32> apicalPotentialOverlaps_;
 
+        // Scratch space for calculatePredictedCells. All zeros between calls.
+        std::vector<unsigned char> cellPredictiveScores_;
+
         bool learnOnOneCell_;
         std::map<UInt, CellIdx> chosenCellForColumn_;
 
@@ -514,6 +1003,133 @@ namespace nupic {
 
         Random rng_;
 
+        void subscribeIndexes_();
+        void unsubscribeIndexes_();
+        void suspendIndexes_(bool& incrementalOverlaps, bool& lazyPermanences);
+        void resumeIndexes_(bool incrementalOverlaps, bool lazyPermanences);
+        void writeState_(ApicalTiebreakTemporalMemoryProto::Builder& proto)
+          const;
+        template <typename ConnectionsT>
+        void writeSegmentsState_(
+          ApicalTiebreakTemporalMemoryProto::Builder& proto,
+          const ConnectionsT& basal, const ConnectionsT& apical) const;
+        void readParameters_(ApicalTiebreakTemporalMemoryProto::Reader& proto);
+        void readState_(ApicalTiebreakTemporalMemoryProto::Reader& proto);
+
+        /**
+         * A subclass's per-step state, written and read with this class's.
+         * Checkpoints and snapshots only hold an
+         * ApicalTiebreakTemporalMemoryProto, so this is how they include it.
+         */
+        virtual void writeSubclassState_(
+          ApicalTiebreakTemporalMemoryProto::Builder& proto) const;
+        virtual void readSubclassState_(
+          ApicalTiebreakTemporalMemoryProto::Reader& proto);
+        void discardPartialRead_();
+        void applyDeltaCheckpoint_(
+          ApicalTiebreakTemporalMemoryDeltaProto::Reader& proto);
+        void writeBaseCheckpoint_(
+          ApicalTiebreakTemporalMemoryProto::Builder& proto,
+          UInt64 checkpointId);
+        void writeDeltaCheckpoint_(
+          ApicalTiebreakTemporalMemoryDeltaProto::Builder& proto,
+          UInt64 checkpointId);
+        void commitCheckpoint_(UInt64 checkpointId);
+        void updateDirtyCellTracking_();
+        void clearDirtyCells_();
+        void releaseSnapshot_();
+        void activateCellsFrozen_(const UInt* activeColumnsBegin,
+                                  const UInt* activeColumnsEnd);
+        void updateCellIndexThresholds_();
+        void compactIfFragmented_();
+        void coolSegments_();
+        void coolNextCells_();
+        void subscribeSegmentRecency_();
+        void unsubscribeSegmentRecency_();
+        void enforceSynapseBudget_();
+        void reserve_();
+        void createDeferredSegments_();
+        void updateSegmentArrayCapacities_(bool countReallocations);
+        void promoteColdSegments_(
+          const UInt* activeColumnsBegin,
+          const UInt* activeColumnsEnd,
+          const std::vector<unsigned char>& basalReinforceCandidatesDense,
+          const std::vector<unsigned char>& apicalReinforceCandidatesDense);
+
+        // Each segment's synapses as parallel arrays, for the learning loops.
+        // Owned by the Connections they are subscribed to.
+        SynapseArrays* basalSynapseArrays_;
+        UInt32 basalSynapseArraysToken_;
+        SynapseArrays* apicalSynapseArrays_;
+        UInt32 apicalSynapseArraysToken_;
+
+        // Applied to the synapse arrays whenever they're subscribed.
+        bool lazyPermanences_;
+
+        // The synapses of the segments that can become active or matching,
+        // by presynaptic cell, for the overlap computation. Owned by the
+        // Connections they are subscribed to.
+        PresynapticCellIndex* basalCellIndex_;
+        UInt32 basalCellIndexToken_;
+        PresynapticCellIndex* apicalCellIndex_;
+        UInt32 apicalCellIndexToken_;
+
+        // Only set in incremental overlaps mode. Owned by the Connections they
+        // are subscribed to.
+        IncrementalOverlaps* basalIncrementalOverlaps_;
+        UInt32 basalIncrementalOverlapsToken_;
+        IncrementalOverlaps* apicalIncrementalOverlaps_;
+        UInt32 apicalIncrementalOverlapsToken_;
+
+        Real32 compactionThreshold_;
+        UInt64 coldSegmentAge_;
+
+        // The first cell that the next learning step checks for cold
+        // segments.
+        CellIdx coolingCursor_;
+
+        // Only set when there's a maxSynapses. Owned by the Connections they
+        // are subscribed to.
+        UInt64 maxSynapses_;
+        SegmentRecency* basalSegmentRecency_;
+        UInt32 basalSegmentRecencyToken_;
+        SegmentRecency* apicalSegmentRecency_;
+        UInt32 apicalSegmentRecencyToken_;
+
+        // Owned by this class.
+        LearningBudget* learningBudget_;
+
+        // The cells changed since the last checkpoint. Owned by this class,
+        // and updated by trackers that are only subscribed while the model
+        // is in a chain of checkpoints.
+        DirtyCells* basalDirtyCells_;
+        UInt32 basalDirtyCellTrackerToken_;
+        DirtyCells* apicalDirtyCells_;
+        UInt32 apicalDirtyCellTrackerToken_;
+        bool trackingDirtyCells_;
+        UInt64 checkpointId_;
+        UInt64 checkpointIteration_;
+
+        // Only set while the model is frozen. Owned by this class.
+        MappedSnapshot* snapshot_;
+
+        bool collectStats_;
+        ApicalTiebreakTemporalMemoryStats stats_;
+
+        // Maintained by the SynapseArrays and the learning code. The
+        // SynapseArrays recompute the histograms when they're rebuilt.
+        ApicalTiebreakTemporalMemoryLifecycleStats lifecycleStats_;
+
+        UInt expectedSegments_;
+        UInt expectedSynapsesPerSegment_;
+
+        // The indexes count their own reallocations here. This class's
+        // per-segment arrays are checked after each compute by comparing
+        // their capacities.
+        UInt64 numReallocations_;
+        static const size_t NUM_SEGMENT_ARRAYS = 6;
+        size_t segmentArrayCapacities_[NUM_SEGMENT_ARRAYS];
+
       public:
         Connections basalConnections;
         Connections apicalConnections;
@@ -748,6 +1364,11 @@ namespace nupic {
         virtual void read(ApicalTiebreakSequenceMemoryProto::Reader& proto) override;
 
       protected:
+        virtual void writeSubclassState_(
+          ApicalTiebreakTemporalMemoryProto::Builder& proto) const override;
+        virtual void readSubclassState_(
+          ApicalTiebreakTemporalMemoryProto::Reader& proto) override;
+
         std::vector<CellIdx> prevApicalInput_;
         std::vector<CellIdx> prevApicalGrowthCandidates_;
         std::vector<CellIdx> prevPredictedCells_;
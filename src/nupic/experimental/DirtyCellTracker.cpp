@@ -0,0 +1,97 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+
+/** @file
+ * Implementation of tracking the cells whose segments changed
+ */
+
+#include <algorithm>
+
+#include <nupic/experimental/DirtyCellTracker.hpp>
+
+using namespace nupic;
+using namespace nupic::experimental::apical_tiebreak_temporal_memory;
+
+const std::vector<CellIdx>& DirtyCells::cells()
+{
+  std::sort(cells_.begin(), cells_.end());
+  return cells_;
+}
+
+void DirtyCells::clear()
+{
+  for (CellIdx cell : cells_)
+  {
+    isDirty_[cell] = 0;
+  }
+  cells_.clear();
+}
+
+size_t DirtyCells::memoryUsage() const
+{
+  return isDirty_.capacity() * sizeof(unsigned char) +
+    cells_.capacity() * sizeof(CellIdx);
+}
+
+DirtyCellTracker::DirtyCellTracker(const Connections& connections,
+                                   DirtyCells& dirtyCells)
+  : connections_(connections),
+    dirtyCells_(dirtyCells)
+{
+}
+
+void DirtyCellTracker::onCreateSegment(Segment segment)
+{
+  markSegment_(segment);
+}
+
+void DirtyCellTracker::onDestroySegment(Segment segment)
+{
+  markSegment_(segment);
+}
+
+void DirtyCellTracker::onCreateSynapse(Synapse synapse)
+{
+  markSynapse_(synapse);
+}
+
+void DirtyCellTracker::onDestroySynapse(Synapse synapse)
+{
+  markSynapse_(synapse);
+}
+
+void DirtyCellTracker::onUpdateSynapsePermanence(Synapse synapse,
+                                                 Permanence permanence)
+{
+  markSynapse_(synapse);
+}
+
+void DirtyCellTracker::markSegment_(Segment segment)
+{
+  dirtyCells_.mark(connections_.dataForSegment(segment).cell);
+}
+
+void DirtyCellTracker::markSynapse_(Synapse synapse)
+{
+  markSegment_(connections_.dataForSynapse(synapse).segment);
+}
@@ -0,0 +1,116 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+
+/** @file
+ * Declarations for tracking the cells whose segments changed, for delta
+ * checkpoints
+ */
+
+#ifndef NTA_DIRTY_CELL_TRACKER_HPP
+#define NTA_DIRTY_CELL_TRACKER_HPP
+
+#include <vector>
+
+#include <nupic/algorithms/Connections.hpp>
+#include <nupic/types/Types.hpp>
+
+namespace nupic {
+  namespace experimental {
+    namespace apical_tiebreak_temporal_memory {
+
+      using namespace algorithms::connections;
+
+      /**
+       * The cells whose segments or synapses changed since the last
+       * checkpoint, for delta checkpoints. Marking a cell is a byte check in
+       * the common case, so it's cheap enough to do on every change.
+       */
+      class DirtyCells
+      {
+      public:
+        void mark(CellIdx cell)
+        {
+          if (cell >= isDirty_.size())
+          {
+            isDirty_.resize(cell + 1, 0);
+          }
+          if (!isDirty_[cell])
+          {
+            isDirty_[cell] = 1;
+            cells_.push_back(cell);
+          }
+        }
+
+        /**
+         * The dirty cells, sorted.
+         */
+        const std::vector<CellIdx>& cells();
+
+        bool isDirty(CellIdx cell) const
+        {
+          return cell < isDirty_.size() && isDirty_[cell];
+        }
+
+        size_t size() const
+        {
+          return cells_.size();
+        }
+
+        void clear();
+
+        size_t memoryUsage() const;
+
+      private:
+        std::vector<unsigned char> isDirty_;
+        std::vector<CellIdx> cells_;
+      };
+
+      /**
+       * Marks the cells of the segments and synapses that change.
+       */
+      class DirtyCellTracker : public ConnectionsEventHandler
+      {
+      public:
+        DirtyCellTracker(const Connections& connections,
+                         DirtyCells& dirtyCells);
+
+        virtual void onCreateSegment(Segment segment) override;
+        virtual void onDestroySegment(Segment segment) override;
+        virtual void onCreateSynapse(Synapse synapse) override;
+        virtual void onDestroySynapse(Synapse synapse) override;
+        virtual void onUpdateSynapsePermanence(Synapse synapse,
+                                               Permanence permanence) override;
+
+      private:
+        void markSegment_(Segment segment);
+        void markSynapse_(Synapse synapse);
+
+        const Connections& connections_;
+        DirtyCells& dirtyCells_;
+      };
+
+    } // end namespace apical_tiebreak_temporal_memory
+  } // end namespace experimental
+} // end namespace nupic
+
+#endif // NTA_DIRTY_CELL_TRACKER_HPP
@@ -0,0 +1,195 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+
+/** @file
+ * Implementation of reading ApicalTiebreakTemporalMemory snapshots in place
+ */
+
+#include <cstring>
+#include <limits>
+
+#include <nupic/experimental/FrozenConnections.hpp>
+
+using namespace nupic;
+using namespace nupic::experimental::apical_tiebreak_temporal_memory;
+using nupic::experimental::MappedFile;
+using std::string;
+using std::vector;
+
+/**
+ * Checks that the offsets of a CSR array are ascending and end at length.
+ */
+template <typename Offset>
+static void checkSnapshotOffsets(const Offset* offsets, UInt64 count,
+                                 UInt64 length)
+{
+  NTA_CHECK(offsets[0] == 0 && offsets[count] == length)
+    << "The snapshot is corrupt";
+  for (UInt64 i = 0; i < count; i++)
+  {
+    NTA_CHECK(offsets[i] <= offsets[i + 1])
+      << "The snapshot is corrupt";
+  }
+}
+
+static SnapshotHeader readSnapshotHeader(const MappedFile& file)
+{
+  SnapshotHeader header;
+  NTA_CHECK(file.size() >= sizeof(header) &&
+            memcmp(file.data(), SNAPSHOT_MAGIC,
+                   sizeof(SNAPSHOT_MAGIC)) == 0)
+    << "The file isn't an ApicalTiebreakTemporalMemory snapshot";
+  memcpy(&header, file.data(), sizeof(header));
+
+  NTA_CHECK(header.version == SNAPSHOT_VERSION)
+    << "Unsupported snapshot version " << header.version;
+  NTA_CHECK(header.byteOrder == SNAPSHOT_BYTE_ORDER)
+    << "The snapshot was written on a machine with another byte order";
+
+  return header;
+}
+
+FrozenConnections::FrozenConnections(const MappedFile& file,
+                                     const SnapshotConnections& header)
+  : numCells_((CellIdx)header.numCells),
+    numSegments_((UInt32)header.numSegments),
+    numSynapses_(header.numSynapses),
+    numPresynapticCells_(header.numPresynapticCells)
+{
+  NTA_CHECK(header.numCells <= std::numeric_limits<CellIdx>::max() &&
+            header.numSegments <= std::numeric_limits<UInt32>::max())
+    << "The snapshot is corrupt";
+
+  segmentOffsetForCell_ = snapshotArray<UInt32>(
+    file, header.segmentOffsetForCell, header.numCells + 1);
+  cellForSegment_ = snapshotArray<CellIdx>(
+    file, header.cellForSegment, header.numSegments);
+  lastUsedIterationForSegment_ = snapshotArray<UInt64>(
+    file, header.lastUsedIterationForSegment, header.numSegments);
+  potentialOverlapForSegment_ = snapshotArray<UInt32>(
+    file, header.potentialOverlapForSegment, header.numSegments);
+  synapseOffsetForSegment_ = snapshotArray<UInt64>(
+    file, header.synapseOffsetForSegment, header.numSegments + 1);
+  presynapticCells_ = snapshotArray<CellIdx>(
+    file, header.presynapticCells, header.numSynapses);
+  permanences_ = snapshotArray<Permanence>(
+    file, header.permanences, header.numSynapses);
+  synapseOffsetForPresynapticCell_ = snapshotArray<UInt64>(
+    file, header.synapseOffsetForPresynapticCell,
+    header.numPresynapticCells + 1);
+  segmentForPresynapticSynapse_ = snapshotArray<Segment>(
+    file, header.segmentForPresynapticSynapse, header.numSynapses);
+  permanenceForPresynapticSynapse_ = snapshotArray<Permanence>(
+    file, header.permanenceForPresynapticSynapse, header.numSynapses);
+
+  // This is one pass over the synapses, which is much less work than
+  // materializing them.
+  checkSnapshotOffsets(segmentOffsetForCell_, header.numCells,
+                       header.numSegments);
+  checkSnapshotOffsets(synapseOffsetForSegment_, header.numSegments,
+                       header.numSynapses);
+  checkSnapshotOffsets(synapseOffsetForPresynapticCell_,
+                       header.numPresynapticCells, header.numSynapses);
+
+  for (CellIdx cell = 0; cell < numCells_; cell++)
+  {
+    for (UInt32 segment = segmentOffsetForCell_[cell];
+         segment < segmentOffsetForCell_[cell + 1];
+         segment++)
+    {
+      NTA_CHECK(cellForSegment_[segment] == cell)
+        << "The snapshot is corrupt";
+    }
+  }
+  for (UInt64 i = 0; i < header.numSynapses; i++)
+  {
+    NTA_CHECK(presynapticCells_[i] < numPresynapticCells_ &&
+              segmentForPresynapticSynapse_[i] < numSegments_)
+      << "The snapshot is corrupt";
+  }
+}
+
+Segment FrozenConnections::getSegment(CellIdx cell, UInt32 idxOnCell) const
+{
+  NTA_CHECK(cell < numCells_ && idxOnCell < numSegments(cell))
+    << "The snapshot has no segment " << idxOnCell << " on cell " << cell;
+  return segmentOffsetForCell_[cell] + idxOnCell;
+}
+
+void FrozenConnections::materialize(
+  Connections& connections,
+  vector<UInt64>& lastUsedIterationForSegment) const
+{
+  connections = Connections(numCells_);
+
+  for (CellIdx cell = 0; cell < numCells_; cell++)
+  {
+    for (Segment frozenSegment = segmentOffsetForCell_[cell];
+         frozenSegment < segmentOffsetForCell_[cell + 1];
+         frozenSegment++)
+    {
+      const Segment segment = connections.createSegment(cell);
+      NTA_ASSERT(segment == frozenSegment);
+
+      for (UInt64 i = synapseOffsetForSegment_[frozenSegment];
+           i < synapseOffsetForSegment_[frozenSegment + 1];
+           i++)
+      {
+        connections.createSynapse(segment, presynapticCells_[i],
+                                  permanences_[i]);
+      }
+    }
+  }
+
+  lastUsedIterationForSegment.assign(
+    lastUsedIterationForSegment_,
+    lastUsedIterationForSegment_ + numSegments_);
+}
+
+ConnectionsMemoryUsage FrozenConnections::memoryUsage() const
+{
+  ConnectionsMemoryUsage usage;
+  usage.liveSegments = numSegments_;
+  usage.liveSynapses = numSynapses_;
+  usage.segments =
+    ((size_t)numCells_ + 1) * sizeof(UInt32) +
+    (size_t)numSegments_ * (sizeof(CellIdx) + sizeof(UInt32)) +
+    ((size_t)numSegments_ + 1) * sizeof(UInt64);
+  usage.synapses = numSynapses_ * (sizeof(CellIdx) + sizeof(Permanence));
+  usage.presynapticMaps =
+    (numPresynapticCells_ + 1) * sizeof(UInt64) +
+    numSynapses_ * (sizeof(Segment) + sizeof(Permanence));
+  return usage;
+}
+
+size_t FrozenConnections::lastUsedIterationBytes() const
+{
+  return (size_t)numSegments_ * sizeof(UInt64);
+}
+
+MappedSnapshot::MappedSnapshot(const string& path)
+  : file(path),
+    header(readSnapshotHeader(file)),
+    basal(file, header.basal),
+    apical(file, header.apical)
+{}
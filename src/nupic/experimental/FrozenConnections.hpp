@@ -0,0 +1,261 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+
+/** @file
+ * Declarations for reading ApicalTiebreakTemporalMemory snapshots in place
+ */
+
+#ifndef NTA_FROZEN_CONNECTIONS_HPP
+#define NTA_FROZEN_CONNECTIONS_HPP
+
+#include <string>
+#include <vector>
+
+#include <nupic/algorithms/Connections.hpp>
+#include <nupic/experimental/ApicalTiebreakTemporalMemory.hpp>
+#include <nupic/experimental/IndexUtils.hpp>
+#include <nupic/experimental/MappedFile.hpp>
+#include <nupic/types/Types.hpp>
+#include <nupic/utils/Log.hpp>
+
+namespace nupic {
+  namespace experimental {
+    namespace apical_tiebreak_temporal_memory {
+
+      using namespace algorithms::connections;
+
+      /**
+       * The layout of a snapshot file: this header followed by arrays in
+       * native byte order, each 8-byte aligned. Offsets are from the start
+       * of the file, and lengths are in elements.
+       */
+      struct SnapshotArray
+      {
+        UInt64 offset;
+        UInt64 length;
+      };
+
+      struct SnapshotConnections
+      {
+        UInt64 numCells;
+        UInt64 numSegments;
+        UInt64 numSynapses;
+        UInt64 numPresynapticCells;
+
+        // The segments are numbered in cell order, so each cell's segments
+        // are a range of numbers.
+        SnapshotArray segmentOffsetForCell;         // UInt32
+        SnapshotArray cellForSegment;               // CellIdx
+        SnapshotArray lastUsedIterationForSegment;  // UInt64
+        SnapshotArray potentialOverlapForSegment;   // UInt32
+
+        // The synapses in segment order, as parallel arrays.
+        SnapshotArray synapseOffsetForSegment;      // UInt64
+        SnapshotArray presynapticCells;             // CellIdx
+        SnapshotArray permanences;                  // Permanence
+
+        // The synapses again in presynaptic cell order, for the overlaps.
+        SnapshotArray synapseOffsetForPresynapticCell;  // UInt64
+        SnapshotArray segmentForPresynapticSynapse;     // Segment
+        SnapshotArray permanenceForPresynapticSynapse;  // Permanence
+      };
+
+      struct SnapshotHeader
+      {
+        char magic[8];
+        UInt32 version;
+        UInt32 byteOrder;
+
+        // A capnp message with the parameters and the per-step state.
+        SnapshotArray state;
+
+        SnapshotConnections basal;
+        SnapshotConnections apical;
+      };
+
+      const char SNAPSHOT_MAGIC[8] = {'A', 'T', 'T', 'M',
+                                      'S', 'N', 'A', 'P'};
+      const UInt32 SNAPSHOT_VERSION = 1;
+      const UInt32 SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+      /**
+       * Checks that an array is within the file and aligned for its type.
+       */
+      template <typename T>
+      const T* snapshotArray(const MappedFile& file,
+                             const SnapshotArray& array,
+                             UInt64 length)
+      {
+        NTA_CHECK(array.length == length &&
+                  array.offset % sizeof(T) == 0 &&
+                  array.offset <= file.size() &&
+                  length <= (file.size() - array.offset) / sizeof(T))
+          << "The snapshot is truncated or corrupt";
+        return reinterpret_cast<const T*>(file.data() + array.offset);
+      }
+
+      /**
+       * The segments of a snapshot, read in place from the mapping. It has
+       * the parts of the Connections interface that inference uses, so the
+       * inference code can run on either.
+       *
+       * The segments are numbered in cell order, which is also the order
+       * that compareSegments sorts them in. materialize() creates them in a
+       * new Connections, which numbers them the same way.
+       */
+      class FrozenConnections
+      {
+      public:
+        /**
+         * Checks the offsets and the cell and segment ids, so that a
+         * corrupt file can't send reads outside the mapping or writes
+         * outside the overlap arrays.
+         */
+        FrozenConnections(const MappedFile& file,
+                          const SnapshotConnections& header);
+
+        CellIdx numCells() const
+        {
+          return numCells_;
+        }
+
+        UInt32 numSegments() const
+        {
+          return numSegments_;
+        }
+
+        UInt32 numSegments(CellIdx cell) const
+        {
+          return segmentOffsetForCell_[cell + 1] - segmentOffsetForCell_[cell];
+        }
+
+        UInt32 segmentFlatListLength() const
+        {
+          return numSegments_;
+        }
+
+        CellIdx cellForSegment(Segment segment) const
+        {
+          return cellForSegment_[segment];
+        }
+
+        UInt32 idxOnCellForSegment(Segment segment) const
+        {
+          return segment - segmentOffsetForCell_[cellForSegment_[segment]];
+        }
+
+        Segment getSegment(CellIdx cell, UInt32 idxOnCell) const;
+
+        bool compareSegments(Segment a, Segment b) const
+        {
+          return a < b;
+        }
+
+        void computeActivity(std::vector<UInt32>& overlaps,
+                             std::vector<UInt32>& potentialOverlaps,
+                             CellIdx cell,
+                             Permanence connectedPermanence) const
+        {
+          if (cell >= numPresynapticCells_)
+          {
+            return;
+          }
+
+          for (UInt64 i = synapseOffsetForPresynapticCell_[cell];
+               i < synapseOffsetForPresynapticCell_[cell + 1];
+               i++)
+          {
+            const Segment segment = segmentForPresynapticSynapse_[i];
+            NTA_ASSERT(segment < numSegments_);
+
+            potentialOverlaps[segment]++;
+            if (permanenceForPresynapticSynapse_[i] >=
+                connectedPermanence - CONNECTED_EPSILON)
+            {
+              overlaps[segment]++;
+            }
+          }
+        }
+
+        /**
+         * The potential overlaps when the snapshot was written.
+         */
+        const UInt32* potentialOverlaps() const
+        {
+          return potentialOverlapForSegment_;
+        }
+
+        /**
+         * Replaces the Connections with these segments. Their lists of
+         * synapses are in the same order as when the snapshot was written.
+         */
+        void materialize(Connections& connections,
+                         std::vector<UInt64>& lastUsedIterationForSegment)
+          const;
+
+        /**
+         * The snapshot's counts, and the bytes of its arrays in the
+         * mapping. They're paged in as they're read, so they aren't all
+         * resident.
+         */
+        ConnectionsMemoryUsage memoryUsage() const;
+
+        size_t lastUsedIterationBytes() const;
+
+      private:
+        CellIdx numCells_;
+        UInt32 numSegments_;
+        UInt64 numSynapses_;
+        UInt64 numPresynapticCells_;
+
+        const UInt32* segmentOffsetForCell_;
+        const CellIdx* cellForSegment_;
+        const UInt64* lastUsedIterationForSegment_;
+        const UInt32* potentialOverlapForSegment_;
+        const UInt64* synapseOffsetForSegment_;
+        const CellIdx* presynapticCells_;
+        const Permanence* permanences_;
+        const UInt64* synapseOffsetForPresynapticCell_;
+        const Segment* segmentForPresynapticSynapse_;
+        const Permanence* permanenceForPresynapticSynapse_;
+      };
+
+      /**
+       * A mapped snapshot file and its segments.
+       */
+      class MappedSnapshot
+      {
+      public:
+        MappedSnapshot(const std::string& path);
+
+        MappedFile file;
+        SnapshotHeader header;
+        FrozenConnections basal;
+        FrozenConnections apical;
+      };
+
+    } // end namespace apical_tiebreak_temporal_memory
+  } // end namespace experimental
+} // end namespace nupic
+
+#endif // NTA_FROZEN_CONNECTIONS_HPP
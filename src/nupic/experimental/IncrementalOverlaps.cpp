@@ -0,0 +1,290 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+
+/** @file
+ * Implementation of computing segment overlaps incrementally
+ */
+
+#include <iterator>
+
+#include <nupic/experimental/IncrementalOverlaps.hpp>
+#include <nupic/experimental/IndexUtils.hpp>
+
+using namespace nupic;
+using namespace nupic::experimental::apical_tiebreak_temporal_memory;
+using std::vector;
+
+IncrementalOverlaps::IncrementalOverlaps(const Connections& connections,
+                                         UInt64& numReallocations)
+  : connections_(connections),
+    valid_(false),
+    connectedPermanence_(0.0),
+    activationThreshold_(0),
+    minThreshold_(0),
+    stamp_(0),
+    numReallocations_(numReallocations)
+{}
+
+void IncrementalOverlaps::onCreateSegment(Segment segment)
+{
+  pending_.push_back({segment, 0, 0, true});
+}
+
+void IncrementalOverlaps::onDestroySegment(Segment segment)
+{
+  pending_.push_back({segment, 0, 0, true});
+}
+
+void IncrementalOverlaps::onCreateSynapse(Synapse synapse)
+{
+  const SynapseData& synapseData = connections_.dataForSynapse(synapse);
+  if (isActive_(synapseData.presynapticCell))
+  {
+    pending_.push_back({synapseData.segment,
+                        isConnected_(synapseData.permanence) ? 1 : 0,
+                        1, false});
+  }
+}
+
+void IncrementalOverlaps::onDestroySynapse(Synapse synapse)
+{
+  const SynapseData& synapseData = connections_.dataForSynapse(synapse);
+  if (isActive_(synapseData.presynapticCell))
+  {
+    pending_.push_back({synapseData.segment,
+                        isConnected_(synapseData.permanence) ? -1 : 0,
+                        -1, false});
+  }
+}
+
+void IncrementalOverlaps::onUpdateSynapsePermanence(Synapse synapse,
+                                                    Permanence permanence)
+{
+  // Called before the permanence is changed.
+  const SynapseData& synapseData = connections_.dataForSynapse(synapse);
+  if (isActive_(synapseData.presynapticCell))
+  {
+    const bool wasConnected = isConnected_(synapseData.permanence);
+    const bool isConnected = isConnected_(permanence);
+    if (wasConnected != isConnected)
+    {
+      pending_.push_back({synapseData.segment,
+                          isConnected ? 1 : -1, 0, false});
+    }
+  }
+}
+
+void IncrementalOverlaps::reserve(UInt numSegments)
+{
+  touchedStamp_.reserve(numSegments);
+  touched_.reserve(numSegments);
+  added_.reserve(numSegments);
+}
+
+size_t IncrementalOverlaps::memoryUsage() const
+{
+  return vectorBytes(input_) + vectorBytes(pending_) +
+    vectorBytes(activeSegments_) + vectorBytes(matchingSegments_) +
+    vectorBytes(touchedStamp_) + vectorBytes(touched_) +
+    vectorBytes(added_) + vectorBytes(merged_);
+}
+
+void IncrementalOverlaps::invalidate()
+{
+  valid_ = false;
+  pending_.clear();
+}
+
+void IncrementalOverlaps::compute(
+  vector<UInt32>& overlaps,
+  vector<Segment>& activeSegments,
+  vector<UInt32>& potentialOverlaps,
+  vector<Segment>& matchingSegments,
+  const CellIdx* activeInputBegin,
+  const CellIdx* activeInputEnd,
+  Permanence connectedPermanence,
+  UInt activationThreshold,
+  UInt minThreshold)
+{
+  if (!valid_ ||
+      connectedPermanence != connectedPermanence_ ||
+      activationThreshold != activationThreshold_ ||
+      minThreshold != minThreshold_)
+  {
+    calculateOverlaps(overlaps, activeSegments_,
+                      potentialOverlaps, matchingSegments_,
+                      activeInputBegin, activeInputEnd,
+                      connections_, nullptr,
+                      connectedPermanence, activationThreshold,
+                      minThreshold);
+
+    input_.assign(activeInputBegin, activeInputEnd);
+    pending_.clear();
+    connectedPermanence_ = connectedPermanence;
+    activationThreshold_ = activationThreshold;
+    minThreshold_ = minThreshold;
+    valid_ = true;
+  }
+  else
+  {
+    update_(overlaps, potentialOverlaps, activeInputBegin, activeInputEnd);
+  }
+
+  activeSegments = activeSegments_;
+  matchingSegments = matchingSegments_;
+}
+
+bool IncrementalOverlaps::isActive_(CellIdx cell) const
+{
+  return valid_ && std::binary_search(input_.begin(), input_.end(), cell);
+}
+
+bool IncrementalOverlaps::isConnected_(Permanence permanence) const
+{
+  return permanence >= connectedPermanence_ - CONNECTED_EPSILON;
+}
+
+void IncrementalOverlaps::touch_(Segment segment)
+{
+  if (touchedStamp_[segment] != stamp_)
+  {
+    touchedStamp_[segment] = stamp_;
+    touched_.push_back(segment);
+  }
+}
+
+void IncrementalOverlaps::applyCell_(vector<UInt32>& overlaps,
+                                     vector<UInt32>& potentialOverlaps,
+                                     CellIdx cell, Int32 delta)
+{
+  for (Synapse synapse : connections_.synapsesForPresynapticCell(cell))
+  {
+    const SynapseData& synapseData = connections_.dataForSynapse(synapse);
+    potentialOverlaps[synapseData.segment] += delta;
+    if (isConnected_(synapseData.permanence))
+    {
+      overlaps[synapseData.segment] += delta;
+    }
+    touch_(synapseData.segment);
+  }
+}
+
+void IncrementalOverlaps::update_(vector<UInt32>& overlaps,
+                                  vector<UInt32>& potentialOverlaps,
+                                  const CellIdx* activeInputBegin,
+                                  const CellIdx* activeInputEnd)
+{
+  const UInt32 length = connections_.segmentFlatListLength();
+  overlaps.resize(length, 0);
+  potentialOverlaps.resize(length, 0);
+  resizeCounted(touchedStamp_, length, (UInt64)0, numReallocations_);
+  stamp_++;
+  touched_.clear();
+
+  // Changes from learning, relative to the previous input.
+  for (const OverlapChange& change : pending_)
+  {
+    if (change.reset)
+    {
+      overlaps[change.segment] = 0;
+      potentialOverlaps[change.segment] = 0;
+    }
+    else
+    {
+      overlaps[change.segment] += change.overlapDelta;
+      potentialOverlaps[change.segment] += change.potentialOverlapDelta;
+    }
+    touch_(change.segment);
+  }
+  pending_.clear();
+
+  // Changes from the input.
+  auto previous = input_.begin();
+  auto current = activeInputBegin;
+  while (previous != input_.end() || current != activeInputEnd)
+  {
+    if (current == activeInputEnd ||
+        (previous != input_.end() && *previous < *current))
+    {
+      applyCell_(overlaps, potentialOverlaps, *previous++, -1);
+    }
+    else if (previous == input_.end() || *current < *previous)
+    {
+      applyCell_(overlaps, potentialOverlaps, *current++, 1);
+    }
+    else
+    {
+      previous++;
+      current++;
+    }
+  }
+  input_.assign(activeInputBegin, activeInputEnd);
+
+  // Only the touched segments can have entered or left the active and
+  // matching sets.
+  {
+    NTA_ATTM_TIME_PHASE(SORT_SEGMENTS);
+    std::sort(touched_.begin(), touched_.end(),
+              [&](Segment a, Segment b)
+              {
+                return connections_.compareSegments(a, b);
+              });
+  }
+  updateSegments_(activeSegments_, overlaps, activationThreshold_);
+  updateSegments_(matchingSegments_, potentialOverlaps, minThreshold_);
+}
+
+void IncrementalOverlaps::updateSegments_(vector<Segment>& segments,
+                                          const vector<UInt32>& overlaps,
+                                          UInt threshold)
+{
+  segments.erase(
+    std::remove_if(segments.begin(), segments.end(),
+                   [&](Segment segment)
+                   {
+                     return touchedStamp_[segment] == stamp_;
+                   }),
+    segments.end());
+
+  added_.clear();
+  for (Segment segment : touched_)
+  {
+    if (overlaps[segment] >= threshold)
+    {
+      added_.push_back(segment);
+    }
+  }
+
+  if (!added_.empty())
+  {
+    merged_.clear();
+    std::merge(segments.begin(), segments.end(),
+               added_.begin(), added_.end(),
+               std::back_inserter(merged_),
+               [&](Segment a, Segment b)
+               {
+                 return connections_.compareSegments(a, b);
+               });
+    segments.swap(merged_);
+  }
+}
@@ -0,0 +1,230 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+
+/** @file
+ * Declarations for computing segment overlaps, from scratch or
+ * incrementally
+ */
+
+#ifndef NTA_INCREMENTAL_OVERLAPS_HPP
+#define NTA_INCREMENTAL_OVERLAPS_HPP
+
+#include <algorithm>
+#include <vector>
+
+#include <nupic/algorithms/Connections.hpp>
+#include <nupic/experimental/PhaseTimer.hpp>
+#include <nupic/experimental/PresynapticCellIndex.hpp>
+#include <nupic/types/Types.hpp>
+
+namespace nupic {
+  namespace experimental {
+    namespace apical_tiebreak_temporal_memory {
+
+      using namespace algorithms::connections;
+
+      /**
+       * Computes the overlaps of every segment with the active input, and
+       * the active and matching segments in the order of
+       * compareSegments. ConnectionsT is a Connections or a
+       * FrozenConnections.
+       *
+       * If a cellIndex is given, it's used instead of the Connections, and
+       * the overlaps of segments that can't be active or matching aren't
+       * computed.
+       */
+      template <typename ConnectionsT>
+      void calculateOverlaps(
+        std::vector<UInt32>& overlaps,
+        std::vector<Segment>& activeSegments,
+        std::vector<UInt32>& potentialOverlaps,
+        std::vector<Segment>& matchingSegments,
+        const CellIdx* activeInputBegin,
+        const CellIdx* activeInputEnd,
+        const ConnectionsT& connections,
+        const PresynapticCellIndex* cellIndex,
+        Permanence connectedPermanence,
+        UInt activationThreshold,
+        UInt minThreshold)
+      {
+        const UInt32 length = connections.segmentFlatListLength();
+        overlaps.assign(length, 0);
+        potentialOverlaps.assign(length, 0);
+
+        if (cellIndex != nullptr)
+        {
+          for (auto cell = activeInputBegin; cell != activeInputEnd; cell++)
+          {
+            cellIndex->computeActivity(overlaps, potentialOverlaps, *cell);
+          }
+        }
+        else
+        {
+          for (auto cell = activeInputBegin; cell != activeInputEnd; cell++)
+          {
+            connections.computeActivity(overlaps, potentialOverlaps,
+                                        *cell, connectedPermanence);
+          }
+        }
+
+        // Active segments, connected synapses.
+        activeSegments.clear();
+        for (Segment segment = 0;
+             segment < overlaps.size();
+             segment++)
+        {
+          if (overlaps[segment] >= activationThreshold)
+          {
+            activeSegments.push_back(segment);
+          }
+        }
+        {
+          NTA_ATTM_TIME_PHASE(SORT_SEGMENTS);
+          std::sort(activeSegments.begin(), activeSegments.end(),
+                    [&](Segment a, Segment b)
+                    {
+                      return connections.compareSegments(a, b);
+                    });
+        }
+
+        // Matching segments, potential synapses.
+        matchingSegments.clear();
+        for (Segment segment = 0;
+             segment < potentialOverlaps.size();
+             segment++)
+        {
+          if (potentialOverlaps[segment] >= minThreshold)
+          {
+            matchingSegments.push_back(segment);
+          }
+        }
+        {
+          NTA_ATTM_TIME_PHASE(SORT_SEGMENTS);
+          std::sort(matchingSegments.begin(), matchingSegments.end(),
+                    [&](Segment a, Segment b)
+                    {
+                      return connections.compareSegments(a, b);
+                    });
+        }
+      }
+
+      /**
+       * Keeps a Connections' segment overlaps up to date between time steps.
+       * Each step it applies the difference from the previous input, i.e.
+       * +1 / -1 for the synapses of added / removed cells, plus any synapse
+       * changes from learning. The cost is proportional to the input churn
+       * rather than the number of segments.
+       *
+       * The overlap vectors are the caller's, and they must not be modified
+       * between calls. Synapse events are queued and applied at the start of
+       * the next compute, so the overlaps don't change while the caller is
+       * learning on them.
+       */
+      class IncrementalOverlaps : public ConnectionsEventHandler
+      {
+      public:
+        IncrementalOverlaps(const Connections& connections,
+                            UInt64& numReallocations);
+
+        virtual void onCreateSegment(Segment segment) override;
+        virtual void onDestroySegment(Segment segment) override;
+        virtual void onCreateSynapse(Synapse synapse) override;
+        virtual void onDestroySynapse(Synapse synapse) override;
+        virtual void onUpdateSynapsePermanence(Synapse synapse,
+                                               Permanence permanence) override;
+
+        /**
+         * Reserves storage for numSegments segments.
+         */
+        void reserve(UInt numSegments);
+
+        size_t memoryUsage() const;
+
+        /**
+         * Forget the previous input. The next compute starts from scratch.
+         */
+        void invalidate();
+
+        /**
+         * Same outputs as calculateOverlaps.
+         */
+        void compute(
+          std::vector<UInt32>& overlaps,
+          std::vector<Segment>& activeSegments,
+          std::vector<UInt32>& potentialOverlaps,
+          std::vector<Segment>& matchingSegments,
+          const CellIdx* activeInputBegin,
+          const CellIdx* activeInputEnd,
+          Permanence connectedPermanence,
+          UInt activationThreshold,
+          UInt minThreshold);
+
+      private:
+        struct OverlapChange
+        {
+          Segment segment;
+          Int32 overlapDelta;
+          Int32 potentialOverlapDelta;
+          bool reset;
+        };
+
+        bool isActive_(CellIdx cell) const;
+        bool isConnected_(Permanence permanence) const;
+        void touch_(Segment segment);
+        void applyCell_(std::vector<UInt32>& overlaps,
+                        std::vector<UInt32>& potentialOverlaps,
+                        CellIdx cell, Int32 delta);
+        void update_(std::vector<UInt32>& overlaps,
+                     std::vector<UInt32>& potentialOverlaps,
+                     const CellIdx* activeInputBegin,
+                     const CellIdx* activeInputEnd);
+        void updateSegments_(std::vector<Segment>& segments,
+                             const std::vector<UInt32>& overlaps,
+                             UInt threshold);
+
+        const Connections& connections_;
+
+        bool valid_;
+        Permanence connectedPermanence_;
+        UInt activationThreshold_;
+        UInt minThreshold_;
+
+        std::vector<CellIdx> input_;
+        std::vector<OverlapChange> pending_;
+        std::vector<Segment> activeSegments_;
+        std::vector<Segment> matchingSegments_;
+
+        std::vector<UInt64> touchedStamp_;
+        UInt64 stamp_;
+        std::vector<Segment> touched_;
+        std::vector<Segment> added_;
+        std::vector<Segment> merged_;
+
+        UInt64& numReallocations_;
+      };
+
+    } // end namespace apical_tiebreak_temporal_memory
+  } // end namespace experimental
+} // end namespace nupic
+
+#endif // NTA_INCREMENTAL_OVERLAPS_HPP
@@ -0,0 +1,110 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+
+/** @file
+ * Helpers shared by the ApicalTiebreakTemporalMemory and the indexes it
+ * keeps of its Connections
+ */
+
+#ifndef NTA_INDEX_UTILS_HPP
+#define NTA_INDEX_UTILS_HPP
+
+#include <vector>
+
+#include <nupic/algorithms/Connections.hpp>
+#include <nupic/types/Types.hpp>
+#include <nupic/utils/Log.hpp>
+
+namespace nupic {
+  namespace experimental {
+    namespace apical_tiebreak_temporal_memory {
+
+      using namespace algorithms::connections;
+
+      // Matches the tolerance used by Connections::computeActivity.
+      const Permanence CONNECTED_EPSILON = 0.00001;
+
+      // Position of a synapse that an index isn't tracking.
+      const UInt32 NOT_INDEXED = (UInt32)-1;
+
+      /**
+       * Resizes the vector, counting it if that reallocates its storage.
+       */
+      template <typename T>
+      void resizeCounted(std::vector<T>& v, size_t size, const T& value,
+                         UInt64& numReallocations)
+      {
+        if (size > v.capacity())
+        {
+          numReallocations++;
+        }
+        v.resize(size, value);
+      }
+
+      template <typename T>
+      void pushBackCounted(std::vector<T>& v, const T& value,
+                           UInt64& numReallocations)
+      {
+        if (v.size() == v.capacity())
+        {
+          numReallocations++;
+        }
+        v.push_back(value);
+      }
+
+      /**
+       * The bytes allocated by the vector, not counting what its elements
+       * allocate.
+       */
+      template <typename T>
+      size_t vectorBytes(const std::vector<T>& v)
+      {
+        return v.capacity() * sizeof(T);
+      }
+
+      inline size_t vectorBytes(const std::vector<bool>& v)
+      {
+        return (v.capacity() + 7) / 8;
+      }
+
+      /**
+       * Moves one entry of a histogram from one bucket to another, growing
+       * it as needed.
+       */
+      inline void moveHistogramEntry(std::vector<UInt64>& histogram,
+                                     size_t from, size_t to)
+      {
+        NTA_ASSERT(from < histogram.size() && histogram[from] > 0);
+        histogram[from]--;
+        if (to >= histogram.size())
+        {
+          histogram.resize(to + 1, 0);
+        }
+        histogram[to]++;
+      }
+
+    } // end namespace apical_tiebreak_temporal_memory
+  } // end namespace experimental
+} // end namespace nupic
+
+#endif // NTA_INDEX_UTILS_HPP
@@ -0,0 +1,136 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+
+/** @file
+ * Implementation of read-only memory mapped files
+ */
+
+#include <nupic/experimental/MappedFile.hpp>
+#include <nupic/utils/Log.hpp>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace nupic::experimental;
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& path)
+  : data_(nullptr),
+    size_(0),
+    fileHandle_(INVALID_HANDLE_VALUE),
+    mappingHandle_(nullptr)
+{
+  fileHandle_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  NTA_CHECK(fileHandle_ != INVALID_HANDLE_VALUE) << "Couldn't open " << path;
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(fileHandle_, &size))
+  {
+    CloseHandle(fileHandle_);
+    NTA_THROW << "Couldn't get the size of " << path;
+  }
+  size_ = (size_t)size.QuadPart;
+
+  // A file can't be mapped if it's empty.
+  if (size_ > 0)
+  {
+    mappingHandle_ = CreateFileMappingA(fileHandle_, nullptr, PAGE_READONLY,
+                                        0, 0, nullptr);
+    if (mappingHandle_ != nullptr)
+    {
+      data_ = (const char*)MapViewOfFile(mappingHandle_, FILE_MAP_READ,
+                                         0, 0, 0);
+    }
+    if (data_ == nullptr)
+    {
+      if (mappingHandle_ != nullptr)
+      {
+        CloseHandle(mappingHandle_);
+      }
+      CloseHandle(fileHandle_);
+      NTA_THROW << "Couldn't map " << path;
+    }
+  }
+}
+
+MappedFile::~MappedFile()
+{
+  if (data_ != nullptr)
+  {
+    UnmapViewOfFile(data_);
+    CloseHandle(mappingHandle_);
+  }
+  CloseHandle(fileHandle_);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path)
+  : data_(nullptr),
+    size_(0)
+{
+  const int fd = open(path.c_str(), O_RDONLY);
+  NTA_CHECK(fd >= 0) << "Couldn't open " << path;
+
+  struct stat status;
+  if (fstat(fd, &status) != 0)
+  {
+    close(fd);
+    NTA_THROW << "Couldn't get the size of " << path;
+  }
+  size_ = (size_t)status.st_size;
+
+  // A file can't be mapped if it's empty.
+  if (size_ > 0)
+  {
+    void* data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+    {
+      close(fd);
+      NTA_THROW << "Couldn't map " << path;
+    }
+    data_ = (const char*)data;
+  }
+
+  // The mapping keeps the file open.
+  close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+  if (data_ != nullptr)
+  {
+    munmap((void*)data_, size_);
+  }
+}
+
+#endif
@@ -0,0 +1,78 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+
+/** @file
+ * Declarations for read-only memory mapped files
+ */
+
+#ifndef NTA_MAPPED_FILE_HPP
+#define NTA_MAPPED_FILE_HPP
+
+#include <string>
+
+namespace nupic {
+  namespace experimental {
+
+    /**
+     * A file mapped read-only into memory. The pages are loaded by the OS as
+     * they're read and they're shared with other processes mapping the file,
+     * so mapping a large file is cheap until it's used.
+     *
+     * The mapping is page aligned. It stays valid until the MappedFile is
+     * destroyed, and the file must not be modified in the meantime.
+     */
+    class MappedFile
+    {
+    public:
+      /**
+       * Maps the whole file, throwing if it can't be opened or mapped.
+       */
+      MappedFile(const std::string& path);
+      ~MappedFile();
+
+      const char* data() const
+      {
+        return data_;
+      }
+
+      size_t size() const
+      {
+        return size_;
+      }
+
+    private:
+      MappedFile(const MappedFile&) = delete;
+      MappedFile& operator=(const MappedFile&) = delete;
+
+      const char* data_;
+      size_t size_;
+#ifdef _WIN32
+      void* fileHandle_;
+      void* mappingHandle_;
+#endif
+    };
+
+  } // end namespace experimental
+} // end namespace nupic
+
+#endif // NTA_MAPPED_FILE_HPP
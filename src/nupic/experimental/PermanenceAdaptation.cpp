@@ -0,0 +1,215 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+/** @file
+ * Implementation of the permanence adaptation kernels
+ *
+ * The AVX2 kernel is compiled with a function-level target attribute, so
+ * this file doesn't need any special compiler flags, and it's only called
+ * if the CPU supports AVX2. Both kernels compute exactly the same results:
+ * the decrement is applied as an addition of its negation, and the clamping
+ * uses the same comparisons.
+ */
+
+#include <algorithm>
+
+#include <nupic/experimental/PermanenceAdaptation.hpp>
+#include <nupic/utils/Log.hpp>
+
+// MinGW doesn't keep the stack 32-byte aligned, which AVX spills rely on.
+#if (defined(__GNUC__) || defined(__clang__)) && \
+  (defined(__x86_64__) || defined(__i386__)) && !defined(__MINGW32__)
+#define NTA_PERMANENCE_ADAPTATION_AVX2
+#include <immintrin.h>
+#endif
+
+using namespace nupic;
+using namespace nupic::experimental::permanence_adaptation;
+
+static inline UInt32 adaptPermanencesRange(
+  Real32* adaptedPermanences,
+  unsigned char* destroy,
+  const UInt32* presynapticCells,
+  const Real32* permanences,
+  size_t begin,
+  size_t end,
+  const unsigned char* activeInputDense,
+  Real32 permanenceIncrement,
+  Real32 permanenceDecrement,
+  Real32 destroyThreshold)
+{
+  const Real32 negativeDecrement = -permanenceDecrement;
+
+  UInt32 numDestroyed = 0;
+  for (size_t i = begin; i < end; i++)
+  {
+    Real32 permanence = permanences[i] +
+      (activeInputDense[presynapticCells[i]]
+       ? permanenceIncrement
+       : negativeDecrement);
+
+    permanence = std::min(permanence, (Real32)1.0);
+    permanence = std::max(permanence, (Real32)0.0);
+
+    adaptedPermanences[i] = permanence;
+    destroy[i] = (permanence < destroyThreshold);
+    numDestroyed += destroy[i];
+  }
+
+  return numDestroyed;
+}
+
+UInt32 nupic::experimental::permanence_adaptation::adaptPermanencesScalar(
+  Real32* adaptedPermanences,
+  unsigned char* destroy,
+  const UInt32* presynapticCells,
+  const Real32* permanences,
+  size_t numSynapses,
+  const unsigned char* activeInputDense,
+  Real32 permanenceIncrement,
+  Real32 permanenceDecrement,
+  Real32 destroyThreshold)
+{
+  return adaptPermanencesRange(adaptedPermanences, destroy,
+                               presynapticCells, permanences,
+                               0, numSynapses, activeInputDense,
+                               permanenceIncrement, permanenceDecrement,
+                               destroyThreshold);
+}
+
+#ifdef NTA_PERMANENCE_ADAPTATION_AVX2
+
+__attribute__((target("avx2")))
+UInt32 nupic::experimental::permanence_adaptation::adaptPermanencesAvx2(
+  Real32* adaptedPermanences,
+  unsigned char* destroy,
+  const UInt32* presynapticCells,
+  const Real32* permanences,
+  size_t numSynapses,
+  const unsigned char* activeInputDense,
+  Real32 permanenceIncrement,
+  Real32 permanenceDecrement,
+  Real32 destroyThreshold)
+{
+  const __m256 increment = _mm256_set1_ps(permanenceIncrement);
+  const __m256 negativeDecrement = _mm256_set1_ps(-permanenceDecrement);
+  const __m256 one = _mm256_set1_ps(1.0);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 threshold = _mm256_set1_ps(destroyThreshold);
+  const __m256i lowByte = _mm256_set1_epi32(0xFF);
+
+  UInt32 numDestroyed = 0;
+  size_t i = 0;
+  for (; i + 8 <= numSynapses; i += 8)
+  {
+    // Gather the 4-byte word starting at each presynaptic cell's byte and
+    // keep the first byte.
+    const __m256i cells = _mm256_loadu_si256(
+      (const __m256i*)(presynapticCells + i));
+    const __m256i active = _mm256_and_si256(
+      _mm256_i32gather_epi32((const int*)activeInputDense, cells, 1),
+      lowByte);
+    const __m256 isActive = _mm256_castsi256_ps(
+      _mm256_cmpgt_epi32(active, _mm256_setzero_si256()));
+
+    __m256 permanence = _mm256_add_ps(
+      _mm256_loadu_ps(permanences + i),
+      _mm256_blendv_ps(negativeDecrement, increment, isActive));
+    permanence = _mm256_min_ps(permanence, one);
+    permanence = _mm256_max_ps(permanence, zero);
+    _mm256_storeu_ps(adaptedPermanences + i, permanence);
+
+    const int destroyBits = _mm256_movemask_ps(
+      _mm256_cmp_ps(permanence, threshold, _CMP_LT_OQ));
+    for (int lane = 0; lane < 8; lane++)
+    {
+      destroy[i + lane] = (destroyBits >> lane) & 1;
+    }
+    numDestroyed += __builtin_popcount(destroyBits);
+  }
+
+  return numDestroyed +
+    adaptPermanencesRange(adaptedPermanences, destroy,
+                          presynapticCells, permanences,
+                          i, numSynapses, activeInputDense,
+                          permanenceIncrement, permanenceDecrement,
+                          destroyThreshold);
+}
+
+static bool detectAvx2()
+{
+  // Needed in case this runs during static initialization.
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+
+bool nupic::experimental::permanence_adaptation::avx2Supported()
+{
+  static const bool supported = detectAvx2();
+  return supported;
+}
+
+#else
+
+UInt32 nupic::experimental::permanence_adaptation::adaptPermanencesAvx2(
+  Real32* adaptedPermanences,
+  unsigned char* destroy,
+  const UInt32* presynapticCells,
+  const Real32* permanences,
+  size_t numSynapses,
+  const unsigned char* activeInputDense,
+  Real32 permanenceIncrement,
+  Real32 permanenceDecrement,
+  Real32 destroyThreshold)
+{
+  NTA_THROW << "adaptPermanencesAvx2: Not available in this build";
+}
+
+bool nupic::experimental::permanence_adaptation::avx2Supported()
+{
+  return false;
+}
+
+#endif // NTA_PERMANENCE_ADAPTATION_AVX2
+
+UInt32 nupic::experimental::permanence_adaptation::adaptPermanences(
+  Real32* adaptedPermanences,
+  unsigned char* destroy,
+  const UInt32* presynapticCells,
+  const Real32* permanences,
+  size_t numSynapses,
+  const unsigned char* activeInputDense,
+  Real32 permanenceIncrement,
+  Real32 permanenceDecrement,
+  Real32 destroyThreshold)
+{
+  typedef UInt32 (*Kernel)(Real32*, unsigned char*, const UInt32*,
+                           const Real32*, size_t, const unsigned char*,
+                           Real32, Real32, Real32);
+  static const Kernel kernel = avx2Supported()
+    ? adaptPermanencesAvx2
+    : adaptPermanencesScalar;
+
+  return kernel(adaptedPermanences, destroy, presynapticCells, permanences,
+                numSynapses, activeInputDense,
+                permanenceIncrement, permanenceDecrement, destroyThreshold);
+}
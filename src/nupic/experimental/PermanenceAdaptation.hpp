@@ -0,0 +1,117 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef NTA_PERMANENCE_ADAPTATION_HPP
+#define NTA_PERMANENCE_ADAPTATION_HPP
+
+#include <cstddef>
+
+#include <nupic/types/Types.hpp>
+
+namespace nupic {
+  namespace experimental {
+    namespace permanence_adaptation {
+
+      /**
+       * The number of bytes after the last input bit that the active input
+       * array must have. The vectorized kernel reads each input bit as part
+       * of a 4-byte word.
+       */
+      const size_t ACTIVE_INPUT_PADDING = sizeof(UInt32) - 1;
+
+      /**
+       * Computes the reinforced permanences of a segment's synapses.
+       *
+       * Each permanence is incremented if its presynaptic cell is active and
+       * decremented otherwise, then clamped to [0.0, 1.0]. The results are
+       * written to a separate array, so the caller can compare them with the
+       * old permanences, and no synapse is modified.
+       *
+       * @param adaptedPermanences
+       * Output array of numSynapses permanences.
+       *
+       * @param destroy
+       * Output array of numSynapses flags. A flag is 1 if the adapted
+       * permanence is below destroyThreshold, otherwise 0.
+       *
+       * @param presynapticCells
+       * The presynaptic cell of each synapse.
+       *
+       * @param permanences
+       * The permanence of each synapse.
+       *
+       * @param activeInputDense
+       * One byte per input cell, nonzero if the cell is active. It must be
+       * followed by ACTIVE_INPUT_PADDING readable bytes.
+       *
+       * @return
+       * The number of synapses flagged for destruction.
+       */
+      UInt32 adaptPermanences(
+        Real32* adaptedPermanences,
+        unsigned char* destroy,
+        const UInt32* presynapticCells,
+        const Real32* permanences,
+        size_t numSynapses,
+        const unsigned char* activeInputDense,
+        Real32 permanenceIncrement,
+        Real32 permanenceDecrement,
+        Real32 destroyThreshold);
+
+      /**
+       * The implementations that adaptPermanences chooses from, depending on
+       * what the CPU supports. They're exposed for testing.
+       */
+      UInt32 adaptPermanencesScalar(
+        Real32* adaptedPermanences,
+        unsigned char* destroy,
+        const UInt32* presynapticCells,
+        const Real32* permanences,
+        size_t numSynapses,
+        const unsigned char* activeInputDense,
+        Real32 permanenceIncrement,
+        Real32 permanenceDecrement,
+        Real32 destroyThreshold);
+
+      /**
+       * Only valid to call if avx2Supported() is true.
+       */
+      UInt32 adaptPermanencesAvx2(
+        Real32* adaptedPermanences,
+        unsigned char* destroy,
+        const UInt32* presynapticCells,
+        const Real32* permanences,
+        size_t numSynapses,
+        const unsigned char* activeInputDense,
+        Real32 permanenceIncrement,
+        Real32 permanenceDecrement,
+        Real32 destroyThreshold);
+
+      /**
+       * Whether this build has an AVX2 kernel and the CPU supports it.
+       */
+      bool avx2Supported();
+    }
+  }
+}
+
+#endif // NTA_PERMANENCE_ADAPTATION_HPP
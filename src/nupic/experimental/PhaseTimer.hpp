@@ -0,0 +1,138 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+
+/** @file
+ * Macros for the ApicalTiebreakTemporalMemoryStats, shared by the
+ * ApicalTiebreakTemporalMemory and its indexes. They're no-ops unless the
+ * library is built with NTA_ATTM_STATS.
+ */
+
+#ifndef NTA_PHASE_TIMER_HPP
+#define NTA_PHASE_TIMER_HPP
+
+#ifdef NTA_ATTM_STATS
+
+#include <chrono>
+
+#include <nupic/experimental/ApicalTiebreakTemporalMemory.hpp>
+#include <nupic/experimental/Tracing.hpp>
+
+namespace nupic {
+  namespace experimental {
+    namespace apical_tiebreak_temporal_memory {
+
+      // The stats of the TM that's computing on this thread, or nullptr if
+      // it isn't collecting stats. This avoids passing the stats to every
+      // helper.
+      extern thread_local ApicalTiebreakTemporalMemoryStats* currentStats;
+
+      /**
+       * Sets the currentStats for its lifetime.
+       */
+      class StatsScope
+      {
+      public:
+        StatsScope(ApicalTiebreakTemporalMemoryStats* stats)
+          : previous_(currentStats)
+        {
+          currentStats = stats;
+        }
+
+        ~StatsScope()
+        {
+          currentStats = previous_;
+        }
+
+      private:
+        ApicalTiebreakTemporalMemoryStats* previous_;
+      };
+
+      /**
+       * Adds its lifetime to a phase of the currentStats, and records it as
+       * a trace event if tracing.
+       */
+      class PhaseTimer
+      {
+      public:
+        PhaseTimer(ApicalTiebreakTemporalMemoryStats::Phase phase)
+          : stats_(currentStats), phase_(phase),
+            traceScope_(ApicalTiebreakTemporalMemoryStats::phaseName(phase))
+        {
+          if (stats_ != nullptr)
+          {
+            start_ = std::chrono::steady_clock::now();
+          }
+        }
+
+        ~PhaseTimer()
+        {
+          if (stats_ != nullptr)
+          {
+            stats_->calls[phase_]++;
+            stats_->nanoseconds[phase_] +=
+              std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start_).count();
+          }
+        }
+
+      private:
+        ApicalTiebreakTemporalMemoryStats* stats_;
+        ApicalTiebreakTemporalMemoryStats::Phase phase_;
+        std::chrono::steady_clock::time_point start_;
+        tracing::Scope traceScope_;
+      };
+
+    } // end namespace apical_tiebreak_temporal_memory
+  } // end namespace experimental
+} // end namespace nupic
+
+#define NTA_ATTM_STATS_SCOPE(stats)                                     \
+  nupic::experimental::apical_tiebreak_temporal_memory::StatsScope      \
+  statsScope(stats)
+#define NTA_ATTM_TRACE(name) \
+  nupic::experimental::tracing::Scope traceScope(name)
+#define NTA_ATTM_TIME_PHASE(phase)                                      \
+  nupic::experimental::apical_tiebreak_temporal_memory::PhaseTimer      \
+  phaseTimer(nupic::experimental::apical_tiebreak_temporal_memory::     \
+             ApicalTiebreakTemporalMemoryStats::phase)
+#define NTA_ATTM_COUNT(counter, n)                                      \
+  do                                                                    \
+  {                                                                     \
+    using nupic::experimental::apical_tiebreak_temporal_memory::        \
+      currentStats;                                                     \
+    if (currentStats != nullptr)                                        \
+    {                                                                   \
+      currentStats->counter += (n);                                     \
+    }                                                                   \
+  } while (false)
+
+#else
+
+#define NTA_ATTM_STATS_SCOPE(stats)
+#define NTA_ATTM_TRACE(name)
+#define NTA_ATTM_TIME_PHASE(phase)
+#define NTA_ATTM_COUNT(counter, n)
+
+#endif // NTA_ATTM_STATS
+
+#endif // NTA_PHASE_TIMER_HPP
@@ -0,0 +1,338 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+
+/** @file
+ * Implementation of indexing a Connections' synapses by presynaptic cell
+ */
+
+#include <nupic/experimental/IndexUtils.hpp>
+#include <nupic/experimental/PresynapticCellIndex.hpp>
+
+using namespace nupic;
+using namespace nupic::experimental::apical_tiebreak_temporal_memory;
+using std::vector;
+
+PresynapticCellIndex::PresynapticCellIndex(const Connections& connections,
+                                           Permanence connectedPermanence,
+                                           UInt activationThreshold,
+                                           UInt minThreshold,
+                                           UInt64& numReallocations)
+  : connections_(connections),
+    connectedPermanence_(connectedPermanence),
+    activationThreshold_(activationThreshold),
+    minThreshold_(minThreshold),
+    numSynapses_(0),
+    numReallocations_(numReallocations)
+{
+  rebuild();
+}
+
+void PresynapticCellIndex::onCreateSegment(Segment segment)
+{
+  if (segment >= counts_.size())
+  {
+    resizeCounted(counts_, segment + 1, SegmentCounts(), numReallocations_);
+  }
+
+  if (segment < cold_.size())
+  {
+    cold_[segment] = false;
+  }
+
+  counts_[segment] = SegmentCounts();
+  counts_[segment].eligible = isEligible_(segment);
+}
+
+void PresynapticCellIndex::onDestroySegment(Segment segment)
+{
+  if (counts_[segment].eligible)
+  {
+    for (Synapse synapse : connections_.synapsesForSegment(segment))
+    {
+      remove_(synapse);
+    }
+  }
+
+  numSynapses_ -= counts_[segment].numSynapses;
+  counts_[segment] = SegmentCounts();
+}
+
+void PresynapticCellIndex::onCreateSynapse(Synapse synapse)
+{
+  const SynapseData& synapseData = connections_.dataForSynapse(synapse);
+  SegmentCounts& counts = counts_[synapseData.segment];
+
+  counts.numSynapses++;
+  if (isConnected_(synapseData.permanence))
+  {
+    counts.numConnected++;
+  }
+  numSynapses_++;
+
+  if (counts.eligible)
+  {
+    add_(synapse);
+  }
+  else
+  {
+    updateEligibility_(synapseData.segment);
+  }
+}
+
+void PresynapticCellIndex::onDestroySynapse(Synapse synapse)
+{
+  const SynapseData& synapseData = connections_.dataForSynapse(synapse);
+  SegmentCounts& counts = counts_[synapseData.segment];
+
+  if (counts.numSynapses == 0)
+  {
+    // Already removed with its segment.
+    return;
+  }
+
+  counts.numSynapses--;
+  if (isConnected_(synapseData.permanence))
+  {
+    counts.numConnected--;
+  }
+  numSynapses_--;
+
+  if (counts.eligible)
+  {
+    remove_(synapse);
+    updateEligibility_(synapseData.segment);
+  }
+}
+
+void PresynapticCellIndex::onUpdateSynapsePermanence(Synapse synapse,
+                                                     Permanence permanence)
+{
+  const SynapseData& synapseData = connections_.dataForSynapse(synapse);
+  const bool wasConnected = isConnected_(synapseData.permanence);
+  const bool connected = isConnected_(permanence);
+  if (wasConnected == connected)
+  {
+    return;
+  }
+
+  SegmentCounts& counts = counts_[synapseData.segment];
+  if (connected)
+  {
+    counts.numConnected++;
+  }
+  else
+  {
+    counts.numConnected--;
+  }
+
+  // If the segment becomes eligible, its synapses are added with their
+  // current permanences, so set this one afterward.
+  updateEligibility_(synapseData.segment);
+  if (counts.eligible)
+  {
+    synapsesForCell_[synapseData.presynapticCell][
+      positionForSynapse_[synapse]].connected = connected;
+  }
+}
+
+void PresynapticCellIndex::setCold(Segment segment, bool cold)
+{
+  if (segment >= cold_.size())
+  {
+    resizeCounted(cold_, connections_.segmentFlatListLength(), false,
+                  numReallocations_);
+  }
+
+  if (cold_[segment] != cold)
+  {
+    cold_[segment] = cold;
+    updateEligibility_(segment);
+  }
+}
+
+size_t PresynapticCellIndex::memoryUsage() const
+{
+  size_t bytes = vectorBytes(synapsesForCell_) +
+    vectorBytes(positionForSynapse_) +
+    vectorBytes(counts_) +
+    vectorBytes(cold_);
+  for (const vector<Entry>& entries : synapsesForCell_)
+  {
+    bytes += vectorBytes(entries);
+  }
+  return bytes;
+}
+
+size_t PresynapticCellIndex::estimateMemoryUsage(size_t numSegments,
+                                                 size_t numSynapses,
+                                                 size_t numPresynapticCells)
+{
+  return numPresynapticCells * sizeof(vector<Entry>) +
+    numSynapses * (sizeof(Entry) + sizeof(UInt32)) +
+    numSegments * sizeof(SegmentCounts) + numSegments / 8;
+}
+
+void PresynapticCellIndex::reserve(UInt numSegments, size_t numSynapses,
+                                   UInt numPresynapticCells)
+{
+  counts_.reserve(numSegments);
+  cold_.reserve(numSegments);
+  positionForSynapse_.reserve(numSynapses);
+
+  if (numPresynapticCells > synapsesForCell_.size())
+  {
+    synapsesForCell_.resize(numPresynapticCells);
+  }
+  if (numPresynapticCells > 0)
+  {
+    const size_t synapsesPerCell =
+      (numSynapses + numPresynapticCells - 1) / numPresynapticCells;
+    for (vector<Entry>& entries : synapsesForCell_)
+    {
+      entries.reserve(synapsesPerCell);
+    }
+  }
+}
+
+void PresynapticCellIndex::setThresholds(Permanence connectedPermanence,
+                                         UInt activationThreshold,
+                                         UInt minThreshold)
+{
+  if (connectedPermanence != connectedPermanence_ ||
+      activationThreshold != activationThreshold_ ||
+      minThreshold != minThreshold_)
+  {
+    connectedPermanence_ = connectedPermanence;
+    activationThreshold_ = activationThreshold;
+    minThreshold_ = minThreshold;
+    rebuild();
+  }
+}
+
+void PresynapticCellIndex::rebuild()
+{
+  for (vector<Entry>& entries : synapsesForCell_)
+  {
+    entries.clear();
+  }
+  positionForSynapse_.clear();
+  counts_.assign(connections_.segmentFlatListLength(), SegmentCounts());
+  numSynapses_ = 0;
+
+  for (CellIdx cell = 0; cell < connections_.numCells(); cell++)
+  {
+    for (Segment segment : connections_.segmentsForCell(cell))
+    {
+      SegmentCounts& counts = counts_[segment];
+      for (Synapse synapse : connections_.synapsesForSegment(segment))
+      {
+        counts.numSynapses++;
+        if (isConnected_(connections_.dataForSynapse(synapse).permanence))
+        {
+          counts.numConnected++;
+        }
+      }
+      numSynapses_ += counts.numSynapses;
+
+      updateEligibility_(segment);
+    }
+  }
+}
+
+bool PresynapticCellIndex::isConnected_(Permanence permanence) const
+{
+  return permanence >= connectedPermanence_ - CONNECTED_EPSILON;
+}
+
+bool PresynapticCellIndex::isEligible_(Segment segment) const
+{
+  const SegmentCounts& counts = counts_[segment];
+  return (!isCold(segment) &&
+          (counts.numConnected >= activationThreshold_ ||
+           counts.numSynapses >= minThreshold_));
+}
+
+void PresynapticCellIndex::updateEligibility_(Segment segment)
+{
+  SegmentCounts& counts = counts_[segment];
+  const bool eligible = isEligible_(segment);
+  if (eligible == counts.eligible)
+  {
+    return;
+  }
+
+  counts.eligible = eligible;
+  for (Synapse synapse : connections_.synapsesForSegment(segment))
+  {
+    if (eligible)
+    {
+      add_(synapse);
+    }
+    else
+    {
+      remove_(synapse);
+    }
+  }
+}
+
+void PresynapticCellIndex::add_(Synapse synapse)
+{
+  const SynapseData& synapseData = connections_.dataForSynapse(synapse);
+
+  if (synapseData.presynapticCell >= synapsesForCell_.size())
+  {
+    resizeCounted(synapsesForCell_, synapseData.presynapticCell + 1,
+                  vector<Entry>(), numReallocations_);
+  }
+  if (synapse >= positionForSynapse_.size())
+  {
+    resizeCounted(positionForSynapse_, synapse + 1, NOT_INDEXED,
+                  numReallocations_);
+  }
+
+  vector<Entry>& entries = synapsesForCell_[synapseData.presynapticCell];
+  positionForSynapse_[synapse] = (UInt32)entries.size();
+  pushBackCounted(entries,
+                  Entry{synapseData.segment, synapse,
+                        isConnected_(synapseData.permanence)},
+                  numReallocations_);
+}
+
+// Connections may or may not report the synapses of a destroyed segment
+// individually, so removing is a no-op for unknown synapses.
+void PresynapticCellIndex::remove_(Synapse synapse)
+{
+  if (synapse < positionForSynapse_.size() &&
+      positionForSynapse_[synapse] != NOT_INDEXED)
+  {
+    vector<Entry>& entries = synapsesForCell_[
+      connections_.dataForSynapse(synapse).presynapticCell];
+
+    const UInt32 position = positionForSynapse_[synapse];
+    entries[position] = entries.back();
+    positionForSynapse_[entries[position].synapse] = position;
+    entries.pop_back();
+
+    positionForSynapse_[synapse] = NOT_INDEXED;
+  }
+}
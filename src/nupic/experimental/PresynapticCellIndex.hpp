@@ -0,0 +1,181 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+
+/** @file
+ * Declarations for indexing a Connections' synapses by presynaptic cell
+ */
+
+#ifndef NTA_PRESYNAPTIC_CELL_INDEX_HPP
+#define NTA_PRESYNAPTIC_CELL_INDEX_HPP
+
+#include <vector>
+
+#include <nupic/algorithms/Connections.hpp>
+#include <nupic/types/Types.hpp>
+
+namespace nupic {
+  namespace experimental {
+    namespace apical_tiebreak_temporal_memory {
+
+      using namespace algorithms::connections;
+
+      /**
+       * Tracks the synapses of a Connections by presynaptic cell, for the
+       * overlap computation, along with each segment's number of connected
+       * synapses and total number of synapses. Receives Connections events to
+       * stay up to date.
+       *
+       * Only the synapses of eligible segments are in the index. A segment
+       * with fewer than activationThreshold connected synapses can't become
+       * active, and one with fewer than minThreshold synapses can't match,
+       * so if both are true its overlaps are never used and it's left out.
+       * Segments move in and out of the index as their counts change. The
+       * thresholds are given to the index, and changing them rebuilds it.
+       *
+       * Segments can also be marked cold, which leaves them out of the index
+       * regardless of their counts.
+       */
+      class PresynapticCellIndex : public ConnectionsEventHandler
+      {
+      public:
+        PresynapticCellIndex(const Connections& connections,
+                             Permanence connectedPermanence,
+                             UInt activationThreshold,
+                             UInt minThreshold,
+                             UInt64& numReallocations);
+
+        virtual void onCreateSegment(Segment segment) override;
+        virtual void onDestroySegment(Segment segment) override;
+        virtual void onCreateSynapse(Synapse synapse) override;
+        virtual void onDestroySynapse(Synapse synapse) override;
+        virtual void onUpdateSynapsePermanence(Synapse synapse,
+                                               Permanence permanence) override;
+
+        bool isCold(Segment segment) const
+        {
+          return segment < cold_.size() && cold_[segment];
+        }
+
+        void setCold(Segment segment, bool cold);
+
+        /**
+         * Whether every synapse in the Connections is counted. This is a
+         * safety check in case an event was missed.
+         */
+        bool inSync() const
+        {
+          return numSynapses_ == connections_.numSynapses();
+        }
+
+        size_t memoryUsage() const;
+
+        /**
+         * Assumes every segment is eligible.
+         */
+        static size_t estimateMemoryUsage(size_t numSegments,
+                                          size_t numSynapses,
+                                          size_t numPresynapticCells);
+
+        /**
+         * Reserves storage for numSegments segments and numSynapses synapses
+         * on numPresynapticCells cells, assuming the synapses are spread
+         * evenly over the cells. The reservation is kept when the index is
+         * rebuilt.
+         */
+        void reserve(UInt numSegments, size_t numSynapses,
+                     UInt numPresynapticCells);
+
+        /**
+         * Rebuilds the index if any of the thresholds changed.
+         */
+        void setThresholds(Permanence connectedPermanence,
+                           UInt activationThreshold,
+                           UInt minThreshold);
+
+        void rebuild();
+
+        /**
+         * Equivalent to Connections::computeActivity with the
+         * connectedPermanence given to the index, except that the overlaps
+         * of ineligible segments aren't computed.
+         */
+        void computeActivity(
+          std::vector<UInt32>& numActiveConnectedSynapsesForSegment,
+          std::vector<UInt32>& numActivePotentialSynapsesForSegment,
+          CellIdx cell) const
+        {
+          if (cell < synapsesForCell_.size())
+          {
+            for (const Entry& entry : synapsesForCell_[cell])
+            {
+              ++numActivePotentialSynapsesForSegment[entry.segment];
+              numActiveConnectedSynapsesForSegment[entry.segment] +=
+                entry.connected;
+            }
+          }
+        }
+
+      private:
+        struct Entry
+        {
+          Segment segment;
+          Synapse synapse;
+          UInt32 connected;
+        };
+
+        struct SegmentCounts
+        {
+          SegmentCounts()
+            : numSynapses(0), numConnected(0), eligible(false)
+          {}
+
+          UInt32 numSynapses;
+          UInt32 numConnected;
+          bool eligible;
+        };
+
+        bool isConnected_(Permanence permanence) const;
+        bool isEligible_(Segment segment) const;
+        void updateEligibility_(Segment segment);
+        void add_(Synapse synapse);
+        void remove_(Synapse synapse);
+
+        const Connections& connections_;
+        Permanence connectedPermanence_;
+        UInt activationThreshold_;
+        UInt minThreshold_;
+        std::vector<std::vector<Entry>> synapsesForCell_;
+        std::vector<UInt32> positionForSynapse_;
+        std::vector<SegmentCounts> counts_;
+        UInt numSynapses_;
+        UInt64& numReallocations_;
+
+        // Kept when the index is rebuilt.
+        std::vector<bool> cold_;
+      };
+
+    } // end namespace apical_tiebreak_temporal_memory
+  } // end namespace experimental
+} // end namespace nupic
+
+#endif // NTA_PRESYNAPTIC_CELL_INDEX_HPP
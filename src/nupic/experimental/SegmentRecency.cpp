@@ -0,0 +1,148 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+
+/** @file
+ * Implementation of finding a Connections' least recently used segment
+ */
+
+#include <algorithm>
+
+#include <nupic/experimental/IndexUtils.hpp>
+#include <nupic/experimental/SegmentRecency.hpp>
+
+using namespace nupic;
+using namespace nupic::experimental::apical_tiebreak_temporal_memory;
+
+SegmentRecency::SegmentRecency(
+  const Connections& connections,
+  const std::vector<UInt64>& lastUsedIterationForSegment,
+  UInt64& numReallocations)
+  : connections_(connections),
+    lastUsedIterationForSegment_(lastUsedIterationForSegment),
+    numLive_(0),
+    numReallocations_(numReallocations)
+{
+  rebuild_();
+}
+
+void SegmentRecency::onCreateSegment(Segment segment)
+{
+  if (segment >= isLive_.size())
+  {
+    resizeCounted(isLive_, segment + 1, false, numReallocations_);
+  }
+  isLive_[segment] = true;
+  numLive_++;
+
+  // The TM sets the iteration after creating the segment, so push it with
+  // the earliest possible one.
+  push_(0, segment);
+
+  // Drop the out of date entries before they outnumber the segments.
+  if (heap_.size() > 2 * numLive_ + 16)
+  {
+    rebuild_();
+  }
+}
+
+void SegmentRecency::onDestroySegment(Segment segment)
+{
+  isLive_[segment] = false;
+  numLive_--;
+}
+
+Segment SegmentRecency::leastRecentlyUsed(UInt64& lastUsedIteration)
+{
+  while (!heap_.empty())
+  {
+    const Entry top = heap_.front();
+    if (top.segment < isLive_.size() && isLive_[top.segment])
+    {
+      const UInt64 current = lastUsedIteration_(top.segment);
+      if (current == top.lastUsedIteration)
+      {
+        lastUsedIteration = current;
+        return top.segment;
+      }
+
+      pop_();
+      push_(current, top.segment);
+    }
+    else
+    {
+      pop_();
+    }
+  }
+
+  return NOT_INDEXED;
+}
+
+void SegmentRecency::reserve(UInt numSegments)
+{
+  heap_.reserve(2 * (size_t)numSegments + 17);
+  isLive_.reserve(numSegments);
+}
+
+size_t SegmentRecency::memoryUsage() const
+{
+  return vectorBytes(heap_) + vectorBytes(isLive_);
+}
+
+UInt64 SegmentRecency::lastUsedIteration_(Segment segment) const
+{
+  return (segment < lastUsedIterationForSegment_.size())
+    ? lastUsedIterationForSegment_[segment]
+    : 0;
+}
+
+void SegmentRecency::push_(UInt64 lastUsedIteration, Segment segment)
+{
+  pushBackCounted(heap_, Entry{lastUsedIteration, segment},
+                  numReallocations_);
+  std::push_heap(heap_.begin(), heap_.end());
+}
+
+void SegmentRecency::pop_()
+{
+  std::pop_heap(heap_.begin(), heap_.end());
+  heap_.pop_back();
+}
+
+void SegmentRecency::rebuild_()
+{
+  heap_.clear();
+  isLive_.assign(connections_.segmentFlatListLength(), false);
+  numLive_ = 0;
+
+  for (CellIdx cell = 0; cell < connections_.numCells(); cell++)
+  {
+    for (Segment segment : connections_.segmentsForCell(cell))
+    {
+      isLive_[segment] = true;
+      numLive_++;
+      heap_.push_back({lastUsedIteration_(segment), segment});
+    }
+  }
+
+  std::make_heap(heap_.begin(), heap_.end());
+}
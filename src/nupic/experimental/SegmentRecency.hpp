@@ -0,0 +1,110 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+
+/** @file
+ * Declarations for finding a Connections' least recently used segment
+ */
+
+#ifndef NTA_SEGMENT_RECENCY_HPP
+#define NTA_SEGMENT_RECENCY_HPP
+
+#include <vector>
+
+#include <nupic/algorithms/Connections.hpp>
+#include <nupic/types/Types.hpp>
+
+namespace nupic {
+  namespace experimental {
+    namespace apical_tiebreak_temporal_memory {
+
+      using namespace algorithms::connections;
+
+      /**
+       * Finds the least recently used segment of a Connections, for evicting
+       * segments when the TM is over its synapse budget.
+       *
+       * The segments are kept in a heap ordered by last used iteration. The
+       * TM updates the last used iterations directly, so heap entries can be
+       * out of date. An entry is checked when it reaches the top of the heap:
+       * destroyed segments are dropped, and segments that have been used since
+       * are pushed again with their current iteration. Iterations only grow,
+       * so every live segment has an entry at or below its current iteration,
+       * and each entry is pushed again at most once per use.
+       */
+      class SegmentRecency : public ConnectionsEventHandler
+      {
+      public:
+        SegmentRecency(const Connections& connections,
+                       const std::vector<UInt64>& lastUsedIterationForSegment,
+                       UInt64& numReallocations);
+
+        virtual void onCreateSegment(Segment segment) override;
+        virtual void onDestroySegment(Segment segment) override;
+
+        /**
+         * Returns the least recently used segment, or NOT_INDEXED if there
+         * are no segments.
+         */
+        Segment leastRecentlyUsed(UInt64& lastUsedIteration);
+
+        /**
+         * Reserves storage for numSegments segments, including the out of
+         * date entries that the heap holds before it's rebuilt.
+         */
+        void reserve(UInt numSegments);
+
+        size_t memoryUsage() const;
+
+      private:
+        struct Entry
+        {
+          UInt64 lastUsedIteration;
+          Segment segment;
+
+          // Orders the heap with the least recently used on top.
+          bool operator<(const Entry& other) const
+          {
+            return (lastUsedIteration > other.lastUsedIteration ||
+                    (lastUsedIteration == other.lastUsedIteration &&
+                     segment > other.segment));
+          }
+        };
+
+        UInt64 lastUsedIteration_(Segment segment) const;
+        void push_(UInt64 lastUsedIteration, Segment segment);
+        void pop_();
+        void rebuild_();
+
+        const Connections& connections_;
+        const std::vector<UInt64>& lastUsedIterationForSegment_;
+        std::vector<Entry> heap_;
+        std::vector<bool> isLive_;
+        size_t numLive_;
+        UInt64& numReallocations_;
+      };
+
+    } // end namespace apical_tiebreak_temporal_memory
+  } // end namespace experimental
+} // end namespace nupic
+
+#endif // NTA_SEGMENT_RECENCY_HPP
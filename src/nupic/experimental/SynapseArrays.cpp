@@ -0,0 +1,332 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+
+/** @file
+ * Implementation of mirroring a Connections' synapses as per-segment arrays
+ */
+
+#include <nupic/experimental/SynapseArrays.hpp>
+
+using namespace nupic;
+using namespace nupic::experimental::apical_tiebreak_temporal_memory;
+using std::vector;
+
+SynapseArrays::SynapseArrays(Connections& connections,
+                             UInt64& numReallocations,
+                             ConnectionsLifecycleStats& lifecycleStats)
+  : connections_(connections),
+    numSynapses_(0),
+    synapsesPerSegment_(0),
+    numReallocations_(numReallocations),
+    lifecycleStats_(lifecycleStats),
+    lazy_(false),
+    connectedPermanence_(0.0)
+{
+  rebuild();
+}
+
+void SynapseArrays::onCreateSegment(Segment segment)
+{
+  if (segment >= segments_.size())
+  {
+    resizeCounted(segments_, segment + 1, SegmentSynapses(),
+                  numReallocations_);
+    resizeCounted(isStale_, segment + 1, false, numReallocations_);
+  }
+
+  clear_(segment);
+  reserveSegment_(segment);
+
+  // The segment has been added.
+  const UInt numSegments = connections_.numSegments(
+    connections_.dataForSegment(segment).cell);
+  moveHistogramEntry(lifecycleStats_.segmentsPerCell,
+                     numSegments - 1, numSegments);
+  if (lifecycleStats_.synapsesPerSegment.empty())
+  {
+    lifecycleStats_.synapsesPerSegment.push_back(0);
+  }
+  lifecycleStats_.synapsesPerSegment[0]++;
+}
+
+void SynapseArrays::onDestroySegment(Segment segment)
+{
+  // The segment hasn't been removed yet.
+  const UInt numSegments = connections_.numSegments(
+    connections_.dataForSegment(segment).cell);
+  moveHistogramEntry(lifecycleStats_.segmentsPerCell,
+                     numSegments, numSegments - 1);
+  lifecycleStats_.synapsesPerSegment[segments_[segment].synapses.size()]--;
+
+  clear_(segment);
+}
+
+void SynapseArrays::onCreateSynapse(Synapse synapse)
+{
+  const size_t numSynapses = add_(synapse);
+  moveHistogramEntry(lifecycleStats_.synapsesPerSegment,
+                     numSynapses - 1, numSynapses);
+}
+
+void SynapseArrays::onDestroySynapse(Synapse synapse)
+{
+  size_t numSynapses;
+  if (remove_(synapse, numSynapses))
+  {
+    moveHistogramEntry(lifecycleStats_.synapsesPerSegment,
+                       numSynapses + 1, numSynapses);
+  }
+}
+
+void SynapseArrays::onUpdateSynapsePermanence(Synapse synapse,
+                                              Permanence permanence)
+{
+  NTA_ASSERT(positionForSynapse_[synapse] != NOT_INDEXED);
+
+  const Segment segment = connections_.dataForSynapse(synapse).segment;
+  segments_[segment].permanences[positionForSynapse_[synapse]] = permanence;
+}
+
+void SynapseArrays::reserve(UInt numSegments, UInt synapsesPerSegment)
+{
+  segments_.reserve(numSegments);
+  isStale_.reserve(numSegments);
+  staleSegments_.reserve(numSegments);
+  positionForSynapse_.reserve((size_t)numSegments * synapsesPerSegment);
+
+  synapsesPerSegment_ = synapsesPerSegment;
+  for (Segment segment = 0; segment < segments_.size(); segment++)
+  {
+    reserveSegment_(segment);
+  }
+
+  adaptBuffers_.permanences.reserve(synapsesPerSegment);
+  adaptBuffers_.destroy.reserve(synapsesPerSegment);
+  adaptBuffers_.synapsesToDestroy.reserve(synapsesPerSegment);
+}
+
+void SynapseArrays::setLazy(bool lazy, Permanence connectedPermanence)
+{
+  if (lazy_ != lazy || connectedPermanence_ != connectedPermanence)
+  {
+    materialize();
+  }
+
+  lazy_ = lazy;
+  connectedPermanence_ = connectedPermanence;
+}
+
+void SynapseArrays::materialize()
+{
+  for (Segment segment : staleSegments_)
+  {
+    if (!isStale_[segment])
+    {
+      // Destroyed since.
+      continue;
+    }
+    isStale_[segment] = false;
+
+    const SegmentSynapses& segmentSynapses = segments_[segment];
+    for (size_t i = 0; i < segmentSynapses.synapses.size(); i++)
+    {
+      const Synapse synapse = segmentSynapses.synapses[i];
+      if (connections_.dataForSynapse(synapse).permanence !=
+          segmentSynapses.permanences[i])
+      {
+        connections_.updateSynapsePermanence(
+          synapse, segmentSynapses.permanences[i]);
+      }
+    }
+  }
+
+  staleSegments_.clear();
+}
+
+void SynapseArrays::copyTo(Connections& copy) const
+{
+  copy = Connections(connections_.numCells());
+
+  for (CellIdx cell = 0; cell < connections_.numCells(); cell++)
+  {
+    for (Segment segment : connections_.segmentsForCell(cell))
+    {
+      const Segment copySegment = copy.createSegment(cell);
+
+      const SegmentSynapses& segmentSynapses = segments_[segment];
+      for (size_t i = 0; i < segmentSynapses.synapses.size(); i++)
+      {
+        copy.createSynapse(copySegment,
+                           segmentSynapses.presynapticCells[i],
+                           segmentSynapses.permanences[i]);
+      }
+    }
+  }
+}
+
+size_t SynapseArrays::memoryUsage() const
+{
+  size_t bytes = vectorBytes(segments_) +
+    vectorBytes(positionForSynapse_) +
+    vectorBytes(adaptBuffers_.permanences) +
+    vectorBytes(adaptBuffers_.destroy) +
+    vectorBytes(adaptBuffers_.synapsesToDestroy) +
+    vectorBytes(isStale_) +
+    vectorBytes(staleSegments_);
+  for (const SegmentSynapses& segmentSynapses : segments_)
+  {
+    bytes += vectorBytes(segmentSynapses.synapses) +
+      vectorBytes(segmentSynapses.presynapticCells) +
+      vectorBytes(segmentSynapses.permanences);
+  }
+  return bytes;
+}
+
+size_t SynapseArrays::estimateMemoryUsage(size_t numSegments,
+                                          size_t numSynapses)
+{
+  return numSegments * sizeof(SegmentSynapses) + numSegments / 8 +
+    numSynapses * (sizeof(Synapse) + sizeof(CellIdx) +
+                   sizeof(Permanence) + sizeof(UInt32));
+}
+
+void SynapseArrays::rebuild()
+{
+  segments_.clear();
+  segments_.resize(connections_.segmentFlatListLength());
+  isStale_.assign(segments_.size(), false);
+  staleSegments_.clear();
+  positionForSynapse_.clear();
+  numSynapses_ = 0;
+
+  vector<UInt64>& segmentsPerCell = lifecycleStats_.segmentsPerCell;
+  vector<UInt64>& synapsesPerSegment = lifecycleStats_.synapsesPerSegment;
+  segmentsPerCell.assign(1, 0);
+  synapsesPerSegment.assign(1, 0);
+
+  for (CellIdx cell = 0; cell < connections_.numCells(); cell++)
+  {
+    const vector<Segment>& segments = connections_.segmentsForCell(cell);
+    if (segments.size() >= segmentsPerCell.size())
+    {
+      segmentsPerCell.resize(segments.size() + 1, 0);
+    }
+    segmentsPerCell[segments.size()]++;
+
+    for (Segment segment : segments)
+    {
+      const vector<Synapse>& synapses =
+        connections_.synapsesForSegment(segment);
+      if (synapses.size() >= synapsesPerSegment.size())
+      {
+        synapsesPerSegment.resize(synapses.size() + 1, 0);
+      }
+      synapsesPerSegment[synapses.size()]++;
+
+      for (Synapse synapse : synapses)
+      {
+        add_(synapse);
+      }
+    }
+  }
+}
+
+// Returns the segment's new number of synapses.
+size_t SynapseArrays::add_(Synapse synapse)
+{
+  const SynapseData& synapseData = connections_.dataForSynapse(synapse);
+  SegmentSynapses& segmentSynapses = segments_[synapseData.segment];
+
+  if (synapse >= positionForSynapse_.size())
+  {
+    resizeCounted(positionForSynapse_, synapse + 1, NOT_INDEXED,
+                  numReallocations_);
+  }
+  positionForSynapse_[synapse] = (UInt32)segmentSynapses.synapses.size();
+
+  // The three arrays always have the same capacity, so count them as one.
+  pushBackCounted(segmentSynapses.synapses, synapse, numReallocations_);
+  segmentSynapses.presynapticCells.push_back(synapseData.presynapticCell);
+  segmentSynapses.permanences.push_back(synapseData.permanence);
+  numSynapses_++;
+
+  return segmentSynapses.synapses.size();
+}
+
+void SynapseArrays::reserveSegment_(Segment segment)
+{
+  SegmentSynapses& segmentSynapses = segments_[segment];
+  segmentSynapses.synapses.reserve(synapsesPerSegment_);
+  segmentSynapses.presynapticCells.reserve(synapsesPerSegment_);
+  segmentSynapses.permanences.reserve(synapsesPerSegment_);
+}
+
+// Keep the Connections' order of synapses on the segment. Like
+// PresynapticCellIndex, ignore synapses that were already removed with their
+// segment. Returns whether the synapse was removed, and the segment's new
+// number of synapses.
+bool SynapseArrays::remove_(Synapse synapse, size_t& numSynapses)
+{
+  if (synapse >= positionForSynapse_.size() ||
+      positionForSynapse_[synapse] == NOT_INDEXED)
+  {
+    return false;
+  }
+
+  SegmentSynapses& segmentSynapses =
+    segments_[connections_.dataForSynapse(synapse).segment];
+  const UInt32 position = positionForSynapse_[synapse];
+
+  segmentSynapses.synapses.erase(
+    segmentSynapses.synapses.begin() + position);
+  segmentSynapses.presynapticCells.erase(
+    segmentSynapses.presynapticCells.begin() + position);
+  segmentSynapses.permanences.erase(
+    segmentSynapses.permanences.begin() + position);
+
+  for (UInt32 i = position; i < segmentSynapses.synapses.size(); i++)
+  {
+    positionForSynapse_[segmentSynapses.synapses[i]] = i;
+  }
+  positionForSynapse_[synapse] = NOT_INDEXED;
+  numSynapses_--;
+
+  numSynapses = segmentSynapses.synapses.size();
+  return true;
+}
+
+void SynapseArrays::clear_(Segment segment)
+{
+  isStale_[segment] = false;
+
+  SegmentSynapses& segmentSynapses = segments_[segment];
+  for (Synapse synapse : segmentSynapses.synapses)
+  {
+    positionForSynapse_[synapse] = NOT_INDEXED;
+  }
+  numSynapses_ -= (UInt)segmentSynapses.synapses.size();
+
+  segmentSynapses.synapses.clear();
+  segmentSynapses.presynapticCells.clear();
+  segmentSynapses.permanences.clear();
+}
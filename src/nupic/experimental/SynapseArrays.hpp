@@ -0,0 +1,245 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+
+/** @file
+ * Declarations for mirroring a Connections' synapses as per-segment arrays
+ */
+
+#ifndef NTA_SYNAPSE_ARRAYS_HPP
+#define NTA_SYNAPSE_ARRAYS_HPP
+
+#include <vector>
+
+#include <nupic/algorithms/Connections.hpp>
+#include <nupic/experimental/ApicalTiebreakTemporalMemory.hpp>
+#include <nupic/experimental/IndexUtils.hpp>
+#include <nupic/types/Types.hpp>
+
+namespace nupic {
+  namespace experimental {
+    namespace apical_tiebreak_temporal_memory {
+
+      using namespace algorithms::connections;
+
+      /**
+       * Each segment's synapses as parallel arrays, so that the learning
+       * loops can scan a segment's presynaptic cells and permanences
+       * sequentially rather than looking up each synapse in the Connections.
+       *
+       * This is a mirror of a Connections, which remains the authoritative
+       * copy (e.g. for serialization and for Python). It's built from the
+       * Connections and receives Connections events to stay up to date, so
+       * changes go through the Connections as usual.
+       *
+       * The exception is lazy mode, where updatePermanence only writes to the
+       * Connections if the synapse becomes connected or disconnected. Other
+       * permanence changes are kept here until materialize(). The Connections
+       * then always agree on which synapses are connected, which is all that
+       * computeActivity reads.
+       */
+      class SynapseArrays : public ConnectionsEventHandler
+      {
+      public:
+        struct SegmentSynapses
+        {
+          std::vector<Synapse> synapses;
+          std::vector<CellIdx> presynapticCells;
+          std::vector<Permanence> permanences;
+        };
+
+        /**
+         * Scratch space for adaptSegment, reused across calls to avoid
+         * allocations.
+         */
+        struct AdaptBuffers
+        {
+          std::vector<Permanence> permanences;
+          std::vector<unsigned char> destroy;
+          std::vector<Synapse> synapsesToDestroy;
+        };
+
+        SynapseArrays(Connections& connections, UInt64& numReallocations,
+                      ConnectionsLifecycleStats& lifecycleStats);
+
+        virtual void onCreateSegment(Segment segment) override;
+        virtual void onDestroySegment(Segment segment) override;
+        virtual void onCreateSynapse(Synapse synapse) override;
+        virtual void onDestroySynapse(Synapse synapse) override;
+        virtual void onUpdateSynapsePermanence(Synapse synapse,
+                                               Permanence permanence) override;
+
+        const SegmentSynapses& forSegment(Segment segment) const
+        {
+          return segments_[segment];
+        }
+
+        /**
+         * Sized for a segment with this many synapses.
+         */
+        AdaptBuffers& adaptBuffers(size_t numSynapses)
+        {
+          resizeCounted(adaptBuffers_.permanences, numSynapses,
+                        (Permanence)0.0, numReallocations_);
+          resizeCounted(adaptBuffers_.destroy, numSynapses,
+                        (unsigned char)0, numReallocations_);
+          if (numSynapses > adaptBuffers_.synapsesToDestroy.capacity())
+          {
+            numReallocations_++;
+            adaptBuffers_.synapsesToDestroy.reserve(numSynapses);
+          }
+          return adaptBuffers_;
+        }
+
+        /**
+         * Reserves storage for numSegments segments with synapsesPerSegment
+         * synapses each. Segments created later reserve synapsesPerSegment
+         * synapses too.
+         */
+        void reserve(UInt numSegments, UInt synapsesPerSegment);
+
+        /**
+         * Sets the permanence of the synapse at this position on the segment.
+         */
+        void updatePermanence(Segment segment, UInt32 position,
+                              Permanence permanence)
+        {
+          SegmentSynapses& segmentSynapses = segments_[segment];
+
+          if (lazy_ &&
+              (isConnected_(segmentSynapses.permanences[position]) ==
+               isConnected_(permanence)))
+          {
+            segmentSynapses.permanences[position] = permanence;
+            if (!isStale_[segment])
+            {
+              isStale_[segment] = true;
+              pushBackCounted(staleSegments_, segment, numReallocations_);
+            }
+          }
+          else
+          {
+            connections_.updateSynapsePermanence(
+              segmentSynapses.synapses[position], permanence);
+          }
+        }
+
+        bool isLazy() const
+        {
+          return lazy_;
+        }
+
+        /**
+         * Changing the connectedPermanence materializes the deferred changes,
+         * since they were only deferred for the old one.
+         */
+        void setLazy(bool lazy, Permanence connectedPermanence);
+
+        /**
+         * Writes the deferred permanence changes to the Connections.
+         */
+        void materialize();
+
+        /**
+         * Whether some permanence changes haven't been written to the
+         * Connections.
+         */
+        bool hasDeferredChanges() const
+        {
+          return !staleSegments_.empty();
+        }
+
+        /**
+         * Replaces copy with the Connections' segments and synapses, in the
+         * same order, with the permanences from here. Unlike materialize()
+         * this leaves the Connections alone, so const readers can see the
+         * deferred changes.
+         */
+        void copyTo(Connections& copy) const;
+
+        /**
+         * Whether every synapse in the Connections is mirrored. This is a
+         * safety check in case an event was missed.
+         */
+        bool inSync() const
+        {
+          return numSynapses_ == connections_.numSynapses();
+        }
+
+        /**
+         * The number of synapse slots seen, i.e. one past the highest
+         * synapse, since the Connections doesn't expose its flat list length.
+         */
+        size_t synapseFlatListLength() const
+        {
+          return positionForSynapse_.size();
+        }
+
+        /**
+         * The Connections' lifecycle stats, for the learning code to count
+         * why it destroys segments and synapses.
+         */
+        ConnectionsLifecycleStats& lifecycleStats()
+        {
+          return lifecycleStats_;
+        }
+
+        size_t memoryUsage() const;
+
+        static size_t estimateMemoryUsage(size_t numSegments,
+                                          size_t numSynapses);
+
+        void rebuild();
+
+      private:
+        size_t add_(Synapse synapse);
+        void reserveSegment_(Segment segment);
+        bool remove_(Synapse synapse, size_t& numSynapses);
+        void clear_(Segment segment);
+
+        bool isConnected_(Permanence permanence) const
+        {
+          return permanence >= connectedPermanence_ - CONNECTED_EPSILON;
+        }
+
+        Connections& connections_;
+        std::vector<SegmentSynapses> segments_;
+        std::vector<UInt32> positionForSynapse_;
+        UInt numSynapses_;
+        AdaptBuffers adaptBuffers_;
+        UInt synapsesPerSegment_;
+        UInt64& numReallocations_;
+        ConnectionsLifecycleStats& lifecycleStats_;
+
+        // Lazy mode. The segments whose permanences differ from the
+        // Connections, with duplicates removed via isStale_.
+        bool lazy_;
+        Permanence connectedPermanence_;
+        std::vector<bool> isStale_;
+        std::vector<Segment> staleSegments_;
+      };
+
+    } // end namespace apical_tiebreak_temporal_memory
+  } // end namespace experimental
+} // end namespace nupic
+
+#endif // NTA_SYNAPSE_ARRAYS_HPP
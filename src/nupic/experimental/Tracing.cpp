@@ -0,0 +1,416 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+/** @file
+ * Implementation of the scoped event tracing
+ *
+ * Each thread has its own ring buffer, so recording an event doesn't take a
+ * lock or share a cache line with other threads. The buffers are linked into
+ * a list when a thread first records, and they're never freed, so that the
+ * events of finished threads can still be written. When a thread exits, its
+ * perf counters are closed and its buffer is freed for the next thread that
+ * records, which adds to the same events and thread id.
+ */
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+
+#include <nupic/experimental/Tracing.hpp>
+#include <nupic/utils/Log.hpp>
+
+#if defined(__linux__)
+#define NTA_TRACING_PERF_EVENT
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace nupic;
+using namespace nupic::experimental::tracing;
+
+std::atomic<bool> nupic::experimental::tracing::tracingEnabled(false);
+
+namespace {
+
+  struct Event
+  {
+    const char* name;
+    UInt64 beginNanoseconds;
+    UInt64 durationNanoseconds;
+    UInt64 cacheMisses;
+    UInt64 branchMisses;
+  };
+
+  struct ThreadBuffer
+  {
+    ThreadBuffer(UInt32 threadId)
+      : threadId(threadId),
+        generation(0),
+        numRecorded(0),
+        hardwareCounters(false),
+        next(nullptr),
+        inUse(true),
+        perfLeaderFd(-1),
+        perfMemberFd(-1)
+    {}
+
+    UInt32 threadId;
+
+    // The start() that the events are from.
+    UInt64 generation;
+    std::vector<Event> events;
+    std::atomic<UInt64> numRecorded;
+
+    // Whether the events have the cache misses and branch misses.
+    bool hardwareCounters;
+
+    ThreadBuffer* next;
+
+    // Whether a running thread records into this buffer.
+    std::atomic<bool> inUse;
+
+    // Cache misses and branch misses, as a perf_event group, or -1.
+    int perfLeaderFd;
+    int perfMemberFd;
+  };
+
+  std::atomic<ThreadBuffer*> threadBuffers(nullptr);
+  std::atomic<UInt32> nextThreadId(0);
+  std::atomic<UInt64> currentGeneration(0);
+  std::atomic<size_t> eventsPerThread(0);
+  std::atomic<bool> hardwareCountersRequested(false);
+  std::atomic<Int64> epochNanoseconds(0);
+
+  thread_local ThreadBuffer* threadBuffer = nullptr;
+
+  Int64 nowNanoseconds()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+#ifdef NTA_TRACING_PERF_EVENT
+
+  int openPerfCounter(UInt64 config, int leaderFd)
+  {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = (leaderFd == -1);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+
+    // This thread, any CPU.
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, leaderFd, 0);
+  }
+
+  void openPerfCounters(ThreadBuffer& buffer)
+  {
+    buffer.perfLeaderFd = openPerfCounter(PERF_COUNT_HW_CACHE_MISSES, -1);
+    if (buffer.perfLeaderFd == -1)
+    {
+      return;
+    }
+
+    buffer.perfMemberFd = openPerfCounter(PERF_COUNT_HW_BRANCH_MISSES,
+                                          buffer.perfLeaderFd);
+    if (buffer.perfMemberFd == -1)
+    {
+      close(buffer.perfLeaderFd);
+      buffer.perfLeaderFd = -1;
+      return;
+    }
+
+    ioctl(buffer.perfLeaderFd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+
+  void closePerfCounters(ThreadBuffer& buffer)
+  {
+    if (buffer.perfLeaderFd != -1)
+    {
+      close(buffer.perfMemberFd);
+      close(buffer.perfLeaderFd);
+      buffer.perfLeaderFd = -1;
+      buffer.perfMemberFd = -1;
+    }
+  }
+
+  void readPerfCounters(const ThreadBuffer& buffer,
+                        UInt64& cacheMisses, UInt64& branchMisses)
+  {
+    struct
+    {
+      UInt64 numCounters;
+      UInt64 values[2];
+    } group;
+
+    if (buffer.perfLeaderFd != -1 &&
+        read(buffer.perfLeaderFd, &group, sizeof(group)) == sizeof(group))
+    {
+      cacheMisses = group.values[0];
+      branchMisses = group.values[1];
+    }
+    else
+    {
+      cacheMisses = 0;
+      branchMisses = 0;
+    }
+  }
+
+#else
+
+  void openPerfCounters(ThreadBuffer& buffer)
+  {
+  }
+
+  void closePerfCounters(ThreadBuffer& buffer)
+  {
+  }
+
+  void readPerfCounters(const ThreadBuffer& buffer,
+                        UInt64& cacheMisses, UInt64& branchMisses)
+  {
+    cacheMisses = 0;
+    branchMisses = 0;
+  }
+
+#endif // NTA_TRACING_PERF_EVENT
+
+  /**
+   * Frees this thread's buffer when the thread exits. It's separate from
+   * threadBuffer so that recording doesn't pay for a thread_local with a
+   * destructor.
+   */
+  struct ThreadBufferRelease
+  {
+    ThreadBuffer* buffer = nullptr;
+
+    ~ThreadBufferRelease()
+    {
+      if (buffer != nullptr)
+      {
+        closePerfCounters(*buffer);
+        buffer->inUse.store(false, std::memory_order_release);
+      }
+    }
+  };
+
+  thread_local ThreadBufferRelease threadBufferRelease;
+
+  /**
+   * Takes a buffer that a finished thread freed, or adds a new one.
+   */
+  ThreadBuffer* acquireThreadBuffer()
+  {
+    for (ThreadBuffer* buffer = threadBuffers.load();
+         buffer != nullptr;
+         buffer = buffer->next)
+    {
+      bool inUse = false;
+      if (buffer->inUse.compare_exchange_strong(inUse, true,
+                                                std::memory_order_acquire))
+      {
+        // The counters count the thread that opened them.
+        if (buffer->generation == currentGeneration.load() &&
+            buffer->hardwareCounters)
+        {
+          openPerfCounters(*buffer);
+        }
+        return buffer;
+      }
+    }
+
+    ThreadBuffer* buffer = new ThreadBuffer(nextThreadId++);
+    ThreadBuffer* head = threadBuffers.load();
+    do
+    {
+      buffer->next = head;
+    } while (!threadBuffers.compare_exchange_weak(head, buffer));
+    return buffer;
+  }
+
+  /**
+   * Returns this thread's buffer, set up for the current start().
+   */
+  ThreadBuffer& getThreadBuffer()
+  {
+    if (threadBuffer == nullptr)
+    {
+      threadBuffer = acquireThreadBuffer();
+      threadBufferRelease.buffer = threadBuffer;
+    }
+
+    ThreadBuffer& buffer = *threadBuffer;
+    const UInt64 generation = currentGeneration.load();
+    if (buffer.generation != generation)
+    {
+      buffer.events.assign(eventsPerThread.load(), Event());
+      buffer.numRecorded.store(0);
+
+      closePerfCounters(buffer);
+      if (hardwareCountersRequested.load())
+      {
+        openPerfCounters(buffer);
+      }
+      buffer.hardwareCounters = (buffer.perfLeaderFd != -1);
+
+      buffer.generation = generation;
+    }
+
+    return buffer;
+  }
+
+  void writeMicroseconds(std::ostream& out, UInt64 nanoseconds)
+  {
+    out << nanoseconds / 1000 << "."
+        << std::setw(3) << std::setfill('0') << nanoseconds % 1000;
+  }
+
+  void writeJsonString(std::ostream& out, const char* s)
+  {
+    out << '"';
+    for (; *s != '\0'; s++)
+    {
+      if (*s == '"' || *s == '\\')
+      {
+        out << '\\';
+      }
+      out << *s;
+    }
+    out << '"';
+  }
+
+}
+
+void nupic::experimental::tracing::start(size_t eventsPerThread,
+                                         bool hardwareCounters)
+{
+  NTA_CHECK(eventsPerThread > 0);
+
+  // Threads set up their buffers again when they see the new generation.
+  tracingEnabled.store(false);
+  ::eventsPerThread.store(eventsPerThread);
+  hardwareCountersRequested.store(hardwareCounters);
+  epochNanoseconds.store(nowNanoseconds());
+  currentGeneration++;
+  tracingEnabled.store(true);
+}
+
+void nupic::experimental::tracing::stop()
+{
+  tracingEnabled.store(false);
+}
+
+bool nupic::experimental::tracing::hardwareCountersAvailable()
+{
+  return (isTracing() && getThreadBuffer().perfLeaderFd != -1);
+}
+
+void nupic::experimental::tracing::writeChromeTrace(const std::string& path)
+{
+  std::ofstream out(path.c_str());
+  NTA_CHECK(out.good()) << "Couldn't open " << path;
+
+  out << "{\"traceEvents\":[";
+
+  bool first = true;
+  const UInt64 generation = currentGeneration.load();
+  for (const ThreadBuffer* buffer = threadBuffers.load();
+       buffer != nullptr;
+       buffer = buffer->next)
+  {
+    if (buffer->generation != generation)
+    {
+      continue;
+    }
+
+    // When the ring buffer has wrapped, only the last events remain.
+    const UInt64 numRecorded = buffer->numRecorded.load();
+    const size_t capacity = buffer->events.size();
+    const UInt64 begin = (numRecorded > capacity) ? numRecorded - capacity : 0;
+    for (UInt64 i = begin; i < numRecorded; i++)
+    {
+      const Event& event = buffer->events[i % capacity];
+
+      out << (first ? "\n" : ",\n") << "{\"name\":";
+      writeJsonString(out, event.name);
+      out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->threadId
+          << ",\"ts\":";
+      writeMicroseconds(out, event.beginNanoseconds);
+      out << ",\"dur\":";
+      writeMicroseconds(out, event.durationNanoseconds);
+      if (buffer->hardwareCounters)
+      {
+        out << ",\"args\":{\"cacheMisses\":" << event.cacheMisses
+            << ",\"branchMisses\":" << event.branchMisses << "}";
+      }
+      out << "}";
+      first = false;
+    }
+  }
+
+  out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+  NTA_CHECK(out.good()) << "Couldn't write " << path;
+}
+
+void Scope::begin_(const char* name)
+{
+  const ThreadBuffer& buffer = getThreadBuffer();
+
+  name_ = name;
+  generation_ = buffer.generation;
+  readPerfCounters(buffer, beginCacheMisses_, beginBranchMisses_);
+  beginNanoseconds_ = nowNanoseconds() - epochNanoseconds.load();
+}
+
+void Scope::end_()
+{
+  const UInt64 endNanoseconds = nowNanoseconds() - epochNanoseconds.load();
+
+  ThreadBuffer& buffer = *threadBuffer;
+  if (buffer.generation != generation_)
+  {
+    // Tracing was restarted during the scope.
+    return;
+  }
+
+  UInt64 cacheMisses, branchMisses;
+  readPerfCounters(buffer, cacheMisses, branchMisses);
+
+  const UInt64 numRecorded = buffer.numRecorded.load(std::memory_order_relaxed);
+  Event& event = buffer.events[numRecorded % buffer.events.size()];
+  event.name = name_;
+  event.beginNanoseconds = beginNanoseconds_;
+  event.durationNanoseconds = endNanoseconds - beginNanoseconds_;
+  event.cacheMisses = cacheMisses - beginCacheMisses_;
+  event.branchMisses = branchMisses - beginBranchMisses_;
+
+  // Publish the event to writeChromeTrace.
+  buffer.numRecorded.store(numRecorded + 1, std::memory_order_release);
+}
@@ -0,0 +1,118 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+/** @file
+ * Declarations for the scoped event tracing
+ */
+
+#ifndef NTA_TRACING_HPP
+#define NTA_TRACING_HPP
+
+#include <atomic>
+#include <string>
+
+#include <nupic/types/Types.hpp>
+
+namespace nupic {
+  namespace experimental {
+    namespace tracing {
+
+      /**
+       * Starts recording Scope events. Each thread records into its own ring
+       * buffer of eventsPerThread events, keeping the most recent ones.
+       * Restarting clears the events.
+       *
+       * @param hardwareCounters
+       * Also record each event's cache misses and branch misses, using Linux
+       * perf_event. If the counters can't be opened, e.g. on other platforms
+       * or due to perf_event_paranoid, the events are recorded without them.
+       */
+      void start(size_t eventsPerThread, bool hardwareCounters = false);
+
+      /**
+       * Stops recording. The recorded events are kept for writeChromeTrace.
+       */
+      void stop();
+
+      /**
+       * Writes the recorded events as Chrome trace JSON, which can be opened
+       * in chrome://tracing or Perfetto. Call it after stop(), or while no
+       * thread is recording, since the ring buffers aren't locked.
+       */
+      void writeChromeTrace(const std::string& path);
+
+      /**
+       * Returns whether the hardware counters are being recorded on this
+       * thread.
+       */
+      bool hardwareCountersAvailable();
+
+      extern std::atomic<bool> tracingEnabled;
+
+      inline bool isTracing()
+      {
+        return tracingEnabled.load(std::memory_order_relaxed);
+      }
+
+      /**
+       * Records an event for its lifetime if tracing. The name must outlive
+       * the trace, e.g. a string literal.
+       */
+      class Scope
+      {
+      public:
+        Scope(const char* name)
+          : name_(nullptr)
+        {
+          if (isTracing())
+          {
+            begin_(name);
+          }
+        }
+
+        ~Scope()
+        {
+          if (name_ != nullptr)
+          {
+            end_();
+          }
+        }
+
+      private:
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        void begin_(const char* name);
+        void end_();
+
+        const char* name_;
+        UInt64 generation_;
+        UInt64 beginNanoseconds_;
+        UInt64 beginCacheMisses_;
+        UInt64 beginBranchMisses_;
+      };
+
+    } // end namespace tracing
+  } // end namespace experimental
+} // end namespace nupic
+
+#endif // NTA_TRACING_HPP
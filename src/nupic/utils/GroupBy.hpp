@@ -24,6 +24,8 @@
 #define NTA_GROUPBY_HPP
 
 #include <tuple>
+#include <type_traits>
+#include <utility>
 #include <algorithm> // is_sorted
 
 #include <nupic/utils/Log.hpp>
@@ -42,17 +44,19 @@ namespace nupic
    * - `groupBy`, which takes in collections
    * - `iterGroupBy`, which takes in pairs of iterators
    *
-   * Both functions take a key function for each sequence.
+   * Both functions take a key function for each sequence, and both accept any
+   * number of sequences:
+   *
+   *   groupBy(sequence0, keyFn0, sequence1, keyFn1, ...)
+   *   iterGroupBy(begin0, end0, keyFn0, begin1, end1, keyFn1, ...)
    *
    * Both functions return an iterable object. The iterator returns a tuple
    * containing the key, followed by a begin and end iterator for each
    * sequence. The sequences are traversed lazily as the iterator is advanced.
    *
-   * Note: The implementation includes this "minFrontKey" to avoid GCC
-   * "maybe-initialized" false positives. This approach makes it very obvious to
-   * the compiler that the "key" variable always gets initialized.
-   *
-   * Feel free to add new GroupBy7, GroupBy8, ..., GroupByN classes as needed.
+   * The per-sequence work is expanded at compile time over a parameter pack,
+   * so the generated code is the same straight-line code as a hand-written
+   * class for that number of sequences.
    */
 
   // ==========================================================================
@@ -65,392 +69,158 @@ namespace nupic
     return x;
   }
 
-  // ==========================================================================
-  // 1 SEQUENCE
-  // ==========================================================================
-
-  template<typename Iterator0, typename KeyFn0,
-           typename Element0 = decltype(*std::declval<Iterator0>()),
-           typename KeyType = typename std::remove_const<
-             typename std::result_of<
-               KeyFn0(decltype(*std::declval<Iterator0>()))
-                 >::type >::type>
-  class GroupBy1
+  namespace groupby_detail
   {
-  public:
+    // C++11 substitute for std::index_sequence.
+    template<size_t... Is>
+    struct IndexSequence {};
 
-    GroupBy1(
-      Iterator0 begin0, Iterator0 end0, KeyFn0 keyFn0)
-    : begin0_(begin0), end0_(end0), keyFn0_(keyFn0)
-    {
-      NTA_ASSERT(std::is_sorted(begin0, end0,
-                                [&](const Element0& a, const Element0& b)
-                                {
-                                  return keyFn0(a) < keyFn0(b);
-                                }));
-    }
+    template<size_t N, size_t... Is>
+    struct MakeIndexSequence : MakeIndexSequence<N - 1, N - 1, Is...> {};
 
-    class Iterator
+    template<size_t... Is>
+    struct MakeIndexSequence<0, Is...>
     {
-    public:
-      Iterator(
-        Iterator0 begin0, Iterator0 end0, KeyFn0 keyFn0)
-        :current0_(begin0), end0_(end0), keyFn0_(keyFn0),
-         finished_(false)
-      {
-        calculateNext_();
-      }
-
-      bool operator !=(const Iterator& other)
-      {
-        return (finished_ != other.finished_ ||
-                current0_ != other.current0_);
-      }
-
-      const std::tuple<KeyType,
-                       Iterator0, Iterator0>& operator*() const
-      {
-        NTA_ASSERT(!finished_);
-        return v_;
-      }
-
-      const Iterator& operator++()
-      {
-        NTA_ASSERT(!finished_);
-        calculateNext_();
-        return *this;
-      }
-
-    private:
-
-      void calculateNext_()
-      {
-        if (current0_ != end0_)
-        {
-          const KeyType key = keyFn0_(*current0_);
-          std::get<0>(v_) = key;
-
-          // Find all elements with this key.
-          std::get<1>(v_) = current0_;
-          while (current0_ != end0_ && keyFn0_(*current0_) == key)
-          {
-            current0_++;
-          }
-          std::get<2>(v_) = current0_;
-        }
-        else
-        {
-          finished_ = true;
-        }
-      }
-
-      std::tuple<KeyType,
-                 Iterator0, Iterator0> v_;
-
-      Iterator0 current0_;
-      Iterator0 end0_;
-      KeyFn0 keyFn0_;
-
-      bool finished_;
+      typedef IndexSequence<Is...> type;
     };
 
-    Iterator begin() const
-    {
-      return Iterator(begin0_, end0_, keyFn0_);
-    }
-
-    Iterator end() const
-    {
-      return Iterator(end0_, end0_, keyFn0_);
-    }
-
-  private:
-    Iterator0 begin0_;
-    Iterator0 end0_;
-    KeyFn0 keyFn0_;
-  };
-
-  template<typename Sequence0, typename KeyFn0>
-  GroupBy1<typename Sequence0::const_iterator, KeyFn0>
-  groupBy(const Sequence0& sequence0, KeyFn0 keyFn0)
-  {
-    return {sequence0.begin(), sequence0.end(), keyFn0};
-  }
-
-  template<typename Iterator0, typename KeyFn0>
-  GroupBy1<Iterator0, KeyFn0>
-  iterGroupBy(Iterator0 begin0, Iterator0 end0, KeyFn0 keyFn0)
-  {
-    return {begin0, end0, keyFn0};
-  }
-
+    /**
+     * One input of a GroupBy: the unvisited range of a sequence and the
+     * function that computes each element's key.
+     */
+    template<typename Iterator_, typename KeyFn_>
+    struct Sequence
+    {
+      typedef Iterator_ Iterator;
+      typedef KeyFn_ KeyFn;
+      typedef typename std::remove_const<
+        typename std::remove_reference<
+          decltype(std::declval<KeyFn&>()(*std::declval<Iterator>()))
+          >::type>::type KeyType;
+
+      Sequence(Iterator begin, Iterator end, KeyFn keyFn)
+        : current(begin), end(end), keyFn(keyFn)
+      {}
+
+      Iterator current;
+      Iterator end;
+      KeyFn keyFn;
+    };
 
-  // ==========================================================================
-  // 2 SEQUENCES
-  // ==========================================================================
+    /**
+     * Computes std::tuple<KeyType, Iterator0, Iterator0, Iterator1, ...>.
+     */
+    template<typename Tuple, typename... Sequences>
+    struct AppendIteratorPairs;
 
-  template<typename Iterator0, typename KeyFn0,
-           typename KeyType = typename std::remove_const<
-             typename std::result_of<
-               KeyFn0(decltype(*std::declval<Iterator0>()))
-                 >::type >::type>
-  static KeyType minFrontKey(KeyType frontrunner,
-                             Iterator0 begin0, Iterator0 end0, KeyFn0 keyFn0)
-  {
-    if (begin0 != end0)
-    {
-      return std::min(frontrunner, keyFn0(*begin0));
-    }
-    else
+    template<typename... Ts>
+    struct AppendIteratorPairs<std::tuple<Ts...>>
     {
-      return frontrunner;
-    }
-  }
-
-  template<typename Iterator0, typename KeyFn0,
-           typename Iterator1, typename KeyFn1,
-           typename Element0 = decltype(*std::declval<Iterator0>()),
-           typename Element1 = decltype(*std::declval<Iterator1>()),
-           typename KeyType = typename std::remove_const<
-             typename std::result_of<
-               KeyFn0(decltype(*std::declval<Iterator0>()))
-                 >::type >::type>
-  class GroupBy2
-  {
-  public:
+      typedef std::tuple<Ts...> type;
+    };
 
-    GroupBy2(
-      Iterator0 begin0, Iterator0 end0, KeyFn0 keyFn0,
-      Iterator1 begin1, Iterator1 end1, KeyFn1 keyFn1)
-    : begin0_(begin0), end0_(end0), keyFn0_(keyFn0),
-      begin1_(begin1), end1_(end1), keyFn1_(keyFn1)
-    {
-      NTA_ASSERT(std::is_sorted(begin0, end0,
-                                [&](const Element0& a, const Element0& b)
-                                {
-                                  return keyFn0(a) < keyFn0(b);
-                                }));
-      NTA_ASSERT(std::is_sorted(begin1, end1,
-                                [&](const Element1& a, const Element1& b)
-                                {
-                                  return keyFn1(a) < keyFn1(b);
-                                }));
-    }
+    template<typename... Ts, typename Sequence0, typename... Sequences>
+    struct AppendIteratorPairs<std::tuple<Ts...>, Sequence0, Sequences...>
+      : AppendIteratorPairs<std::tuple<Ts...,
+                                       typename Sequence0::Iterator,
+                                       typename Sequence0::Iterator>,
+                            Sequences...>
+    {};
 
-    class Iterator
+    template<typename Sequence0, typename... Sequences>
+    struct First
     {
-    public:
-      Iterator(
-        Iterator0 begin0, Iterator0 end0, KeyFn0 keyFn0,
-        Iterator1 begin1, Iterator1 end1, KeyFn1 keyFn1)
-        :current0_(begin0), end0_(end0), keyFn0_(keyFn0),
-         current1_(begin1), end1_(end1), keyFn1_(keyFn1),
-         finished_(false)
-      {
-        calculateNext_();
-      }
-
-      bool operator !=(const Iterator& other)
-      {
-        return (finished_ != other.finished_ ||
-                current0_ != other.current0_ ||
-                current1_ != other.current1_);
-      }
-
-      const std::tuple<KeyType,
-                       Iterator0, Iterator0,
-                       Iterator1, Iterator1>& operator*() const
-      {
-        NTA_ASSERT(!finished_);
-        return v_;
-      }
-
-      const Iterator& operator++()
-      {
-        NTA_ASSERT(!finished_);
-        calculateNext_();
-        return *this;
-      }
-
-    private:
-
-      void calculateNext_()
-      {
-        if (current0_ != end0_ ||
-            current1_ != end1_)
-        {
-          // Find the lowest key.
-          KeyType key;
-          if (current0_ != end0_)
-          {
-            key = minFrontKey(keyFn0_(*current0_),
-                              current1_, end1_, keyFn1_);
-          }
-          else
-          {
-            key = keyFn1_(*current1_);
-          }
-
-          std::get<0>(v_) = key;
-
-          // Find all elements with this key.
-          std::get<1>(v_) = current0_;
-          while (current0_ != end0_ && keyFn0_(*current0_) == key)
-          {
-            current0_++;
-          }
-          std::get<2>(v_) = current0_;
-
-          std::get<3>(v_) = current1_;
-          while (current1_ != end1_ && keyFn1_(*current1_) == key)
-          {
-            current1_++;
-          }
-          std::get<4>(v_) = current1_;
-        }
-        else
-        {
-          finished_ = true;
-        }
-      }
-
-      std::tuple<KeyType,
-                 Iterator0, Iterator0,
-                 Iterator1, Iterator1> v_;
-
-      Iterator0 current0_;
-      Iterator0 end0_;
-      KeyFn0 keyFn0_;
-
-      Iterator1 current1_;
-      Iterator1 end1_;
-      KeyFn1 keyFn1_;
-
-      bool finished_;
+      typedef Sequence0 type;
     };
 
-    Iterator begin() const
-    {
-      return Iterator(begin0_, end0_, keyFn0_,
-                      begin1_, end1_, keyFn1_);
-    }
+    /**
+     * Converts the flat (begin, end, keyFn, begin, end, keyFn, ...) template
+     * arguments of iterGroupBy into a list of Sequence types.
+     */
+    template<template<typename...> class Result, typename Accumulated,
+             typename... Args>
+    struct MakeIterGroupBy;
 
-    Iterator end() const
+    template<template<typename...> class Result, typename... Sequences>
+    struct MakeIterGroupBy<Result, std::tuple<Sequences...>>
     {
-      return Iterator(end0_, end0_, keyFn0_,
-                      end1_, end1_, keyFn1_);
-    }
-
-  private:
-    Iterator0 begin0_;
-    Iterator0 end0_;
-    KeyFn0 keyFn0_;
-
-    Iterator1 begin1_;
-    Iterator1 end1_;
-    KeyFn1 keyFn1_;
-  };
+      typedef Result<Sequences...> type;
+    };
 
-  template<typename Sequence0, typename KeyFn0,
-           typename Sequence1, typename KeyFn1>
-  GroupBy2<typename Sequence0::const_iterator, KeyFn0,
-           typename Sequence1::const_iterator, KeyFn1>
-  groupBy(const Sequence0& sequence0, KeyFn0 keyFn0,
-          const Sequence1& sequence1, KeyFn1 keyFn1)
-  {
-    return {sequence0.begin(), sequence0.end(), keyFn0,
-            sequence1.begin(), sequence1.end(), keyFn1};
-  }
+    template<template<typename...> class Result, typename... Sequences,
+             typename Iterator, typename KeyFn, typename... Args>
+    struct MakeIterGroupBy<Result, std::tuple<Sequences...>,
+                           Iterator, Iterator, KeyFn, Args...>
+      : MakeIterGroupBy<Result,
+                        std::tuple<Sequences...,
+                                   Sequence<Iterator,
+                                            typename std::decay<KeyFn>::type>>,
+                        Args...>
+    {};
+
+    /**
+     * Converts the flat (sequence, keyFn, sequence, keyFn, ...) template
+     * arguments of groupBy into a list of Sequence types.
+     */
+    template<template<typename...> class Result, typename Accumulated,
+             typename... Args>
+    struct MakeGroupBy;
+
+    template<template<typename...> class Result, typename... Sequences>
+    struct MakeGroupBy<Result, std::tuple<Sequences...>>
+    {
+      typedef Result<Sequences...> type;
+    };
 
-  template<typename Iterator0, typename KeyFn0,
-           typename Iterator1, typename KeyFn1>
-  GroupBy2<Iterator0, KeyFn0,
-           Iterator1, KeyFn1>
-  iterGroupBy(Iterator0 begin0, Iterator0 end0, KeyFn0 keyFn0,
-              Iterator1 begin1, Iterator1 end1, KeyFn1 keyFn1)
-  {
-    return {begin0, end0, keyFn0,
-            begin1, end1, keyFn1};
-  }
+    template<template<typename...> class Result, typename... Sequences,
+             typename Container, typename KeyFn, typename... Args>
+    struct MakeGroupBy<Result, std::tuple<Sequences...>,
+                       Container, KeyFn, Args...>
+      : MakeGroupBy<Result,
+                    std::tuple<Sequences...,
+                               Sequence<typename Container::const_iterator,
+                                        typename std::decay<KeyFn>::type>>,
+                    Args...>
+    {};
+  } // end namespace groupby_detail
 
   // ==========================================================================
-  // 3 SEQUENCES
+  // N SEQUENCES
   // ==========================================================================
 
-  template<typename Iterator0, typename KeyFn0,
-           typename Iterator1, typename KeyFn1,
-           typename KeyType = typename std::remove_const<
-             typename std::result_of<
-               KeyFn0(decltype(*std::declval<Iterator0>()))
-                 >::type >::type>
-  static KeyType minFrontKey(KeyType frontrunner,
-                             Iterator0 begin0, Iterator0 end0, KeyFn0 keyFn0,
-                             Iterator1 begin1, Iterator1 end1, KeyFn1 keyFn1)
+  /**
+   * The iterable returned by groupBy and iterGroupBy.
+   *
+   * Each template argument is a groupby_detail::Sequence. The key type is
+   * taken from the first sequence's key function.
+   */
+  template<typename... Sequences>
+  class GroupBy
   {
-    KeyType ret = frontrunner;
-
-    if (begin0 != end0)
-    {
-      ret = std::min(ret, keyFn0(*begin0));
-    }
+  public:
+    static_assert(sizeof...(Sequences) > 0,
+                  "GroupBy requires at least one sequence");
 
-    if (begin1 != end1)
-    {
-      ret = std::min(ret, keyFn1(*begin1));
-    }
+    typedef typename groupby_detail::First<Sequences...>::type::KeyType
+      KeyType;
+    typedef typename groupby_detail::AppendIteratorPairs<
+      std::tuple<KeyType>, Sequences...>::type Value;
+    typedef typename groupby_detail::MakeIndexSequence<
+      sizeof...(Sequences)>::type Indices;
 
-    return ret;
-  }
+    typedef std::tuple<Sequences...> SequenceTuple;
 
-  template<typename Iterator0, typename KeyFn0,
-           typename Iterator1, typename KeyFn1,
-           typename Iterator2, typename KeyFn2,
-           typename Element0 = decltype(*std::declval<Iterator0>()),
-           typename Element1 = decltype(*std::declval<Iterator1>()),
-           typename Element2 = decltype(*std::declval<Iterator2>()),
-           typename KeyType = typename std::remove_const<
-             typename std::result_of<
-               KeyFn0(decltype(*std::declval<Iterator0>()))
-                 >::type >::type>
-  class GroupBy3
-  {
-  public:
-    GroupBy3(
-      Iterator0 begin0, Iterator0 end0, KeyFn0 keyFn0,
-      Iterator1 begin1, Iterator1 end1, KeyFn1 keyFn1,
-      Iterator2 begin2, Iterator2 end2, KeyFn2 keyFn2)
-    : begin0_(begin0), end0_(end0), keyFn0_(keyFn0),
-      begin1_(begin1), end1_(end1), keyFn1_(keyFn1),
-      begin2_(begin2), end2_(end2), keyFn2_(keyFn2)
+    GroupBy(const Sequences&... sequences)
+      : sequences_(sequences...)
     {
-      NTA_ASSERT(std::is_sorted(begin0, end0,
-                                [&](const Element0& a, const Element0& b)
-                                {
-                                  return keyFn0(a) < keyFn0(b);
-                                }));
-      NTA_ASSERT(std::is_sorted(begin1, end1,
-                                [&](const Element1& a, const Element1& b)
-                                {
-                                  return keyFn1(a) < keyFn1(b);
-                                }));
-      NTA_ASSERT(std::is_sorted(begin2, end2,
-                                [&](const Element2& a, const Element2& b)
-                                {
-                                  return keyFn2(a) < keyFn2(b);
-                                }));
+      assertSorted_(Indices());
     }
 
     class Iterator
     {
     public:
-      Iterator(
-        Iterator0 begin0, Iterator0 end0, KeyFn0 keyFn0,
-        Iterator1 begin1, Iterator1 end1, KeyFn1 keyFn1,
-        Iterator2 begin2, Iterator2 end2, KeyFn2 keyFn2)
-        :current0_(begin0), end0_(end0), keyFn0_(keyFn0),
-         current1_(begin1), end1_(end1), keyFn1_(keyFn1),
-         current2_(begin2), end2_(end2), keyFn2_(keyFn2),
-         finished_(false)
+      Iterator(const std::tuple<Sequences...>& sequences)
+        :sequences_(sequences), finished_(false)
       {
         calculateNext_();
       }
@@ -458,15 +228,11 @@ namespace nupic
       bool operator !=(const Iterator& other)
       {
         return (finished_ != other.finished_ ||
-                current0_ != other.current0_ ||
-                current1_ != other.current1_ ||
-                current2_ != other.current2_);
+                anyCurrentDiffers_(other,
+                                   std::integral_constant<size_t, 0>()));
       }
 
-      const std::tuple<KeyType,
-                       Iterator0, Iterator0,
-                       Iterator1, Iterator1,
-                       Iterator2, Iterator2>& operator*() const
+      const Value& operator*() const
       {
         NTA_ASSERT(!finished_);
         return v_;
@@ -481,662 +247,89 @@ namespace nupic
 
     private:
 
-      void calculateNext_()
-      {
-        if (current0_ != end0_ ||
-            current1_ != end1_ ||
-            current2_ != end2_)
-        {
-          // Find the lowest key.
-          KeyType key;
-          if (current0_ != end0_)
-          {
-            key = minFrontKey(keyFn0_(*current0_),
-                              current1_, end1_, keyFn1_,
-                              current2_, end2_, keyFn2_);
-          }
-          else if (current1_ != end1_)
-          {
-            key = minFrontKey(keyFn1_(*current1_),
-                              current2_, end2_, keyFn2_);
-          }
-          else
-          {
-            key = keyFn2_(*current2_);
-          }
-
-          std::get<0>(v_) = key;
-
-          // Find all elements with this key.
-          std::get<1>(v_) = current0_;
-          while (current0_ != end0_ && keyFn0_(*current0_) == key)
-          {
-            current0_++;
-          }
-          std::get<2>(v_) = current0_;
-
-          std::get<3>(v_) = current1_;
-          while (current1_ != end1_ && keyFn1_(*current1_) == key)
-          {
-            current1_++;
-          }
-          std::get<4>(v_) = current1_;
+      typedef std::integral_constant<size_t, sizeof...(Sequences)> End_;
 
-          std::get<5>(v_) = current2_;
-          while (current2_ != end2_ && keyFn2_(*current2_) == key)
-          {
-            current2_++;
-          }
-          std::get<6>(v_) = current2_;
-        }
-        else
+      // Fold the remaining front keys into "frontrunner". Mirrors the
+      // branch structure of a hand-written min over each sequence's front.
+      template<size_t I>
+      KeyType minFrontKey_(KeyType frontrunner,
+                           std::integral_constant<size_t, I>) const
+      {
+        const auto& sequence = std::get<I>(sequences_);
+        if (sequence.current != sequence.end)
         {
-          finished_ = true;
+          frontrunner = std::min(frontrunner,
+                                 (KeyType)sequence.keyFn(*sequence.current));
         }
+        return minFrontKey_(frontrunner,
+                            std::integral_constant<size_t, I + 1>());
       }
 
-      std::tuple<KeyType,
-                 Iterator0, Iterator0,
-                 Iterator1, Iterator1,
-                 Iterator2, Iterator2> v_;
-
-      Iterator0 current0_;
-      Iterator0 end0_;
-      KeyFn0 keyFn0_;
-
-      Iterator1 current1_;
-      Iterator1 end1_;
-      KeyFn1 keyFn1_;
-
-      Iterator2 current2_;
-      Iterator2 end2_;
-      KeyFn2 keyFn2_;
-
-      bool finished_;
-    };
-
-    Iterator begin() const
-    {
-      return Iterator(begin0_, end0_, keyFn0_,
-                      begin1_, end1_, keyFn1_,
-                      begin2_, end2_, keyFn2_);
-    }
-
-    Iterator end() const
-    {
-      return Iterator(end0_, end0_, keyFn0_,
-                      end1_, end1_, keyFn1_,
-                      end2_, end2_, keyFn2_);
-    }
-
-  private:
-    Iterator0 begin0_;
-    Iterator0 end0_;
-    KeyFn0 keyFn0_;
-
-    Iterator1 begin1_;
-    Iterator1 end1_;
-    KeyFn1 keyFn1_;
-
-    Iterator2 begin2_;
-    Iterator2 end2_;
-    KeyFn2 keyFn2_;
-  };
-
-  template<typename Sequence0, typename KeyFn0,
-           typename Sequence1, typename KeyFn1,
-           typename Sequence2, typename KeyFn2>
-  GroupBy3<typename Sequence0::const_iterator, KeyFn0,
-           typename Sequence1::const_iterator, KeyFn1,
-           typename Sequence2::const_iterator, KeyFn2>
-  groupBy(const Sequence0& sequence0, KeyFn0 keyFn0,
-          const Sequence1& sequence1, KeyFn1 keyFn1,
-          const Sequence2& sequence2, KeyFn2 keyFn2)
-  {
-    return {sequence0.begin(), sequence0.end(), keyFn0,
-            sequence1.begin(), sequence1.end(), keyFn1,
-            sequence2.begin(), sequence2.end(), keyFn2};
-  }
-
-  template<typename Iterator0, typename KeyFn0,
-           typename Iterator1, typename KeyFn1,
-           typename Iterator2, typename KeyFn2>
-  GroupBy3<Iterator0, KeyFn0,
-           Iterator1, KeyFn1,
-           Iterator2, KeyFn2>
-  iterGroupBy(
-    Iterator0 begin0, Iterator0 end0, KeyFn0 keyFn0,
-    Iterator1 begin1, Iterator1 end1, KeyFn1 keyFn1,
-    Iterator2 begin2, Iterator2 end2, KeyFn2 keyFn2)
-  {
-    return {begin0, end0, keyFn0,
-            begin1, end1, keyFn1,
-            begin2, end2, keyFn2};
-  }
-
-
-  // ==========================================================================
-  // 4 SEQUENCES
-  // ==========================================================================
-
-  template<typename Iterator0, typename KeyFn0,
-           typename Iterator1, typename KeyFn1,
-           typename Iterator2, typename KeyFn2,
-           typename KeyType = typename std::remove_const<
-             typename std::result_of<
-               KeyFn0(decltype(*std::declval<Iterator0>()))
-                 >::type >::type>
-  static KeyType minFrontKey(KeyType frontrunner,
-                             Iterator0 begin0, Iterator0 end0, KeyFn0 keyFn0,
-                             Iterator1 begin1, Iterator1 end1, KeyFn1 keyFn1,
-                             Iterator2 begin2, Iterator2 end2, KeyFn2 keyFn2)
-  {
-    KeyType ret = frontrunner;
-
-    if (begin0 != end0)
-    {
-      ret = std::min(ret, keyFn0(*begin0));
-    }
-
-    if (begin1 != end1)
-    {
-      ret = std::min(ret, keyFn1(*begin1));
-    }
-
-    if (begin2 != end2)
-    {
-      ret = std::min(ret, keyFn2(*begin2));
-    }
-
-    return ret;
-  }
-
-  template<typename Iterator0, typename KeyFn0,
-           typename Iterator1, typename KeyFn1,
-           typename Iterator2, typename KeyFn2,
-           typename Iterator3, typename KeyFn3,
-           typename Element0 = decltype(*std::declval<Iterator0>()),
-           typename Element1 = decltype(*std::declval<Iterator1>()),
-           typename Element2 = decltype(*std::declval<Iterator2>()),
-           typename Element3 = decltype(*std::declval<Iterator3>()),
-           typename KeyType = typename std::remove_const<
-             typename std::result_of<
-               KeyFn0(decltype(*std::declval<Iterator0>()))
-                 >::type >::type>
-  class GroupBy4
-  {
-  public:
-    GroupBy4(
-      Iterator0 begin0, Iterator0 end0, KeyFn0 keyFn0,
-      Iterator1 begin1, Iterator1 end1, KeyFn1 keyFn1,
-      Iterator2 begin2, Iterator2 end2, KeyFn2 keyFn2,
-      Iterator3 begin3, Iterator3 end3, KeyFn3 keyFn3)
-    : begin0_(begin0), end0_(end0), keyFn0_(keyFn0),
-      begin1_(begin1), end1_(end1), keyFn1_(keyFn1),
-      begin2_(begin2), end2_(end2), keyFn2_(keyFn2),
-      begin3_(begin3), end3_(end3), keyFn3_(keyFn3)
-    {
-      NTA_ASSERT(std::is_sorted(begin0, end0,
-                                [&](const Element0& a, const Element0& b)
-                                {
-                                  return keyFn0(a) < keyFn0(b);
-                                }));
-      NTA_ASSERT(std::is_sorted(begin1, end1,
-                                [&](const Element1& a, const Element1& b)
-                                {
-                                  return keyFn1(a) < keyFn1(b);
-                                }));
-      NTA_ASSERT(std::is_sorted(begin2, end2,
-                                [&](const Element2& a, const Element2& b)
-                                {
-                                  return keyFn2(a) < keyFn2(b);
-                                }));
-      NTA_ASSERT(std::is_sorted(begin3, end3,
-                                [&](const Element3& a, const Element3& b)
-                                {
-                                  return keyFn3(a) < keyFn3(b);
-                                }));
-    }
-
-    class Iterator
-    {
-    public:
-      Iterator(
-        Iterator0 begin0, Iterator0 end0, KeyFn0 keyFn0,
-        Iterator1 begin1, Iterator1 end1, KeyFn1 keyFn1,
-        Iterator2 begin2, Iterator2 end2, KeyFn2 keyFn2,
-        Iterator3 begin3, Iterator3 end3, KeyFn3 keyFn3)
-        :current0_(begin0), end0_(end0), keyFn0_(keyFn0),
-         current1_(begin1), end1_(end1), keyFn1_(keyFn1),
-         current2_(begin2), end2_(end2), keyFn2_(keyFn2),
-         current3_(begin3), end3_(end3), keyFn3_(keyFn3),
-         finished_(false)
-      {
-        calculateNext_();
-      }
-
-      bool operator !=(const Iterator& other)
+      KeyType minFrontKey_(KeyType frontrunner, End_) const
       {
-        return (finished_ != other.finished_ ||
-                current0_ != other.current0_ ||
-                current1_ != other.current1_ ||
-                current2_ != other.current2_ ||
-                current3_ != other.current3_);
+        return frontrunner;
       }
 
-      const std::tuple<KeyType,
-                       Iterator0, Iterator0,
-                       Iterator1, Iterator1,
-                       Iterator2, Iterator2,
-                       Iterator3, Iterator3>& operator*() const
+      // Find the first nonempty sequence, then the lowest key among it and
+      // the sequences after it. Returns false if every sequence is empty.
+      template<size_t I>
+      bool lowestKey_(KeyType& key, std::integral_constant<size_t, I>) const
       {
-        NTA_ASSERT(!finished_);
-        return v_;
-      }
-
-      const Iterator& operator++()
-      {
-        NTA_ASSERT(!finished_);
-        calculateNext_();
-        return *this;
-      }
-
-    private:
-
-      void calculateNext_()
-      {
-        if (current0_ != end0_ ||
-            current1_ != end1_ ||
-            current2_ != end2_ ||
-            current3_ != end3_)
-        {
-          // Find the lowest key.
-          KeyType key;
-          if (current0_ != end0_)
-          {
-            key = minFrontKey(keyFn0_(*current0_),
-                              current1_, end1_, keyFn1_,
-                              current2_, end2_, keyFn2_,
-                              current3_, end3_, keyFn3_);
-          }
-          else if (current1_ != end1_)
-          {
-            key = minFrontKey(keyFn1_(*current1_),
-                              current2_, end2_, keyFn2_,
-                              current3_, end3_, keyFn3_);
-          }
-          else if (current2_ != end2_)
-          {
-            key = minFrontKey(keyFn2_(*current2_),
-                              current3_, end3_, keyFn3_);
-          }
-          else
-          {
-            key = keyFn3_(*current3_);
-          }
-
-          std::get<0>(v_) = key;
-
-          // Find all elements with this key.
-          std::get<1>(v_) = current0_;
-          while (current0_ != end0_ && keyFn0_(*current0_) == key)
-          {
-            current0_++;
-          }
-          std::get<2>(v_) = current0_;
-
-          std::get<3>(v_) = current1_;
-          while (current1_ != end1_ && keyFn1_(*current1_) == key)
-          {
-            current1_++;
-          }
-          std::get<4>(v_) = current1_;
-
-          std::get<5>(v_) = current2_;
-          while (current2_ != end2_ && keyFn2_(*current2_) == key)
-          {
-            current2_++;
-          }
-          std::get<6>(v_) = current2_;
-
-          std::get<7>(v_) = current3_;
-          while (current3_ != end3_ && keyFn3_(*current3_) == key)
-          {
-            current3_++;
-          }
-          std::get<8>(v_) = current3_;
-        }
-        else
+        const auto& sequence = std::get<I>(sequences_);
+        if (sequence.current != sequence.end)
         {
-          finished_ = true;
+          key = minFrontKey_(sequence.keyFn(*sequence.current),
+                             std::integral_constant<size_t, I + 1>());
+          return true;
         }
+        return lowestKey_(key, std::integral_constant<size_t, I + 1>());
       }
 
-      std::tuple<KeyType,
-                 Iterator0, Iterator0,
-                 Iterator1, Iterator1,
-                 Iterator2, Iterator2,
-                 Iterator3, Iterator3> v_;
-
-      Iterator0 current0_;
-      Iterator0 end0_;
-      KeyFn0 keyFn0_;
-
-      Iterator1 current1_;
-      Iterator1 end1_;
-      KeyFn1 keyFn1_;
-
-      Iterator2 current2_;
-      Iterator2 end2_;
-      KeyFn2 keyFn2_;
-
-      Iterator3 current3_;
-      Iterator3 end3_;
-      KeyFn3 keyFn3_;
-
-      bool finished_;
-    };
-
-    Iterator begin() const
-    {
-      return Iterator(begin0_, end0_, keyFn0_,
-                      begin1_, end1_, keyFn1_,
-                      begin2_, end2_, keyFn2_,
-                      begin3_, end3_, keyFn3_);
-    }
-
-    Iterator end() const
-    {
-      return Iterator(end0_, end0_, keyFn0_,
-                      end1_, end1_, keyFn1_,
-                      end2_, end2_, keyFn2_,
-                      end3_, end3_, keyFn3_);
-    }
-
-  private:
-    Iterator0 begin0_;
-    Iterator0 end0_;
-    KeyFn0 keyFn0_;
-
-    Iterator1 begin1_;
-    Iterator1 end1_;
-    KeyFn1 keyFn1_;
-
-    Iterator2 begin2_;
-    Iterator2 end2_;
-    KeyFn2 keyFn2_;
-
-    Iterator3 begin3_;
-    Iterator3 end3_;
-    KeyFn3 keyFn3_;
-  };
-
-  template<typename Sequence0, typename KeyFn0,
-           typename Sequence1, typename KeyFn1,
-           typename Sequence2, typename KeyFn2,
-           typename Sequence3, typename KeyFn3>
-  GroupBy4<typename Sequence0::const_iterator, KeyFn0,
-           typename Sequence1::const_iterator, KeyFn1,
-           typename Sequence2::const_iterator, KeyFn2,
-           typename Sequence3::const_iterator, KeyFn3>
-  groupBy(const Sequence0& sequence0, KeyFn0 keyFn0,
-          const Sequence1& sequence1, KeyFn1 keyFn1,
-          const Sequence2& sequence2, KeyFn2 keyFn2,
-          const Sequence3& sequence3, KeyFn3 keyFn3)
-  {
-    return {sequence0.begin(), sequence0.end(), keyFn0,
-            sequence1.begin(), sequence1.end(), keyFn1,
-            sequence2.begin(), sequence2.end(), keyFn2,
-            sequence3.begin(), sequence3.end(), keyFn3};
-  }
-
-  template<typename Iterator0, typename KeyFn0,
-           typename Iterator1, typename KeyFn1,
-           typename Iterator2, typename KeyFn2,
-           typename Iterator3, typename KeyFn3>
-  GroupBy4<Iterator0, KeyFn0,
-           Iterator1, KeyFn1,
-           Iterator2, KeyFn2,
-           Iterator3, KeyFn3>
-  iterGroupBy(
-    Iterator0 begin0, Iterator0 end0, KeyFn0 keyFn0,
-    Iterator1 begin1, Iterator1 end1, KeyFn1 keyFn1,
-    Iterator2 begin2, Iterator2 end2, KeyFn2 keyFn2,
-    Iterator3 begin3, Iterator3 end3, KeyFn3 keyFn3)
-  {
-    return {begin0, end0, keyFn0,
-            begin1, end1, keyFn1,
-            begin2, end2, keyFn2,
-            begin3, end3, keyFn3};
-  }
-
-
-  // ==========================================================================
-  // 5 SEQUENCES
-  // ==========================================================================
-
-  template<typename Iterator0, typename KeyFn0,
-           typename Iterator1, typename KeyFn1,
-           typename Iterator2, typename KeyFn2,
-           typename Iterator3, typename KeyFn3,
-           typename KeyType = typename std::remove_const<
-             typename std::result_of<
-               KeyFn0(decltype(*std::declval<Iterator0>()))
-                 >::type >::type>
-  static KeyType minFrontKey(KeyType frontrunner,
-                             Iterator0 begin0, Iterator0 end0, KeyFn0 keyFn0,
-                             Iterator1 begin1, Iterator1 end1, KeyFn1 keyFn1,
-                             Iterator2 begin2, Iterator2 end2, KeyFn2 keyFn2,
-                             Iterator3 begin3, Iterator3 end3, KeyFn3 keyFn3)
-  {
-    KeyType ret = frontrunner;
-
-    if (begin0 != end0)
-    {
-      ret = std::min(ret, keyFn0(*begin0));
-    }
-
-    if (begin1 != end1)
-    {
-      ret = std::min(ret, keyFn1(*begin1));
-    }
-
-    if (begin2 != end2)
-    {
-      ret = std::min(ret, keyFn2(*begin2));
-    }
-
-    if (begin3 != end3)
-    {
-      ret = std::min(ret, keyFn3(*begin3));
-    }
-
-    return ret;
-  }
-
-  template<typename Iterator0, typename KeyFn0,
-           typename Iterator1, typename KeyFn1,
-           typename Iterator2, typename KeyFn2,
-           typename Iterator3, typename KeyFn3,
-           typename Iterator4, typename KeyFn4,
-           typename Element0 = decltype(*std::declval<Iterator0>()),
-           typename Element1 = decltype(*std::declval<Iterator1>()),
-           typename Element2 = decltype(*std::declval<Iterator2>()),
-           typename Element3 = decltype(*std::declval<Iterator3>()),
-           typename Element4 = decltype(*std::declval<Iterator4>()),
-           typename KeyType = typename std::remove_const<
-             typename std::result_of<
-               KeyFn0(decltype(*std::declval<Iterator0>()))
-                 >::type >::type>
-  class GroupBy5
-  {
-  public:
-    GroupBy5(
-      Iterator0 begin0, Iterator0 end0, KeyFn0 keyFn0,
-      Iterator1 begin1, Iterator1 end1, KeyFn1 keyFn1,
-      Iterator2 begin2, Iterator2 end2, KeyFn2 keyFn2,
-      Iterator3 begin3, Iterator3 end3, KeyFn3 keyFn3,
-      Iterator4 begin4, Iterator4 end4, KeyFn4 keyFn4)
-    : begin0_(begin0), end0_(end0), keyFn0_(keyFn0),
-      begin1_(begin1), end1_(end1), keyFn1_(keyFn1),
-      begin2_(begin2), end2_(end2), keyFn2_(keyFn2),
-      begin3_(begin3), end3_(end3), keyFn3_(keyFn3),
-      begin4_(begin4), end4_(end4), keyFn4_(keyFn4)
-    {
-      NTA_ASSERT(std::is_sorted(begin0, end0,
-                                [&](const Element0& a, const Element0& b)
-                                {
-                                  return keyFn0(a) < keyFn0(b);
-                                }));
-      NTA_ASSERT(std::is_sorted(begin1, end1,
-                                [&](const Element1& a, const Element1& b)
-                                {
-                                  return keyFn1(a) < keyFn1(b);
-                                }));
-      NTA_ASSERT(std::is_sorted(begin2, end2,
-                                [&](const Element2& a, const Element2& b)
-                                {
-                                  return keyFn2(a) < keyFn2(b);
-                                }));
-      NTA_ASSERT(std::is_sorted(begin3, end3,
-                                [&](const Element3& a, const Element3& b)
-                                {
-                                  return keyFn3(a) < keyFn3(b);
-                                }));
-      NTA_ASSERT(std::is_sorted(begin4, end4,
-                                [&](const Element4& a, const Element4& b)
-                                {
-                                  return keyFn4(a) < keyFn4(b);
-                                }));
-    }
-
-    class Iterator
-    {
-    public:
-      Iterator(
-        Iterator0 begin0, Iterator0 end0, KeyFn0 keyFn0,
-        Iterator1 begin1, Iterator1 end1, KeyFn1 keyFn1,
-        Iterator2 begin2, Iterator2 end2, KeyFn2 keyFn2,
-        Iterator3 begin3, Iterator3 end3, KeyFn3 keyFn3,
-        Iterator4 begin4, Iterator4 end4, KeyFn4 keyFn4)
-        :current0_(begin0), end0_(end0), keyFn0_(keyFn0),
-         current1_(begin1), end1_(end1), keyFn1_(keyFn1),
-         current2_(begin2), end2_(end2), keyFn2_(keyFn2),
-         current3_(begin3), end3_(end3), keyFn3_(keyFn3),
-         current4_(begin4), end4_(end4), keyFn4_(keyFn4),
-         finished_(false)
+      bool lowestKey_(KeyType& key, End_) const
       {
-        calculateNext_();
+        return false;
       }
 
-      bool operator !=(const Iterator& other)
+      template<size_t I>
+      bool anyCurrentDiffers_(const Iterator& other,
+                              std::integral_constant<size_t, I>) const
       {
-        return (finished_ != other.finished_ ||
-                current0_ != other.current0_ ||
-                current1_ != other.current1_ ||
-                current2_ != other.current2_ ||
-                current3_ != other.current3_ ||
-                current4_ != other.current4_);
+        return (std::get<I>(sequences_).current !=
+                std::get<I>(other.sequences_).current ||
+                anyCurrentDiffers_(other,
+                                   std::integral_constant<size_t, I + 1>()));
       }
 
-      const std::tuple<KeyType,
-                       Iterator0, Iterator0,
-                       Iterator1, Iterator1,
-                       Iterator2, Iterator2,
-                       Iterator3, Iterator3,
-                       Iterator4, Iterator4>& operator*() const
+      bool anyCurrentDiffers_(const Iterator& other, End_) const
       {
-        NTA_ASSERT(!finished_);
-        return v_;
+        return false;
       }
 
-      const Iterator& operator++()
+      template<size_t I>
+      void takeGroup_(const KeyType& key)
       {
-        NTA_ASSERT(!finished_);
-        calculateNext_();
-        return *this;
-      }
+        auto& sequence = std::get<I>(sequences_);
 
-    private:
+        // Find all elements with this key.
+        std::get<1 + 2*I>(v_) = sequence.current;
+        while (sequence.current != sequence.end &&
+               sequence.keyFn(*sequence.current) == key)
+        {
+          sequence.current++;
+        }
+        std::get<2 + 2*I>(v_) = sequence.current;
+      }
 
-      void calculateNext_()
+      template<size_t... Is>
+      void calculateNext_(groupby_detail::IndexSequence<Is...>)
       {
-        if (current0_ != end0_ ||
-            current1_ != end1_ ||
-            current2_ != end2_ ||
-            current3_ != end3_ ||
-            current4_ != end4_)
+        KeyType key;
+        if (lowestKey_(key, std::integral_constant<size_t, 0>()))
         {
-          // Find the lowest key.
-          KeyType key;
-          if (current0_ != end0_)
-          {
-            key = minFrontKey(keyFn0_(*current0_),
-                              current1_, end1_, keyFn1_,
-                              current2_, end2_, keyFn2_,
-                              current3_, end3_, keyFn3_,
-                              current4_, end4_, keyFn4_);
-          }
-          else if (current1_ != end1_)
-          {
-            key = minFrontKey(keyFn1_(*current1_),
-                              current2_, end2_, keyFn2_,
-                              current3_, end3_, keyFn3_,
-                              current4_, end4_, keyFn4_);
-          }
-          else if (current2_ != end2_)
-          {
-            key = minFrontKey(keyFn2_(*current2_),
-                              current3_, end3_, keyFn3_,
-                              current4_, end4_, keyFn4_);
-          }
-          else if (current3_ != end3_)
-          {
-            key = minFrontKey(keyFn3_(*current3_),
-                              current4_, end4_, keyFn4_);
-          }
-          else
-          {
-            key = keyFn4_(*current4_);
-          }
-
           std::get<0>(v_) = key;
 
-          // Find all elements with this key.
-          std::get<1>(v_) = current0_;
-          while (current0_ != end0_ && keyFn0_(*current0_) == key)
-          {
-            current0_++;
-          }
-          std::get<2>(v_) = current0_;
-
-          std::get<3>(v_) = current1_;
-          while (current1_ != end1_ && keyFn1_(*current1_) == key)
-          {
-            current1_++;
-          }
-          std::get<4>(v_) = current1_;
-
-          std::get<5>(v_) = current2_;
-          while (current2_ != end2_ && keyFn2_(*current2_) == key)
-          {
-            current2_++;
-          }
-          std::get<6>(v_) = current2_;
-
-          std::get<7>(v_) = current3_;
-          while (current3_ != end3_ && keyFn3_(*current3_) == key)
-          {
-            current3_++;
-          }
-          std::get<8>(v_) = current3_;
-
-          std::get<9>(v_) = current4_;
-          while (current4_ != end4_ && keyFn4_(*current4_) == key)
-          {
-            current4_++;
-          }
-          std::get<10>(v_) = current4_;
+          const int expandTake[] = {0, (takeGroup_<Is>(key), 0)...};
+          (void)expandTake;
         }
         else
         {
@@ -1144,528 +337,108 @@ namespace nupic
         }
       }
 
-      std::tuple<KeyType,
-                 Iterator0, Iterator0,
-                 Iterator1, Iterator1,
-                 Iterator2, Iterator2,
-                 Iterator3, Iterator3,
-                 Iterator4, Iterator4> v_;
-
-      Iterator0 current0_;
-      Iterator0 end0_;
-      KeyFn0 keyFn0_;
-
-      Iterator1 current1_;
-      Iterator1 end1_;
-      KeyFn1 keyFn1_;
-
-      Iterator2 current2_;
-      Iterator2 end2_;
-      KeyFn2 keyFn2_;
-
-      Iterator3 current3_;
-      Iterator3 end3_;
-      KeyFn3 keyFn3_;
-
-      Iterator4 current4_;
-      Iterator4 end4_;
-      KeyFn4 keyFn4_;
+      void calculateNext_()
+      {
+        calculateNext_(Indices());
+      }
 
+      Value v_;
+      std::tuple<Sequences...> sequences_;
       bool finished_;
     };
 
     Iterator begin() const
     {
-      return Iterator(begin0_, end0_, keyFn0_,
-                      begin1_, end1_, keyFn1_,
-                      begin2_, end2_, keyFn2_,
-                      begin3_, end3_, keyFn3_,
-                      begin4_, end4_, keyFn4_);
+      return Iterator(sequences_);
     }
 
     Iterator end() const
     {
-      return Iterator(end0_, end0_, keyFn0_,
-                      end1_, end1_, keyFn1_,
-                      end2_, end2_, keyFn2_,
-                      end3_, end3_, keyFn3_,
-                      end4_, end4_, keyFn4_);
+      return Iterator(atEnd_(Indices()));
     }
 
   private:
-    Iterator0 begin0_;
-    Iterator0 end0_;
-    KeyFn0 keyFn0_;
-
-    Iterator1 begin1_;
-    Iterator1 end1_;
-    KeyFn1 keyFn1_;
-
-    Iterator2 begin2_;
-    Iterator2 end2_;
-    KeyFn2 keyFn2_;
-
-    Iterator3 begin3_;
-    Iterator3 end3_;
-    KeyFn3 keyFn3_;
-
-    Iterator4 begin4_;
-    Iterator4 end4_;
-    KeyFn4 keyFn4_;
-  };
-
-  template<typename Sequence0, typename KeyFn0,
-           typename Sequence1, typename KeyFn1,
-           typename Sequence2, typename KeyFn2,
-           typename Sequence3, typename KeyFn3,
-           typename Sequence4, typename KeyFn4>
-  GroupBy5<typename Sequence0::const_iterator, KeyFn0,
-           typename Sequence1::const_iterator, KeyFn1,
-           typename Sequence2::const_iterator, KeyFn2,
-           typename Sequence3::const_iterator, KeyFn3,
-           typename Sequence4::const_iterator, KeyFn4>
-  groupBy(const Sequence0& sequence0, KeyFn0 keyFn0,
-          const Sequence1& sequence1, KeyFn1 keyFn1,
-          const Sequence2& sequence2, KeyFn2 keyFn2,
-          const Sequence3& sequence3, KeyFn3 keyFn3,
-          const Sequence4& sequence4, KeyFn4 keyFn4)
-  {
-    return {sequence0.begin(), sequence0.end(), keyFn0,
-            sequence1.begin(), sequence1.end(), keyFn1,
-            sequence2.begin(), sequence2.end(), keyFn2,
-            sequence3.begin(), sequence3.end(), keyFn3,
-            sequence4.begin(), sequence4.end(), keyFn4};
-  }
-
-  template<typename Iterator0, typename KeyFn0,
-           typename Iterator1, typename KeyFn1,
-           typename Iterator2, typename KeyFn2,
-           typename Iterator3, typename KeyFn3,
-           typename Iterator4, typename KeyFn4>
-  GroupBy5<Iterator0, KeyFn0,
-           Iterator1, KeyFn1,
-           Iterator2, KeyFn2,
-           Iterator3, KeyFn3,
-           Iterator4, KeyFn4>
-  iterGroupBy(
-    Iterator0 begin0, Iterator0 end0, KeyFn0 keyFn0,
-    Iterator1 begin1, Iterator1 end1, KeyFn1 keyFn1,
-    Iterator2 begin2, Iterator2 end2, KeyFn2 keyFn2,
-    Iterator3 begin3, Iterator3 end3, KeyFn3 keyFn3,
-    Iterator4 begin4, Iterator4 end4, KeyFn4 keyFn4)
-  {
-    return {begin0, end0, keyFn0,
-            begin1, end1, keyFn1,
-            begin2, end2, keyFn2,
-            begin3, end3, keyFn3,
-            begin4, end4, keyFn4};
-  }
-
-
-  // ==========================================================================
-  // 6 SEQUENCES
-  // ==========================================================================
-
-  template<typename Iterator0, typename KeyFn0,
-           typename Iterator1, typename KeyFn1,
-           typename Iterator2, typename KeyFn2,
-           typename Iterator3, typename KeyFn3,
-           typename Iterator4, typename KeyFn4,
-           typename KeyType = typename std::remove_const<
-             typename std::result_of<
-               KeyFn0(decltype(*std::declval<Iterator0>()))
-                 >::type >::type>
-  static KeyType minFrontKey(KeyType frontrunner,
-                             Iterator0 begin0, Iterator0 end0, KeyFn0 keyFn0,
-                             Iterator1 begin1, Iterator1 end1, KeyFn1 keyFn1,
-                             Iterator2 begin2, Iterator2 end2, KeyFn2 keyFn2,
-                             Iterator3 begin3, Iterator3 end3, KeyFn3 keyFn3,
-                             Iterator4 begin4, Iterator4 end4, KeyFn4 keyFn4)
-  {
-    KeyType ret = frontrunner;
-
-    if (begin0 != end0)
-    {
-      ret = std::min(ret, keyFn0(*begin0));
-    }
-
-    if (begin1 != end1)
-    {
-      ret = std::min(ret, keyFn1(*begin1));
-    }
-
-    if (begin2 != end2)
-    {
-      ret = std::min(ret, keyFn2(*begin2));
-    }
 
-    if (begin3 != end3)
+    template<size_t... Is>
+    void assertSorted_(groupby_detail::IndexSequence<Is...>) const
     {
-      ret = std::min(ret, keyFn3(*begin3));
+      const int expand[] = {0, (assertSequenceSorted_(std::get<Is>(sequences_)),
+                                0)...};
+      (void)expand;
     }
 
-    if (begin4 != end4)
+    template<typename Sequence>
+    static void assertSequenceSorted_(const Sequence& sequence)
     {
-      ret = std::min(ret, keyFn4(*begin4));
-    }
-
-    return ret;
-  }
-
-  template<typename Iterator0, typename KeyFn0,
-           typename Iterator1, typename KeyFn1,
-           typename Iterator2, typename KeyFn2,
-           typename Iterator3, typename KeyFn3,
-           typename Iterator4, typename KeyFn4,
-           typename Iterator5, typename KeyFn5,
-           typename Element0 = decltype(*std::declval<Iterator0>()),
-           typename Element1 = decltype(*std::declval<Iterator1>()),
-           typename Element2 = decltype(*std::declval<Iterator2>()),
-           typename Element3 = decltype(*std::declval<Iterator3>()),
-           typename Element4 = decltype(*std::declval<Iterator4>()),
-           typename Element5 = decltype(*std::declval<Iterator5>()),
-           typename KeyType = typename std::remove_const<
-             typename std::result_of<
-               KeyFn0(decltype(*std::declval<Iterator0>()))
-                 >::type >::type>
-  class GroupBy6
-  {
-  public:
-    GroupBy6(
-      Iterator0 begin0, Iterator0 end0, KeyFn0 keyFn0,
-      Iterator1 begin1, Iterator1 end1, KeyFn1 keyFn1,
-      Iterator2 begin2, Iterator2 end2, KeyFn2 keyFn2,
-      Iterator3 begin3, Iterator3 end3, KeyFn3 keyFn3,
-      Iterator4 begin4, Iterator4 end4, KeyFn4 keyFn4,
-      Iterator5 begin5, Iterator5 end5, KeyFn5 keyFn5)
-    : begin0_(begin0), end0_(end0), keyFn0_(keyFn0),
-      begin1_(begin1), end1_(end1), keyFn1_(keyFn1),
-      begin2_(begin2), end2_(end2), keyFn2_(keyFn2),
-      begin3_(begin3), end3_(end3), keyFn3_(keyFn3),
-      begin4_(begin4), end4_(end4), keyFn4_(keyFn4),
-      begin5_(begin5), end5_(end5), keyFn5_(keyFn5)
-    {
-      NTA_ASSERT(std::is_sorted(begin0, end0,
-                                [&](const Element0& a, const Element0& b)
-                                {
-                                  return keyFn0(a) < keyFn0(b);
-                                }));
-      NTA_ASSERT(std::is_sorted(begin1, end1,
-                                [&](const Element1& a, const Element1& b)
-                                {
-                                  return keyFn1(a) < keyFn1(b);
-                                }));
-      NTA_ASSERT(std::is_sorted(begin2, end2,
-                                [&](const Element2& a, const Element2& b)
+      NTA_ASSERT(std::is_sorted(sequence.current, sequence.end,
+                                [&](decltype(*sequence.current) a,
+                                    decltype(*sequence.current) b)
                                 {
-                                  return keyFn2(a) < keyFn2(b);
-                                }));
-      NTA_ASSERT(std::is_sorted(begin3, end3,
-                                [&](const Element3& a, const Element3& b)
-                                {
-                                  return keyFn3(a) < keyFn3(b);
-                                }));
-      NTA_ASSERT(std::is_sorted(begin4, end4,
-                                [&](const Element4& a, const Element4& b)
-                                {
-                                  return keyFn4(a) < keyFn4(b);
-                                }));
-      NTA_ASSERT(std::is_sorted(begin5, end5,
-                                [&](const Element5& a, const Element5& b)
-                                {
-                                  return keyFn5(a) < keyFn5(b);
+                                  return sequence.keyFn(a) < sequence.keyFn(b);
                                 }));
     }
 
-    class Iterator
+    template<size_t... Is>
+    std::tuple<Sequences...> atEnd_(groupby_detail::IndexSequence<Is...>) const
     {
-    public:
-      Iterator(
-        Iterator0 begin0, Iterator0 end0, KeyFn0 keyFn0,
-        Iterator1 begin1, Iterator1 end1, KeyFn1 keyFn1,
-        Iterator2 begin2, Iterator2 end2, KeyFn2 keyFn2,
-        Iterator3 begin3, Iterator3 end3, KeyFn3 keyFn3,
-        Iterator4 begin4, Iterator4 end4, KeyFn4 keyFn4,
-        Iterator5 begin5, Iterator5 end5, KeyFn5 keyFn5)
-        :current0_(begin0), end0_(end0), keyFn0_(keyFn0),
-         current1_(begin1), end1_(end1), keyFn1_(keyFn1),
-         current2_(begin2), end2_(end2), keyFn2_(keyFn2),
-         current3_(begin3), end3_(end3), keyFn3_(keyFn3),
-         current4_(begin4), end4_(end4), keyFn4_(keyFn4),
-         current5_(begin5), end5_(end5), keyFn5_(keyFn5),
-         finished_(false)
-      {
-        calculateNext_();
-      }
-
-      bool operator !=(const Iterator& other)
-      {
-        return (finished_ != other.finished_ ||
-                current0_ != other.current0_ ||
-                current1_ != other.current1_ ||
-                current2_ != other.current2_ ||
-                current3_ != other.current3_ ||
-                current4_ != other.current4_ ||
-                current5_ != other.current5_);
-      }
-
-      const std::tuple<KeyType,
-                       Iterator0, Iterator0,
-                       Iterator1, Iterator1,
-                       Iterator2, Iterator2,
-                       Iterator3, Iterator3,
-                       Iterator4, Iterator4,
-                       Iterator5, Iterator5>& operator*() const
-      {
-        NTA_ASSERT(!finished_);
-        return v_;
-      }
-
-      const Iterator& operator++()
-      {
-        NTA_ASSERT(!finished_);
-        calculateNext_();
-        return *this;
-      }
-
-    private:
-
-      void calculateNext_()
-      {
-        if (current0_ != end0_ ||
-            current1_ != end1_ ||
-            current2_ != end2_ ||
-            current3_ != end3_ ||
-            current4_ != end4_ ||
-            current5_ != end5_)
-        {
-          // Find the lowest key.
-          KeyType key;
-          if (current0_ != end0_)
-          {
-            key = minFrontKey(keyFn0_(*current0_),
-                              current1_, end1_, keyFn1_,
-                              current2_, end2_, keyFn2_,
-                              current3_, end3_, keyFn3_,
-                              current4_, end4_, keyFn4_,
-                              current5_, end5_, keyFn5_);
-          }
-          else if (current1_ != end1_)
-          {
-            key = minFrontKey(keyFn1_(*current1_),
-                              current2_, end2_, keyFn2_,
-                              current3_, end3_, keyFn3_,
-                              current4_, end4_, keyFn4_,
-                              current5_, end5_, keyFn5_);
-          }
-          else if (current2_ != end2_)
-          {
-            key = minFrontKey(keyFn2_(*current2_),
-                              current3_, end3_, keyFn3_,
-                              current4_, end4_, keyFn4_,
-                              current5_, end5_, keyFn5_);
-          }
-          else if (current3_ != end3_)
-          {
-            key = minFrontKey(keyFn3_(*current3_),
-                              current4_, end4_, keyFn4_,
-                              current5_, end5_, keyFn5_);
-          }
-          else if (current4_ != end4_)
-          {
-            key = minFrontKey(keyFn4_(*current4_),
-                              current5_, end5_, keyFn5_);
-          }
-          else
-          {
-            key = keyFn5_(*current5_);
-          }
-
-          std::get<0>(v_) = key;
-
-          // Find all elements with this key.
-          std::get<1>(v_) = current0_;
-          while (current0_ != end0_ && keyFn0_(*current0_) == key)
-          {
-            current0_++;
-          }
-          std::get<2>(v_) = current0_;
-
-          std::get<3>(v_) = current1_;
-          while (current1_ != end1_ && keyFn1_(*current1_) == key)
-          {
-            current1_++;
-          }
-          std::get<4>(v_) = current1_;
-
-          std::get<5>(v_) = current2_;
-          while (current2_ != end2_ && keyFn2_(*current2_) == key)
-          {
-            current2_++;
-          }
-          std::get<6>(v_) = current2_;
-
-          std::get<7>(v_) = current3_;
-          while (current3_ != end3_ && keyFn3_(*current3_) == key)
-          {
-            current3_++;
-          }
-          std::get<8>(v_) = current3_;
-
-          std::get<9>(v_) = current4_;
-          while (current4_ != end4_ && keyFn4_(*current4_) == key)
-          {
-            current4_++;
-          }
-          std::get<10>(v_) = current4_;
-
-          std::get<11>(v_) = current5_;
-          while (current5_ != end5_ && keyFn5_(*current5_) == key)
-          {
-            current5_++;
-          }
-          std::get<12>(v_) = current5_;
-        }
-        else
-        {
-          finished_ = true;
-        }
-      }
-
-      std::tuple<KeyType,
-                 Iterator0, Iterator0,
-                 Iterator1, Iterator1,
-                 Iterator2, Iterator2,
-                 Iterator3, Iterator3,
-                 Iterator4, Iterator4,
-                 Iterator5, Iterator5> v_;
-
-      Iterator0 current0_;
-      Iterator0 end0_;
-      KeyFn0 keyFn0_;
-
-      Iterator1 current1_;
-      Iterator1 end1_;
-      KeyFn1 keyFn1_;
-
-      Iterator2 current2_;
-      Iterator2 end2_;
-      KeyFn2 keyFn2_;
-
-      Iterator3 current3_;
-      Iterator3 end3_;
-      KeyFn3 keyFn3_;
-
-      Iterator4 current4_;
-      Iterator4 end4_;
-      KeyFn4 keyFn4_;
-
-      Iterator5 current5_;
-      Iterator5 end5_;
-      KeyFn5 keyFn5_;
+      return std::tuple<Sequences...>(
+        Sequences(std::get<Is>(sequences_).end,
+                  std::get<Is>(sequences_).end,
+                  std::get<Is>(sequences_).keyFn)...);
+    }
 
-      bool finished_;
-    };
+    std::tuple<Sequences...> sequences_;
+  };
 
-    Iterator begin() const
+  namespace groupby_detail
+  {
+    template<typename Result, typename ArgsTuple, size_t... Is>
+    Result fromContainerPairs(const ArgsTuple& args, IndexSequence<Is...>)
     {
-      return Iterator(begin0_, end0_, keyFn0_,
-                      begin1_, end1_, keyFn1_,
-                      begin2_, end2_, keyFn2_,
-                      begin3_, end3_, keyFn3_,
-                      begin4_, end4_, keyFn4_,
-                      begin5_, end5_, keyFn5_);
+      return Result(
+        typename std::tuple_element<
+          Is, typename Result::SequenceTuple>::type(
+            std::get<2*Is>(args).begin(),
+            std::get<2*Is>(args).end(),
+            std::get<2*Is + 1>(args))...);
     }
 
-    Iterator end() const
+    template<typename Result, typename ArgsTuple, size_t... Is>
+    Result fromIteratorTriples(const ArgsTuple& args, IndexSequence<Is...>)
     {
-      return Iterator(end0_, end0_, keyFn0_,
-                      end1_, end1_, keyFn1_,
-                      end2_, end2_, keyFn2_,
-                      end3_, end3_, keyFn3_,
-                      end4_, end4_, keyFn4_,
-                      end5_, end5_, keyFn5_);
+      return Result(
+        typename std::tuple_element<
+          Is, typename Result::SequenceTuple>::type(
+            std::get<3*Is>(args),
+            std::get<3*Is + 1>(args),
+            std::get<3*Is + 2>(args))...);
     }
+  } // end namespace groupby_detail
 
-  private:
-    Iterator0 begin0_;
-    Iterator0 end0_;
-    KeyFn0 keyFn0_;
-
-    Iterator1 begin1_;
-    Iterator1 end1_;
-    KeyFn1 keyFn1_;
-
-    Iterator2 begin2_;
-    Iterator2 end2_;
-    KeyFn2 keyFn2_;
-
-    Iterator3 begin3_;
-    Iterator3 end3_;
-    KeyFn3 keyFn3_;
-
-    Iterator4 begin4_;
-    Iterator4 end4_;
-    KeyFn4 keyFn4_;
-
-    Iterator5 begin5_;
-    Iterator5 end5_;
-    KeyFn5 keyFn5_;
-  };
-
-  template<typename Sequence0, typename KeyFn0,
-           typename Sequence1, typename KeyFn1,
-           typename Sequence2, typename KeyFn2,
-           typename Sequence3, typename KeyFn3,
-           typename Sequence4, typename KeyFn4,
-           typename Sequence5, typename KeyFn5>
-  GroupBy6<typename Sequence0::const_iterator, KeyFn0,
-           typename Sequence1::const_iterator, KeyFn1,
-           typename Sequence2::const_iterator, KeyFn2,
-           typename Sequence3::const_iterator, KeyFn3,
-           typename Sequence4::const_iterator, KeyFn4,
-           typename Sequence5::const_iterator, KeyFn5>
-  groupBy(const Sequence0& sequence0, KeyFn0 keyFn0,
-          const Sequence1& sequence1, KeyFn1 keyFn1,
-          const Sequence2& sequence2, KeyFn2 keyFn2,
-          const Sequence3& sequence3, KeyFn3 keyFn3,
-          const Sequence4& sequence4, KeyFn4 keyFn4,
-          const Sequence5& sequence5, KeyFn5 keyFn5)
+  template<typename... Args>
+  typename groupby_detail::MakeGroupBy<GroupBy, std::tuple<>, Args...>::type
+  groupBy(const Args&... args)
   {
-    return {sequence0.begin(), sequence0.end(), keyFn0,
-            sequence1.begin(), sequence1.end(), keyFn1,
-            sequence2.begin(), sequence2.end(), keyFn2,
-            sequence3.begin(), sequence3.end(), keyFn3,
-            sequence4.begin(), sequence4.end(), keyFn4,
-            sequence5.begin(), sequence5.end(), keyFn5};
+    static_assert(sizeof...(Args) % 2 == 0,
+                  "groupBy expects (sequence, keyFn) pairs");
+
+    typedef typename groupby_detail::MakeGroupBy<
+      GroupBy, std::tuple<>, Args...>::type Result;
+    return groupby_detail::fromContainerPairs<Result>(
+      std::forward_as_tuple(args...), typename Result::Indices());
   }
 
-  template<typename Iterator0, typename KeyFn0,
-           typename Iterator1, typename KeyFn1,
-           typename Iterator2, typename KeyFn2,
-           typename Iterator3, typename KeyFn3,
-           typename Iterator4, typename KeyFn4,
-           typename Iterator5, typename KeyFn5>
-  GroupBy6<Iterator0, KeyFn0,
-           Iterator1, KeyFn1,
-           Iterator2, KeyFn2,
-           Iterator3, KeyFn3,
-           Iterator4, KeyFn4,
-           Iterator5, KeyFn5>
-  iterGroupBy(
-    Iterator0 begin0, Iterator0 end0, KeyFn0 keyFn0,
-    Iterator1 begin1, Iterator1 end1, KeyFn1 keyFn1,
-    Iterator2 begin2, Iterator2 end2, KeyFn2 keyFn2,
-    Iterator3 begin3, Iterator3 end3, KeyFn3 keyFn3,
-    Iterator4 begin4, Iterator4 end4, KeyFn4 keyFn4,
-    Iterator5 begin5, Iterator5 end5, KeyFn5 keyFn5)
+  template<typename... Args>
+  typename groupby_detail::MakeIterGroupBy<GroupBy, std::tuple<>, Args...>::type
+  iterGroupBy(Args... args)
   {
-    return {begin0, end0, keyFn0,
-            begin1, end1, keyFn1,
-            begin2, end2, keyFn2,
-            begin3, end3, keyFn3,
-            begin4, end4, keyFn4,
-            begin5, end5, keyFn5};
+    static_assert(sizeof...(Args) % 3 == 0,
+                  "iterGroupBy expects (begin, end, keyFn) triples");
+
+    typedef typename groupby_detail::MakeIterGroupBy<
+      GroupBy, std::tuple<>, Args...>::type Result;
+    return groupby_detail::fromIteratorTriples<Result>(
+      std::forward_as_tuple(args...), typename Result::Indices());
   }
 
 } // end namespace nupic
@@ -0,0 +1,347 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef NTA_PARTITION_GROUPBY_HPP
+#define NTA_PARTITION_GROUPBY_HPP
+
+#include <algorithm> // lower_bound
+#include <exception>
+#include <iterator>
+#include <tuple>
+#include <vector>
+
+#if !defined(__MINGW32__) || defined(_GLIBCXX_HAS_GTHREADS)
+#define NTA_PARTITION_GROUPBY_THREADS
+#include <atomic>
+#include <system_error>
+#include <thread>
+#endif
+
+#include <nupic/utils/GroupBy.hpp>
+#include <nupic/utils/Log.hpp>
+
+namespace nupic
+{
+  /** @file
+   * Splits the inputs of an iterGroupBy into chunks that can be processed
+   * independently.
+   *
+   * The sequences passed to iterGroupBy are each sorted by key. To process
+   * them in parallel, every sequence has to be cut at the same keys, so that
+   * no group is split between two chunks. There are two functions:
+   *
+   * - `iterGroupByPartitions`, which computes the cut points
+   * - `partitionGroupBy`, which computes the cut points and runs a function
+   *   on each chunk, in parallel
+   *
+   * Both take the same (begin, end, keyFn) triples as iterGroupBy:
+   *
+   *   iterGroupByPartitions(numChunks, begin0, end0, keyFn0, ...)
+   *   partitionGroupBy(numChunks, fn, begin0, end0, keyFn0, ...)
+   *
+   * The cut keys are taken at evenly spaced positions in the longest
+   * sequence, and each sequence is cut at the first element whose key is not
+   * less than the cut key, found via binary search. If a key repeats, two
+   * cut points can coincide, so fewer than numChunks chunks may be produced.
+   *
+   * `fn` is called as
+   *
+   *   fn(chunk, begin0, end0, keyFn0, begin1, end1, keyFn1, ...)
+   *
+   * i.e. with the arguments of an iterGroupBy over that chunk. Each chunk
+   * only reads its own slice of the inputs; any shared output must be
+   * written to disjoint locations (e.g. indexed by key) or be synchronized
+   * by the caller. If a call throws, the first exception is rethrown after
+   * all chunks have finished.
+   *
+   * The chunks are processed by the calling thread and at most
+   * hardware_concurrency() - 1 worker threads, which each take the next
+   * unprocessed chunk until none are left. So numChunks can be sized by the
+   * data rather than by the number of cores. If a worker thread can't be
+   * started, the threads that did start process the rest.
+   *
+   * On toolchains without std::thread (our MinGW build) the chunks are
+   * processed sequentially on the calling thread.
+   */
+
+  namespace groupby_detail
+  {
+    /**
+     * Holds one boundary: an iterator into each sequence.
+     */
+    template<typename... Sequences>
+    struct BoundaryOf
+    {
+      typedef std::tuple<typename Sequences::Iterator...> type;
+    };
+
+    template<typename... Sequences>
+    class Partitioner
+    {
+    public:
+      typedef typename First<Sequences...>::type::KeyType KeyType;
+      typedef typename BoundaryOf<Sequences...>::type Boundary;
+      typedef typename MakeIndexSequence<sizeof...(Sequences)>::type Indices;
+      typedef std::tuple<Sequences...> SequenceTuple;
+
+      Partitioner(const Sequences&... sequences)
+        : sequences_(sequences...)
+      {}
+
+      /**
+       * Returns numChunks + 1 boundaries or fewer. Chunk i is the range
+       * between boundaries i and i + 1.
+       */
+      std::vector<Boundary> boundaries(size_t numChunks) const
+      {
+        NTA_CHECK(numChunks > 0) << "numChunks must be positive";
+
+        std::vector<Boundary> result;
+        result.reserve(numChunks + 1);
+        result.push_back(begins_(Indices()));
+
+        size_t longestSize = 0;
+        size_t longest = 0;
+        sizes_(Indices(), longest, longestSize);
+
+        for (size_t chunk = 1; chunk < numChunks; chunk++)
+        {
+          const size_t position = longestSize * chunk / numChunks;
+          if (position == 0)
+          {
+            continue;
+          }
+
+          const KeyType cutKey = keyAt_(longest, position,
+                                        std::integral_constant<size_t, 0>());
+          const Boundary cut = lowerBounds_(cutKey, Indices());
+          if (cut != result.back())
+          {
+            result.push_back(cut);
+          }
+        }
+
+        const Boundary last = ends_(Indices());
+        if (last != result.back() || result.size() == 1)
+        {
+          result.push_back(last);
+        }
+
+        return result;
+      }
+
+      template<typename Fn>
+      void call(Fn& fn, size_t chunk, const Boundary& begin,
+                const Boundary& end) const
+      {
+        call_(fn, chunk, begin, end, Indices());
+      }
+
+    private:
+      template<size_t... Is>
+      Boundary begins_(IndexSequence<Is...>) const
+      {
+        return Boundary(std::get<Is>(sequences_).current...);
+      }
+
+      template<size_t... Is>
+      Boundary ends_(IndexSequence<Is...>) const
+      {
+        return Boundary(std::get<Is>(sequences_).end...);
+      }
+
+      template<size_t... Is>
+      void sizes_(IndexSequence<Is...>, size_t& longest,
+                  size_t& longestSize) const
+      {
+        const size_t sizes[] = {
+          (size_t)std::distance(std::get<Is>(sequences_).current,
+                                std::get<Is>(sequences_).end)...};
+
+        for (size_t i = 0; i < sizeof...(Is); i++)
+        {
+          if (sizes[i] > longestSize)
+          {
+            longest = i;
+            longestSize = sizes[i];
+          }
+        }
+      }
+
+      template<size_t I>
+      KeyType keyAt_(size_t sequence, size_t position,
+                     std::integral_constant<size_t, I>) const
+      {
+        if (sequence == I)
+        {
+          const auto& s = std::get<I>(sequences_);
+          return s.keyFn(*std::next(s.current, position));
+        }
+
+        return keyAt_(sequence, position,
+                      std::integral_constant<size_t, I + 1>());
+      }
+
+      KeyType keyAt_(size_t, size_t,
+                     std::integral_constant<size_t,
+                                            sizeof...(Sequences)>) const
+      {
+        NTA_THROW << "Invalid sequence index";
+      }
+
+      template<size_t I>
+      typename std::tuple_element<I, Boundary>::type
+      lowerBound_(const KeyType& key) const
+      {
+        const auto& s = std::get<I>(sequences_);
+        return std::lower_bound(
+          s.current, s.end, key,
+          [&](decltype(*s.current) element, const KeyType& k) {
+            return s.keyFn(element) < k;
+          });
+      }
+
+      template<size_t... Is>
+      Boundary lowerBounds_(const KeyType& key, IndexSequence<Is...>) const
+      {
+        return Boundary(lowerBound_<Is>(key)...);
+      }
+
+      template<typename Fn, typename Args, size_t... Is>
+      static void apply_(Fn& fn, size_t chunk, const Args& args,
+                         IndexSequence<Is...>)
+      {
+        fn(chunk, std::get<Is>(args)...);
+      }
+
+      template<typename Fn, size_t... Is>
+      void call_(Fn& fn, size_t chunk, const Boundary& begin,
+                 const Boundary& end, IndexSequence<Is...>) const
+      {
+        apply_(fn, chunk,
+               std::tuple_cat(
+                 std::make_tuple(std::get<Is>(begin), std::get<Is>(end),
+                                 std::get<Is>(sequences_).keyFn)...),
+               typename MakeIndexSequence<3 * sizeof...(Is)>::type());
+      }
+
+      std::tuple<Sequences...> sequences_;
+    };
+
+  } // end namespace groupby_detail
+
+  template<typename... Args>
+  std::vector<typename groupby_detail::MakeIterGroupBy<
+                groupby_detail::Partitioner, std::tuple<>,
+                Args...>::type::Boundary>
+  iterGroupByPartitions(size_t numChunks, Args... args)
+  {
+    static_assert(sizeof...(Args) > 0 && sizeof...(Args) % 3 == 0,
+                  "iterGroupByPartitions expects (begin, end, keyFn) triples");
+
+    typedef typename groupby_detail::MakeIterGroupBy<
+      groupby_detail::Partitioner, std::tuple<>, Args...>::type Partitioner;
+    return groupby_detail::fromIteratorTriples<Partitioner>(
+      std::forward_as_tuple(args...), typename Partitioner::Indices())
+      .boundaries(numChunks);
+  }
+
+  template<typename Fn, typename... Args>
+  void partitionGroupBy(size_t numChunks, Fn fn, Args... args)
+  {
+    static_assert(sizeof...(Args) > 0 && sizeof...(Args) % 3 == 0,
+                  "partitionGroupBy expects (begin, end, keyFn) triples");
+
+    typedef typename groupby_detail::MakeIterGroupBy<
+      groupby_detail::Partitioner, std::tuple<>, Args...>::type Partitioner;
+    const Partitioner partitioner =
+      groupby_detail::fromIteratorTriples<Partitioner>(
+        std::forward_as_tuple(args...), typename Partitioner::Indices());
+
+    const auto boundaries = partitioner.boundaries(numChunks);
+    const size_t numActualChunks = boundaries.size() - 1;
+
+    std::vector<std::exception_ptr> errors(numActualChunks);
+    auto runChunk = [&](size_t chunk) {
+      try
+      {
+        partitioner.call(fn, chunk, boundaries[chunk], boundaries[chunk + 1]);
+      }
+      catch (...)
+      {
+        errors[chunk] = std::current_exception();
+      }
+    };
+
+#ifdef NTA_PARTITION_GROUPBY_THREADS
+    std::atomic<size_t> nextChunk(0);
+    auto runChunks = [&]() {
+      for (size_t chunk = nextChunk++; chunk < numActualChunks;
+           chunk = nextChunk++)
+      {
+        runChunk(chunk);
+      }
+    };
+
+    // The calling thread is one of the threads.
+    const size_t numThreads = std::min<size_t>(
+      numActualChunks,
+      std::max<size_t>(1, std::thread::hardware_concurrency()));
+    std::vector<std::thread> workers;
+    workers.reserve(numThreads - 1);
+    for (size_t i = 1; i < numThreads; i++)
+    {
+      try
+      {
+        workers.emplace_back(runChunks);
+      }
+      catch (const std::system_error&)
+      {
+        break;
+      }
+    }
+
+    runChunks();
+
+    for (std::thread& worker : workers)
+    {
+      worker.join();
+    }
+#else
+    for (size_t chunk = 0; chunk < numActualChunks; chunk++)
+    {
+      runChunk(chunk);
+    }
+#endif
+
+    for (const std::exception_ptr& error : errors)
+    {
+      if (error)
+      {
+        std::rethrow_exception(error);
+      }
+    }
+  }
+
+} // end namespace nupic
+
+#endif // NTA_PARTITION_GROUPBY_HPP
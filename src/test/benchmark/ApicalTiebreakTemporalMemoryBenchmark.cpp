@@ -0,0 +1,158 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+/** @file
+ * Benchmarks for the ApicalTiebreakTemporalMemory
+ */
+
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <nupic/experimental/ApicalTiebreakTemporalMemory.hpp>
+#include "SyntheticSDRs.hpp"
+
+using namespace nupic;
+using namespace nupic::benchmark_workloads;
+using namespace nupic::experimental::apical_tiebreak_temporal_memory;
+using std::vector;
+
+namespace {
+
+  const UInt SEQUENCE_LENGTH = 20;
+  const UInt NUM_NOVEL_INPUTS = 5000;
+  const UInt NUM_TRAINING_PASSES = 10;
+
+  const UInt LOCATION_SIZE = 4096;
+  const UInt NUM_OBJECTS = 50;
+  const UInt FEATURES_PER_OBJECT = 10;
+
+  /**
+   * One step of a sequence, with the given column count. learn: whether
+   * compute learns. repeated: whether the input is a trained sequence, so
+   * most columns are predicted, or novel inputs, so most columns burst.
+   */
+  void BM_SequenceMemoryCompute(benchmark::State& state)
+  {
+    const UInt columnCount = state.range(0);
+    const bool learn = state.range(1);
+    const bool repeated = state.range(2);
+
+    Random rng(42);
+    ApicalTiebreakSequenceMemory tm(columnCount);
+
+    const vector<vector<UInt>> sequence =
+      randomSDRs(SEQUENCE_LENGTH, columnCount, rng);
+    for (UInt pass = 0; pass < NUM_TRAINING_PASSES; pass++)
+    {
+      for (const vector<UInt>& activeColumns : sequence)
+      {
+        tm.compute(activeColumns);
+      }
+      tm.reset();
+    }
+
+    const vector<vector<UInt>> inputs = repeated
+      ? sequence
+      : randomSDRs(NUM_NOVEL_INPUTS, columnCount, rng);
+
+    size_t i = 0;
+    while (state.KeepRunning())
+    {
+      tm.compute(inputs[i], {}, {}, learn);
+
+      if (++i == inputs.size())
+      {
+        i = 0;
+        if (repeated)
+        {
+          tm.reset();
+        }
+      }
+    }
+
+    state.SetItemsProcessed(state.iterations());
+  }
+  BENCHMARK(BM_SequenceMemoryCompute)
+    ->ArgNames({"columns", "learn", "repeated"})
+    ->Apply([](benchmark::internal::Benchmark* b) {
+        for (int columnCount : {1024, 2048})
+        {
+          for (int learn : {0, 1})
+          {
+            for (int repeated : {0, 1})
+            {
+              b->Args({columnCount, learn, repeated});
+            }
+          }
+        }
+      })
+    ->Unit(benchmark::kMicrosecond);
+
+  /**
+   * One touch of an object: a feature in the columns and its location as the
+   * basal input, with the given column count. learn: whether compute learns.
+   * The objects are trained before timing, so the location predicts the
+   * feature.
+   */
+  void BM_PairMemoryCompute(benchmark::State& state)
+  {
+    const UInt columnCount = state.range(0);
+    const bool learn = state.range(1);
+
+    Random rng(42);
+    ApicalTiebreakPairMemory tm(columnCount, LOCATION_SIZE, 0,
+                                /*cellsPerColumn*/ 16);
+
+    const UInt numPairs = NUM_OBJECTS * FEATURES_PER_OBJECT;
+    const vector<vector<UInt>> features =
+      randomSDRs(numPairs, columnCount, rng);
+    const vector<vector<UInt>> locations =
+      randomSDRs(numPairs, LOCATION_SIZE, rng);
+    for (UInt i = 0; i < numPairs; i++)
+    {
+      tm.compute(features[i], locations[i], {}, locations[i], {});
+      tm.reset();
+    }
+
+    size_t i = 0;
+    while (state.KeepRunning())
+    {
+      tm.compute(features[i], locations[i], {}, locations[i], {}, learn);
+
+      if (++i == numPairs)
+      {
+        i = 0;
+      }
+    }
+
+    state.SetItemsProcessed(state.iterations());
+  }
+  BENCHMARK(BM_PairMemoryCompute)
+    ->ArgNames({"columns", "learn"})
+    ->Args({1024, 0})
+    ->Args({1024, 1})
+    ->Args({2048, 0})
+    ->Args({2048, 1})
+    ->Unit(benchmark::kMicrosecond);
+
+}
@@ -0,0 +1,99 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+
+/** @file
+ * Benchmarks for the grid uniqueness computations
+ */
+
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <nupic/experimental/GridUniqueness.hpp>
+#include "SyntheticSDRs.hpp"
+
+using namespace nupic;
+using namespace nupic::benchmark_workloads;
+using namespace nupic::experimental::grid_uniqueness;
+using std::vector;
+
+namespace {
+
+  const Real64 READOUT_RESOLUTION = 0.2;
+
+  /**
+   * Searches a square away from the origin for a grid code zero, with the
+   * given number of modules. Most of the time goes into proving that no
+   * zero exists, which is the common case in computeGridUniquenessHypercube.
+   */
+  void BM_FindGridCodeZero(benchmark::State& state)
+  {
+    const UInt numModules = state.range(0);
+    const Real64 sidelength = state.range(1);
+
+    Random rng(42);
+    const GridModules modules = randomGridModules(numModules, rng);
+    const vector<Real64> x0 = {100.0, 100.0};
+    const vector<Real64> dims = {sidelength, sidelength};
+
+    while (state.KeepRunning())
+    {
+      benchmark::DoNotOptimize(
+        findGridCodeZero(modules.domainToPlaneByModule,
+                         modules.latticeBasisByModule,
+                         x0, dims, READOUT_RESOLUTION));
+    }
+  }
+  BENCHMARK(BM_FindGridCodeZero)
+    ->ArgNames({"modules", "sidelength"})
+    ->Args({4, 10})
+    ->Args({4, 100})
+    ->Args({8, 10})
+    ->Args({8, 100})
+    ->Unit(benchmark::kMicrosecond);
+
+  /**
+   * Binary-searches for the bin sidelength with the given number of modules.
+   */
+  void BM_ComputeBinSidelength(benchmark::State& state)
+  {
+    const UInt numModules = state.range(0);
+
+    Random rng(42);
+    const GridModules modules = randomGridModules(numModules, rng);
+
+    while (state.KeepRunning())
+    {
+      benchmark::DoNotOptimize(
+        computeBinSidelength(modules.domainToPlaneByModule,
+                             READOUT_RESOLUTION, 0.01));
+    }
+  }
+  BENCHMARK(BM_ComputeBinSidelength)
+    ->ArgNames({"modules"})
+    ->Arg(4)
+    ->Arg(8)
+    ->Arg(16)
+    ->Unit(benchmark::kMicrosecond);
+
+}
@@ -0,0 +1,113 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+
+/** @file
+ * Benchmarks for the GroupBy templates
+ */
+
+#include <algorithm>
+#include <tuple>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <nupic/utils/GroupBy.hpp>
+#include "SyntheticSDRs.hpp"
+
+using namespace nupic;
+using namespace nupic::benchmark_workloads;
+using std::vector;
+
+namespace {
+
+  const UInt CELLS_PER_COLUMN = 32;
+
+  /**
+   * Sorted cells, with roughly the given number of cells per column. This is
+   * the shape of the TM's active segments grouped by column.
+   */
+  vector<UInt> sortedCells(UInt numCells, Random& rng)
+  {
+    return randomSDR((UInt)(numCells / SDR_SPARSITY), rng);
+  }
+
+  UInt columnForCell(UInt cell)
+  {
+    return cell / CELLS_PER_COLUMN;
+  }
+
+  void BM_GroupByOneSequence(benchmark::State& state)
+  {
+    Random rng(42);
+    const vector<UInt> cells = sortedCells(state.range(0), rng);
+
+    while (state.KeepRunning())
+    {
+      size_t numGroups = 0;
+      for (auto data : groupBy(cells, columnForCell))
+      {
+        benchmark::DoNotOptimize(data);
+        numGroups++;
+      }
+      benchmark::DoNotOptimize(numGroups);
+    }
+
+    state.SetItemsProcessed(state.iterations() * cells.size());
+  }
+  BENCHMARK(BM_GroupByOneSequence)
+    ->ArgNames({"cells"})
+    ->Range(1 << 8, 1 << 16);
+
+  /**
+   * The TM's shape: active columns, active segments and matching segments,
+   * grouped by column.
+   */
+  void BM_GroupByThreeSequences(benchmark::State& state)
+  {
+    Random rng(42);
+    const vector<UInt> cells0 = sortedCells(state.range(0), rng);
+    const vector<UInt> cells1 = sortedCells(state.range(0), rng);
+    const vector<UInt> cells2 = sortedCells(state.range(0), rng);
+
+    while (state.KeepRunning())
+    {
+      size_t numGroups = 0;
+      for (auto data : iterGroupBy(
+             cells0.begin(), cells0.end(), columnForCell,
+             cells1.begin(), cells1.end(), columnForCell,
+             cells2.begin(), cells2.end(), columnForCell))
+      {
+        benchmark::DoNotOptimize(data);
+        numGroups++;
+      }
+      benchmark::DoNotOptimize(numGroups);
+    }
+
+    state.SetItemsProcessed(
+      state.iterations() * (cells0.size() + cells1.size() + cells2.size()));
+  }
+  BENCHMARK(BM_GroupByThreeSequences)
+    ->ArgNames({"cells"})
+    ->Range(1 << 8, 1 << 16);
+
+}
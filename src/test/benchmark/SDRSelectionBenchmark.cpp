@@ -0,0 +1,55 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+
+/** @file
+ * Benchmarks for the SDR selection functions
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <nupic/experimental/SDRSelection.hpp>
+
+using namespace nupic;
+using namespace nupic::experimental::sdr_selection;
+
+namespace {
+
+  void BM_EnumerateDistantSDRsBruteForce(benchmark::State& state)
+  {
+    const UInt n = state.range(0);
+    const UInt w = state.range(1);
+    const UInt threshold = state.range(2);
+
+    while (state.KeepRunning())
+    {
+      benchmark::DoNotOptimize(enumerateDistantSDRsBruteForce(n, w, threshold));
+    }
+  }
+  BENCHMARK(BM_EnumerateDistantSDRsBruteForce)
+    ->ArgNames({"n", "w", "threshold"})
+    ->Args({12, 3, 2})
+    ->Args({16, 4, 2})
+    ->Args({20, 4, 2})
+    ->Unit(benchmark::kMicrosecond);
+
+}
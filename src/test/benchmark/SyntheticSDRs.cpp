@@ -0,0 +1,101 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+/** @file
+ * Implementation of the synthetic workloads used by the benchmarks
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "SyntheticSDRs.hpp"
+
+using std::vector;
+using namespace nupic;
+using namespace nupic::benchmark_workloads;
+
+UInt nupic::benchmark_workloads::numActiveBits(UInt size)
+{
+  return std::max((UInt)1, (UInt)std::round(size * SDR_SPARSITY));
+}
+
+vector<UInt> nupic::benchmark_workloads::randomSDR(UInt size, Random& rng)
+{
+  vector<UInt> bits(size);
+  for (UInt i = 0; i < size; i++)
+  {
+    bits[i] = i;
+  }
+
+  // Partial Fisher-Yates shuffle.
+  const UInt numActive = numActiveBits(size);
+  for (UInt i = 0; i < numActive; i++)
+  {
+    std::swap(bits[i], bits[i + rng.getUInt32(size - i)]);
+  }
+
+  bits.resize(numActive);
+  std::sort(bits.begin(), bits.end());
+  return bits;
+}
+
+vector<vector<UInt>> nupic::benchmark_workloads::randomSDRs(UInt numSDRs,
+                                                            UInt size,
+                                                            Random& rng)
+{
+  vector<vector<UInt>> sdrs;
+  sdrs.reserve(numSDRs);
+  for (UInt i = 0; i < numSDRs; i++)
+  {
+    sdrs.push_back(randomSDR(size, rng));
+  }
+  return sdrs;
+}
+
+GridModules nupic::benchmark_workloads::randomGridModules(UInt numModules,
+                                                          Random& rng)
+{
+  const Real64 pi = 3.14159265358979323846;
+  const Real64 baseScale = 10.0;
+  const Real64 scaleRatio = 1.4;
+
+  GridModules modules;
+  Real64 scale = baseScale;
+  for (UInt i = 0; i < numModules; i++)
+  {
+    const Real64 theta = rng.getReal64() * pi / 3;
+    const Real64 c = std::cos(theta) / scale;
+    const Real64 s = std::sin(theta) / scale;
+    modules.domainToPlaneByModule.push_back({
+        {c, -s},
+        {s, c},
+      });
+    modules.latticeBasisByModule.push_back({
+        {1, 0.5},
+        {0, std::sqrt(3.0) / 2},
+      });
+
+    scale *= scaleRatio;
+  }
+
+  return modules;
+}
@@ -0,0 +1,78 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+/** @file
+ * Declarations for the synthetic workloads used by the benchmarks
+ */
+
+#ifndef NTA_SYNTHETIC_SDRS_HPP
+#define NTA_SYNTHETIC_SDRS_HPP
+
+#include <vector>
+
+#include <nupic/types/Types.hpp>
+#include <nupic/utils/Random.hpp>
+
+namespace nupic {
+  namespace benchmark_workloads {
+
+    /**
+     * The fraction of active bits in the SDRs of our networks, e.g. 40 of
+     * 2048 columns.
+     */
+    const Real64 SDR_SPARSITY = 0.02;
+
+    /**
+     * Returns the number of active bits in an SDR of this size with
+     * SDR_SPARSITY, at least 1.
+     */
+    UInt numActiveBits(UInt size);
+
+    /**
+     * Returns a sorted SDR with numActiveBits(size) active bits chosen
+     * uniformly.
+     */
+    std::vector<UInt> randomSDR(UInt size, Random& rng);
+
+    /**
+     * Returns a list of independent random SDRs.
+     */
+    std::vector<std::vector<UInt>> randomSDRs(UInt numSDRs, UInt size,
+                                              Random& rng);
+
+    /**
+     * Grid cell modules on a 2D domain, with increasing scales and random
+     * orientations, and a hexagonal lattice. This is the setup used by the
+     * grid uniqueness experiments.
+     */
+    struct GridModules
+    {
+      std::vector<std::vector<std::vector<Real64>>> domainToPlaneByModule;
+      std::vector<std::vector<std::vector<Real64>>> latticeBasisByModule;
+    };
+
+    GridModules randomGridModules(UInt numModules, Random& rng);
+
+  } // end namespace benchmark_workloads
+} // end namespace nupic
+
+#endif // NTA_SYNTHETIC_SDRS_HPP
@@ -24,9 +24,13 @@
  * Implementation of unit tests for ApicalTiebreakTemporalMemory
  */
 
+#include <algorithm>
 #include <cstring>
 #include <fstream>
+#include <memory>
+#include <sstream>
 #include <stdio.h>
+#include <capnp/message.h>
 #include <nupic/math/StlIo.hpp>
 #include <nupic/types/Types.hpp>
 #include <nupic/utils/Log.hpp>
@@ -1320,6 +1324,1201 @@ namespace {
     EXPECT_EQ(before, tm.basalConnections);
   }
 
+  /**
+   * The sequence memory applies fully active (e.g. bursting) columns of its
+   * basal input in one step using a column index of the basal synapses. The
+   * result should match a pair memory that receives the same previous active
+   * cells one by one, including after segments and synapses are destroyed.
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, SequenceMemoryMatchesCellByCellInput)
+  {
+    const UInt columnCount = 64;
+    const UInt cellsPerColumn = 4;
+
+    ApicalTiebreakSequenceMemory sequenceTM(
+      /*columnCount*/ columnCount,
+      /*apicalInputSize*/ 0,
+      /*cellsPerColumn*/ cellsPerColumn,
+      /*activationThreshold*/ 3,
+      /*initialPermanence*/ 0.21,
+      /*connectedPermanence*/ 0.50,
+      /*minThreshold*/ 2,
+      /*sampleSize*/ 4,
+      /*permanenceIncrement*/ 0.10,
+      /*permanenceDecrement*/ 0.10,
+      /*basalPredictedSegmentDecrement*/ 0.05,
+      /*apicalPredictedSegmentDecrement*/ 0.0,
+      /*learnOnOneCell*/ false,
+      /*seed*/ 42,
+      /*maxSegmentsPerCell*/ 2,
+      /*maxSynapsesPerSegment*/ 5);
+
+    ApicalTiebreakPairMemory pairTM(
+      /*columnCount*/ columnCount,
+      /*basalInputSize*/ columnCount * cellsPerColumn,
+      /*apicalInputSize*/ 0,
+      /*cellsPerColumn*/ cellsPerColumn,
+      /*activationThreshold*/ 3,
+      /*initialPermanence*/ 0.21,
+      /*connectedPermanence*/ 0.50,
+      /*minThreshold*/ 2,
+      /*sampleSize*/ 4,
+      /*permanenceIncrement*/ 0.10,
+      /*permanenceDecrement*/ 0.10,
+      /*basalPredictedSegmentDecrement*/ 0.05,
+      /*apicalPredictedSegmentDecrement*/ 0.0,
+      /*learnOnOneCell*/ false,
+      /*seed*/ 42,
+      /*maxSegmentsPerCell*/ 2,
+      /*maxSynapsesPerSegment*/ 5);
+
+    // A repeating sequence of patterns with occasional noise.
+    Random rng(42);
+    vector<vector<UInt>> patterns(6);
+    for (vector<UInt>& pattern : patterns)
+    {
+      for (UInt column = 0; column < columnCount; column++)
+      {
+        if (rng.getUInt32(8) == 0)
+        {
+          pattern.push_back(column);
+        }
+      }
+    }
+
+    vector<CellIdx> prevActiveCells;
+    vector<CellIdx> prevWinnerCells;
+    for (UInt i = 0; i < 300; i++)
+    {
+      vector<UInt> activeColumns = patterns[i % patterns.size()];
+      if (rng.getUInt32(4) == 0)
+      {
+        activeColumns = patterns[rng.getUInt32(patterns.size())];
+      }
+
+      sequenceTM.compute(activeColumns);
+      pairTM.compute(activeColumns, prevActiveCells, {}, prevWinnerCells, {});
+
+      ASSERT_EQ(pairTM.getActiveCells(), sequenceTM.getActiveCells());
+      ASSERT_EQ(pairTM.getWinnerCells(), sequenceTM.getWinnerCells());
+      ASSERT_EQ(pairTM.basalConnections, sequenceTM.basalConnections);
+
+      prevActiveCells = pairTM.getActiveCells();
+      prevWinnerCells = pairTM.getWinnerCells();
+    }
+  }
+
+  /**
+   * A TM with no apical input skips all apical work. It should behave exactly
+   * like a TM with apical input that never receives any.
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, NoApicalInputMatchesEmptyApicalInput)
+  {
+    const UInt columnCount = 64;
+    const UInt cellsPerColumn = 4;
+
+    ApicalTiebreakPairMemory noApicalTM(
+      /*columnCount*/ columnCount,
+      /*basalInputSize*/ columnCount * cellsPerColumn,
+      /*apicalInputSize*/ 0,
+      /*cellsPerColumn*/ cellsPerColumn,
+      /*activationThreshold*/ 3,
+      /*initialPermanence*/ 0.21,
+      /*connectedPermanence*/ 0.50,
+      /*minThreshold*/ 2,
+      /*sampleSize*/ 4,
+      /*permanenceIncrement*/ 0.10,
+      /*permanenceDecrement*/ 0.10,
+      /*basalPredictedSegmentDecrement*/ 0.05,
+      /*apicalPredictedSegmentDecrement*/ 0.05,
+      /*learnOnOneCell*/ false,
+      /*seed*/ 42,
+      /*maxSegmentsPerCell*/ 2,
+      /*maxSynapsesPerSegment*/ 5);
+
+    ApicalTiebreakPairMemory emptyApicalTM(
+      /*columnCount*/ columnCount,
+      /*basalInputSize*/ columnCount * cellsPerColumn,
+      /*apicalInputSize*/ 100,
+      /*cellsPerColumn*/ cellsPerColumn,
+      /*activationThreshold*/ 3,
+      /*initialPermanence*/ 0.21,
+      /*connectedPermanence*/ 0.50,
+      /*minThreshold*/ 2,
+      /*sampleSize*/ 4,
+      /*permanenceIncrement*/ 0.10,
+      /*permanenceDecrement*/ 0.10,
+      /*basalPredictedSegmentDecrement*/ 0.05,
+      /*apicalPredictedSegmentDecrement*/ 0.05,
+      /*learnOnOneCell*/ false,
+      /*seed*/ 42,
+      /*maxSegmentsPerCell*/ 2,
+      /*maxSynapsesPerSegment*/ 5);
+
+    Random rng(42);
+    vector<vector<UInt>> patterns(6);
+    for (vector<UInt>& pattern : patterns)
+    {
+      for (UInt column = 0; column < columnCount; column++)
+      {
+        if (rng.getUInt32(8) == 0)
+        {
+          pattern.push_back(column);
+        }
+      }
+    }
+
+    vector<CellIdx> prevActiveCells;
+    vector<CellIdx> prevWinnerCells;
+    for (UInt i = 0; i < 300; i++)
+    {
+      vector<UInt> activeColumns = patterns[i % patterns.size()];
+      if (rng.getUInt32(4) == 0)
+      {
+        activeColumns = patterns[rng.getUInt32(patterns.size())];
+      }
+
+      noApicalTM.compute(activeColumns, prevActiveCells, {},
+                         prevWinnerCells, {});
+      emptyApicalTM.compute(activeColumns, prevActiveCells, {},
+                            prevWinnerCells, {});
+
+      ASSERT_EQ(emptyApicalTM.getActiveCells(), noApicalTM.getActiveCells());
+      ASSERT_EQ(emptyApicalTM.getWinnerCells(), noApicalTM.getWinnerCells());
+      ASSERT_EQ(emptyApicalTM.getPredictedCells(),
+                noApicalTM.getPredictedCells());
+      ASSERT_EQ(emptyApicalTM.basalConnections, noApicalTM.basalConnections);
+
+      prevActiveCells = noApicalTM.getActiveCells();
+      prevWinnerCells = noApicalTM.getWinnerCells();
+    }
+  }
+
+  /**
+   * Computing the overlaps incrementally shouldn't change the results, with
+   * slowly changing inputs, learning, and a parameter change along the way.
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, IncrementalOverlapsMatchFullOverlaps)
+  {
+    const UInt columnCount = 64;
+    const UInt cellsPerColumn = 4;
+    const UInt basalInputSize = 200;
+    const UInt apicalInputSize = 100;
+
+    ApicalTiebreakPairMemory fullTM(
+      /*columnCount*/ columnCount,
+      /*basalInputSize*/ basalInputSize,
+      /*apicalInputSize*/ apicalInputSize,
+      /*cellsPerColumn*/ cellsPerColumn,
+      /*activationThreshold*/ 3,
+      /*initialPermanence*/ 0.45,
+      /*connectedPermanence*/ 0.50,
+      /*minThreshold*/ 2,
+      /*sampleSize*/ 4,
+      /*permanenceIncrement*/ 0.10,
+      /*permanenceDecrement*/ 0.10,
+      /*basalPredictedSegmentDecrement*/ 0.05,
+      /*apicalPredictedSegmentDecrement*/ 0.05,
+      /*learnOnOneCell*/ false,
+      /*seed*/ 42,
+      /*maxSegmentsPerCell*/ 2,
+      /*maxSynapsesPerSegment*/ 5);
+
+    ApicalTiebreakPairMemory incrementalTM(
+      /*columnCount*/ columnCount,
+      /*basalInputSize*/ basalInputSize,
+      /*apicalInputSize*/ apicalInputSize,
+      /*cellsPerColumn*/ cellsPerColumn,
+      /*activationThreshold*/ 3,
+      /*initialPermanence*/ 0.45,
+      /*connectedPermanence*/ 0.50,
+      /*minThreshold*/ 2,
+      /*sampleSize*/ 4,
+      /*permanenceIncrement*/ 0.10,
+      /*permanenceDecrement*/ 0.10,
+      /*basalPredictedSegmentDecrement*/ 0.05,
+      /*apicalPredictedSegmentDecrement*/ 0.05,
+      /*learnOnOneCell*/ false,
+      /*seed*/ 42,
+      /*maxSegmentsPerCell*/ 2,
+      /*maxSynapsesPerSegment*/ 5);
+    incrementalTM.setIncrementalOverlaps(true);
+    ASSERT_TRUE(incrementalTM.getIncrementalOverlaps());
+
+    // Replace a few random bits of an input.
+    Random rng(42);
+    const auto drift = [&](vector<CellIdx>& input, UInt inputSize)
+    {
+      for (UInt i = 0; i < 3; i++)
+      {
+        if (!input.empty())
+        {
+          input.erase(input.begin() + rng.getUInt32(input.size()));
+        }
+        const CellIdx cell = rng.getUInt32(inputSize);
+        if (!std::binary_search(input.begin(), input.end(), cell))
+        {
+          input.insert(std::upper_bound(input.begin(), input.end(), cell),
+                       cell);
+        }
+      }
+    };
+
+    vector<CellIdx> basalInput;
+    for (CellIdx cell = 0; cell < basalInputSize; cell++)
+    {
+      if (rng.getUInt32(10) == 0)
+      {
+        basalInput.push_back(cell);
+      }
+    }
+    vector<CellIdx> apicalInput;
+    for (CellIdx cell = 0; cell < apicalInputSize; cell++)
+    {
+      if (rng.getUInt32(10) == 0)
+      {
+        apicalInput.push_back(cell);
+      }
+    }
+
+    for (UInt i = 0; i < 400; i++)
+    {
+      drift(basalInput, basalInputSize);
+      drift(apicalInput, apicalInputSize);
+
+      vector<UInt> activeColumns;
+      for (UInt column = 0; column < columnCount; column++)
+      {
+        if (rng.getUInt32(8) == 0)
+        {
+          activeColumns.push_back(column);
+        }
+      }
+
+      if (i == 200)
+      {
+        fullTM.setConnectedPermanence(0.45);
+        incrementalTM.setConnectedPermanence(0.45);
+      }
+
+      const bool learn = (i % 50 < 40);
+      fullTM.compute(activeColumns, basalInput, apicalInput,
+                     basalInput, apicalInput, learn);
+      incrementalTM.compute(activeColumns, basalInput, apicalInput,
+                            basalInput, apicalInput, learn);
+
+      ASSERT_EQ(fullTM.getActiveBasalSegments(),
+                incrementalTM.getActiveBasalSegments());
+      ASSERT_EQ(fullTM.getMatchingBasalSegments(),
+                incrementalTM.getMatchingBasalSegments());
+      ASSERT_EQ(fullTM.getActiveApicalSegments(),
+                incrementalTM.getActiveApicalSegments());
+      ASSERT_EQ(fullTM.getMatchingApicalSegments(),
+                incrementalTM.getMatchingApicalSegments());
+      ASSERT_EQ(fullTM.getActiveCells(), incrementalTM.getActiveCells());
+      ASSERT_EQ(fullTM.getWinnerCells(), incrementalTM.getWinnerCells());
+      ASSERT_EQ(fullTM.basalConnections, incrementalTM.basalConnections);
+      ASSERT_EQ(fullTM.apicalConnections, incrementalTM.apicalConnections);
+    }
+
+    EXPECT_GT(incrementalTM.basalConnections.numSegments(), 0);
+    EXPECT_GT(incrementalTM.apicalConnections.numSegments(), 0);
+  }
+
+  /**
+   * Deferring the permanence changes doesn't change the results, and the
+   * materialized permanences are the same as with immediate updates.
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, LazyPermanencesMatchEagerPermanences)
+  {
+    const UInt columnCount = 64;
+    const UInt cellsPerColumn = 4;
+    const UInt basalInputSize = 200;
+    const UInt apicalInputSize = 100;
+
+    ApicalTiebreakPairMemory eagerTM(
+      /*columnCount*/ columnCount,
+      /*basalInputSize*/ basalInputSize,
+      /*apicalInputSize*/ apicalInputSize,
+      /*cellsPerColumn*/ cellsPerColumn,
+      /*activationThreshold*/ 3,
+      /*initialPermanence*/ 0.45,
+      /*connectedPermanence*/ 0.50,
+      /*minThreshold*/ 2,
+      /*sampleSize*/ 6,
+      /*permanenceIncrement*/ 0.10,
+      /*permanenceDecrement*/ 0.02,
+      /*basalPredictedSegmentDecrement*/ 0.01,
+      /*apicalPredictedSegmentDecrement*/ 0.01,
+      /*learnOnOneCell*/ false,
+      /*seed*/ 42,
+      /*maxSegmentsPerCell*/ 4,
+      /*maxSynapsesPerSegment*/ 8);
+
+    ApicalTiebreakPairMemory lazyTM(
+      /*columnCount*/ columnCount,
+      /*basalInputSize*/ basalInputSize,
+      /*apicalInputSize*/ apicalInputSize,
+      /*cellsPerColumn*/ cellsPerColumn,
+      /*activationThreshold*/ 3,
+      /*initialPermanence*/ 0.45,
+      /*connectedPermanence*/ 0.50,
+      /*minThreshold*/ 2,
+      /*sampleSize*/ 6,
+      /*permanenceIncrement*/ 0.10,
+      /*permanenceDecrement*/ 0.02,
+      /*basalPredictedSegmentDecrement*/ 0.01,
+      /*apicalPredictedSegmentDecrement*/ 0.01,
+      /*learnOnOneCell*/ false,
+      /*seed*/ 42,
+      /*maxSegmentsPerCell*/ 4,
+      /*maxSynapsesPerSegment*/ 8);
+    lazyTM.setLazyPermanences(true);
+    ASSERT_TRUE(lazyTM.getLazyPermanences());
+
+    // A few fixed patterns, so that segments are reinforced repeatedly.
+    Random rng(42);
+    vector<vector<UInt>> activeColumnPatterns;
+    vector<vector<CellIdx>> basalPatterns;
+    vector<vector<CellIdx>> apicalPatterns;
+    for (UInt i = 0; i < 5; i++)
+    {
+      vector<UInt> activeColumns;
+      for (UInt column = 0; column < columnCount; column++)
+      {
+        if (rng.getUInt32(8) == 0)
+        {
+          activeColumns.push_back(column);
+        }
+      }
+      activeColumnPatterns.push_back(activeColumns);
+
+      vector<CellIdx> basalInput;
+      for (CellIdx cell = 0; cell < basalInputSize; cell++)
+      {
+        if (rng.getUInt32(10) == 0)
+        {
+          basalInput.push_back(cell);
+        }
+      }
+      basalPatterns.push_back(basalInput);
+
+      vector<CellIdx> apicalInput;
+      for (CellIdx cell = 0; cell < apicalInputSize; cell++)
+      {
+        if (rng.getUInt32(10) == 0)
+        {
+          apicalInput.push_back(cell);
+        }
+      }
+      apicalPatterns.push_back(apicalInput);
+    }
+
+    bool sawDeferredChanges = false;
+    for (UInt i = 0; i < 300; i++)
+    {
+      const UInt pattern = rng.getUInt32(5);
+
+      if (i == 150)
+      {
+        eagerTM.setConnectedPermanence(0.45);
+        lazyTM.setConnectedPermanence(0.45);
+      }
+
+      eagerTM.compute(activeColumnPatterns[pattern], basalPatterns[pattern],
+                      apicalPatterns[pattern], basalPatterns[pattern],
+                      apicalPatterns[pattern], true);
+      lazyTM.compute(activeColumnPatterns[pattern], basalPatterns[pattern],
+                     apicalPatterns[pattern], basalPatterns[pattern],
+                     apicalPatterns[pattern], true);
+
+      ASSERT_EQ(eagerTM.getActiveBasalSegments(),
+                lazyTM.getActiveBasalSegments());
+      ASSERT_EQ(eagerTM.getMatchingBasalSegments(),
+                lazyTM.getMatchingBasalSegments());
+      ASSERT_EQ(eagerTM.getActiveApicalSegments(),
+                lazyTM.getActiveApicalSegments());
+      ASSERT_EQ(eagerTM.getActiveCells(), lazyTM.getActiveCells());
+      ASSERT_EQ(eagerTM.getWinnerCells(), lazyTM.getWinnerCells());
+
+      if (i % 50 == 49)
+      {
+        if (eagerTM.basalConnections != lazyTM.basalConnections)
+        {
+          sawDeferredChanges = true;
+        }
+
+        lazyTM.materializePermanences();
+        ASSERT_EQ(eagerTM.basalConnections, lazyTM.basalConnections);
+        ASSERT_EQ(eagerTM.apicalConnections, lazyTM.apicalConnections);
+      }
+    }
+
+    EXPECT_TRUE(sawDeferredChanges);
+  }
+
+  /**
+   * A default-constructed model has no indexes until it's read, so it keeps
+   * the lazy permanences setting and applies it then.
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, LazyPermanencesBeforeRead)
+  {
+    ApicalTiebreakSequenceMemory tm1(
+      /*columnCount*/ 100,
+      /*apicalInputSize*/ 0,
+      /*cellsPerColumn*/ 4,
+      /*activationThreshold*/ 3,
+      /*initialPermanence*/ 0.21,
+      /*connectedPermanence*/ 0.50,
+      /*minThreshold*/ 2,
+      /*sampleSize*/ 4);
+
+    const vector<vector<UInt>> sequence = {{0, 1, 2, 3}, {4, 5, 6, 7},
+                                           {8, 9, 10, 11}};
+    for (UInt i = 0; i < 5; i++)
+    {
+      for (const vector<UInt>& columns : sequence)
+      {
+        tm1.compute(columns);
+      }
+    }
+    tm1.reset();
+
+    stringstream ss;
+    tm1.write(ss);
+
+    ApicalTiebreakSequenceMemory tm2;
+    tm2.setLazyPermanences(true);
+    EXPECT_TRUE(tm2.getLazyPermanences());
+    tm2.read(ss);
+    EXPECT_TRUE(tm2.getLazyPermanences());
+
+    for (const vector<UInt>& columns : sequence)
+    {
+      tm1.compute(columns);
+      tm2.compute(columns);
+      EXPECT_EQ(tm1.getActiveCells(), tm2.getActiveCells());
+      EXPECT_EQ(tm1.getPredictedCells(), tm2.getPredictedCells());
+    }
+    tm2.materializePermanences();
+    EXPECT_EQ(tm1.basalConnections, tm2.basalConnections);
+  }
+
+  /**
+   * Compacting drops the slots of destroyed segments and keeps the others'
+   * synapses.
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, CompactReclaimsDestroyedSegments)
+  {
+    ApicalTiebreakPairMemory tm(
+      /*columnCount*/ 32,
+      /*basalInputSize*/ 100,
+      /*apicalInputSize*/ 100,
+      /*cellsPerColumn*/ 4);
+
+    const Segment segment1 = tm.createBasalSegment(3);
+    const Segment segment2 = tm.createBasalSegment(3);
+    const Segment segment3 = tm.createBasalSegment(7);
+    tm.basalConnections.createSynapse(segment1, 10, 0.6);
+    tm.basalConnections.createSynapse(segment3, 20, 0.3);
+    tm.basalConnections.createSynapse(segment3, 30, 0.7);
+    tm.basalConnections.destroySegment(segment2);
+    tm.createApicalSegment(5);
+
+    ASSERT_EQ(3, tm.basalConnections.segmentFlatListLength());
+
+    EXPECT_LT(0, tm.compact());
+    EXPECT_EQ(2, tm.basalConnections.segmentFlatListLength());
+    EXPECT_EQ(1, tm.apicalConnections.segmentFlatListLength());
+    EXPECT_EQ(0, tm.compact());
+
+    const Segment newSegment1 = tm.basalConnections.getSegment(3, 0);
+    const Segment newSegment3 = tm.basalConnections.getSegment(7, 0);
+    EXPECT_EQ(1, tm.basalConnections.numSegments(3));
+    ASSERT_EQ(1, tm.basalConnections.numSynapses(newSegment1));
+    ASSERT_EQ(2, tm.basalConnections.numSynapses(newSegment3));
+
+    const SynapseData& synapseData = tm.basalConnections.dataForSynapse(
+      tm.basalConnections.synapsesForSegment(newSegment3)[1]);
+    EXPECT_EQ(30, synapseData.presynapticCell);
+    EXPECT_NEAR(0.7, synapseData.permanence, EPSILON);
+
+    // The segments are still used for inference.
+    const vector<UInt> activeColumns = {0};
+    const vector<CellIdx> basalInput = {20, 30};
+    tm.setActivationThreshold(2);
+    tm.setMinThreshold(1);
+    tm.setConnectedPermanence(0.25);
+    tm.compute(activeColumns, basalInput, {}, {}, {}, false);
+    EXPECT_EQ(vector<CellIdx>({7}), tm.getPredictedCells());
+  }
+
+  /**
+   * A TM that compacts whenever it learns to destroy segments computes the
+   * same results as one that never compacts.
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, CompactionDoesntChangeResults)
+  {
+    const UInt columnCount = 32;
+    const UInt cellsPerColumn = 4;
+    const UInt inputSize = 100;
+
+    ApicalTiebreakPairMemory referenceTM(
+      /*columnCount*/ columnCount,
+      /*basalInputSize*/ inputSize,
+      /*apicalInputSize*/ inputSize,
+      /*cellsPerColumn*/ cellsPerColumn,
+      /*activationThreshold*/ 3,
+      /*initialPermanence*/ 0.45,
+      /*connectedPermanence*/ 0.50,
+      /*minThreshold*/ 2,
+      /*sampleSize*/ 6,
+      /*permanenceIncrement*/ 0.10,
+      /*permanenceDecrement*/ 0.10,
+      /*basalPredictedSegmentDecrement*/ 0.2,
+      /*apicalPredictedSegmentDecrement*/ 0.2,
+      /*learnOnOneCell*/ false,
+      /*seed*/ 42,
+      /*maxSegmentsPerCell*/ 2,
+      /*maxSynapsesPerSegment*/ 10);
+
+    ApicalTiebreakPairMemory compactedTM(
+      /*columnCount*/ columnCount,
+      /*basalInputSize*/ inputSize,
+      /*apicalInputSize*/ inputSize,
+      /*cellsPerColumn*/ cellsPerColumn,
+      /*activationThreshold*/ 3,
+      /*initialPermanence*/ 0.45,
+      /*connectedPermanence*/ 0.50,
+      /*minThreshold*/ 2,
+      /*sampleSize*/ 6,
+      /*permanenceIncrement*/ 0.10,
+      /*permanenceDecrement*/ 0.10,
+      /*basalPredictedSegmentDecrement*/ 0.2,
+      /*apicalPredictedSegmentDecrement*/ 0.2,
+      /*learnOnOneCell*/ false,
+      /*seed*/ 42,
+      /*maxSegmentsPerCell*/ 2,
+      /*maxSynapsesPerSegment*/ 10);
+    compactedTM.setCompactionThreshold(0.01);
+    compactedTM.setIncrementalOverlaps(true);
+    compactedTM.setLazyPermanences(true);
+
+    Random rng(42);
+    UInt numCompactions = 0;
+    for (UInt i = 0; i < 300; i++)
+    {
+      vector<UInt> activeColumns;
+      for (UInt column = 0; column < columnCount; column++)
+      {
+        if (rng.getUInt32(4) == 0)
+        {
+          activeColumns.push_back(column);
+        }
+      }
+
+      vector<CellIdx> basalInput;
+      vector<CellIdx> apicalInput;
+      for (CellIdx cell = 0; cell < inputSize; cell++)
+      {
+        if (rng.getUInt32(8) == 0)
+        {
+          basalInput.push_back(cell);
+        }
+        if (rng.getUInt32(8) == 0)
+        {
+          apicalInput.push_back(cell);
+        }
+      }
+
+      const UInt32 lengthBefore =
+        compactedTM.basalConnections.segmentFlatListLength();
+
+      referenceTM.compute(activeColumns, basalInput, apicalInput,
+                          basalInput, apicalInput, true);
+      compactedTM.compute(activeColumns, basalInput, apicalInput,
+                          basalInput, apicalInput, true);
+
+      if (compactedTM.basalConnections.segmentFlatListLength() <
+          lengthBefore)
+      {
+        numCompactions++;
+      }
+
+      ASSERT_EQ(referenceTM.getPredictedCells(),
+                compactedTM.getPredictedCells());
+      ASSERT_EQ(referenceTM.getActiveCells(), compactedTM.getActiveCells());
+      ASSERT_EQ(referenceTM.getWinnerCells(), compactedTM.getWinnerCells());
+    }
+
+    EXPECT_LT(0, numCompactions);
+    EXPECT_TRUE(referenceTM == compactedTM);
+  }
+
+  /**
+   * Over the synapse budget, learning destroys the least recently active
+   * segments, whether they're basal or apical.
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, SynapseBudgetEvictsLeastRecentlyUsed)
+  {
+    ApicalTiebreakPairMemory tm(
+      /*columnCount*/ 32,
+      /*basalInputSize*/ 100,
+      /*apicalInputSize*/ 100,
+      /*cellsPerColumn*/ 4,
+      /*activationThreshold*/ 3,
+      /*initialPermanence*/ 0.21,
+      /*connectedPermanence*/ 0.50,
+      /*minThreshold*/ 2);
+
+    const vector<CellIdx> basalInput = {1, 2, 3};
+    const vector<CellIdx> apicalInput = {7, 8, 9};
+
+    const Segment basalSegment1 = tm.createBasalSegment(4);
+    const Segment basalSegment2 = tm.createBasalSegment(8);
+    const Segment apicalSegment = tm.createApicalSegment(12);
+    for (CellIdx presynapticCell = 1; presynapticCell < 4; presynapticCell++)
+    {
+      tm.basalConnections.createSynapse(basalSegment1, presynapticCell, 0.6);
+      tm.basalConnections.createSynapse(basalSegment2, presynapticCell + 3,
+                                        0.6);
+      tm.apicalConnections.createSynapse(apicalSegment, presynapticCell + 6,
+                                         0.6);
+    }
+
+    tm.compute({}, basalInput, apicalInput, {}, {}, true);
+    tm.setMaxSynapses(7);
+    ASSERT_EQ(7, tm.getMaxSynapses());
+
+    tm.compute({}, basalInput, apicalInput, {}, {}, true);
+    EXPECT_EQ(1, tm.basalConnections.numSegments(4));
+    EXPECT_EQ(0, tm.basalConnections.numSegments(8));
+    EXPECT_EQ(1, tm.apicalConnections.numSegments(12));
+
+    tm.setMaxSynapses(4);
+    tm.compute({}, basalInput, {}, {}, {}, true);
+    EXPECT_EQ(1, tm.basalConnections.numSegments(4));
+    EXPECT_EQ(0, tm.apicalConnections.numSegments(12));
+
+    // Without a budget, nothing is evicted.
+    tm.setMaxSynapses(0);
+    const Segment segment = tm.createBasalSegment(16);
+    tm.basalConnections.createSynapse(segment, 50, 0.6);
+    tm.compute({}, basalInput, {}, {}, {}, true);
+    EXPECT_EQ(2, tm.basalConnections.numSegments());
+
+    // Learning keeps growing and evicting.
+    tm.setMaxSynapses(200);
+    Random rng(42);
+    for (UInt i = 0; i < 200; i++)
+    {
+      vector<UInt> activeColumns;
+      for (UInt column = 0; column < 32; column++)
+      {
+        if (rng.getUInt32(4) == 0)
+        {
+          activeColumns.push_back(column);
+        }
+      }
+      vector<CellIdx> input;
+      for (CellIdx cell = 0; cell < 100; cell++)
+      {
+        if (rng.getUInt32(8) == 0)
+        {
+          input.push_back(cell);
+        }
+      }
+
+      tm.compute(activeColumns, input, input, input, input, true);
+      ASSERT_LE(tm.basalConnections.numSynapses() +
+                tm.apicalConnections.numSynapses(), 200);
+    }
+  }
+
+  /**
+   * Learning grows the per-segment and per-synapse storage, unless it was
+   * reserved for the model's size.
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, ReserveAvoidsReallocations)
+  {
+    ApicalTiebreakPairMemory unreserved(
+      /*columnCount*/ 32,
+      /*basalInputSize*/ 100,
+      /*apicalInputSize*/ 100,
+      /*cellsPerColumn*/ 4,
+      /*activationThreshold*/ 3,
+      /*initialPermanence*/ 0.21,
+      /*connectedPermanence*/ 0.50,
+      /*minThreshold*/ 2,
+      /*sampleSize*/ 8,
+      /*permanenceIncrement*/ 0.10,
+      /*permanenceDecrement*/ 0.10,
+      /*basalPredictedSegmentDecrement*/ 0.0,
+      /*apicalPredictedSegmentDecrement*/ 0.0,
+      /*learnOnOneCell*/ false,
+      /*seed*/ 42,
+      /*maxSegmentsPerCell*/ 4,
+      /*maxSynapsesPerSegment*/ 16);
+    ApicalTiebreakPairMemory reserved(
+      32, 100, 100, 4, 3, 0.21, 0.50, 2, 8, 0.10, 0.10, 0.0, 0.0, false, 42,
+      4, 16);
+
+    // Reserve everything that the model can grow to.
+    reserved.setIncrementalOverlaps(true);
+    reserved.setMaxSynapses(100000);
+    reserved.reserve(32 * 4 * 4, 16);
+    EXPECT_EQ(0, reserved.getNumReallocations());
+
+    Random rng(42);
+    for (UInt i = 0; i < 200; i++)
+    {
+      vector<UInt> activeColumns;
+      for (UInt column = 0; column < 32; column++)
+      {
+        if (rng.getUInt32(4) == 0)
+        {
+          activeColumns.push_back(column);
+        }
+      }
+      vector<CellIdx> input;
+      for (CellIdx cell = 0; cell < 100; cell++)
+      {
+        if (rng.getUInt32(8) == 0)
+        {
+          input.push_back(cell);
+        }
+      }
+
+      unreserved.compute(activeColumns, input, input, input, input, true);
+      reserved.compute(activeColumns, input, input, input, input, true);
+    }
+
+    EXPECT_EQ(unreserved.basalConnections.numSynapses(),
+              reserved.basalConnections.numSynapses());
+    EXPECT_GT(unreserved.getNumReallocations(), 0);
+    EXPECT_EQ(0, reserved.getNumReallocations());
+  }
+
+  /**
+   * Segments over the per-step maximum are created on later computes, with
+   * the growth candidates from when they were deferred.
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, BoundedLearningDefersNewSegments)
+  {
+    ApicalTiebreakPairMemory tm(
+      /*columnCount*/ 32,
+      /*basalInputSize*/ 100,
+      /*apicalInputSize*/ 100,
+      /*cellsPerColumn*/ 4,
+      /*activationThreshold*/ 3,
+      /*initialPermanence*/ 0.21,
+      /*connectedPermanence*/ 0.50,
+      /*minThreshold*/ 2,
+      /*sampleSize*/ 3);
+    tm.setMaxNewSegmentsPerStep(2);
+    ASSERT_EQ(2, tm.getMaxNewSegmentsPerStep());
+
+    const vector<UInt> activeColumns = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+    const vector<CellIdx> basalInput = {10, 20, 30, 40};
+
+    tm.compute(activeColumns, basalInput, {}, basalInput, {}, true);
+    const vector<CellIdx> winnerCells = tm.getWinnerCells();
+    ASSERT_EQ(10, winnerCells.size());
+    EXPECT_EQ(2, tm.basalConnections.numSegments());
+    EXPECT_EQ(8, tm.getNumDeferredSegments());
+
+    // Computes without learning work drain the backlog.
+    for (UInt i = 0; i < 4; i++)
+    {
+      tm.compute({}, {}, {}, {}, {}, true);
+      EXPECT_EQ(6 - 2*i, tm.getNumDeferredSegments());
+    }
+
+    for (CellIdx cell : winnerCells)
+    {
+      const vector<Segment> segments =
+        tm.basalConnections.segmentsForCell(cell);
+      ASSERT_EQ(1, segments.size());
+      EXPECT_EQ(3, tm.basalConnections.numSynapses(segments[0]));
+      for (Synapse synapse :
+             tm.basalConnections.synapsesForSegment(segments[0]))
+      {
+        EXPECT_TRUE(std::binary_search(
+                      basalInput.begin(), basalInput.end(),
+                      tm.basalConnections.dataForSynapse(synapse)
+                      .presynapticCell));
+      }
+    }
+
+    // Without a maximum, nothing is deferred.
+    tm.setMaxNewSegmentsPerStep(0);
+    tm.compute({10, 11, 12}, basalInput, {}, basalInput, {}, true);
+    EXPECT_EQ(13, tm.basalConnections.numSegments());
+    EXPECT_EQ(0, tm.getNumDeferredSegments());
+  }
+
+  /**
+   * A column that keeps bursting while its segment is deferred doesn't queue
+   * more segments for its cell, so each cell gets one segment, as without a
+   * maximum.
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, BoundedLearningDefersOneSegmentPerCell)
+  {
+    ApicalTiebreakPairMemory tm(
+      /*columnCount*/ 32,
+      /*basalInputSize*/ 100,
+      /*apicalInputSize*/ 100,
+      /*cellsPerColumn*/ 4,
+      /*activationThreshold*/ 3,
+      /*initialPermanence*/ 0.21,
+      /*connectedPermanence*/ 0.50,
+      /*minThreshold*/ 2,
+      /*sampleSize*/ 3,
+      /*permanenceIncrement*/ 0.10,
+      /*permanenceDecrement*/ 0.10,
+      /*basalPredictedSegmentDecrement*/ 0.0,
+      /*apicalPredictedSegmentDecrement*/ 0.0,
+      /*learnOnOneCell*/ true);
+    tm.setMaxNewSegmentsPerStep(1);
+
+    const vector<UInt> activeColumns = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+    const vector<CellIdx> basalInput = {10, 20, 30, 40};
+
+    // The transition repeats while the budget is saturated.
+    for (UInt i = 0; i < 5; i++)
+    {
+      tm.compute(activeColumns, basalInput, {}, basalInput, {}, true);
+      EXPECT_LE(tm.getNumDeferredSegments(), activeColumns.size());
+    }
+    const vector<CellIdx> winnerCells = tm.getWinnerCells();
+    ASSERT_EQ(10, winnerCells.size());
+
+    while (tm.getNumDeferredSegments() > 0)
+    {
+      tm.compute({}, {}, {}, {}, {}, true);
+    }
+
+    EXPECT_EQ(10, tm.basalConnections.numSegments());
+    for (CellIdx cell : winnerCells)
+    {
+      EXPECT_EQ(1, tm.basalConnections.numSegments(cell));
+    }
+  }
+
+  /**
+   * With stats enabled, each phase and learning event is counted. Without
+   * NTA_ATTM_STATS, stats can't be enabled.
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, StatsCountPhases)
+  {
+    ApicalTiebreakPairMemory tm(
+      /*columnCount*/ 32,
+      /*basalInputSize*/ 100,
+      /*apicalInputSize*/ 100,
+      /*cellsPerColumn*/ 4,
+      /*activationThreshold*/ 3,
+      /*initialPermanence*/ 0.60,
+      /*connectedPermanence*/ 0.50,
+      /*minThreshold*/ 2);
+    EXPECT_FALSE(tm.getCollectStats());
+
+    if (!ApicalTiebreakTemporalMemory::statsAvailable())
+    {
+      EXPECT_THROW(tm.setCollectStats(true), std::exception);
+      return;
+    }
+
+    typedef ApicalTiebreakTemporalMemoryStats Stats;
+    const vector<CellIdx> basalInput = {10, 20, 30};
+
+    tm.setCollectStats(true);
+    tm.compute({0, 1, 2}, basalInput, {}, basalInput, {}, true);
+    EXPECT_EQ(1, tm.getStats().calls[Stats::BASAL_OVERLAPS]);
+    EXPECT_EQ(1, tm.getStats().calls[Stats::APICAL_OVERLAPS]);
+    EXPECT_EQ(3, tm.getStats().calls[Stats::BURST_COLUMN]);
+    EXPECT_EQ(0, tm.getStats().calls[Stats::ACTIVATE_PREDICTED_COLUMN]);
+    EXPECT_EQ(3, tm.getStats().calls[Stats::CREATE_SEGMENT]);
+    EXPECT_EQ(3, tm.getStats().segmentsCreated);
+    EXPECT_EQ(9, tm.getStats().synapsesGrown);
+    EXPECT_EQ(0, tm.getStats().synapsesDestroyed);
+
+    // The segments are now active, so the columns are predicted.
+    tm.compute({0, 1, 2}, basalInput, {}, basalInput, {}, true);
+    EXPECT_EQ(3, tm.getStats().calls[Stats::BURST_COLUMN]);
+    EXPECT_EQ(3, tm.getStats().calls[Stats::ACTIVATE_PREDICTED_COLUMN]);
+
+    tm.resetStats();
+    EXPECT_EQ(0, tm.getStats().calls[Stats::BURST_COLUMN]);
+    EXPECT_EQ(0, tm.getStats().segmentsCreated);
+
+    tm.setCollectStats(false);
+    tm.compute({3}, basalInput, {}, basalInput, {}, true);
+    EXPECT_EQ(0, tm.getStats().calls[Stats::BURST_COLUMN]);
+    EXPECT_EQ(0, tm.getStats().segmentsCreated);
+  }
+
+  /**
+   * A segment that hasn't been active for coldSegmentAge iterations doesn't
+   * predict its cell, until its column bursts with matching input.
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, ColdSegmentsAreSkippedUntilPromoted)
+  {
+    ApicalTiebreakPairMemory tm(
+      /*columnCount*/ 32,
+      /*basalInputSize*/ 100,
+      /*apicalInputSize*/ 100,
+      /*cellsPerColumn*/ 4,
+      /*activationThreshold*/ 3,
+      /*initialPermanence*/ 0.21,
+      /*connectedPermanence*/ 0.50,
+      /*minThreshold*/ 2,
+      /*sampleSize*/ 3,
+      /*permanenceIncrement*/ 0.10,
+      /*permanenceDecrement*/ 0.10);
+    tm.setColdSegmentAge(10);
+    ASSERT_EQ(10, tm.getColdSegmentAge());
+
+    const vector<UInt> activeColumns = {1};
+    const vector<CellIdx> basalInput = {10, 11, 12};
+
+    const Segment segment = tm.createBasalSegment(5);
+    for (CellIdx presynapticCell : basalInput)
+    {
+      tm.basalConnections.createSynapse(segment, presynapticCell, 0.6);
+    }
+
+    tm.compute({}, basalInput, {}, {}, {}, false);
+    EXPECT_EQ(vector<CellIdx>({5}), tm.getPredictedCells());
+
+    for (UInt i = 0; i < 20; i++)
+    {
+      tm.compute({}, {}, {}, {}, {}, true);
+    }
+
+    tm.compute({}, basalInput, {}, {}, {}, false);
+    EXPECT_EQ(vector<CellIdx>(), tm.getPredictedCells());
+
+    // The column bursts and the cold segment is learned on instead of a new
+    // segment.
+    tm.compute(activeColumns, basalInput, {}, basalInput, {}, true);
+    EXPECT_EQ(vector<CellIdx>({5}), tm.getWinnerCells());
+    EXPECT_EQ(1, tm.basalConnections.numSegments());
+
+    tm.compute({}, basalInput, {}, {}, {}, false);
+    EXPECT_EQ(vector<CellIdx>({5}), tm.getPredictedCells());
+
+    tm.setColdSegmentAge(0);
+    for (UInt i = 0; i < 20; i++)
+    {
+      tm.compute({}, {}, {}, {}, {}, true);
+    }
+    tm.compute({}, basalInput, {}, {}, {}, false);
+    EXPECT_EQ(vector<CellIdx>({5}), tm.getPredictedCells());
+  }
+
+  /**
+   * Each learning step checks a slice of the cells for cold segments, and
+   * every cell is checked within coldSegmentAge steps.
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, ColdSegmentsOnEveryCell)
+  {
+    ApicalTiebreakPairMemory tm(
+      /*columnCount*/ 32,
+      /*basalInputSize*/ 100,
+      /*apicalInputSize*/ 0,
+      /*cellsPerColumn*/ 4,
+      /*activationThreshold*/ 3,
+      /*initialPermanence*/ 0.21,
+      /*connectedPermanence*/ 0.50,
+      /*minThreshold*/ 2,
+      /*sampleSize*/ 3);
+    tm.setColdSegmentAge(10);
+
+    const vector<CellIdx> cells = {0, 63, 127};
+    const vector<CellIdx> basalInput = {10, 11, 12};
+    for (CellIdx cell : cells)
+    {
+      const Segment segment = tm.createBasalSegment(cell);
+      for (CellIdx presynapticCell : basalInput)
+      {
+        tm.basalConnections.createSynapse(segment, presynapticCell, 0.6);
+      }
+    }
+
+    tm.compute({}, basalInput, {}, {}, {}, false);
+    EXPECT_EQ(cells, tm.getPredictedCells());
+
+    for (UInt i = 0; i < 10; i++)
+    {
+      tm.compute({}, {}, {}, {}, {}, true);
+    }
+    tm.compute({}, basalInput, {}, {}, {}, false);
+    EXPECT_EQ(cells, tm.getPredictedCells());
+
+    for (UInt i = 0; i < 10; i++)
+    {
+      tm.compute({}, {}, {}, {}, {}, true);
+    }
+    tm.compute({}, basalInput, {}, {}, {}, false);
+    EXPECT_EQ(vector<CellIdx>(), tm.getPredictedCells());
+  }
+
+  /**
+   * A default-constructed model has no indexes until it's read, so it keeps
+   * the coldSegmentAge and applies it then.
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, ColdSegmentAgeBeforeRead)
+  {
+    ApicalTiebreakSequenceMemory tm1(
+      /*columnCount*/ 32,
+      /*apicalInputSize*/ 0,
+      /*cellsPerColumn*/ 4);
+    stringstream ss;
+    tm1.write(ss);
+
+    ApicalTiebreakSequenceMemory tm2;
+    tm2.setColdSegmentAge(0);
+    tm2.setColdSegmentAge(5);
+    tm2.read(ss);
+    EXPECT_EQ(5, tm2.getColdSegmentAge());
+
+    tm2.compute({0, 1, 2});
+    tm2.setColdSegmentAge(0);
+    tm2.compute({3, 4, 5});
+  }
+
+  /**
+   * Changing the thresholds takes effect immediately, including for segments
+   * that couldn't be active or matching under the old thresholds.
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, ThresholdChangesUpdateSegmentEligibility)
+  {
+    ApicalTiebreakPairMemory tm(
+      /*columnCount*/ 32,
+      /*basalInputSize*/ 32,
+      /*apicalInputSize*/ 0,
+      /*cellsPerColumn*/ 4,
+      /*activationThreshold*/ 3,
+      /*initialPermanence*/ 0.21,
+      /*connectedPermanence*/ 0.50,
+      /*minThreshold*/ 2,
+      /*sampleSize*/ 3,
+      /*permanenceIncrement*/ 0.10,
+      /*permanenceDecrement*/ 0.10,
+      /*basalPredictedSegmentDecrement*/ 0.0,
+      /*apicalPredictedSegmentDecrement*/ 0.0,
+      /*learnOnOneCell*/ false,
+      /*seed*/ 42);
+
+    const vector<CellIdx> basalInput = {1, 2, 3, 4};
+
+    // Three connected synapses and one unconnected one.
+    const Segment segment = tm.createBasalSegment(0);
+    tm.basalConnections.createSynapse(segment, 1, 0.6);
+    tm.basalConnections.createSynapse(segment, 2, 0.6);
+    tm.basalConnections.createSynapse(segment, 3, 0.6);
+    tm.basalConnections.createSynapse(segment, 4, 0.3);
+
+    const auto depolarize = [&]() {
+      tm.depolarizeCells(basalInput.data(),
+                         basalInput.data() + basalInput.size(),
+                         nullptr, nullptr, false);
+    };
+    const vector<Segment> none = {};
+    const vector<Segment> justSegment = {segment};
+
+    depolarize();
+    EXPECT_EQ(justSegment, tm.getActiveBasalSegments());
+    EXPECT_EQ(justSegment, tm.getMatchingBasalSegments());
+
+    tm.setMinThreshold(5);
+    tm.setActivationThreshold(5);
+    depolarize();
+    EXPECT_EQ(none, tm.getActiveBasalSegments());
+    EXPECT_EQ(none, tm.getMatchingBasalSegments());
+
+    tm.setConnectedPermanence(0.25);
+    tm.setActivationThreshold(4);
+    depolarize();
+    EXPECT_EQ(justSegment, tm.getActiveBasalSegments());
+    EXPECT_EQ(none, tm.getMatchingBasalSegments());
+
+    tm.setMinThreshold(4);
+    depolarize();
+    EXPECT_EQ(justSegment, tm.getActiveBasalSegments());
+    EXPECT_EQ(justSegment, tm.getMatchingBasalSegments());
+
+    // Learning moves the segment in and out of eligibility too.
+    tm.setConnectedPermanence(0.5);
+    tm.setMinThreshold(5);
+    tm.setActivationThreshold(5);
+    tm.basalConnections.createSynapse(segment, 5, 0.3);
+    const vector<CellIdx> basalInputWith5 = {1, 2, 3, 4, 5};
+    tm.depolarizeCells(basalInputWith5.data(),
+                       basalInputWith5.data() + basalInputWith5.size(),
+                       nullptr, nullptr, false);
+    EXPECT_EQ(none, tm.getActiveBasalSegments());
+    EXPECT_EQ(justSegment, tm.getMatchingBasalSegments());
+  }
+
+  /**
+   * Within a column, cells with active basal and apical segments win the
+   * tiebreak over cells with only active basal segments. Columns with only
+   * apical activity aren't predicted. The predicted cells should be the same
+   * whether there are few active segments per column (groups segments by
+   * cell) or many (uses per-cell scores).
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, ApicalTiebreakAtLowAndHighActivity)
+  {
+    for (UInt basalSegmentsPerCell : {1, 2})
+    {
+      ApicalTiebreakPairMemory tm(
+        /*columnCount*/ 64,
+        /*basalInputSize*/ 16,
+        /*apicalInputSize*/ 16,
+        /*cellsPerColumn*/ 4,
+        /*activationThreshold*/ 2,
+        /*initialPermanence*/ 0.21,
+        /*connectedPermanence*/ 0.50,
+        /*minThreshold*/ 1,
+        /*sampleSize*/ 3,
+        /*permanenceIncrement*/ 0.10,
+        /*permanenceDecrement*/ 0.10,
+        /*basalPredictedSegmentDecrement*/ 0.0,
+        /*apicalPredictedSegmentDecrement*/ 0.0,
+        /*learnOnOneCell*/ false,
+        /*seed*/ 42
+        );
+
+      const vector<CellIdx> basalInput = {0, 1};
+      const vector<CellIdx> apicalInput = {0, 1};
+      const vector<CellIdx> cellsWithBasal = {0, 1, 4, 5};
+      const vector<CellIdx> cellsWithApical = {1, 9};
+      const vector<CellIdx> expectedPredictedCells = {1, 4, 5};
+
+      for (CellIdx cell : cellsWithBasal)
+      {
+        for (UInt i = 0; i < basalSegmentsPerCell; i++)
+        {
+          Segment segment = tm.createBasalSegment(cell);
+          tm.basalConnections.createSynapse(segment, basalInput[0], 0.5);
+          tm.basalConnections.createSynapse(segment, basalInput[1], 0.5);
+        }
+      }
+
+      for (CellIdx cell : cellsWithApical)
+      {
+        Segment segment = tm.createApicalSegment(cell);
+        tm.apicalConnections.createSynapse(segment, apicalInput[0], 0.5);
+        tm.apicalConnections.createSynapse(segment, apicalInput[1], 0.5);
+      }
+
+      tm.compute({}, basalInput, apicalInput, {}, {}, false);
+
+      EXPECT_EQ(expectedPredictedCells, tm.getPredictedCells());
+    }
+  }
+
   TEST(ApicalTiebreakTemporalMemoryTest, testColumnForCell)
   {
     ApicalTiebreakSequenceMemory tm(
@@ -1327,132 +2526,1402 @@ namespace {
       /*apicalInputSize*/ 0,
       /*cellsPerColumn*/ 5);
 
-    ASSERT_EQ(0, tm.columnForCell(0));
-    ASSERT_EQ(0, tm.columnForCell(4));
-    ASSERT_EQ(1, tm.columnForCell(5));
-    ASSERT_EQ(2047, tm.columnForCell(10239));
+    ASSERT_EQ(0, tm.columnForCell(0));
+    ASSERT_EQ(0, tm.columnForCell(4));
+    ASSERT_EQ(1, tm.columnForCell(5));
+    ASSERT_EQ(2047, tm.columnForCell(10239));
+  }
+
+  TEST(ApicalTiebreakTemporalMemoryTest, testColumnForCellInvalidCell)
+  {
+    ApicalTiebreakSequenceMemory tm(
+      /*columnCount*/ 4096,
+      /*apicalInputSize*/ 0,
+      /*cellsPerColumn*/ 4);
+
+    EXPECT_NO_THROW(tm.columnForCell(16383));
+    EXPECT_THROW(tm.columnForCell(16384), std::exception);
+    EXPECT_THROW(tm.columnForCell(-1), std::exception);
+  }
+
+  TEST(ApicalTiebreakTemporalMemoryTest, testNumberOfColumns)
+  {
+    ApicalTiebreakSequenceMemory tm(
+      /*columnCount*/ 2048,
+      /*apicalInputSize*/ 0,
+      /*cellsPerColumn*/ 32);
+
+    int numOfColumns = tm.numberOfColumns();
+    ASSERT_EQ(numOfColumns, 2048);
+  }
+
+  TEST(ApicalTiebreakTemporalMemoryTest, testNumberOfCells)
+  {
+    ApicalTiebreakSequenceMemory tm(
+      /*columnCount*/ 2048,
+      /*apicalInputSize*/ 0,
+      /*cellsPerColumn*/ 32);
+
+    Int numberOfCells = tm.numberOfCells();
+    ASSERT_EQ(numberOfCells, 2048 * 32);
+  }
+
+  TEST(ApicalTiebreakTemporalMemoryTest, testNumberOfCellsOverflow)
+  {
+    EXPECT_THROW(ApicalTiebreakPairMemory(
+                   /*columnCount*/ 1 << 20,
+                   /*basalInputSize*/ 100,
+                   /*apicalInputSize*/ 0,
+                   /*cellsPerColumn*/ 1 << 12),
+                 std::exception);
+  }
+
+  TEST(ApicalTiebreakTemporalMemoryTest, testWrite)
+  {
+    ApicalTiebreakSequenceMemory tm1(
+      /*columnCount*/ 100,
+      /*apicalInputSize*/ 0,
+      /*cellsPerColumn*/ 4,
+      /*activationThreshold*/ 7,
+      /*initialPermanence*/ 0.37,
+      /*connectedPermanence*/ 0.58,
+      /*minThreshold*/ 4,
+      /*sampleSize*/ 18,
+      /*permanenceIncrement*/ 0.23,
+      /*permanenceDecrement*/ 0.08,
+      /*basalPredictedSegmentDecrement*/ 0.0,
+      /*apicalPredictedSegmentDecrement*/ 0.0,
+      /*learnOnOneCell*/ false,
+      /*seed*/ 42);
+
+    // Run some data through before serializing
+    /*
+      PatternMachine patternMachine = PatternMachine(100, 4);
+      SequenceMachine sequenceMachine = SequenceMachine(self.patternMachine);
+      Sequence sequence = self.sequenceMachine.generateFromNumbers(range(5));
+    */
+    vector<vector<UInt>> sequence =
+      {
+        { 45, 53, 70, 83 },
+        { 8, 59, 65, 67 },
+        { 25, 39, 98, 99 },
+        { 11, 14, 66, 78 },
+        { 69, 87, 95, 96 } };
+
+    for (UInt i = 0; i < 3; i++)
+    {
+      for (vector<UInt> pattern : sequence)
+        tm1.compute(pattern);
+    }
+
+    // Write and read back the proto
+    stringstream ss;
+    tm1.write(ss);
+    ApicalTiebreakSequenceMemory tm2;
+    tm2.read(ss);
+
+    // Check that the two temporal memory objects have the same attributes
+    ASSERT_TRUE(tm1 == tm2);
+
+    tm1.compute(sequence[0]);
+    tm2.compute(sequence[0]);
+    ASSERT_EQ(tm1.getActiveCells(), tm2.getActiveCells());
+    ASSERT_EQ(tm1.getWinnerCells(), tm2.getWinnerCells());
+    ASSERT_EQ(tm1.basalConnections, tm2.basalConnections);
+
+    tm1.compute(sequence[3]);
+    tm2.compute(sequence[3]);
+    ASSERT_EQ(tm1.getActiveCells(), tm2.getActiveCells());
+
+    const vector<Segment> activeSegments1 = tm1.getActiveBasalSegments();
+    const vector<Segment> activeSegments2 = tm2.getActiveBasalSegments();
+    ASSERT_EQ(activeSegments1.size(), activeSegments2.size());
+    for (size_t i = 0; i < activeSegments1.size(); i++)
+    {
+      const SegmentData& segmentData1 =
+        tm1.basalConnections.dataForSegment(activeSegments1[i]);
+      const SegmentData& segmentData2 =
+        tm2.basalConnections.dataForSegment(activeSegments2[i]);
+
+      ASSERT_EQ(segmentData1.cell, segmentData2.cell);
+    }
+
+    const vector<Segment> matchingSegments1 = tm1.getMatchingBasalSegments();
+    const vector<Segment> matchingSegments2 = tm2.getMatchingBasalSegments();
+    ASSERT_EQ(matchingSegments1.size(), matchingSegments2.size());
+    for (size_t i = 0; i < matchingSegments1.size(); i++)
+    {
+      const SegmentData& segmentData1 =
+        tm1.basalConnections.dataForSegment(matchingSegments1[i]);
+      const SegmentData& segmentData2 =
+        tm2.basalConnections.dataForSegment(matchingSegments2[i]);
+
+      ASSERT_EQ(segmentData1.cell, segmentData2.cell);
+    }
+
+    ASSERT_EQ(tm1.getWinnerCells(), tm2.getWinnerCells());
+    ASSERT_EQ(tm1.basalConnections, tm2.basalConnections);
+
+    ASSERT_TRUE(tm1 == tm2);
+  }
+
+  /**
+   * memoryUsage counts the live and dead slots, and the estimate from the
+   * model's size is in the right range.
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, MemoryUsage)
+  {
+    ApicalTiebreakPairMemory tm(
+      /*columnCount*/ 32,
+      /*basalInputSize*/ 100,
+      /*apicalInputSize*/ 100,
+      /*cellsPerColumn*/ 4,
+      /*activationThreshold*/ 3,
+      /*initialPermanence*/ 0.21,
+      /*connectedPermanence*/ 0.50,
+      /*minThreshold*/ 2,
+      /*sampleSize*/ 8);
+
+    const ApicalTiebreakTemporalMemoryMemoryUsage empty = tm.memoryUsage();
+    EXPECT_EQ(0, empty.basal.liveSegments);
+    EXPECT_EQ(0, empty.basal.liveSynapses);
+
+    Random rng(42);
+    for (UInt i = 0; i < 100; i++)
+    {
+      vector<UInt> activeColumns;
+      for (UInt column = 0; column < 32; column++)
+      {
+        if (rng.getUInt32(4) == 0)
+        {
+          activeColumns.push_back(column);
+        }
+      }
+      vector<CellIdx> input;
+      for (CellIdx cell = 0; cell < 100; cell++)
+      {
+        if (rng.getUInt32(8) == 0)
+        {
+          input.push_back(cell);
+        }
+      }
+
+      tm.compute(activeColumns, input, input, input, input, true);
+    }
+
+    const UInt numSegments = tm.basalConnections.numSegments();
+    const UInt numSynapses = tm.basalConnections.numSynapses();
+    tm.basalConnections.destroySegment(tm.basalConnections.getSegment(0, 0));
+
+    const ApicalTiebreakTemporalMemoryMemoryUsage usage = tm.memoryUsage();
+    EXPECT_EQ(numSegments - 1, usage.basal.liveSegments);
+    EXPECT_EQ(1, usage.basal.deadSegments);
+    EXPECT_EQ(tm.basalConnections.numSynapses(), usage.basal.liveSynapses);
+    EXPECT_EQ(numSynapses - tm.basalConnections.numSynapses(),
+              usage.basal.deadSynapses);
+    EXPECT_GT(usage.basal.indexes, 0);
+    EXPECT_GT(usage.lastUsedIterations, 0);
+    EXPECT_GT(usage.total(), empty.total());
+
+    const ApicalTiebreakTemporalMemoryMemoryUsage estimate =
+      ApicalTiebreakTemporalMemory::estimateMemoryUsage(
+        32, 4, 100, 100,
+        tm.basalConnections.numSegments(),
+        tm.apicalConnections.numSegments(),
+        tm.basalConnections.numSynapses() /
+        tm.basalConnections.numSegments());
+    EXPECT_GT(estimate.total(), usage.total() / 2);
+    EXPECT_LT(estimate.total(), usage.total() * 2);
+  }
+
+  /**
+   * Computes a Connections' histograms from scratch.
+   */
+  void expectHistogramsMatch(const Connections& connections,
+                             const ConnectionsLifecycleStats& lifecycleStats)
+  {
+    vector<UInt64> segmentsPerCell(
+      lifecycleStats.segmentsPerCell.size(), 0);
+    vector<UInt64> synapsesPerSegment(
+      lifecycleStats.synapsesPerSegment.size(), 0);
+    for (CellIdx cell = 0; cell < connections.numCells(); cell++)
+    {
+      const vector<Segment>& segments = connections.segmentsForCell(cell);
+      ASSERT_LT(segments.size(), segmentsPerCell.size());
+      segmentsPerCell[segments.size()]++;
+
+      for (Segment segment : segments)
+      {
+        const UInt numSynapses = connections.numSynapses(segment);
+        ASSERT_LT(numSynapses, synapsesPerSegment.size());
+        synapsesPerSegment[numSynapses]++;
+      }
+    }
+
+    EXPECT_EQ(segmentsPerCell, lifecycleStats.segmentsPerCell);
+    EXPECT_EQ(synapsesPerSegment, lifecycleStats.synapsesPerSegment);
+  }
+
+  /**
+   * The histograms follow the Connections as learning creates, evicts and
+   * destroys segments and synapses, and each cause is counted.
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, LifecycleStats)
+  {
+    ApicalTiebreakPairMemory tm(
+      /*columnCount*/ 32,
+      /*basalInputSize*/ 100,
+      /*apicalInputSize*/ 100,
+      /*cellsPerColumn*/ 4,
+      /*activationThreshold*/ 3,
+      /*initialPermanence*/ 0.21,
+      /*connectedPermanence*/ 0.50,
+      /*minThreshold*/ 2,
+      /*sampleSize*/ 8,
+      /*permanenceIncrement*/ 0.10,
+      /*permanenceDecrement*/ 0.10,
+      /*basalPredictedSegmentDecrement*/ 0.05,
+      /*apicalPredictedSegmentDecrement*/ 0.0,
+      /*learnOnOneCell*/ false,
+      /*seed*/ 42,
+      /*maxSegmentsPerCell*/ 2,
+      /*maxSynapsesPerSegment*/ 10);
+
+    const ApicalTiebreakTemporalMemoryLifecycleStats& lifecycleStats =
+      tm.getLifecycleStats();
+    EXPECT_EQ(vector<UInt64>({32 * 4}), lifecycleStats.basal.segmentsPerCell);
+
+    Random rng(42);
+    for (UInt i = 0; i < 300; i++)
+    {
+      vector<UInt> activeColumns;
+      for (UInt column = 0; column < 32; column++)
+      {
+        if (rng.getUInt32(4) == 0)
+        {
+          activeColumns.push_back(column);
+        }
+      }
+      vector<CellIdx> input;
+      for (CellIdx cell = 0; cell < 100; cell++)
+      {
+        if (rng.getUInt32(8) == 0)
+        {
+          input.push_back(cell);
+        }
+      }
+
+      tm.compute(activeColumns, input, input, input, input, true);
+    }
+
+    expectHistogramsMatch(tm.basalConnections, lifecycleStats.basal);
+    expectHistogramsMatch(tm.apicalConnections, lifecycleStats.apical);
+
+    const ConnectionsLifecycleStats& basal = lifecycleStats.basal;
+    EXPECT_GT(basal.segmentsEvicted, 0);
+    EXPECT_GT(basal.synapsesDestroyedByAdaptSegment, 0);
+    EXPECT_GT(basal.synapsesDestroyedByMinPermanence, 0);
+    EXPECT_EQ(0, basal.segmentsEvictedBySynapseBudget);
+
+    UInt64 numEvictionAges = 0;
+    for (UInt64 count : basal.evictionAges)
+    {
+      numEvictionAges += count;
+    }
+    EXPECT_EQ(basal.segmentsEvicted, numEvictionAges);
+
+    // Destroying a segment directly updates the histograms without counting
+    // a cause.
+    const ConnectionsLifecycleStats before = basal;
+    tm.basalConnections.destroySegment(tm.basalConnections.getSegment(0, 0));
+    expectHistogramsMatch(tm.basalConnections, lifecycleStats.basal);
+    EXPECT_EQ(before.segmentsEvicted, basal.segmentsEvicted);
+
+    // Resetting keeps the histograms.
+    tm.resetLifecycleStats();
+    expectHistogramsMatch(tm.basalConnections, lifecycleStats.basal);
+    EXPECT_EQ(0, basal.segmentsEvicted);
+    EXPECT_EQ(0, basal.synapsesDestroyedByAdaptSegment);
+    EXPECT_TRUE(basal.evictionAges.empty());
+  }
+
+  /**
+   * Feeds random columns and inputs to a pair memory, the same for a given
+   * seed.
+   */
+  void computeRandom(ApicalTiebreakPairMemory& tm, Random& rng,
+                     UInt numSteps, bool learn = true)
+  {
+    for (UInt i = 0; i < numSteps; i++)
+    {
+      vector<UInt> activeColumns;
+      for (UInt column = 0; column < 32; column++)
+      {
+        if (rng.getUInt32(4) == 0)
+        {
+          activeColumns.push_back(column);
+        }
+      }
+      vector<CellIdx> input;
+      for (CellIdx cell = 0; cell < 100; cell++)
+      {
+        if (rng.getUInt32(8) == 0)
+        {
+          input.push_back(cell);
+        }
+      }
+
+      tm.compute(activeColumns, input, input, input, input, learn);
+    }
+  }
+
+  std::unique_ptr<ApicalTiebreakPairMemory> makeCheckpointedTM()
+  {
+    return std::unique_ptr<ApicalTiebreakPairMemory>(
+      new ApicalTiebreakPairMemory(
+      /*columnCount*/ 32,
+      /*basalInputSize*/ 100,
+      /*apicalInputSize*/ 100,
+      /*cellsPerColumn*/ 4,
+      /*activationThreshold*/ 3,
+      /*initialPermanence*/ 0.21,
+      /*connectedPermanence*/ 0.50,
+      /*minThreshold*/ 2,
+      /*sampleSize*/ 8,
+      /*permanenceIncrement*/ 0.10,
+      /*permanenceDecrement*/ 0.10,
+      /*basalPredictedSegmentDecrement*/ 0.05,
+      /*apicalPredictedSegmentDecrement*/ 0.0,
+      /*learnOnOneCell*/ false,
+      /*seed*/ 42,
+      /*maxSegmentsPerCell*/ 3,
+      /*maxSynapsesPerSegment*/ 10));
+  }
+
+  void writeBaseCheckpoint(ApicalTiebreakPairMemory& tm, const string& path)
+  {
+    std::ofstream out(path.c_str(), std::ios::binary);
+    tm.writeBaseCheckpoint(out);
+  }
+
+  void writeDeltaCheckpoint(ApicalTiebreakPairMemory& tm, const string& path)
+  {
+    std::ofstream out(path.c_str(), std::ios::binary);
+    tm.writeDeltaCheckpoint(out);
+  }
+
+  /**
+   * A base checkpoint plus a chain of deltas loads the same model, including
+   * the last used iterations that decide which segments are evicted, and a
+   * compacted chain continues the chain.
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, DeltaCheckpoints)
+  {
+    std::unique_ptr<ApicalTiebreakPairMemory> tm1Ptr = makeCheckpointedTM();
+    ApicalTiebreakPairMemory& tm1 = *tm1Ptr;
+    Random rng(42);
+    computeRandom(tm1, rng, 100);
+
+    EXPECT_EQ(0, tm1.getCheckpointId());
+    EXPECT_THROW(writeDeltaCheckpoint(tm1, "DeltaCheckpointsTest.delta1"),
+                 std::exception);
+
+    writeBaseCheckpoint(tm1, "DeltaCheckpointsTest.base");
+    EXPECT_NE(0, tm1.getCheckpointId());
+    EXPECT_EQ(0, tm1.getNumDirtyCells());
+
+    computeRandom(tm1, rng, 20);
+    EXPECT_GT(tm1.getNumDirtyCells(), 0);
+    EXPECT_LT(tm1.getNumDirtyCells(), 2 * tm1.numberOfCells());
+    writeDeltaCheckpoint(tm1, "DeltaCheckpointsTest.delta1");
+    EXPECT_EQ(0, tm1.getNumDirtyCells());
+
+    computeRandom(tm1, rng, 20);
+    writeDeltaCheckpoint(tm1, "DeltaCheckpointsTest.delta2");
+
+    std::unique_ptr<ApicalTiebreakPairMemory> tm2Ptr = makeCheckpointedTM();
+    ApicalTiebreakPairMemory& tm2 = *tm2Ptr;
+    tm2.loadCheckpoints("DeltaCheckpointsTest.base",
+                        {"DeltaCheckpointsTest.delta1",
+                         "DeltaCheckpointsTest.delta2"});
+    EXPECT_TRUE(tm1 == tm2);
+    EXPECT_EQ(tm1.getCheckpointId(), tm2.getCheckpointId());
+
+    // The deltas only apply in order.
+    std::unique_ptr<ApicalTiebreakPairMemory> tm3Ptr = makeCheckpointedTM();
+    ApicalTiebreakPairMemory& tm3 = *tm3Ptr;
+    EXPECT_THROW(tm3.loadCheckpoints("DeltaCheckpointsTest.base",
+                                     {"DeltaCheckpointsTest.delta2"}),
+                 std::exception);
+
+    // The compacted base keeps the chain going.
+    ApicalTiebreakTemporalMemory::compactCheckpoints(
+      "DeltaCheckpointsTest.base",
+      {"DeltaCheckpointsTest.delta1", "DeltaCheckpointsTest.delta2"},
+      "DeltaCheckpointsTest.compacted");
+    computeRandom(tm1, rng, 20);
+    writeDeltaCheckpoint(tm1, "DeltaCheckpointsTest.delta3");
+
+    std::unique_ptr<ApicalTiebreakPairMemory> tm4Ptr = makeCheckpointedTM();
+    ApicalTiebreakPairMemory& tm4 = *tm4Ptr;
+    tm4.loadCheckpoints("DeltaCheckpointsTest.compacted",
+                        {"DeltaCheckpointsTest.delta3"});
+    EXPECT_TRUE(tm1 == tm4);
+
+    // Evictions depend on the last used iterations.
+    Random rng1(7);
+    Random rng2(7);
+    computeRandom(tm1, rng1, 50);
+    computeRandom(tm4, rng2, 50);
+    EXPECT_TRUE(tm1 == tm4);
+    EXPECT_EQ(tm1.getActiveCells(), tm4.getActiveCells());
+
+    for (const char* path : {"DeltaCheckpointsTest.base",
+                             "DeltaCheckpointsTest.delta1",
+                             "DeltaCheckpointsTest.delta2",
+                             "DeltaCheckpointsTest.delta3",
+                             "DeltaCheckpointsTest.compacted"})
+    {
+      std::remove(path);
+    }
+  }
+
+  /**
+   * A checkpoint that fails to write isn't committed, so the next delta is
+   * still relative to the last checkpoint that was written.
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, FailedCheckpointWrite)
+  {
+    std::unique_ptr<ApicalTiebreakPairMemory> tm1 = makeCheckpointedTM();
+    Random rng(42);
+    computeRandom(*tm1, rng, 100);
+
+    std::ostringstream failed;
+    failed.setstate(std::ios::badbit);
+    EXPECT_THROW(tm1->writeBaseCheckpoint(failed), std::exception);
+    EXPECT_EQ(0, tm1->getCheckpointId());
+
+    writeBaseCheckpoint(*tm1, "FailedCheckpointWriteTest.base");
+    const UInt64 baseId = tm1->getCheckpointId();
+
+    computeRandom(*tm1, rng, 20);
+    const size_t numDirtyCells = tm1->getNumDirtyCells();
+    EXPECT_GT(numDirtyCells, 0);
+    EXPECT_THROW(tm1->writeDeltaCheckpoint(failed), std::exception);
+    EXPECT_EQ(baseId, tm1->getCheckpointId());
+    EXPECT_EQ(numDirtyCells, tm1->getNumDirtyCells());
+
+    writeDeltaCheckpoint(*tm1, "FailedCheckpointWriteTest.delta");
+
+    std::unique_ptr<ApicalTiebreakPairMemory> tm2 = makeCheckpointedTM();
+    tm2->loadCheckpoints("FailedCheckpointWriteTest.base",
+                         {"FailedCheckpointWriteTest.delta"});
+    EXPECT_TRUE(*tm1 == *tm2);
+
+    std::remove("FailedCheckpointWriteTest.base");
+    std::remove("FailedCheckpointWriteTest.delta");
+  }
+
+  /**
+   * write() and operator== see the deferred permanence changes without
+   * materializing them, so they don't mark cells for the next delta.
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, WriteKeepsPermanencesDeferred)
+  {
+    std::unique_ptr<ApicalTiebreakPairMemory> tm1 = makeCheckpointedTM();
+    tm1->setLazyPermanences(true);
+    Random rng(42);
+    computeRandom(*tm1, rng, 100);
+
+    writeBaseCheckpoint(*tm1, "WriteKeepsPermanencesDeferredTest.base");
+    computeRandom(*tm1, rng, 20);
+    const size_t numDirtyCells = tm1->getNumDirtyCells();
+    const Connections basalConnections = tm1->basalConnections;
+
+    stringstream ss;
+    tm1->write(ss);
+    EXPECT_EQ(numDirtyCells, tm1->getNumDirtyCells());
+    EXPECT_TRUE(basalConnections == tm1->basalConnections);
+
+    std::unique_ptr<ApicalTiebreakPairMemory> tm2 = makeCheckpointedTM();
+    tm2->read(ss);
+    EXPECT_TRUE(*tm1 == *tm2);
+    EXPECT_EQ(numDirtyCells, tm1->getNumDirtyCells());
+
+    // The copy has the permanences that were deferred.
+    ASSERT_TRUE(tm1->basalConnections != tm2->basalConnections);
+    tm1->materializePermanences();
+    EXPECT_TRUE(tm1->basalConnections == tm2->basalConnections);
+    EXPECT_GT(tm1->getNumDirtyCells(), numDirtyCells);
+
+    std::remove("WriteKeepsPermanencesDeferredTest.base");
   }
 
-  TEST(ApicalTiebreakTemporalMemoryTest, testColumnForCellInvalidCell)
+  /**
+   * Cells are only tracked while the model is in a chain of checkpoints.
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, DirtyCellsOnlyInChain)
   {
-    ApicalTiebreakSequenceMemory tm(
-      /*columnCount*/ 4096,
-      /*apicalInputSize*/ 0,
-      /*cellsPerColumn*/ 4);
+    std::unique_ptr<ApicalTiebreakPairMemory> tm = makeCheckpointedTM();
+    Random rng(42);
+    computeRandom(*tm, rng, 50);
+    EXPECT_EQ(0, tm->getNumDirtyCells());
 
-    EXPECT_NO_THROW(tm.columnForCell(16383));
-    EXPECT_THROW(tm.columnForCell(16384), std::exception);
-    EXPECT_THROW(tm.columnForCell(-1), std::exception);
+    writeBaseCheckpoint(*tm, "DirtyCellsOnlyInChainTest.base");
+    computeRandom(*tm, rng, 20);
+    EXPECT_GT(tm->getNumDirtyCells(), 0);
+
+    // A model read without a checkpoint id leaves the chain.
+    stringstream ss;
+    tm->write(ss);
+    tm->read(ss);
+    EXPECT_EQ(0, tm->getCheckpointId());
+    computeRandom(*tm, rng, 20);
+    EXPECT_EQ(0, tm->getNumDirtyCells());
+
+    // So does one that loads a snapshot.
+    writeBaseCheckpoint(*tm, "DirtyCellsOnlyInChainTest.base");
+    computeRandom(*tm, rng, 20);
+    tm->writeSnapshot("DirtyCellsOnlyInChainTest.snapshot");
+    tm->loadSnapshot("DirtyCellsOnlyInChainTest.snapshot");
+    EXPECT_EQ(0, tm->getNumDirtyCells());
+    computeRandom(*tm, rng, 20);
+    EXPECT_FALSE(tm->isFrozen());
+    EXPECT_EQ(0, tm->getNumDirtyCells());
+
+    std::remove("DirtyCellsOnlyInChainTest.base");
+    std::remove("DirtyCellsOnlyInChainTest.snapshot");
   }
 
-  TEST(ApicalTiebreakTemporalMemoryTest, testNumberOfColumns)
+  /**
+   * A sequence memory's checkpoints include its previous inputs, which its
+   * next compute uses.
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, SequenceMemoryDeltaCheckpoints)
   {
-    ApicalTiebreakSequenceMemory tm(
-      /*columnCount*/ 2048,
-      /*apicalInputSize*/ 0,
-      /*cellsPerColumn*/ 32);
+    ApicalTiebreakSequenceMemory tm1(
+      /*columnCount*/ 32,
+      /*apicalInputSize*/ 50,
+      /*cellsPerColumn*/ 4,
+      /*activationThreshold*/ 3,
+      /*initialPermanence*/ 0.21,
+      /*connectedPermanence*/ 0.50,
+      /*minThreshold*/ 2,
+      /*sampleSize*/ 3);
+
+    const vector<vector<UInt>> sequence = {{0, 1, 2}, {3, 4, 5}, {6, 7, 8},
+                                           {9, 10, 11}};
+    const vector<vector<CellIdx>> apicalInputs = {{1, 2, 3}, {4, 5, 6},
+                                                  {7, 8, 9}, {10, 11, 12}};
+    const auto computeSequence = [&](ApicalTiebreakSequenceMemory& tm,
+                                     size_t begin, size_t end)
+      {
+        for (size_t i = begin; i < end; i++)
+        {
+          tm.compute(sequence[i], apicalInputs[i], apicalInputs[i]);
+        }
+      };
 
-    int numOfColumns = tm.numberOfColumns();
-    ASSERT_EQ(numOfColumns, 2048);
+    for (UInt repetition = 0; repetition < 5; repetition++)
+    {
+      tm1.reset();
+      computeSequence(tm1, 0, sequence.size());
+    }
+
+    tm1.reset();
+    computeSequence(tm1, 0, 1);
+    {
+      std::ofstream out("SequenceMemoryDeltaCheckpointsTest.base",
+                        std::ios::binary);
+      tm1.writeBaseCheckpoint(out);
+    }
+    computeSequence(tm1, 1, 2);
+    {
+      std::ofstream out("SequenceMemoryDeltaCheckpointsTest.delta",
+                        std::ios::binary);
+      tm1.writeDeltaCheckpoint(out);
+    }
+
+    ApicalTiebreakSequenceMemory tm2;
+    tm2.loadCheckpoints("SequenceMemoryDeltaCheckpointsTest.base",
+                        {"SequenceMemoryDeltaCheckpointsTest.delta"});
+    EXPECT_EQ(tm1.getPredictedCells(), tm2.getPredictedCells());
+    EXPECT_FALSE(tm2.getPredictedCells().empty());
+
+    computeSequence(tm1, 2, sequence.size());
+    computeSequence(tm2, 2, sequence.size());
+    EXPECT_EQ(tm1.getActiveCells(), tm2.getActiveCells());
+    EXPECT_EQ(tm1.getPredictedCells(), tm2.getPredictedCells());
+    EXPECT_TRUE(tm1 == tm2);
+
+    std::remove("SequenceMemoryDeltaCheckpointsTest.base");
+    std::remove("SequenceMemoryDeltaCheckpointsTest.delta");
   }
 
-  TEST(ApicalTiebreakTemporalMemoryTest, testNumberOfCells)
+  void expectSameOutputs(ApicalTiebreakPairMemory& expected,
+                         ApicalTiebreakPairMemory& actual)
   {
-    ApicalTiebreakSequenceMemory tm(
-      /*columnCount*/ 2048,
-      /*apicalInputSize*/ 0,
-      /*cellsPerColumn*/ 32);
+    EXPECT_EQ(expected.getActiveCells(), actual.getActiveCells());
+    EXPECT_EQ(expected.getWinnerCells(), actual.getWinnerCells());
+    EXPECT_EQ(expected.getPredictedCells(), actual.getPredictedCells());
+    EXPECT_EQ(expected.getPredictedActiveCells(),
+              actual.getPredictedActiveCells());
+    EXPECT_EQ(expected.getBasalPredictedCells(),
+              actual.getBasalPredictedCells());
+    EXPECT_EQ(expected.getApicalPredictedCells(),
+              actual.getApicalPredictedCells());
+  }
 
-    Int numberOfCells = tm.numberOfCells();
-    ASSERT_EQ(numberOfCells, 2048 * 32);
+  /**
+   * Changes made directly to the Connections between computes reach every
+   * index, so the model learns the same as one freshly read from it. The
+   * model is written with deferred permanence changes, so the read model's
+   * segment ages come from a renumbered copy of the segments.
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, DirectConnectionsChanges)
+  {
+    for (bool incrementalOverlaps : {false, true})
+    {
+      std::unique_ptr<ApicalTiebreakPairMemory> tm1Ptr = makeCheckpointedTM();
+      ApicalTiebreakPairMemory& tm1 = *tm1Ptr;
+      tm1.setIncrementalOverlaps(incrementalOverlaps);
+      tm1.setLazyPermanences(true);
+
+      // Learning can destroy the segments in the step's outputs, which are
+      // written with the model, so finish with a step that doesn't learn.
+      Random rng(42);
+      computeRandom(tm1, rng, 50);
+      computeRandom(tm1, rng, 1, false);
+
+      Connections& connections = tm1.basalConnections;
+      vector<Segment> segments;
+      CellIdx cellWithRoom = connections.numCells();
+      for (CellIdx cell = 0; cell < connections.numCells(); cell++)
+      {
+        const vector<Segment>& cellSegments =
+          connections.segmentsForCell(cell);
+        segments.insert(segments.end(), cellSegments.begin(),
+                        cellSegments.end());
+        if (cellSegments.empty() && cellWithRoom == connections.numCells())
+        {
+          cellWithRoom = cell;
+        }
+      }
+      ASSERT_GT(segments.size(), 3);
+      ASSERT_LT(cellWithRoom, connections.numCells());
+
+      // Move one segment's synapses across the connected threshold, and
+      // another's within it.
+      for (Synapse synapse : connections.synapsesForSegment(segments[0]))
+      {
+        const Permanence permanence =
+          connections.dataForSynapse(synapse).permanence;
+        connections.updateSynapsePermanence(
+          synapse, (permanence >= 0.50) ? 0.30 : 0.70);
+      }
+      for (Synapse synapse : connections.synapsesForSegment(segments[1]))
+      {
+        const Permanence permanence =
+          connections.dataForSynapse(synapse).permanence;
+        connections.updateSynapsePermanence(
+          synapse, std::min((Permanence)1.0, permanence + (Permanence)0.01));
+      }
+
+      ASSERT_GT(connections.numSynapses(segments[2]), 0);
+      connections.destroySynapse(
+        connections.synapsesForSegment(segments[2])[0]);
+
+      // Likewise leave the step's segments, and destroy another.
+      const vector<Segment> matchingSegments = tm1.getMatchingBasalSegments();
+      auto unused = std::find_if(
+        segments.begin() + 3, segments.end(),
+        [&](Segment segment)
+        {
+          return std::find(matchingSegments.begin(), matchingSegments.end(),
+                           segment) == matchingSegments.end();
+        });
+      ASSERT_NE(segments.end(), unused);
+      connections.destroySegment(*unused);
+
+      // A new segment on a tenth of the input, so it's often matching.
+      const Segment segment = connections.createSegment(cellWithRoom);
+      for (CellIdx cell = 0; cell < 100; cell += 10)
+      {
+        connections.createSynapse(segment, cell, 0.60);
+      }
+
+      stringstream ss;
+      tm1.write(ss);
+      std::unique_ptr<ApicalTiebreakPairMemory> tm2Ptr = makeCheckpointedTM();
+      ApicalTiebreakPairMemory& tm2 = *tm2Ptr;
+      tm2.read(ss);
+      tm2.setIncrementalOverlaps(incrementalOverlaps);
+      tm2.setLazyPermanences(true);
+
+      Random rng1(7);
+      Random rng2(7);
+      for (UInt i = 0; i < 50; i++)
+      {
+        computeRandom(tm1, rng1, 1);
+        computeRandom(tm2, rng2, 1);
+        expectSameOutputs(tm2, tm1);
+
+        // The read model numbers its segments differently.
+        ASSERT_EQ(tm2.getActiveBasalSegments().size(),
+                  tm1.getActiveBasalSegments().size());
+        ASSERT_EQ(tm2.getMatchingBasalSegments().size(),
+                  tm1.getMatchingBasalSegments().size());
+      }
+
+      EXPECT_TRUE(tm1 == tm2);
+    }
   }
 
-  TEST(ApicalTiebreakTemporalMemoryTest, testWrite)
+  /**
+   * A frozen model computes the same as the model that wrote the snapshot,
+   * and it thaws into the same model when it learns.
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, Snapshots)
+  {
+    std::unique_ptr<ApicalTiebreakPairMemory> tm1Ptr = makeCheckpointedTM();
+    ApicalTiebreakPairMemory& tm1 = *tm1Ptr;
+
+    // Learn some pairs so that there are predictions with apical support.
+    Random rng(42);
+    vector<vector<UInt>> columns(8);
+    vector<vector<CellIdx>> inputs(8);
+    for (UInt i = 0; i < columns.size(); i++)
+    {
+      for (UInt column = 0; column < 32; column++)
+      {
+        if (rng.getUInt32(4) == 0)
+        {
+          columns[i].push_back(column);
+        }
+      }
+      for (CellIdx cell = 0; cell < 100; cell++)
+      {
+        if (rng.getUInt32(8) == 0)
+        {
+          inputs[i].push_back(cell);
+        }
+      }
+    }
+    const auto computePair = [&](ApicalTiebreakPairMemory& tm, UInt i,
+                                 bool learn)
+      {
+        const vector<CellIdx>& apicalInput = inputs[(i + 1) % inputs.size()];
+        tm.compute(columns[i], inputs[i], apicalInput, inputs[i],
+                   apicalInput, learn);
+      };
+    for (UInt repetition = 0; repetition < 10; repetition++)
+    {
+      for (UInt i = 0; i < columns.size(); i++)
+      {
+        computePair(tm1, i, true);
+      }
+    }
+    computeRandom(tm1, rng, 20);
+
+    tm1.writeSnapshot("SnapshotsTest.snapshot");
+    EXPECT_FALSE(tm1.isFrozen());
+
+    std::unique_ptr<ApicalTiebreakPairMemory> tm2Ptr = makeCheckpointedTM();
+    ApicalTiebreakPairMemory& tm2 = *tm2Ptr;
+    tm2.loadSnapshot("SnapshotsTest.snapshot");
+    EXPECT_TRUE(tm2.isFrozen());
+    EXPECT_EQ(0, tm2.basalConnections.numSegments());
+    EXPECT_THROW(tm1 == tm2, std::exception);
+
+    // The memory usage counts the snapshot's segments and synapses.
+    const ApicalTiebreakTemporalMemoryMemoryUsage usage1 = tm1.memoryUsage();
+    const ApicalTiebreakTemporalMemoryMemoryUsage usage2 = tm2.memoryUsage();
+    EXPECT_EQ(usage1.basal.liveSegments, usage2.basal.liveSegments);
+    EXPECT_EQ(usage1.basal.liveSynapses, usage2.basal.liveSynapses);
+    EXPECT_EQ(usage1.apical.liveSegments, usage2.apical.liveSegments);
+    EXPECT_EQ(usage1.apical.liveSynapses, usage2.apical.liveSynapses);
+    EXPECT_GT(usage2.basal.synapses, 0);
+    EXPECT_GT(usage2.lastUsedIterations, 0);
+
+    // The loaded model continues from the same per-step state.
+    expectSameOutputs(tm1, tm2);
+
+    size_t numPredictedActiveCells = 0;
+    for (UInt i = 0; i < columns.size(); i++)
+    {
+      computePair(tm1, i, false);
+      computePair(tm2, i, false);
+      expectSameOutputs(tm1, tm2);
+      numPredictedActiveCells += tm2.getPredictedActiveCells().size();
+    }
+    Random rng1(7);
+    Random rng2(7);
+    computeRandom(tm1, rng1, 5, false);
+    computeRandom(tm2, rng2, 5, false);
+    expectSameOutputs(tm1, tm2);
+    EXPECT_GT(numPredictedActiveCells, 0);
+    EXPECT_TRUE(tm2.isFrozen());
+
+    // Writing it copies the segments out of the snapshot without thawing it.
+    stringstream ss;
+    tm2.write(ss);
+    EXPECT_TRUE(tm2.isFrozen());
+    std::unique_ptr<ApicalTiebreakPairMemory> tm3Ptr = makeCheckpointedTM();
+    ApicalTiebreakPairMemory& tm3 = *tm3Ptr;
+    tm3.read(ss);
+    EXPECT_TRUE(tm1 == tm3);
+    Random rng3(rng2);
+
+    // Learning thaws it.
+    computeRandom(tm1, rng1, 1);
+    computeRandom(tm2, rng2, 1);
+    EXPECT_FALSE(tm2.isFrozen());
+    EXPECT_TRUE(tm1 == tm2);
+
+    computeRandom(tm1, rng1, 20);
+    computeRandom(tm2, rng2, 20);
+    computeRandom(tm3, rng3, 21);
+    expectSameOutputs(tm1, tm2);
+    expectSameOutputs(tm1, tm3);
+    EXPECT_TRUE(tm1 == tm2);
+    EXPECT_TRUE(tm1 == tm3);
+
+    std::remove("SnapshotsTest.snapshot");
+  }
+
+  /**
+   * The sequence memory passes bursting columns as whole columns, which a
+   * frozen model handles too.
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, SnapshotSequenceMemory)
   {
     ApicalTiebreakSequenceMemory tm1(
-      /*columnCount*/ 100,
+      /*columnCount*/ 32,
       /*apicalInputSize*/ 0,
       /*cellsPerColumn*/ 4,
-      /*activationThreshold*/ 7,
-      /*initialPermanence*/ 0.37,
-      /*connectedPermanence*/ 0.58,
-      /*minThreshold*/ 4,
-      /*sampleSize*/ 18,
-      /*permanenceIncrement*/ 0.23,
-      /*permanenceDecrement*/ 0.08,
-      /*basalPredictedSegmentDecrement*/ 0.0,
-      /*apicalPredictedSegmentDecrement*/ 0.0,
-      /*learnOnOneCell*/ false,
-      /*seed*/ 42);
+      /*activationThreshold*/ 3,
+      /*initialPermanence*/ 0.21,
+      /*connectedPermanence*/ 0.50,
+      /*minThreshold*/ 2,
+      /*sampleSize*/ 3);
+    ApicalTiebreakSequenceMemory tm2(32, 0, 4);
 
-    // Run some data through before serializing
-    /*
-      PatternMachine patternMachine = PatternMachine(100, 4);
-      SequenceMachine sequenceMachine = SequenceMachine(self.patternMachine);
-      Sequence sequence = self.sequenceMachine.generateFromNumbers(range(5));
-    */
-    vector<vector<UInt>> sequence =
+    const vector<vector<UInt>> sequence = {{0, 1, 2}, {3, 4, 5}, {6, 7, 8},
+                                           {9, 10, 11}};
+    for (UInt repetition = 0; repetition < 10; repetition++)
+    {
+      tm1.reset();
+      for (const vector<UInt>& columns : sequence)
       {
-        { 45, 53, 70, 83 },
-        { 8, 59, 65, 67 },
-        { 25, 39, 98, 99 },
-        { 11, 14, 66, 78 },
-        { 69, 87, 95, 96 } };
+        tm1.compute(columns);
+      }
+    }
+    tm1.reset();
 
-    for (UInt i = 0; i < 3; i++)
+    tm1.writeSnapshot("SnapshotSequenceMemoryTest.snapshot");
+    tm2.loadSnapshot("SnapshotSequenceMemoryTest.snapshot");
+
+    // A frozen model can be written, e.g. to pickle it.
+    stringstream ss;
+    tm2.write(ss);
+    ApicalTiebreakSequenceMemory tm3;
+    tm3.read(ss);
+
+    for (const vector<UInt>& columns : sequence)
     {
-      for (vector<UInt> pattern : sequence)
-        tm1.compute(pattern);
+      tm1.compute(columns, {}, {}, false);
+      tm2.compute(columns, {}, {}, false);
+      tm3.compute(columns, {}, {}, false);
+      EXPECT_EQ(tm1.getActiveCells(), tm2.getActiveCells());
+      EXPECT_EQ(tm1.getPredictedCells(), tm2.getPredictedCells());
+      EXPECT_EQ(tm1.getNextPredictedCells(), tm2.getNextPredictedCells());
+      EXPECT_EQ(tm1.getActiveCells(), tm3.getActiveCells());
+      EXPECT_EQ(tm1.getNextPredictedCells(), tm3.getNextPredictedCells());
     }
+    EXPECT_FALSE(tm2.getPredictedCells().empty());
+    EXPECT_TRUE(tm2.isFrozen());
 
-    // Write and read back the proto
-    stringstream ss;
-    tm1.write(ss);
-    ApicalTiebreakSequenceMemory tm2;
-    tm2.read(ss);
+    std::remove("SnapshotSequenceMemoryTest.snapshot");
+  }
 
-    // Check that the two temporal memory objects have the same attributes
-    ASSERT_TRUE(tm1 == tm2);
+  template <typename T>
+  T readSnapshotValue(const string& contents, size_t offset)
+  {
+    T value;
+    memcpy(&value, contents.data() + offset, sizeof(T));
+    return value;
+  }
 
-    tm1.compute(sequence[0]);
-    tm2.compute(sequence[0]);
-    ASSERT_EQ(tm1.getActiveCells(), tm2.getActiveCells());
-    ASSERT_EQ(tm1.getWinnerCells(), tm2.getWinnerCells());
-    ASSERT_EQ(tm1.basalConnections, tm2.basalConnections);
+  template <typename T>
+  void writeSnapshotValue(string& contents, size_t offset, T value)
+  {
+    memcpy(&contents[offset], &value, sizeof(T));
+  }
 
-    tm1.compute(sequence[3]);
-    tm2.compute(sequence[3]);
-    ASSERT_EQ(tm1.getActiveCells(), tm2.getActiveCells());
+  // The snapshot header is 32 bytes, then the basal counts (numCells,
+  // numSegments, numSynapses, numPresynapticCells), then the offset and
+  // length of each basal array in the order writeSnapshot() writes them.
+  const size_t BASAL_NUM_SEGMENTS = 40;
+  const size_t BASAL_NUM_SYNAPSES = 48;
+  enum BasalSnapshotArray
+  {
+    SEGMENT_OFFSET_FOR_CELL = 0,
+    CELL_FOR_SEGMENT = 1,
+    SEGMENT_FOR_PRESYNAPTIC_SYNAPSE = 8
+  };
+
+  size_t basalSnapshotArrayOffset(const string& contents,
+                                  BasalSnapshotArray array)
+  {
+    return readSnapshotValue<UInt64>(contents, 64 + 16 * array);
+  }
+
+  void writeFile(const string& path, const string& contents)
+  {
+    std::ofstream out(path.c_str(), std::ios::binary);
+    out << contents;
+  }
+
+  TEST(ApicalTiebreakTemporalMemoryTest, SnapshotCorrupt)
+  {
+    std::unique_ptr<ApicalTiebreakPairMemory> tmPtr = makeCheckpointedTM();
+    ApicalTiebreakPairMemory& tm = *tmPtr;
+    Random rng(42);
+    computeRandom(tm, rng, 20);
+    tm.writeSnapshot("SnapshotCorruptTest.snapshot");
+
+    std::ifstream in("SnapshotCorruptTest.snapshot", std::ios::binary);
+    const string contents((std::istreambuf_iterator<char>(in)),
+                          std::istreambuf_iterator<char>());
+    in.close();
 
-    const vector<Segment> activeSegments1 = tm1.getActiveBasalSegments();
-    const vector<Segment> activeSegments2 = tm2.getActiveBasalSegments();
-    ASSERT_EQ(activeSegments1.size(), activeSegments2.size());
-    for (size_t i = 0; i < activeSegments1.size(); i++)
     {
-      const SegmentData& segmentData1 =
-        tm1.basalConnections.dataForSegment(activeSegments1[i]);
-      const SegmentData& segmentData2 =
-        tm2.basalConnections.dataForSegment(activeSegments2[i]);
+      std::ofstream out("SnapshotCorruptTest.snapshot", std::ios::binary);
+      out << contents.substr(0, contents.size() / 2);
+    }
+    EXPECT_THROW(tm.loadSnapshot("SnapshotCorruptTest.snapshot"),
+                 std::exception);
 
-      ASSERT_EQ(segmentData1.cell, segmentData2.cell);
+    {
+      std::ofstream out("SnapshotCorruptTest.snapshot", std::ios::binary);
+      out << "Not a snapshot" << contents.substr(14);
     }
+    EXPECT_THROW(tm.loadSnapshot("SnapshotCorruptTest.snapshot"),
+                 std::exception);
+    EXPECT_FALSE(tm.isFrozen());
+
+    // A segment id past the segments would be an overlap write outside the
+    // overlap arrays.
+    ASSERT_GT(readSnapshotValue<UInt64>(contents, BASAL_NUM_SYNAPSES), 0);
+    string badSegment = contents;
+    writeSnapshotValue<Segment>(
+      badSegment,
+      basalSnapshotArrayOffset(contents, SEGMENT_FOR_PRESYNAPTIC_SYNAPSE),
+      (Segment)readSnapshotValue<UInt64>(contents, BASAL_NUM_SEGMENTS));
+    writeFile("SnapshotCorruptTest.snapshot", badSegment);
+    EXPECT_THROW(tm.loadSnapshot("SnapshotCorruptTest.snapshot"),
+                 std::exception);
+    EXPECT_FALSE(tm.isFrozen());
+
+    std::remove("SnapshotCorruptTest.snapshot");
+  }
 
-    const vector<Segment> matchingSegments1 = tm1.getMatchingBasalSegments();
-    const vector<Segment> matchingSegments2 = tm2.getMatchingBasalSegments();
-    ASSERT_EQ(matchingSegments1.size(), matchingSegments2.size());
-    for (size_t i = 0; i < matchingSegments1.size(); i++)
+  /**
+   * A snapshot whose per-step state names a segment it doesn't have fails
+   * after the model's segments were replaced. The model is left empty but
+   * usable.
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, SnapshotBadState)
+  {
+    std::unique_ptr<ApicalTiebreakPairMemory> tm1 = makeCheckpointedTM();
+    Random rng(42);
+    computeRandom(*tm1, rng, 100);
+
+    // Find a matching segment that's the last one on its cell.
+    const Connections& connections = tm1->basalConnections;
+    CellIdx cell = 0;
+    UInt32 idxOnCell = 0;
+    bool found = false;
+    for (Segment segment : tm1->getMatchingBasalSegments())
     {
-      const SegmentData& segmentData1 =
-        tm1.basalConnections.dataForSegment(matchingSegments1[i]);
-      const SegmentData& segmentData2 =
-        tm2.basalConnections.dataForSegment(matchingSegments2[i]);
+      cell = connections.cellForSegment(segment);
+      idxOnCell = connections.idxOnCellForSegment(segment);
+      if (idxOnCell + 1 == connections.numSegments(cell) &&
+          cell + 1 < connections.numCells())
+      {
+        found = true;
+        break;
+      }
+    }
+    ASSERT_TRUE(found);
+
+    tm1->writeSnapshot("SnapshotBadStateTest.snapshot");
+    std::ifstream in("SnapshotBadStateTest.snapshot", std::ios::binary);
+    const string contents((std::istreambuf_iterator<char>(in)),
+                          std::istreambuf_iterator<char>());
+    in.close();
+
+    // Move the segment to the next cell, so the state's idxOnCell is past
+    // the end of its cell.
+    const size_t segmentOffsets =
+      basalSnapshotArrayOffset(contents, SEGMENT_OFFSET_FOR_CELL);
+    const size_t cellForSegment =
+      basalSnapshotArrayOffset(contents, CELL_FOR_SEGMENT);
+    const UInt32 frozenSegment =
+      readSnapshotValue<UInt32>(contents, segmentOffsets + 4 * cell) +
+      idxOnCell;
+    string badState = contents;
+    writeSnapshotValue<UInt32>(badState, segmentOffsets + 4 * (cell + 1),
+                               frozenSegment);
+    writeSnapshotValue<CellIdx>(badState, cellForSegment + 4 * frozenSegment,
+                                cell + 1);
+    writeFile("SnapshotBadStateTest.snapshot", badState);
+
+    std::unique_ptr<ApicalTiebreakPairMemory> tm2 = makeCheckpointedTM();
+    computeRandom(*tm2, rng, 20);
+    EXPECT_THROW(tm2->loadSnapshot("SnapshotBadStateTest.snapshot"),
+                 std::exception);
+    EXPECT_FALSE(tm2->isFrozen());
+    EXPECT_EQ(0, tm2->basalConnections.numSegments());
+    computeRandom(*tm2, rng, 20);
+
+    writeFile("SnapshotBadStateTest.snapshot", contents);
+    tm2->loadSnapshot("SnapshotBadStateTest.snapshot");
+    Random rng1(7);
+    Random rng2(7);
+    computeRandom(*tm1, rng1, 20, false);
+    computeRandom(*tm2, rng2, 20, false);
+    expectSameOutputs(*tm1, *tm2);
+
+    std::remove("SnapshotBadStateTest.snapshot");
+  }
 
-      ASSERT_EQ(segmentData1.cell, segmentData2.cell);
+  template <typename AgeChunks>
+  vector<UInt64> decodeSegmentAges(AgeChunks chunks)
+  {
+    vector<UInt64> ages;
+    UInt64 value = 0;
+    UInt shift = 0;
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+      for (unsigned char byte : chunks[i].getBytes())
+      {
+        value |= (UInt64)(byte & 0x7F) << shift;
+        shift += 7;
+        if ((byte & 0x80) == 0)
+        {
+          ages.push_back(value);
+          value = 0;
+          shift = 0;
+        }
+      }
     }
+    return ages;
+  }
 
-    ASSERT_EQ(tm1.getWinnerCells(), tm2.getWinnerCells());
-    ASSERT_EQ(tm1.basalConnections, tm2.basalConnections);
+  /**
+   * Decodes the segment ages of a version 1 proto into the old list of
+   * (cell, idxOnCell, lastUsedIteration).
+   */
+  template <typename AgeChunks, typename InitPairs>
+  void writeVersion0LastUsed(AgeChunks chunks, InitPairs initPairs,
+                             const Connections& connections,
+                             UInt64 iteration)
+  {
+    const vector<UInt64> ages = decodeSegmentAges(chunks);
+    ASSERT_EQ(connections.numSegments(), ages.size());
 
-    ASSERT_TRUE(tm1 == tm2);
+    auto pairs = initPairs(ages.size());
+    size_t i = 0;
+    for (CellIdx cell = 0; cell < connections.numCells(); cell++)
+    {
+      for (UInt32 idxOnCell = 0;
+           idxOnCell < connections.numSegments(cell); idxOnCell++)
+      {
+        pairs[i].setCell(cell);
+        pairs[i].setIdxOnCell(idxOnCell);
+        pairs[i].setNumber(iteration - ages[i]);
+        i++;
+      }
+    }
+  }
+
+  template <typename Segments, typename Overlaps, typename InitPairs>
+  void writeVersion0Overlaps(Segments matchingSegments, Overlaps overlaps,
+                             InitPairs initPairs)
+  {
+    auto pairs = initPairs(matchingSegments.size());
+    for (size_t i = 0; i < matchingSegments.size(); i++)
+    {
+      pairs[i].setCell(matchingSegments[i].getCell());
+      pairs[i].setIdxOnCell(matchingSegments[i].getIdxOnCell());
+      pairs[i].setNumber(overlaps[i]);
+    }
+  }
+
+  /**
+   * Returns the encoded last used iterations that write() produces.
+   */
+  vector<unsigned char> writeSegmentAges(ApicalTiebreakPairMemory& tm)
+  {
+    capnp::MallocMessageBuilder message;
+    ApicalTiebreakTemporalMemoryProto::Builder proto =
+      message.initRoot<ApicalTiebreakTemporalMemoryProto>();
+    tm.write(proto);
+
+    vector<unsigned char> bytes;
+    for (auto chunk : proto.getLastUsedIterationAgeForBasalSegment())
+    {
+      bytes.insert(bytes.end(), chunk.getBytes().begin(),
+                   chunk.getBytes().end());
+    }
+    for (auto chunk : proto.getLastUsedIterationAgeForApicalSegment())
+    {
+      bytes.insert(bytes.end(), chunk.getBytes().begin(),
+                   chunk.getBytes().end());
+    }
+    return bytes;
+  }
+
+  /**
+   * write() uses one varint per segment for the last used iterations, and
+   * read() still reads the old per-segment lists.
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, SerializationVersions)
+  {
+    std::unique_ptr<ApicalTiebreakPairMemory> tm1 = makeCheckpointedTM();
+    Random rng(42);
+    computeRandom(*tm1, rng, 100);
+
+    capnp::MallocMessageBuilder message;
+    ApicalTiebreakTemporalMemoryProto::Builder proto =
+      message.initRoot<ApicalTiebreakTemporalMemoryProto>();
+    tm1->write(proto);
+    EXPECT_EQ(1, proto.getSerializationVersion());
+    EXPECT_EQ(0, proto.getLastUsedIterationForBasalSegment().size());
+    EXPECT_EQ(tm1->getMatchingBasalSegments().size(),
+              proto.getNumActivePotentialSynapsesForMatchingBasalSegment()
+              .size());
+
+    // Each segment was used in the last 128 iterations, so its age is a
+    // single byte.
+    size_t numBytes = 0;
+    for (auto chunk : proto.getLastUsedIterationAgeForBasalSegment())
+    {
+      numBytes += chunk.getBytes().size();
+    }
+    EXPECT_EQ(tm1->basalConnections.numSegments(), numBytes);
+
+    std::unique_ptr<ApicalTiebreakPairMemory> tm2 = makeCheckpointedTM();
+    ApicalTiebreakTemporalMemoryProto::Reader reader = proto.asReader();
+    tm2->read(reader);
+
+    // Rewrite the message in the old format.
+    const UInt64 iteration = proto.getIteration();
+    writeVersion0LastUsed(
+      proto.getLastUsedIterationAgeForBasalSegment(),
+      [&](size_t n) { return proto.initLastUsedIterationForBasalSegment(n); },
+      tm1->basalConnections, iteration);
+    writeVersion0LastUsed(
+      proto.getLastUsedIterationAgeForApicalSegment(),
+      [&](size_t n) { return proto.initLastUsedIterationForApicalSegment(n); },
+      tm1->apicalConnections, iteration);
+    writeVersion0Overlaps(
+      proto.getMatchingBasalSegments(),
+      proto.getNumActivePotentialSynapsesForMatchingBasalSegment(),
+      [&](size_t n)
+      { return proto.initNumActivePotentialSynapsesForBasalSegment(n); });
+    writeVersion0Overlaps(
+      proto.getMatchingApicalSegments(),
+      proto.getNumActivePotentialSynapsesForMatchingApicalSegment(),
+      [&](size_t n)
+      { return proto.initNumActivePotentialSynapsesForApicalSegment(n); });
+    proto.initLastUsedIterationAgeForBasalSegment(0);
+    proto.initLastUsedIterationAgeForApicalSegment(0);
+    proto.initNumActivePotentialSynapsesForMatchingBasalSegment(0);
+    proto.initNumActivePotentialSynapsesForMatchingApicalSegment(0);
+    proto.setSerializationVersion(0);
+
+    std::unique_ptr<ApicalTiebreakPairMemory> tm3 = makeCheckpointedTM();
+    reader = proto.asReader();
+    tm3->read(reader);
+
+    const vector<unsigned char> ages = writeSegmentAges(*tm1);
+    EXPECT_EQ(ages, writeSegmentAges(*tm2));
+    EXPECT_EQ(ages, writeSegmentAges(*tm3));
+
+    // The segments are evicted by their last used iterations, so the models
+    // only stay equal if those were read correctly.
+    Random rng2(rng);
+    Random rng3(rng);
+    computeRandom(*tm1, rng, 100);
+    computeRandom(*tm2, rng2, 100);
+    computeRandom(*tm3, rng3, 100);
+    EXPECT_TRUE(*tm1 == *tm2);
+    EXPECT_TRUE(*tm1 == *tm3);
+    EXPECT_EQ(tm1->getActiveCells(), tm2->getActiveCells());
+    EXPECT_EQ(tm1->getActiveCells(), tm3->getActiveCells());
+
+    proto.setSerializationVersion(2);
+    reader = proto.asReader();
+    EXPECT_THROW(tm3->read(reader), std::exception);
+  }
+
+  /**
+   * Writes the old (cell, idxOnCell, lastUsedIteration) lists in chunks of
+   * chunkLength.
+   */
+  template <typename InitChunks>
+  void writeVersion0LastUsedChunks(const vector<UInt64>& ages,
+                                   InitChunks initChunks,
+                                   const Connections& connections,
+                                   UInt64 iteration, size_t chunkLength)
+  {
+    ASSERT_EQ(connections.numSegments(), ages.size());
+
+    const size_t numChunks = (ages.size() + chunkLength - 1) / chunkLength;
+    auto chunks = initChunks(numChunks);
+    for (size_t chunk = 0; chunk < numChunks; chunk++)
+    {
+      chunks[chunk].initPairs(
+        std::min(chunkLength, ages.size() - chunk * chunkLength));
+    }
+
+    size_t i = 0;
+    for (CellIdx cell = 0; cell < connections.numCells(); cell++)
+    {
+      for (UInt32 idxOnCell = 0;
+           idxOnCell < connections.numSegments(cell); idxOnCell++)
+      {
+        auto pair = chunks[i / chunkLength].getPairs()[i % chunkLength];
+        pair.setCell(cell);
+        pair.setIdxOnCell(idxOnCell);
+        pair.setNumber(iteration - ages[i]);
+        i++;
+      }
+    }
+  }
+
+  /**
+   * Lists that are longer than the max list length are split into chunks,
+   * and read back the same.
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, ChunkedSerialization)
+  {
+    const size_t defaultMaxListLength =
+      ApicalTiebreakTemporalMemory::getMaxListLength();
+    EXPECT_THROW(ApicalTiebreakTemporalMemory::setMaxListLength(0),
+                 std::exception);
+    ApicalTiebreakTemporalMemory::setMaxListLength(3);
+
+    std::unique_ptr<ApicalTiebreakPairMemory> tm1 = makeCheckpointedTM();
+    Random rng(42);
+    computeRandom(*tm1, rng, 100);
+
+    // Grow apical segments for one input.
+    vector<CellIdx> input;
+    for (CellIdx cell = 0; cell < 100; cell += 4)
+    {
+      input.push_back(cell);
+    }
+    const vector<UInt> learnedColumns = {0, 1, 2, 3, 4, 5, 6, 7};
+    for (int i = 0; i < 10; i++)
+    {
+      tm1->compute(learnedColumns, input, input, input, input, true);
+    }
+
+    capnp::MallocMessageBuilder message;
+    ApicalTiebreakTemporalMemoryProto::Builder proto =
+      message.initRoot<ApicalTiebreakTemporalMemoryProto>();
+    tm1->writeBaseCheckpoint(proto);
+    EXPECT_GT(proto.getLastUsedIterationAgeForBasalSegment().size(), 1);
+    EXPECT_GT(proto.getLastUsedIterationAgeForApicalSegment().size(), 1);
+
+    std::unique_ptr<ApicalTiebreakPairMemory> tm2 = makeCheckpointedTM();
+    ApicalTiebreakTemporalMemoryProto::Reader reader = proto.asReader();
+    tm2->read(reader);
+    EXPECT_TRUE(*tm1 == *tm2);
+    EXPECT_EQ(writeSegmentAges(*tm1), writeSegmentAges(*tm2));
+
+    // The used segments in a delta are chunked too. The apical segments are
+    // used in inactive columns, so their cells stay clean.
+    const vector<UInt> otherColumns = {20, 21, 22, 23};
+    tm1->compute(otherColumns, input, input, input, input, true);
+    capnp::MallocMessageBuilder deltaMessage;
+    ApicalTiebreakTemporalMemoryDeltaProto::Builder delta =
+      deltaMessage.initRoot<ApicalTiebreakTemporalMemoryDeltaProto>();
+    tm1->writeDeltaCheckpoint(delta);
+    EXPECT_EQ(0, delta.getLastUsedIterationForApicalSegment().size());
+    EXPECT_GT(delta.getLastUsedIterationForApicalSegmentChunks().size(), 1);
+
+    ApicalTiebreakTemporalMemoryDeltaProto::Reader deltaReader =
+      delta.asReader();
+    tm2->readDeltaCheckpoint(deltaReader);
+    EXPECT_TRUE(*tm1 == *tm2);
+    EXPECT_EQ(writeSegmentAges(*tm1), writeSegmentAges(*tm2));
+
+    // Old messages kept long lists in the chunk fields.
+    std::unique_ptr<ApicalTiebreakPairMemory> tm3 = makeCheckpointedTM();
+    tm3->read(reader);
+    const UInt64 iteration = proto.getIteration();
+    writeVersion0LastUsedChunks(
+      decodeSegmentAges(proto.getLastUsedIterationAgeForBasalSegment()),
+      [&](size_t n)
+      { return proto.initLastUsedIterationForBasalSegmentChunks(n); },
+      tm3->basalConnections, iteration, 3);
+    writeVersion0LastUsedChunks(
+      decodeSegmentAges(proto.getLastUsedIterationAgeForApicalSegment()),
+      [&](size_t n)
+      { return proto.initLastUsedIterationForApicalSegmentChunks(n); },
+      tm3->apicalConnections, iteration, 3);
+    proto.initLastUsedIterationAgeForBasalSegment(0);
+    proto.initLastUsedIterationAgeForApicalSegment(0);
+    proto.setSerializationVersion(0);
+
+    std::unique_ptr<ApicalTiebreakPairMemory> tm4 = makeCheckpointedTM();
+    reader = proto.asReader();
+    tm4->read(reader);
+    EXPECT_EQ(writeSegmentAges(*tm3), writeSegmentAges(*tm4));
+
+    ApicalTiebreakTemporalMemory::setMaxListLength(defaultMaxListLength);
+  }
+
+  /**
+   * A read that fails partway leaves a model that still computes, and that
+   * can be read again.
+   */
+  TEST(ApicalTiebreakTemporalMemoryTest, FailedRead)
+  {
+    std::unique_ptr<ApicalTiebreakPairMemory> tm1 = makeCheckpointedTM();
+    Random rng(42);
+    computeRandom(*tm1, rng, 100);
+
+    capnp::MallocMessageBuilder message;
+    ApicalTiebreakTemporalMemoryProto::Builder proto =
+      message.initRoot<ApicalTiebreakTemporalMemoryProto>();
+    tm1->writeBaseCheckpoint(proto);
+
+    capnp::MallocMessageBuilder truncatedMessage;
+    ApicalTiebreakTemporalMemoryProto::Builder truncated =
+      truncatedMessage.initRoot<ApicalTiebreakTemporalMemoryProto>();
+    tm1->write(truncated);
+    truncated.initLastUsedIterationAgeForBasalSegment(0);
+
+    std::unique_ptr<ApicalTiebreakPairMemory> tm2 = makeCheckpointedTM();
+    ApicalTiebreakTemporalMemoryProto::Reader truncatedReader =
+      truncated.asReader();
+    EXPECT_THROW(tm2->read(truncatedReader), std::exception);
+    EXPECT_EQ(0, tm2->getCheckpointId());
+    computeRandom(*tm2, rng, 20);
+
+    ApicalTiebreakTemporalMemoryProto::Reader reader = proto.asReader();
+    tm2->read(reader);
+    EXPECT_TRUE(*tm1 == *tm2);
+
+    Random rng1(7);
+    Random rng2(7);
+    computeRandom(*tm1, rng1, 20);
+    computeRandom(*tm2, rng2, 20);
+    EXPECT_TRUE(*tm1 == *tm2);
   }
 }
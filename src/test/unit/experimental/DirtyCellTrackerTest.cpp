@@ -0,0 +1,98 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+
+/** @file
+ * Implementation of unit tests for DirtyCellTracker
+ */
+
+#include <vector>
+
+#include <nupic/experimental/DirtyCellTracker.hpp>
+#include "gtest/gtest.h"
+
+using namespace nupic;
+using namespace nupic::experimental::apical_tiebreak_temporal_memory;
+using std::vector;
+
+namespace {
+
+  TEST(DirtyCellTrackerTest, MarksCells)
+  {
+    DirtyCells dirtyCells;
+    dirtyCells.mark(7);
+    dirtyCells.mark(2);
+    dirtyCells.mark(7);
+    dirtyCells.mark(4);
+
+    EXPECT_EQ(3, dirtyCells.size());
+    EXPECT_TRUE(dirtyCells.isDirty(2));
+    EXPECT_FALSE(dirtyCells.isDirty(3));
+    EXPECT_FALSE(dirtyCells.isDirty(100));
+    EXPECT_EQ(vector<CellIdx>({2, 4, 7}), dirtyCells.cells());
+
+    dirtyCells.clear();
+    EXPECT_EQ(0, dirtyCells.size());
+    EXPECT_FALSE(dirtyCells.isDirty(7));
+    EXPECT_TRUE(dirtyCells.cells().empty());
+
+    dirtyCells.mark(7);
+    EXPECT_EQ(vector<CellIdx>({7}), dirtyCells.cells());
+  }
+
+  /**
+   * Each kind of change marks the cell that owns the segment.
+   */
+  TEST(DirtyCellTrackerTest, TracksConnectionsEvents)
+  {
+    DirtyCells dirtyCells;
+    Connections connections(10);
+    const Segment segment1 = connections.createSegment(1);
+    const Segment segment5 = connections.createSegment(5);
+    const Synapse synapse = connections.createSynapse(segment5, 3, 0.5);
+    connections.createSynapse(segment1, 3, 0.5);
+
+    const UInt32 token = connections.subscribe(
+      new DirtyCellTracker(connections, dirtyCells));
+
+    connections.createSegment(8);
+    EXPECT_EQ(vector<CellIdx>({8}), dirtyCells.cells());
+    dirtyCells.clear();
+
+    connections.updateSynapsePermanence(synapse, 0.6);
+    EXPECT_EQ(vector<CellIdx>({5}), dirtyCells.cells());
+    dirtyCells.clear();
+
+    connections.destroySynapse(synapse);
+    EXPECT_EQ(vector<CellIdx>({5}), dirtyCells.cells());
+    dirtyCells.clear();
+
+    connections.createSynapse(segment1, 4, 0.5);
+    EXPECT_EQ(vector<CellIdx>({1}), dirtyCells.cells());
+    dirtyCells.clear();
+
+    connections.destroySegment(segment1);
+    EXPECT_EQ(vector<CellIdx>({1}), dirtyCells.cells());
+
+    connections.unsubscribe(token);
+  }
+}
@@ -0,0 +1,181 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+
+/** @file
+ * Implementation of unit tests for FrozenConnections
+ */
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <nupic/experimental/ApicalTiebreakTemporalMemory.hpp>
+#include <nupic/experimental/FrozenConnections.hpp>
+#include <nupic/utils/Random.hpp>
+#include "gtest/gtest.h"
+
+using namespace nupic;
+using namespace nupic::experimental::apical_tiebreak_temporal_memory;
+using std::string;
+using std::vector;
+
+namespace {
+
+  /**
+   * Writes a snapshot of a sequence memory that has learned a few
+   * sequences.
+   */
+  void writeTrainedSnapshot(ApicalTiebreakSequenceMemory& tm,
+                            const string& path)
+  {
+    const vector<vector<vector<UInt>>> sequences = {
+      {{0, 1, 2}, {3, 4, 5}, {6, 7, 8}, {9, 10, 11}},
+      {{9, 10, 11}, {3, 4, 5}, {12, 13, 14}, {0, 1, 2}},
+    };
+    for (UInt repetition = 0; repetition < 10; repetition++)
+    {
+      for (const vector<vector<UInt>>& sequence : sequences)
+      {
+        tm.reset();
+        for (const vector<UInt>& columns : sequence)
+        {
+          tm.compute(columns);
+        }
+      }
+    }
+    tm.reset();
+
+    tm.writeSnapshot(path);
+  }
+
+  TEST(FrozenConnectionsTest, MatchesConnections)
+  {
+    const string path = "FrozenConnectionsTest.snapshot";
+    ApicalTiebreakSequenceMemory tm(
+      /*columnCount*/ 32,
+      /*apicalInputSize*/ 0,
+      /*cellsPerColumn*/ 4,
+      /*activationThreshold*/ 3,
+      /*initialPermanence*/ 0.21,
+      /*connectedPermanence*/ 0.50,
+      /*minThreshold*/ 2,
+      /*sampleSize*/ 3);
+    writeTrainedSnapshot(tm, path);
+
+    {
+      MappedSnapshot snapshot(path);
+      const FrozenConnections& frozen = snapshot.basal;
+      const Connections& connections = tm.basalConnections;
+
+      ASSERT_EQ(connections.numCells(), frozen.numCells());
+      ASSERT_EQ(connections.numSegments(), frozen.numSegments());
+      ASSERT_GT(frozen.numSegments(), 0);
+      EXPECT_EQ(0, snapshot.apical.numSegments());
+
+      // The segments are numbered in cell order.
+      Segment expected = 0;
+      for (CellIdx cell = 0; cell < connections.numCells(); cell++)
+      {
+        ASSERT_EQ(connections.numSegments(cell), frozen.numSegments(cell));
+        for (UInt32 i = 0; i < frozen.numSegments(cell); i++)
+        {
+          const Segment segment = frozen.getSegment(cell, i);
+          EXPECT_EQ(expected++, segment);
+          EXPECT_EQ(cell, frozen.cellForSegment(segment));
+          EXPECT_EQ(i, frozen.idxOnCellForSegment(segment));
+        }
+      }
+      EXPECT_THROW(frozen.getSegment(0, frozen.numSegments(0)),
+                   std::exception);
+
+      Random rng(42);
+      vector<UInt32> expectedOverlaps(connections.segmentFlatListLength());
+      vector<UInt32> expectedPotentialOverlaps(expectedOverlaps.size());
+      vector<UInt32> overlaps(frozen.segmentFlatListLength());
+      vector<UInt32> potentialOverlaps(overlaps.size());
+      for (CellIdx cell = 0; cell < connections.numCells(); cell++)
+      {
+        if (rng.getUInt32(4) == 0)
+        {
+          connections.computeActivity(expectedOverlaps,
+                                      expectedPotentialOverlaps, cell, 0.50);
+          frozen.computeActivity(overlaps, potentialOverlaps, cell, 0.50);
+        }
+      }
+      for (CellIdx cell = 0; cell < connections.numCells(); cell++)
+      {
+        const vector<Segment>& segments = connections.segmentsForCell(cell);
+        for (UInt32 i = 0; i < segments.size(); i++)
+        {
+          const Segment segment = frozen.getSegment(cell, i);
+          EXPECT_EQ(expectedOverlaps[segments[i]], overlaps[segment]);
+          EXPECT_EQ(expectedPotentialOverlaps[segments[i]],
+                    potentialOverlaps[segment]);
+        }
+      }
+
+      Connections materialized(1);
+      vector<UInt64> lastUsedIterationForSegment;
+      frozen.materialize(materialized, lastUsedIterationForSegment);
+      EXPECT_TRUE(materialized == connections);
+      EXPECT_EQ(frozen.numSegments(), lastUsedIterationForSegment.size());
+
+      const ConnectionsMemoryUsage usage = frozen.memoryUsage();
+      EXPECT_EQ(connections.numSegments(), usage.liveSegments);
+      EXPECT_EQ(connections.numSynapses(), usage.liveSynapses);
+    }
+
+    std::remove(path.c_str());
+  }
+
+  TEST(FrozenConnectionsTest, RejectsBadFiles)
+  {
+    const string path = "FrozenConnectionsTest.snapshot";
+    const string truncatedPath = "FrozenConnectionsTest.truncated";
+    ApicalTiebreakSequenceMemory tm(32, 0, 4, 3, 0.21, 0.50, 2, 3);
+    writeTrainedSnapshot(tm, path);
+
+    string contents;
+    {
+      std::ifstream in(path.c_str(), std::ios::binary);
+      contents.assign(std::istreambuf_iterator<char>(in),
+                      std::istreambuf_iterator<char>());
+    }
+    {
+      std::ofstream out(truncatedPath.c_str(), std::ios::binary);
+      out << contents.substr(0, contents.size() / 2);
+    }
+    EXPECT_THROW(MappedSnapshot snapshot(truncatedPath), std::exception);
+
+    {
+      std::ofstream out(truncatedPath.c_str(), std::ios::binary);
+      out << string(sizeof(SnapshotHeader), 'x');
+    }
+    EXPECT_THROW(MappedSnapshot snapshot(truncatedPath), std::exception);
+
+    std::remove(truncatedPath.c_str());
+    std::remove(path.c_str());
+  }
+}
@@ -0,0 +1,275 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+
+/** @file
+ * Implementation of unit tests for IncrementalOverlaps
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include <nupic/experimental/IncrementalOverlaps.hpp>
+#include <nupic/utils/Random.hpp>
+#include "gtest/gtest.h"
+
+using namespace nupic;
+using namespace nupic::experimental::apical_tiebreak_temporal_memory;
+using std::vector;
+
+namespace {
+
+  const CellIdx NUM_CELLS = 20;
+  const CellIdx NUM_PRESYNAPTIC_CELLS = 50;
+
+  /**
+   * Creates a segment with up to 12 synapses on distinct presynaptic cells.
+   */
+  void growSegment(Connections& connections, Random& rng)
+  {
+    const Segment segment =
+      connections.createSegment(rng.getUInt32(NUM_CELLS));
+    const UInt32 numSynapses = rng.getUInt32(13);
+    const CellIdx first = rng.getUInt32(NUM_PRESYNAPTIC_CELLS);
+    for (UInt32 i = 0; i < numSynapses; i++)
+    {
+      connections.createSynapse(
+        segment, (first + 7 * i) % NUM_PRESYNAPTIC_CELLS,
+        (Permanence)rng.getReal64());
+    }
+  }
+
+  /**
+   * Makes a random change to a segment or synapse, like learning does.
+   */
+  void mutate(Connections& connections, Random& rng)
+  {
+    vector<Segment> segments;
+    for (CellIdx cell = 0; cell < connections.numCells(); cell++)
+    {
+      for (Segment segment : connections.segmentsForCell(cell))
+      {
+        segments.push_back(segment);
+      }
+    }
+    if (segments.empty())
+    {
+      growSegment(connections, rng);
+      return;
+    }
+
+    const Segment segment = segments[rng.getUInt32(segments.size())];
+    const vector<Synapse> synapses = connections.synapsesForSegment(segment);
+    switch (rng.getUInt32(4))
+    {
+    case 0:
+      growSegment(connections, rng);
+      break;
+    case 1:
+      connections.destroySegment(segment);
+      break;
+    case 2:
+      if (!synapses.empty())
+      {
+        connections.destroySynapse(synapses[rng.getUInt32(synapses.size())]);
+      }
+      break;
+    case 3:
+      if (!synapses.empty())
+      {
+        connections.updateSynapsePermanence(
+          synapses[rng.getUInt32(synapses.size())],
+          (Permanence)rng.getReal64());
+      }
+      break;
+    }
+  }
+
+  /**
+   * Toggles some of the cells, keeping the input sorted.
+   */
+  vector<CellIdx> changeInput(const vector<CellIdx>& activeInput,
+                              Random& rng)
+  {
+    vector<CellIdx> changed;
+    for (CellIdx cell = 0; cell < NUM_PRESYNAPTIC_CELLS; cell++)
+    {
+      const bool active = std::binary_search(activeInput.begin(),
+                                             activeInput.end(), cell);
+      if (active != (rng.getUInt32(8) == 0))
+      {
+        changed.push_back(cell);
+      }
+    }
+    return changed;
+  }
+
+  /**
+   * Computes the overlaps incrementally and from scratch, and checks that
+   * they agree on the live segments.
+   */
+  void expectMatchesCalculateOverlaps(IncrementalOverlaps& incremental,
+                                      vector<UInt32>& overlaps,
+                                      vector<UInt32>& potentialOverlaps,
+                                      const Connections& connections,
+                                      const vector<CellIdx>& activeInput,
+                                      Permanence connectedPermanence,
+                                      UInt activationThreshold,
+                                      UInt minThreshold)
+  {
+    vector<Segment> activeSegments;
+    vector<Segment> matchingSegments;
+    incremental.compute(overlaps, activeSegments,
+                        potentialOverlaps, matchingSegments,
+                        activeInput.data(),
+                        activeInput.data() + activeInput.size(),
+                        connectedPermanence, activationThreshold,
+                        minThreshold);
+
+    vector<UInt32> expectedOverlaps;
+    vector<Segment> expectedActiveSegments;
+    vector<UInt32> expectedPotentialOverlaps;
+    vector<Segment> expectedMatchingSegments;
+    calculateOverlaps(expectedOverlaps, expectedActiveSegments,
+                      expectedPotentialOverlaps, expectedMatchingSegments,
+                      activeInput.data(),
+                      activeInput.data() + activeInput.size(),
+                      connections, nullptr,
+                      connectedPermanence, activationThreshold,
+                      minThreshold);
+
+    EXPECT_EQ(expectedActiveSegments, activeSegments);
+    EXPECT_EQ(expectedMatchingSegments, matchingSegments);
+    for (CellIdx cell = 0; cell < connections.numCells(); cell++)
+    {
+      for (Segment segment : connections.segmentsForCell(cell))
+      {
+        EXPECT_EQ(expectedOverlaps[segment], overlaps[segment]);
+        EXPECT_EQ(expectedPotentialOverlaps[segment],
+                  potentialOverlaps[segment]);
+      }
+    }
+  }
+
+  TEST(IncrementalOverlapsTest, InputChanges)
+  {
+    Random rng(42);
+    UInt64 numReallocations = 0;
+    Connections connections(NUM_CELLS);
+    for (int i = 0; i < 40; i++)
+    {
+      growSegment(connections, rng);
+    }
+
+    IncrementalOverlaps* incremental =
+      new IncrementalOverlaps(connections, numReallocations);
+    const UInt32 token = connections.subscribe(incremental);
+
+    vector<UInt32> overlaps;
+    vector<UInt32> potentialOverlaps;
+    vector<CellIdx> activeInput;
+    for (int i = 0; i < 50; i++)
+    {
+      activeInput = changeInput(activeInput, rng);
+      expectMatchesCalculateOverlaps(*incremental, overlaps,
+                                     potentialOverlaps, connections,
+                                     activeInput, 0.5, 4, 3);
+    }
+
+    connections.unsubscribe(token);
+  }
+
+  /**
+   * Synapse changes between computes are applied on the next one.
+   */
+  TEST(IncrementalOverlapsTest, ConnectionsEvents)
+  {
+    Random rng(42);
+    UInt64 numReallocations = 0;
+    Connections connections(NUM_CELLS);
+    for (int i = 0; i < 20; i++)
+    {
+      growSegment(connections, rng);
+    }
+
+    IncrementalOverlaps* incremental =
+      new IncrementalOverlaps(connections, numReallocations);
+    const UInt32 token = connections.subscribe(incremental);
+
+    vector<UInt32> overlaps;
+    vector<UInt32> potentialOverlaps;
+    vector<CellIdx> activeInput;
+    for (int i = 0; i < 100; i++)
+    {
+      for (UInt32 j = rng.getUInt32(4); j > 0; j--)
+      {
+        mutate(connections, rng);
+      }
+      activeInput = changeInput(activeInput, rng);
+      expectMatchesCalculateOverlaps(*incremental, overlaps,
+                                     potentialOverlaps, connections,
+                                     activeInput, 0.5, 4, 3);
+    }
+
+    connections.unsubscribe(token);
+  }
+
+  /**
+   * Changing the thresholds or invalidating starts from scratch.
+   */
+  TEST(IncrementalOverlapsTest, Restarts)
+  {
+    Random rng(42);
+    UInt64 numReallocations = 0;
+    Connections connections(NUM_CELLS);
+    for (int i = 0; i < 40; i++)
+    {
+      growSegment(connections, rng);
+    }
+
+    IncrementalOverlaps* incremental =
+      new IncrementalOverlaps(connections, numReallocations);
+    const UInt32 token = connections.subscribe(incremental);
+
+    vector<UInt32> overlaps;
+    vector<UInt32> potentialOverlaps;
+    vector<CellIdx> activeInput = changeInput(vector<CellIdx>(), rng);
+    expectMatchesCalculateOverlaps(*incremental, overlaps, potentialOverlaps,
+                                   connections, activeInput, 0.5, 4, 3);
+
+    activeInput = changeInput(activeInput, rng);
+    expectMatchesCalculateOverlaps(*incremental, overlaps, potentialOverlaps,
+                                   connections, activeInput, 0.3, 4, 3);
+    expectMatchesCalculateOverlaps(*incremental, overlaps, potentialOverlaps,
+                                   connections, activeInput, 0.3, 6, 2);
+
+    // The caller's overlaps are recomputed after an invalidate, so they can
+    // be replaced.
+    incremental->invalidate();
+    overlaps.assign(overlaps.size(), 7);
+    activeInput = changeInput(activeInput, rng);
+    expectMatchesCalculateOverlaps(*incremental, overlaps, potentialOverlaps,
+                                   connections, activeInput, 0.3, 6, 2);
+
+    connections.unsubscribe(token);
+  }
+}
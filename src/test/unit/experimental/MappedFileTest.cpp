@@ -0,0 +1,75 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include <nupic/experimental/MappedFile.hpp>
+#include "gtest/gtest.h"
+
+using namespace nupic::experimental;
+using std::string;
+
+namespace {
+
+  void writeFile(const string& path, const string& contents)
+  {
+    std::ofstream out(path.c_str(), std::ios::binary);
+    out << contents;
+  }
+
+  TEST(MappedFileTest, MapsContents)
+  {
+    const string path = "MappedFileTest.bin";
+    const string contents("mapped\0contents", 15);
+    writeFile(path, contents);
+
+    {
+      MappedFile file(path);
+      ASSERT_EQ(contents.size(), file.size());
+      EXPECT_EQ(0, memcmp(contents.data(), file.data(), contents.size()));
+    }
+
+    std::remove(path.c_str());
+  }
+
+  TEST(MappedFileTest, EmptyFile)
+  {
+    const string path = "MappedFileTest.bin";
+    writeFile(path, "");
+
+    {
+      MappedFile file(path);
+      EXPECT_EQ(0, file.size());
+    }
+
+    std::remove(path.c_str());
+  }
+
+  TEST(MappedFileTest, MissingFile)
+  {
+    EXPECT_THROW(MappedFile("MappedFileTest.missing"), std::exception);
+  }
+}
@@ -0,0 +1,124 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+/** @file
+ * Implementation of unit tests for the permanence adaptation kernels
+ */
+
+#include <vector>
+
+#include <nupic/experimental/PermanenceAdaptation.hpp>
+#include <nupic/utils/Random.hpp>
+#include "gtest/gtest.h"
+
+using namespace nupic;
+using namespace nupic::experimental::permanence_adaptation;
+using std::vector;
+
+namespace {
+
+  /**
+   * Increment active synapses, decrement the others, clamp to [0, 1], and
+   * flag the ones below the threshold.
+   */
+  TEST(PermanenceAdaptationTest, AdaptsAndFlags)
+  {
+    const vector<UInt32> presynapticCells = {0, 1, 2, 3, 4};
+    const vector<Real32> permanences = {0.5, 0.5, 0.95, 0.05, 0.2};
+    vector<unsigned char> activeInputDense =
+      {1, 0, 1, 0, 1, 0, 0, 0};
+
+    vector<Real32> adaptedPermanences(presynapticCells.size());
+    vector<unsigned char> destroy(presynapticCells.size());
+    const UInt32 numDestroyed = adaptPermanences(
+      adaptedPermanences.data(), destroy.data(),
+      presynapticCells.data(), permanences.data(), presynapticCells.size(),
+      activeInputDense.data(), 0.1, 0.1, 0.01);
+
+    EXPECT_NEAR(0.6, adaptedPermanences[0], 0.00001);
+    EXPECT_NEAR(0.4, adaptedPermanences[1], 0.00001);
+    EXPECT_EQ(1.0, adaptedPermanences[2]);
+    EXPECT_EQ(0.0, adaptedPermanences[3]);
+    EXPECT_NEAR(0.3, adaptedPermanences[4], 0.00001);
+
+    EXPECT_EQ(vector<unsigned char>({0, 0, 0, 1, 0}), destroy);
+    EXPECT_EQ(1, numDestroyed);
+  }
+
+  /**
+   * Every kernel available on this machine gives exactly the scalar results,
+   * including for the lengths that don't fill a vector.
+   */
+  TEST(PermanenceAdaptationTest, KernelsMatchScalar)
+  {
+    const UInt32 inputSize = 300;
+
+    Random rng(42);
+    vector<unsigned char> activeInputDense(inputSize + ACTIVE_INPUT_PADDING,
+                                           0);
+    for (UInt32 cell = 0; cell < inputSize; cell++)
+    {
+      activeInputDense[cell] = (rng.getUInt32(4) == 0);
+    }
+
+    for (size_t numSynapses = 0; numSynapses < 100; numSynapses++)
+    {
+      vector<UInt32> presynapticCells;
+      vector<Real32> permanences;
+      for (size_t i = 0; i < numSynapses; i++)
+      {
+        // Include the last cell, which is read next to the padding.
+        presynapticCells.push_back(i == 0
+                                   ? inputSize - 1
+                                   : rng.getUInt32(inputSize));
+        permanences.push_back((Real32)rng.getReal64());
+      }
+
+      vector<Real32> expectedPermanences(numSynapses);
+      vector<unsigned char> expectedDestroy(numSynapses);
+      const UInt32 expectedNumDestroyed = adaptPermanencesScalar(
+        expectedPermanences.data(), expectedDestroy.data(),
+        presynapticCells.data(), permanences.data(), numSynapses,
+        activeInputDense.data(), 0.1, 0.3, 0.000001);
+
+      vector<Real32> actualPermanences(numSynapses);
+      vector<unsigned char> actualDestroy(numSynapses);
+      EXPECT_EQ(expectedNumDestroyed, adaptPermanences(
+                  actualPermanences.data(), actualDestroy.data(),
+                  presynapticCells.data(), permanences.data(), numSynapses,
+                  activeInputDense.data(), 0.1, 0.3, 0.000001));
+      EXPECT_EQ(expectedPermanences, actualPermanences);
+      EXPECT_EQ(expectedDestroy, actualDestroy);
+
+      if (avx2Supported())
+      {
+        EXPECT_EQ(expectedNumDestroyed, adaptPermanencesAvx2(
+                    actualPermanences.data(), actualDestroy.data(),
+                    presynapticCells.data(), permanences.data(),
+                    numSynapses, activeInputDense.data(),
+                    0.1, 0.3, 0.000001));
+        EXPECT_EQ(expectedPermanences, actualPermanences);
+        EXPECT_EQ(expectedDestroy, actualDestroy);
+      }
+    }
+  }
+}
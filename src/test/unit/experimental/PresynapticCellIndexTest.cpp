@@ -0,0 +1,294 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+
+/** @file
+ * Implementation of unit tests for PresynapticCellIndex
+ */
+
+#include <vector>
+
+#include <nupic/experimental/IndexUtils.hpp>
+#include <nupic/experimental/PresynapticCellIndex.hpp>
+#include <nupic/utils/Random.hpp>
+#include "gtest/gtest.h"
+
+using namespace nupic;
+using namespace nupic::experimental::apical_tiebreak_temporal_memory;
+using std::vector;
+
+namespace {
+
+  const CellIdx NUM_CELLS = 20;
+  const CellIdx NUM_PRESYNAPTIC_CELLS = 50;
+
+  vector<Segment> liveSegments(const Connections& connections)
+  {
+    vector<Segment> segments;
+    for (CellIdx cell = 0; cell < connections.numCells(); cell++)
+    {
+      for (Segment segment : connections.segmentsForCell(cell))
+      {
+        segments.push_back(segment);
+      }
+    }
+    return segments;
+  }
+
+  /**
+   * Creates a segment with up to 12 synapses on distinct presynaptic cells.
+   */
+  void growSegment(Connections& connections, Random& rng)
+  {
+    const Segment segment =
+      connections.createSegment(rng.getUInt32(NUM_CELLS));
+    const UInt32 numSynapses = rng.getUInt32(13);
+    const CellIdx first = rng.getUInt32(NUM_PRESYNAPTIC_CELLS);
+    for (UInt32 i = 0; i < numSynapses; i++)
+    {
+      connections.createSynapse(
+        segment, (first + 7 * i) % NUM_PRESYNAPTIC_CELLS,
+        (Permanence)rng.getReal64());
+    }
+  }
+
+  /**
+   * Makes a random change to a segment or synapse.
+   */
+  void mutate(Connections& connections, Random& rng)
+  {
+    const vector<Segment> segments = liveSegments(connections);
+    if (segments.empty())
+    {
+      growSegment(connections, rng);
+      return;
+    }
+
+    const Segment segment = segments[rng.getUInt32(segments.size())];
+    const vector<Synapse> synapses = connections.synapsesForSegment(segment);
+    switch (rng.getUInt32(4))
+    {
+    case 0:
+      growSegment(connections, rng);
+      break;
+    case 1:
+      connections.destroySegment(segment);
+      break;
+    case 2:
+      if (!synapses.empty())
+      {
+        connections.destroySynapse(synapses[rng.getUInt32(synapses.size())]);
+      }
+      break;
+    case 3:
+      if (!synapses.empty())
+      {
+        connections.updateSynapsePermanence(
+          synapses[rng.getUInt32(synapses.size())],
+          (Permanence)rng.getReal64());
+      }
+      break;
+    }
+  }
+
+  /**
+   * The index agrees with Connections::computeActivity for the segments
+   * that are in it, and leaves the others at zero.
+   */
+  void expectMatchesConnections(const Connections& connections,
+                                const PresynapticCellIndex& index,
+                                const vector<CellIdx>& activeInput,
+                                Permanence connectedPermanence,
+                                UInt activationThreshold,
+                                UInt minThreshold)
+  {
+    const size_t length = connections.segmentFlatListLength();
+    vector<UInt32> expectedOverlaps(length, 0);
+    vector<UInt32> expectedPotentialOverlaps(length, 0);
+    vector<UInt32> overlaps(length, 0);
+    vector<UInt32> potentialOverlaps(length, 0);
+    for (CellIdx cell : activeInput)
+    {
+      connections.computeActivity(expectedOverlaps, expectedPotentialOverlaps,
+                                  cell, connectedPermanence);
+      index.computeActivity(overlaps, potentialOverlaps, cell);
+    }
+
+    for (Segment segment : liveSegments(connections))
+    {
+      UInt numConnected = 0;
+      for (Synapse synapse : connections.synapsesForSegment(segment))
+      {
+        if (connections.dataForSynapse(synapse).permanence >=
+            connectedPermanence - CONNECTED_EPSILON)
+        {
+          numConnected++;
+        }
+      }
+
+      const bool indexed = !index.isCold(segment) &&
+        (numConnected >= activationThreshold ||
+         connections.numSynapses(segment) >= minThreshold);
+      if (indexed)
+      {
+        EXPECT_EQ(expectedOverlaps[segment], overlaps[segment]);
+        EXPECT_EQ(expectedPotentialOverlaps[segment],
+                  potentialOverlaps[segment]);
+      }
+      else
+      {
+        EXPECT_EQ(0, overlaps[segment]);
+        EXPECT_EQ(0, potentialOverlaps[segment]);
+      }
+    }
+  }
+
+  vector<CellIdx> randomInput(Random& rng)
+  {
+    vector<CellIdx> activeInput;
+    for (CellIdx cell = 0; cell < NUM_PRESYNAPTIC_CELLS; cell++)
+    {
+      if (rng.getUInt32(3) == 0)
+      {
+        activeInput.push_back(cell);
+      }
+    }
+    return activeInput;
+  }
+
+  TEST(PresynapticCellIndexTest, MatchesConnections)
+  {
+    Random rng(42);
+    UInt64 numReallocations = 0;
+    Connections connections(NUM_CELLS);
+    for (int i = 0; i < 40; i++)
+    {
+      growSegment(connections, rng);
+    }
+
+    PresynapticCellIndex* index = new PresynapticCellIndex(
+      connections, 0.5, 4, 6, numReallocations);
+    const UInt32 token = connections.subscribe(index);
+
+    for (int i = 0; i < 10; i++)
+    {
+      expectMatchesConnections(connections, *index, randomInput(rng),
+                               0.5, 4, 6);
+    }
+
+    connections.unsubscribe(token);
+  }
+
+  /**
+   * Segments move in and out of the index as synapses change.
+   */
+  TEST(PresynapticCellIndexTest, TracksConnectionsEvents)
+  {
+    Random rng(42);
+    UInt64 numReallocations = 0;
+    Connections connections(NUM_CELLS);
+    for (int i = 0; i < 20; i++)
+    {
+      growSegment(connections, rng);
+    }
+
+    PresynapticCellIndex* index = new PresynapticCellIndex(
+      connections, 0.5, 4, 6, numReallocations);
+    const UInt32 token = connections.subscribe(index);
+
+    for (int i = 0; i < 200; i++)
+    {
+      mutate(connections, rng);
+      ASSERT_TRUE(index->inSync());
+      expectMatchesConnections(connections, *index, randomInput(rng),
+                               0.5, 4, 6);
+    }
+
+    connections.unsubscribe(token);
+  }
+
+  TEST(PresynapticCellIndexTest, ColdSegments)
+  {
+    Random rng(42);
+    UInt64 numReallocations = 0;
+    Connections connections(NUM_CELLS);
+    for (int i = 0; i < 20; i++)
+    {
+      growSegment(connections, rng);
+    }
+
+    PresynapticCellIndex* index = new PresynapticCellIndex(
+      connections, 0.5, 1, 1, numReallocations);
+    const UInt32 token = connections.subscribe(index);
+
+    const vector<Segment> segments = liveSegments(connections);
+    for (size_t i = 0; i < segments.size(); i += 2)
+    {
+      index->setCold(segments[i], true);
+    }
+    EXPECT_TRUE(index->isCold(segments[0]));
+    EXPECT_FALSE(index->isCold(segments[1]));
+
+    vector<CellIdx> allInput;
+    for (CellIdx cell = 0; cell < NUM_PRESYNAPTIC_CELLS; cell++)
+    {
+      allInput.push_back(cell);
+    }
+    expectMatchesConnections(connections, *index, allInput, 0.5, 1, 1);
+
+    // Cold segments still follow their synapses.
+    for (int i = 0; i < 50; i++)
+    {
+      mutate(connections, rng);
+    }
+    for (Segment segment : liveSegments(connections))
+    {
+      index->setCold(segment, false);
+    }
+    expectMatchesConnections(connections, *index, allInput, 0.5, 1, 1);
+
+    connections.unsubscribe(token);
+  }
+
+  TEST(PresynapticCellIndexTest, SetThresholds)
+  {
+    Random rng(42);
+    UInt64 numReallocations = 0;
+    Connections connections(NUM_CELLS);
+    for (int i = 0; i < 40; i++)
+    {
+      growSegment(connections, rng);
+    }
+
+    PresynapticCellIndex* index = new PresynapticCellIndex(
+      connections, 0.5, 4, 6, numReallocations);
+    const UInt32 token = connections.subscribe(index);
+
+    const vector<CellIdx> activeInput = randomInput(rng);
+    index->setThresholds(0.3, 2, 9);
+    expectMatchesConnections(connections, *index, activeInput, 0.3, 2, 9);
+    index->setThresholds(0.7, 8, 3);
+    expectMatchesConnections(connections, *index, activeInput, 0.7, 8, 3);
+
+    connections.unsubscribe(token);
+  }
+}
@@ -0,0 +1,131 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+
+/** @file
+ * Implementation of unit tests for SegmentRecency
+ */
+
+#include <vector>
+
+#include <nupic/experimental/IndexUtils.hpp>
+#include <nupic/experimental/SegmentRecency.hpp>
+#include "gtest/gtest.h"
+
+using namespace nupic;
+using namespace nupic::experimental::apical_tiebreak_temporal_memory;
+using std::vector;
+
+namespace {
+
+  TEST(SegmentRecencyTest, LeastRecentlyUsed)
+  {
+    UInt64 numReallocations = 0;
+    vector<UInt64> lastUsedIterationForSegment;
+    Connections connections(10);
+    for (CellIdx cell = 0; cell < 4; cell++)
+    {
+      connections.createSegment(cell);
+    }
+    lastUsedIterationForSegment = {5, 2, 9, 2};
+
+    SegmentRecency* recency = new SegmentRecency(
+      connections, lastUsedIterationForSegment, numReallocations);
+    const UInt32 token = connections.subscribe(recency);
+
+    // Ties go to the lower segment.
+    UInt64 lastUsedIteration;
+    EXPECT_EQ(1, recency->leastRecentlyUsed(lastUsedIteration));
+    EXPECT_EQ(2, lastUsedIteration);
+
+    // The TM updates the iterations directly.
+    lastUsedIterationForSegment[1] = 10;
+    EXPECT_EQ(3, recency->leastRecentlyUsed(lastUsedIteration));
+    lastUsedIterationForSegment[3] = 11;
+    EXPECT_EQ(0, recency->leastRecentlyUsed(lastUsedIteration));
+    EXPECT_EQ(5, lastUsedIteration);
+
+    connections.destroySegment(0);
+    EXPECT_EQ(2, recency->leastRecentlyUsed(lastUsedIteration));
+    EXPECT_EQ(9, lastUsedIteration);
+
+    // New segments start out least recently used, until the TM sets them.
+    const Segment segment = connections.createSegment(7);
+    if (segment >= lastUsedIterationForSegment.size())
+    {
+      lastUsedIterationForSegment.resize(segment + 1);
+    }
+    lastUsedIterationForSegment[segment] = 0;
+    EXPECT_EQ(segment, recency->leastRecentlyUsed(lastUsedIteration));
+    lastUsedIterationForSegment[segment] = 12;
+    EXPECT_EQ(2, recency->leastRecentlyUsed(lastUsedIteration));
+
+    connections.unsubscribe(token);
+  }
+
+  TEST(SegmentRecencyTest, NoSegments)
+  {
+    UInt64 numReallocations = 0;
+    vector<UInt64> lastUsedIterationForSegment;
+    Connections connections(10);
+
+    SegmentRecency* recency = new SegmentRecency(
+      connections, lastUsedIterationForSegment, numReallocations);
+    const UInt32 token = connections.subscribe(recency);
+
+    UInt64 lastUsedIteration;
+    EXPECT_EQ(NOT_INDEXED, recency->leastRecentlyUsed(lastUsedIteration));
+
+    connections.destroySegment(connections.createSegment(3));
+    EXPECT_EQ(NOT_INDEXED, recency->leastRecentlyUsed(lastUsedIteration));
+
+    connections.unsubscribe(token);
+  }
+
+  /**
+   * Creating and destroying segments repeatedly doesn't grow the heap
+   * without bound.
+   */
+  TEST(SegmentRecencyTest, DropsOutOfDateEntries)
+  {
+    UInt64 numReallocations = 0;
+    vector<UInt64> lastUsedIterationForSegment(1, 0);
+    Connections connections(10);
+    connections.createSegment(0);
+
+    SegmentRecency* recency = new SegmentRecency(
+      connections, lastUsedIterationForSegment, numReallocations);
+    const UInt32 token = connections.subscribe(recency);
+    recency->reserve(20);
+
+    for (int i = 0; i < 1000; i++)
+    {
+      connections.destroySegment(connections.createSegment(1));
+    }
+    EXPECT_EQ(0, numReallocations);
+
+    UInt64 lastUsedIteration;
+    EXPECT_EQ(0, recency->leastRecentlyUsed(lastUsedIteration));
+
+    connections.unsubscribe(token);
+  }
+}
@@ -0,0 +1,271 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+
+/** @file
+ * Implementation of unit tests for SynapseArrays
+ */
+
+#include <vector>
+
+#include <nupic/experimental/SynapseArrays.hpp>
+#include <nupic/utils/Random.hpp>
+#include "gtest/gtest.h"
+
+using namespace nupic;
+using namespace nupic::experimental::apical_tiebreak_temporal_memory;
+using std::vector;
+
+namespace {
+
+  const CellIdx NUM_CELLS = 20;
+  const CellIdx NUM_PRESYNAPTIC_CELLS = 50;
+
+  vector<Segment> liveSegments(const Connections& connections)
+  {
+    vector<Segment> segments;
+    for (CellIdx cell = 0; cell < connections.numCells(); cell++)
+    {
+      for (Segment segment : connections.segmentsForCell(cell))
+      {
+        segments.push_back(segment);
+      }
+    }
+    return segments;
+  }
+
+  /**
+   * Creates a segment with up to 12 synapses on distinct presynaptic cells.
+   */
+  void growSegment(Connections& connections, Random& rng)
+  {
+    const Segment segment =
+      connections.createSegment(rng.getUInt32(NUM_CELLS));
+    const UInt32 numSynapses = rng.getUInt32(13);
+    const CellIdx first = rng.getUInt32(NUM_PRESYNAPTIC_CELLS);
+    for (UInt32 i = 0; i < numSynapses; i++)
+    {
+      connections.createSynapse(
+        segment, (first + 7 * i) % NUM_PRESYNAPTIC_CELLS,
+        (Permanence)rng.getReal64());
+    }
+  }
+
+  /**
+   * The arrays list each segment's synapses in the Connections' order.
+   */
+  void expectMirrors(const Connections& connections,
+                     const SynapseArrays& synapseArrays)
+  {
+    EXPECT_TRUE(synapseArrays.inSync());
+
+    for (Segment segment : liveSegments(connections))
+    {
+      const SynapseArrays::SegmentSynapses& segmentSynapses =
+        synapseArrays.forSegment(segment);
+      const vector<Synapse>& synapses =
+        connections.synapsesForSegment(segment);
+      ASSERT_EQ(synapses, segmentSynapses.synapses);
+      ASSERT_EQ(synapses.size(), segmentSynapses.presynapticCells.size());
+      ASSERT_EQ(synapses.size(), segmentSynapses.permanences.size());
+      for (size_t i = 0; i < synapses.size(); i++)
+      {
+        const SynapseData& synapseData =
+          connections.dataForSynapse(synapses[i]);
+        EXPECT_EQ(synapseData.presynapticCell,
+                  segmentSynapses.presynapticCells[i]);
+        EXPECT_EQ(synapseData.permanence, segmentSynapses.permanences[i]);
+      }
+    }
+  }
+
+  TEST(SynapseArraysTest, MirrorsConnections)
+  {
+    Random rng(42);
+    UInt64 numReallocations = 0;
+    ConnectionsLifecycleStats lifecycleStats;
+    Connections connections(NUM_CELLS);
+    for (int i = 0; i < 20; i++)
+    {
+      growSegment(connections, rng);
+    }
+
+    SynapseArrays* synapseArrays =
+      new SynapseArrays(connections, numReallocations, lifecycleStats);
+    const UInt32 token = connections.subscribe(synapseArrays);
+    expectMirrors(connections, *synapseArrays);
+
+    for (int i = 0; i < 200; i++)
+    {
+      const vector<Segment> segments = liveSegments(connections);
+      const Segment segment = segments[rng.getUInt32(segments.size())];
+      const vector<Synapse> synapses =
+        connections.synapsesForSegment(segment);
+      switch (rng.getUInt32(4))
+      {
+      case 0:
+        growSegment(connections, rng);
+        break;
+      case 1:
+        if (segments.size() > 1)
+        {
+          connections.destroySegment(segment);
+        }
+        break;
+      case 2:
+        if (!synapses.empty())
+        {
+          // Removing from the middle keeps the order of the others.
+          connections.destroySynapse(
+            synapses[rng.getUInt32(synapses.size())]);
+        }
+        break;
+      case 3:
+        if (!synapses.empty())
+        {
+          connections.updateSynapsePermanence(
+            synapses[rng.getUInt32(synapses.size())],
+            (Permanence)rng.getReal64());
+        }
+        break;
+      }
+      expectMirrors(connections, *synapseArrays);
+    }
+
+    connections.unsubscribe(token);
+  }
+
+  TEST(SynapseArraysTest, CountsHistograms)
+  {
+    UInt64 numReallocations = 0;
+    ConnectionsLifecycleStats lifecycleStats;
+    Connections connections(NUM_CELLS);
+    connections.createSegment(0);
+
+    SynapseArrays* synapseArrays =
+      new SynapseArrays(connections, numReallocations, lifecycleStats);
+    const UInt32 token = connections.subscribe(synapseArrays);
+    EXPECT_EQ(vector<UInt64>({NUM_CELLS - 1, 1}),
+              lifecycleStats.segmentsPerCell);
+    EXPECT_EQ(vector<UInt64>({1}), lifecycleStats.synapsesPerSegment);
+
+    const Segment segment = connections.createSegment(0);
+    connections.createSynapse(segment, 3, 0.5);
+    const Synapse synapse = connections.createSynapse(segment, 4, 0.5);
+    EXPECT_EQ(vector<UInt64>({NUM_CELLS - 1, 0, 1}),
+              lifecycleStats.segmentsPerCell);
+    EXPECT_EQ(vector<UInt64>({1, 0, 1}), lifecycleStats.synapsesPerSegment);
+
+    connections.destroySynapse(synapse);
+    EXPECT_EQ(vector<UInt64>({1, 1, 0}), lifecycleStats.synapsesPerSegment);
+
+    connections.destroySegment(segment);
+    EXPECT_EQ(vector<UInt64>({NUM_CELLS - 1, 1, 0}),
+              lifecycleStats.segmentsPerCell);
+    EXPECT_EQ(vector<UInt64>({1, 0, 0}), lifecycleStats.synapsesPerSegment);
+
+    connections.unsubscribe(token);
+  }
+
+  /**
+   * In lazy mode, only changes that connect or disconnect a synapse reach
+   * the Connections until materialize().
+   */
+  TEST(SynapseArraysTest, LazyPermanences)
+  {
+    UInt64 numReallocations = 0;
+    ConnectionsLifecycleStats lifecycleStats;
+    Connections connections(NUM_CELLS);
+    const Segment segment = connections.createSegment(0);
+    const Synapse synapse0 = connections.createSynapse(segment, 3, 0.6);
+    const Synapse synapse1 = connections.createSynapse(segment, 4, 0.4);
+
+    SynapseArrays* synapseArrays =
+      new SynapseArrays(connections, numReallocations, lifecycleStats);
+    const UInt32 token = connections.subscribe(synapseArrays);
+    synapseArrays->setLazy(true, 0.5);
+    EXPECT_TRUE(synapseArrays->isLazy());
+
+    synapseArrays->updatePermanence(segment, 0, 0.7);
+    synapseArrays->updatePermanence(segment, 1, 0.3);
+    EXPECT_TRUE(synapseArrays->hasDeferredChanges());
+    EXPECT_FLOAT_EQ(0.6, connections.dataForSynapse(synapse0).permanence);
+    EXPECT_FLOAT_EQ(0.4, connections.dataForSynapse(synapse1).permanence);
+    EXPECT_FLOAT_EQ(0.7, synapseArrays->forSegment(segment).permanences[0]);
+    EXPECT_FLOAT_EQ(0.3, synapseArrays->forSegment(segment).permanences[1]);
+
+    // Crossing the threshold is written through.
+    synapseArrays->updatePermanence(segment, 1, 0.55);
+    EXPECT_FLOAT_EQ(0.55, connections.dataForSynapse(synapse1).permanence);
+
+    // A copy sees the deferred changes, and the original doesn't change.
+    Connections copy(NUM_CELLS);
+    synapseArrays->copyTo(copy);
+    const Segment copySegment = copy.segmentsForCell(0)[0];
+    EXPECT_FLOAT_EQ(0.7, copy.dataForSynapse(
+                      copy.synapsesForSegment(copySegment)[0]).permanence);
+    EXPECT_FLOAT_EQ(0.6, connections.dataForSynapse(synapse0).permanence);
+
+    synapseArrays->materialize();
+    EXPECT_FALSE(synapseArrays->hasDeferredChanges());
+    EXPECT_FLOAT_EQ(0.7, connections.dataForSynapse(synapse0).permanence);
+    EXPECT_TRUE(copy == connections);
+
+    // Turning lazy mode off writes any deferred changes.
+    synapseArrays->updatePermanence(segment, 0, 0.8);
+    synapseArrays->setLazy(false, 0.5);
+    EXPECT_FALSE(synapseArrays->hasDeferredChanges());
+    EXPECT_FLOAT_EQ(0.8, connections.dataForSynapse(synapse0).permanence);
+    synapseArrays->updatePermanence(segment, 0, 0.9);
+    EXPECT_FLOAT_EQ(0.9, connections.dataForSynapse(synapse0).permanence);
+
+    connections.unsubscribe(token);
+  }
+
+  /**
+   * A segment's deferred changes are dropped when it's destroyed.
+   */
+  TEST(SynapseArraysTest, DestroyDeferredSegment)
+  {
+    UInt64 numReallocations = 0;
+    ConnectionsLifecycleStats lifecycleStats;
+    Connections connections(NUM_CELLS);
+    const Segment segment = connections.createSegment(0);
+    connections.createSynapse(segment, 3, 0.6);
+
+    SynapseArrays* synapseArrays =
+      new SynapseArrays(connections, numReallocations, lifecycleStats);
+    const UInt32 token = connections.subscribe(synapseArrays);
+    synapseArrays->setLazy(true, 0.5);
+
+    synapseArrays->updatePermanence(segment, 0, 0.7);
+    connections.destroySegment(segment);
+    const Segment segment2 = connections.createSegment(1);
+    const Synapse synapse2 = connections.createSynapse(segment2, 4, 0.2);
+
+    synapseArrays->materialize();
+    EXPECT_FLOAT_EQ(0.2, connections.dataForSynapse(synapse2).permanence);
+    expectMirrors(connections, *synapseArrays);
+
+    connections.unsubscribe(token);
+  }
+}
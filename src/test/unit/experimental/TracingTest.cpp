@@ -0,0 +1,208 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+/** @file
+ * Implementation of unit tests for the scoped event tracing
+ */
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#ifndef __MINGW32__
+#include <thread>
+#endif
+
+#include <nupic/experimental/Tracing.hpp>
+#include "gtest/gtest.h"
+
+using namespace nupic;
+using namespace nupic::experimental;
+using std::string;
+
+namespace {
+
+  string writeAndReadTrace()
+  {
+    const string path = "TracingTest.json";
+    tracing::writeChromeTrace(path);
+
+    std::ifstream in(path.c_str());
+    std::stringstream contents;
+    contents << in.rdbuf();
+    in.close();
+    std::remove(path.c_str());
+
+    return contents.str();
+  }
+
+  size_t countOccurrences(const string& s, const string& pattern)
+  {
+    size_t count = 0;
+    for (size_t i = s.find(pattern); i != string::npos;
+         i = s.find(pattern, i + 1))
+    {
+      count++;
+    }
+    return count;
+  }
+
+  /**
+   * Nested scopes are written as complete events, and scopes outside of
+   * start() and stop() aren't recorded.
+   */
+  TEST(TracingTest, WritesScopes)
+  {
+    {
+      tracing::Scope beforeStart("beforeStart");
+    }
+
+    tracing::start(100);
+    {
+      tracing::Scope outer("outer");
+      tracing::Scope inner("inner");
+    }
+    tracing::stop();
+
+    {
+      tracing::Scope afterStop("afterStop");
+    }
+
+    const string trace = writeAndReadTrace();
+    EXPECT_EQ(0, trace.find("{\"traceEvents\":["));
+    EXPECT_EQ(1, countOccurrences(trace, "\"name\":\"outer\""));
+    EXPECT_EQ(1, countOccurrences(trace, "\"name\":\"inner\""));
+    EXPECT_EQ(2, countOccurrences(trace, "\"ph\":\"X\""));
+    EXPECT_EQ(string::npos, trace.find("beforeStart"));
+    EXPECT_EQ(string::npos, trace.find("afterStop"));
+  }
+
+  /**
+   * When a thread records more events than its buffer holds, only the most
+   * recent events are kept.
+   */
+  TEST(TracingTest, RingBufferKeepsRecentEvents)
+  {
+    tracing::start(3);
+    for (int i = 0; i < 5; i++)
+    {
+      tracing::Scope scope("old");
+    }
+    for (int i = 0; i < 3; i++)
+    {
+      tracing::Scope scope("new");
+    }
+    tracing::stop();
+
+    const string trace = writeAndReadTrace();
+    EXPECT_EQ(0, countOccurrences(trace, "\"name\":\"old\""));
+    EXPECT_EQ(3, countOccurrences(trace, "\"name\":\"new\""));
+  }
+
+  /**
+   * Restarting clears the previous events.
+   */
+  TEST(TracingTest, RestartClearsEvents)
+  {
+    tracing::start(10);
+    {
+      tracing::Scope scope("first");
+    }
+    tracing::start(10);
+    {
+      tracing::Scope scope("second");
+    }
+    tracing::stop();
+
+    const string trace = writeAndReadTrace();
+    EXPECT_EQ(string::npos, trace.find("first"));
+    EXPECT_EQ(1, countOccurrences(trace, "\"name\":\"second\""));
+  }
+
+#ifndef __MINGW32__
+
+  /**
+   * Each thread records into its own buffer, with its own thread id.
+   */
+  TEST(TracingTest, RecordsEachThread)
+  {
+    tracing::start(100);
+
+    std::thread threads[4];
+    for (std::thread& thread : threads)
+    {
+      thread = std::thread([]() {
+          for (int i = 0; i < 10; i++)
+          {
+            tracing::Scope scope("worker");
+          }
+        });
+    }
+    for (std::thread& thread : threads)
+    {
+      thread.join();
+    }
+
+    tracing::stop();
+
+    const string trace = writeAndReadTrace();
+    EXPECT_EQ(40, countOccurrences(trace, "\"name\":\"worker\""));
+  }
+
+  /**
+   * A thread that starts after another one exits reuses its buffer, and the
+   * finished thread's events are still written.
+   */
+  TEST(TracingTest, ReusesBuffersOfFinishedThreads)
+  {
+    tracing::start(100);
+
+    for (int i = 0; i < 5; i++)
+    {
+      std::thread thread([]() {
+          for (int i = 0; i < 10; i++)
+          {
+            tracing::Scope scope("sequential");
+          }
+        });
+      thread.join();
+    }
+
+    tracing::stop();
+
+    const string trace = writeAndReadTrace();
+    const string firstEvent = "{\"name\":\"sequential\"";
+    EXPECT_EQ(50, countOccurrences(trace, firstEvent));
+
+    // All the events have the first thread's id.
+    const size_t begin = trace.find(firstEvent);
+    ASSERT_NE(string::npos, begin);
+    const size_t tidBegin = trace.find("\"tid\":", begin);
+    const string tid = trace.substr(tidBegin,
+                                    trace.find(',', tidBegin) + 1 - tidBegin);
+    EXPECT_EQ(50, countOccurrences(trace, tid));
+  }
+
+#endif // __MINGW32__
+
+}
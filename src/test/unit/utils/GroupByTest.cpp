@@ -630,4 +630,84 @@ namespace {
 
     EXPECT_EQ(expectedValues.size(), i);
   }
+
+  /**
+   * GroupBy is variadic, so it isn't limited to six sequences. Group eight
+   * sequences where each one contributes to a different subset of keys.
+   */
+  TEST(GroupByTest, EightSequences)
+  {
+    const vector<int> sequence0 = {0, 1};
+    const vector<int> sequence1 = {1, 2};
+    const vector<int> sequence2 = {2, 3};
+    const vector<int> sequence3 = {3, 4};
+    const vector<int> sequence4 = {4, 5};
+    const vector<int> sequence5 = {5, 6};
+    const vector<int> sequence6 = {6, 7};
+    const vector<int> sequence7 = {7, 7, 8};
+
+    auto identity = [](int a) { return a; };
+
+    const vector<int> expectedKeys = {0, 1, 2, 3, 4, 5, 6, 7, 8};
+
+    //
+    // groupBy
+    //
+    size_t i = 0;
+    for (auto data : groupBy(sequence0, identity,
+                             sequence1, identity,
+                             sequence2, identity,
+                             sequence3, identity,
+                             sequence4, identity,
+                             sequence5, identity,
+                             sequence6, identity,
+                             sequence7, identity))
+    {
+      const int key = std::get<0>(data);
+      EXPECT_EQ(expectedKeys[i], key);
+
+      // Key k is produced by sequences k-1 and k.
+      EXPECT_EQ(key == 0 || key == 1,
+                std::get<1>(data) != std::get<2>(data));
+      EXPECT_EQ(key == 3 || key == 4,
+                std::get<7>(data) != std::get<8>(data));
+      EXPECT_EQ(key == 7 || key == 8,
+                std::get<15>(data) != std::get<16>(data));
+      if (key == 7)
+      {
+        EXPECT_EQ(2, std::get<16>(data) - std::get<15>(data));
+      }
+
+      i++;
+    }
+
+    EXPECT_EQ(expectedKeys.size(), i);
+
+    //
+    // iterGroupBy
+    //
+    i = 0;
+    for (auto data : iterGroupBy(
+           sequence0.begin(), sequence0.end(), identity,
+           sequence1.begin(), sequence1.end(), identity,
+           sequence2.begin(), sequence2.end(), identity,
+           sequence3.begin(), sequence3.end(), identity,
+           sequence4.begin(), sequence4.end(), identity,
+           sequence5.begin(), sequence5.end(), identity,
+           sequence6.begin(), sequence6.end(), identity,
+           sequence7.begin(), sequence7.end(), identity))
+    {
+      const int key = std::get<0>(data);
+      EXPECT_EQ(expectedKeys[i], key);
+
+      EXPECT_EQ(key == 5 || key == 6,
+                std::get<11>(data) != std::get<12>(data));
+      EXPECT_EQ(key == 6 || key == 7,
+                std::get<13>(data) != std::get<14>(data));
+
+      i++;
+    }
+
+    EXPECT_EQ(expectedKeys.size(), i);
+  }
 }
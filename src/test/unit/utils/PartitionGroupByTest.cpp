@@ -0,0 +1,270 @@
+/* ---------------------------------------------------------------------
+ * Numenta Platform for Intelligent Computing (NuPIC)
+ * Copyright (C) 2017, Numenta, Inc.  Unless you have an agreement
+ * with Numenta, Inc., for a separate license for this software code, the
+ * following terms and conditions apply:
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses.
+ *
+ * http://numenta.org/licenses/
+ * ----------------------------------------------------------------------
+ */
+
+/** @file
+ * Implementation of unit tests for partitionGroupBy
+ */
+
+#include <stdexcept>
+
+#include <nupic/utils/PartitionGroupBy.hpp>
+#include "gtest/gtest.h"
+
+#ifdef NTA_PARTITION_GROUPBY_THREADS
+#include <mutex>
+#include <set>
+#include <thread>
+#endif
+
+using std::get;
+using std::vector;
+
+using nupic::iterGroupBy;
+using nupic::iterGroupByPartitions;
+using nupic::partitionGroupBy;
+
+namespace {
+
+  typedef vector<int>::const_iterator Iter;
+
+  int divideBy10(int a)
+  {
+    return a / 10;
+  }
+
+  int identity(int a)
+  {
+    return a;
+  }
+
+  /**
+   * Records the groups of one chunk as (key, count0, count1) triples.
+   */
+  struct RecordGroups
+  {
+    vector<vector<vector<int>>>* groupsByChunk;
+
+    void operator()(size_t chunk,
+                    Iter begin0, Iter end0, int(*keyFn0)(int),
+                    Iter begin1, Iter end1, int(*keyFn1)(int)) const
+    {
+      for (auto data : iterGroupBy(begin0, end0, keyFn0,
+                                   begin1, end1, keyFn1))
+      {
+        int key;
+        Iter groupBegin0, groupEnd0, groupBegin1, groupEnd1;
+        std::tie(key,
+                 groupBegin0, groupEnd0,
+                 groupBegin1, groupEnd1) = data;
+
+        (*groupsByChunk)[chunk].push_back(
+          {key,
+           (int)std::distance(groupBegin0, groupEnd0),
+           (int)std::distance(groupBegin1, groupEnd1)});
+      }
+    }
+  };
+
+  /**
+   * Every sequence is cut at the same keys, and the chunks cover the inputs.
+   */
+  TEST(PartitionGroupByTest, BoundariesAlignOnKeys)
+  {
+    const vector<int> sequence0 = {1, 3, 5, 12, 14, 25, 31, 33, 35, 47, 48};
+    const vector<int> sequence1 = {12, 15, 16, 17, 18, 19, 47, 52, 53};
+
+    const auto boundaries = iterGroupByPartitions(
+      4,
+      sequence0.begin(), sequence0.end(), divideBy10,
+      sequence1.begin(), sequence1.end(), divideBy10);
+
+    ASSERT_GE(boundaries.size(), 2);
+    EXPECT_LE(boundaries.size(), 5);
+    EXPECT_TRUE(get<0>(boundaries.front()) == sequence0.begin());
+    EXPECT_TRUE(get<1>(boundaries.front()) == sequence1.begin());
+    EXPECT_TRUE(get<0>(boundaries.back()) == sequence0.end());
+    EXPECT_TRUE(get<1>(boundaries.back()) == sequence1.end());
+
+    for (size_t i = 1; i + 1 < boundaries.size(); i++)
+    {
+      const Iter cut0 = get<0>(boundaries[i]);
+      const Iter cut1 = get<1>(boundaries[i]);
+
+      // No key appears on both sides of a cut.
+      int lastKeyBefore = -1;
+      if (cut0 != sequence0.begin())
+      {
+        lastKeyBefore = std::max(lastKeyBefore, divideBy10(*(cut0 - 1)));
+      }
+      if (cut1 != sequence1.begin())
+      {
+        lastKeyBefore = std::max(lastKeyBefore, divideBy10(*(cut1 - 1)));
+      }
+
+      if (cut0 != sequence0.end())
+      {
+        EXPECT_LT(lastKeyBefore, divideBy10(*cut0));
+      }
+      if (cut1 != sequence1.end())
+      {
+        EXPECT_LT(lastKeyBefore, divideBy10(*cut1));
+      }
+    }
+  }
+
+  /**
+   * Processing the chunks separately yields the same groups as a single
+   * iterGroupBy.
+   */
+  TEST(PartitionGroupByTest, SameGroupsAsIterGroupBy)
+  {
+    vector<int> sequence0;
+    vector<int> sequence1;
+    for (int i = 0; i < 1000; i++)
+    {
+      sequence0.push_back(i * 7);
+      if (i % 3 == 0)
+      {
+        sequence1.push_back(i * 5);
+        sequence1.push_back(i * 5 + 1);
+      }
+    }
+
+    vector<vector<int>> expectedGroups;
+    {
+      vector<vector<vector<int>>> groupsByChunk(1);
+      RecordGroups record = {&groupsByChunk};
+      record(0,
+             sequence0.begin(), sequence0.end(), divideBy10,
+             sequence1.begin(), sequence1.end(), divideBy10);
+      expectedGroups = groupsByChunk[0];
+    }
+
+    for (size_t numChunks : {1, 2, 3, 8, 5000})
+    {
+      vector<vector<vector<int>>> groupsByChunk(numChunks);
+      partitionGroupBy(numChunks, RecordGroups{&groupsByChunk},
+                       sequence0.cbegin(), sequence0.cend(), divideBy10,
+                       sequence1.cbegin(), sequence1.cend(), divideBy10);
+
+      vector<vector<int>> actualGroups;
+      for (const vector<vector<int>>& groups : groupsByChunk)
+      {
+        actualGroups.insert(actualGroups.end(), groups.begin(), groups.end());
+      }
+
+      EXPECT_EQ(expectedGroups, actualGroups);
+    }
+  }
+
+  /**
+   * A key is never split, so repeated keys can produce fewer chunks.
+   */
+  TEST(PartitionGroupByTest, RepeatedKeyIsOneChunk)
+  {
+    const vector<int> sequence0 = {4, 4, 4, 4, 4, 4};
+    const vector<int> sequence1 = {4, 4};
+
+    const auto boundaries = iterGroupByPartitions(
+      3,
+      sequence0.begin(), sequence0.end(), identity,
+      sequence1.begin(), sequence1.end(), identity);
+
+    ASSERT_EQ(2, boundaries.size());
+    EXPECT_TRUE(get<0>(boundaries[1]) == sequence0.end());
+    EXPECT_TRUE(get<1>(boundaries[1]) == sequence1.end());
+  }
+
+  /**
+   * Empty inputs produce a single empty chunk.
+   */
+  TEST(PartitionGroupByTest, EmptySequences)
+  {
+    const vector<int> sequence0;
+
+    size_t numCalls = 0;
+    partitionGroupBy(4,
+                     [&](size_t chunk, Iter begin0, Iter end0,
+                         int(*keyFn0)(int)) {
+                       EXPECT_EQ(0, chunk);
+                       EXPECT_TRUE(begin0 == end0);
+                       numCalls++;
+                     },
+                     sequence0.begin(), sequence0.end(), identity);
+
+    EXPECT_EQ(1, numCalls);
+  }
+
+  /**
+   * An exception thrown while processing a chunk reaches the caller.
+   */
+  TEST(PartitionGroupByTest, RethrowsChunkException)
+  {
+    const vector<int> sequence0 = {1, 2, 3, 4, 5, 6, 7, 8};
+
+    EXPECT_THROW(
+      partitionGroupBy(4,
+                       [](size_t chunk, Iter begin0, Iter end0,
+                          int(*keyFn0)(int)) {
+                         if (chunk == 2)
+                         {
+                           throw std::runtime_error("chunk 2");
+                         }
+                       },
+                       sequence0.begin(), sequence0.end(), identity),
+      std::runtime_error);
+  }
+
+  /**
+   * Many more chunks than cores are shared among at most
+   * hardware_concurrency() threads, and each chunk is processed once.
+   */
+#ifdef NTA_PARTITION_GROUPBY_THREADS
+  TEST(PartitionGroupByTest, ManyChunksUseBoundedThreads)
+  {
+    vector<int> sequence0;
+    for (int i = 0; i < 2000; i++)
+    {
+      sequence0.push_back(i);
+    }
+
+    std::mutex mutex;
+    std::set<std::thread::id> threads;
+    vector<size_t> callsPerChunk(sequence0.size(), 0);
+    partitionGroupBy(sequence0.size(),
+                     [&](size_t chunk, Iter begin0, Iter end0,
+                         int(*keyFn0)(int)) {
+                       std::lock_guard<std::mutex> lock(mutex);
+                       threads.insert(std::this_thread::get_id());
+                       callsPerChunk[chunk]++;
+                     },
+                     sequence0.begin(), sequence0.end(), identity);
+
+    for (size_t calls : callsPerChunk)
+    {
+      ASSERT_EQ(1, calls);
+    }
+    EXPECT_LE(threads.size(),
+              std::max<size_t>(1, std::thread::hardware_concurrency()));
+  }
+#endif
+}